@@ -0,0 +1,150 @@
+// Benchmark for common/metrics.h
+//
+// For 1 to -t threads, every thread updates for -d milliseconds and the
+// cost per update is reported for:
+//
+//   shared     one global counter, a relaxed atomic add from every thread,
+//              which is what the per-thread rows avoid
+//   counter    metrics_inc() into the thread's own row
+//   server     the updates a TCP server makes per request: requests,
+//              bytes in and out, and a latency histogram observation
+//
+// and then the time one scrape takes over the rows those threads claimed.
+// Compare the server column with a request's latency (netbench's p50) to
+// see the overhead on the hot path.
+//
+//   ./metrics_bench [-t threads] [-d ms]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include "metrics.h"
+
+enum workload { WORK_SHARED, WORK_COUNTER, WORK_SERVER };
+
+static struct server_metrics metrics;
+static metric_t latency_metric;
+static uint64_t shared_counter;
+static volatile int running;
+
+struct worker {
+    pthread_t tid;
+    enum workload work;
+    unsigned long long updates;
+    long long cpu_ns;
+};
+
+long long clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void *worker_main(void *arg) {
+    struct worker *w = arg;
+    unsigned long long n = 0;
+
+    metrics_thread_init();
+    long long start = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    while (running) {
+        // Check the flag once per 1024 updates so it does not dominate
+        for (int i = 0; i < 1024; i++, n++) {
+            switch (w->work) {
+            case WORK_SHARED:
+                __atomic_fetch_add(&shared_counter, 1, __ATOMIC_RELAXED);
+                break;
+            case WORK_COUNTER:
+                metrics_inc(metrics.requests);
+                break;
+            case WORK_SERVER:
+                metrics_inc(metrics.requests);
+                metrics_add(metrics.bytes_in, 64 + (n & 63));
+                metrics_add(metrics.bytes_out, 64 + (n & 63));
+                metrics_observe_us(latency_metric, n & 1023);
+                break;
+            }
+        }
+    }
+    w->updates = n;
+    w->cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID) - start;
+    return NULL;
+}
+
+// CPU nanoseconds per update (per request for the server workload), so
+// threads outnumbering the CPUs do not inflate it
+double run(enum workload work, int nthreads, int duration_ms) {
+    struct worker *workers = calloc(nthreads, sizeof(*workers));
+    unsigned long long total = 0;
+    double cpu_ns = 0;
+
+    if (workers == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    running = 1;
+    for (int i = 0; i < nthreads; i++) {
+        workers[i].work = work;
+        pthread_create(&workers[i].tid, NULL, worker_main, &workers[i]);
+    }
+    usleep(duration_ms * 1000);
+    running = 0;
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(workers[i].tid, NULL);
+        total += workers[i].updates;
+        cpu_ns += workers[i].cpu_ns;
+    }
+    free(workers);
+    return cpu_ns / total;
+}
+
+int main(int argc, char *argv[]) {
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = ncpus > 0 ? (int)ncpus : 1;
+    int duration_ms = 300;
+    int c;
+
+    while ((c = getopt(argc, argv, "t:d:")) != -1) {
+        switch (c) {
+        case 't': max_threads = atoi(optarg); break;
+        case 'd': duration_ms = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-t threads] [-d ms]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (max_threads < 1 || duration_ms <= 0) {
+        fprintf(stderr, "threads and duration must be positive\n");
+        exit(EXIT_FAILURE);
+    }
+
+    metrics_register_server(&metrics);
+    latency_metric = metrics_histogram("bench_latency_seconds", NULL, "Made-up latencies");
+
+    printf("%8s  %12s  %12s  %12s\n", "threads", "shared ns", "counter ns", "server ns");
+    // Doubling, and ending on max_threads
+    for (int t = 1;; t = t * 2 < max_threads ? t * 2 : max_threads) {
+        printf("%8d", t);
+        for (enum workload w = WORK_SHARED; w <= WORK_SERVER; w++) {
+            printf("  %12.2f", run(w, t, duration_ms));
+        }
+        printf("\n");
+        if (t == max_threads) {
+            break;
+        }
+    }
+
+    int devnull = open("/dev/null", O_WRONLY);
+    long long start = clock_ns(CLOCK_MONOTONIC);
+    for (int i = 0; i < 100; i++) {
+        if (metrics_write(devnull) < 0) {
+            perror("metrics_write");
+            exit(EXIT_FAILURE);
+        }
+    }
+    printf("scrape: %.1f us\n", (clock_ns(CLOCK_MONOTONIC) - start) / 100 / 1e3);
+    close(devnull);
+    return 0;
+}
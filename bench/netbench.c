@@ -0,0 +1,498 @@
+// Benchmark driver for every server in the repo
+//
+// -P picks the protocol, which fixes the default port and the wire format:
+//
+//   tcp        8080   framed request/reply on a persistent connection
+//                     (tcp/tcp.server.c, socket_options/server.c)
+//   multi      12345  framed request/reply on a persistent connection
+//                     (multi/multi.protocol.server.c)
+//   multi-udp  12345  one datagram, one reply (multi/multi.protocol.server.c)
+//   udp        65432  one datagram, one reply (udp/udp.server.c)
+//   mac        5555   connect, framed MAC address, reply, close
+//                     (mac/mac_auth_server.c)
+//   mac-batch  5555   -b packed MAC addresses per frame, one status byte
+//                     each, on a persistent connection (mac/mac_proto.h)
+//   kx         8090   connect, 8-byte public key each way, close
+//                     (key_exchange/server.c)
+//
+// -c connections (or UDP flows) are spread over -t threads. Every one keeps
+// a single request outstanding for -d seconds; for the connect-per-request
+// protocols the measured latency covers the whole connection. Latencies go
+// into log-linear histograms (common/histogram.h) that are merged at the
+// end, and the result is printed as one JSON object. For mac-batch it also
+// has the batch size and devices_per_sec; for mac that is throughput_rps.
+// With -o it is also appended to a file, one line per run, for tracking
+// runs over time:
+//
+//   ./multi.protocol.server -q &  ./netbench -P multi -c 256 -o runs.jsonl
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include "framing.h"
+#include "histogram.h"
+#include "kx_proto.h"
+#include "mac_proto.h"
+
+#define MAX_EVENTS 256
+#define BUFFER_SIZE 2048
+#define DEFAULT_BATCH 64
+#define UDP_TIMEOUT_NS 1000000000LL // resend a datagram unanswered this long
+#define TIMEOUT_SCAN_NS 100000000LL
+
+// How requests and replies look on the wire
+enum wire { WIRE_FRAMED, WIRE_DATAGRAM, WIRE_KX, WIRE_MAC_BATCH };
+
+struct protocol {
+    const char *name;
+    int port;
+    int type;          // SOCK_STREAM or SOCK_DGRAM
+    int per_request;   // a new connection for every request
+    enum wire wire;
+    const char *message;
+};
+
+static const struct protocol protocols[] = {
+    { "tcp",       8080,  SOCK_STREAM, 0, WIRE_FRAMED,   "Hello from client" },
+    { "multi",     12345, SOCK_STREAM, 0, WIRE_FRAMED,   "Hello, TCP server!" },
+    { "multi-udp", 12345, SOCK_DGRAM,  0, WIRE_DATAGRAM, "Hello, UDP server!" },
+    { "udp",       65432, SOCK_DGRAM,  0, WIRE_DATAGRAM, "Hello from client" },
+    { "mac",       5555,  SOCK_STREAM, 1, WIRE_FRAMED,   "02:42:76:c2:f4:73" },
+    { "mac-batch", 5555,  SOCK_STREAM, 0, WIRE_MAC_BATCH, "02:42:76:c2:f4:73" },
+    { "kx",        KX_PORT, SOCK_STREAM, 1, WIRE_KX,     NULL },
+};
+
+enum flow_state { FLOW_IDLE, FLOW_CONNECTING, FLOW_WAITING };
+
+// One connection or UDP flow with at most one request in flight
+struct flow {
+    int fd;
+    enum flow_state state;
+    struct frame_reader *reader; // framed protocols only
+    size_t got;                  // bytes of a fixed-size reply received
+    long long start_ns;
+};
+
+struct worker {
+    pthread_t tid;
+    int nflows;
+    struct flow *flows;
+    struct histogram hist;
+    unsigned long long requests;
+    unsigned long long errors;
+    unsigned long long timeouts;
+};
+
+static const struct protocol *proto;
+static struct sockaddr_in server_addr;
+static char request[FRAME_HEADER_SIZE + MAC_PROTO_MAX_REQUEST];
+static size_t request_len;
+static size_t kx_reply_len = sizeof(long long);
+static int duration = 5;
+static int batch = DEFAULT_BATCH;
+static long long deadline_ns;
+static pthread_barrier_t barrier;
+
+long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Build the request once; every flow sends the same bytes
+void build_request(const char *message) {
+    if (proto->wire == WIRE_KX) {
+        // The client's public key A = G^a mod P for key_exchange/client.c's
+        // P = 23, G = 5, a = 4, in host byte order like the client sends it
+        long long A = 4;
+        memcpy(request, &A, sizeof(A));
+        request_len = sizeof(A);
+    } else if (proto->wire == WIRE_MAC_BATCH) {
+        // The same address batch times, in the packed form
+        unsigned char mac[MAC_BYTES];
+        if (sscanf(message, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+                   &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]) != MAC_BYTES) {
+            fprintf(stderr, "'%s' is not a MAC address\n", message);
+            exit(EXIT_FAILURE);
+        }
+        request_len = FRAME_HEADER_SIZE + 1 + batch * MAC_BYTES;
+        frame_encode_header(request, request_len - FRAME_HEADER_SIZE);
+        request[FRAME_HEADER_SIZE] = (char)MAC_PROTO_BINARY;
+        for (int i = 0; i < batch; i++) {
+            memcpy(request + FRAME_HEADER_SIZE + 1 + i * MAC_BYTES, mac, MAC_BYTES);
+        }
+    } else if (proto->wire == WIRE_FRAMED) {
+        frame_encode_header(request, strlen(message));
+        memcpy(request + FRAME_HEADER_SIZE, message, strlen(message));
+        request_len = FRAME_HEADER_SIZE + strlen(message);
+    } else {
+        memcpy(request, message, strlen(message));
+        request_len = strlen(message);
+    }
+}
+
+void flow_close(int epfd, struct flow *f) {
+    if (f->fd >= 0) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, f->fd, NULL);
+        close(f->fd);
+        f->fd = -1;
+    }
+    f->state = FLOW_IDLE;
+}
+
+// Returns -1 if the request could not be sent
+int flow_send(int epfd, struct flow *f) {
+    struct epoll_event ev;
+
+    if (send(f->fd, request, request_len, MSG_NOSIGNAL) != (ssize_t)request_len) {
+        return -1;
+    }
+    if (f->state != FLOW_WAITING) {
+        ev.events = EPOLLIN;
+        ev.data.ptr = f;
+        if (epoll_ctl(epfd, EPOLL_CTL_MOD, f->fd, &ev) < 0) {
+            return -1;
+        }
+    }
+    f->state = FLOW_WAITING;
+    f->got = 0;
+    return 0;
+}
+
+// Open the socket (non-blocking connect for TCP) and, once connected, send
+// the first request. Returns -1 on failure.
+int flow_start(int epfd, struct flow *f) {
+    struct epoll_event ev;
+    int opt = 1;
+
+    f->start_ns = now_ns();
+    f->fd = socket(AF_INET, proto->type | SOCK_NONBLOCK, 0);
+    if (f->fd < 0) {
+        return -1;
+    }
+    if (proto->type == SOCK_STREAM) {
+        setsockopt(f->fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    }
+    if (f->reader != NULL) {
+        frame_reader_reset(f->reader);
+    }
+
+    ev.events = EPOLLOUT;
+    ev.data.ptr = f;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, f->fd, &ev) < 0) {
+        close(f->fd);
+        f->fd = -1;
+        return -1;
+    }
+    if (connect(f->fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        if (errno == EINPROGRESS) {
+            f->state = FLOW_CONNECTING;
+            return 0;
+        }
+        flow_close(epfd, f);
+        return -1;
+    }
+    f->state = FLOW_CONNECTING;
+    if (flow_send(epfd, f) < 0) {
+        flow_close(epfd, f);
+        return -1;
+    }
+    return 0;
+}
+
+// Read what is available. Returns 1 once the whole reply is in, 0 if more
+// is needed, -1 on error or EOF.
+int flow_read_reply(struct flow *f) {
+    char buffer[BUFFER_SIZE];
+    const char *payload;
+    size_t len;
+
+    if (proto->wire == WIRE_FRAMED || proto->wire == WIRE_MAC_BATCH) {
+        ssize_t n = frame_reader_fill(f->reader, f->fd);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+            return -1;
+        }
+        return frame_reader_next(f->reader, &payload, &len);
+    }
+
+    ssize_t n = recv(f->fd, buffer, sizeof(buffer), 0);
+    if (n < 0) {
+        return errno == EAGAIN || errno == EINTR ? 0 : -1;
+    }
+    if (proto->wire == WIRE_DATAGRAM) {
+        return 1;
+    }
+    if (n == 0) {
+        return -1;
+    }
+    f->got += n;
+    return f->got >= kx_reply_len;
+}
+
+void *worker_main(void *arg) {
+    struct worker *w = arg;
+    struct epoll_event events[MAX_EVENTS];
+
+    int epfd = epoll_create1(0);
+    if (epfd < 0) {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < w->nflows; i++) {
+        w->flows[i].fd = -1;
+        if ((proto->wire == WIRE_FRAMED || proto->wire == WIRE_MAC_BATCH) &&
+            (w->flows[i].reader = frame_reader_new(0)) == NULL) {
+            perror("frame_reader_new");
+            exit(EXIT_FAILURE);
+        }
+    }
+    pthread_barrier_wait(&barrier);
+
+    for (int i = 0; i < w->nflows; i++) {
+        if (flow_start(epfd, &w->flows[i]) < 0) {
+            w->errors++;
+        }
+    }
+
+    long long next_scan = now_ns() + TIMEOUT_SCAN_NS;
+    while (1) {
+        long long t = now_ns();
+        if (t >= deadline_ns) {
+            break;
+        }
+
+        // Lost datagrams are never answered; resend after UDP_TIMEOUT_NS.
+        // Failed TCP flows are retried here too.
+        if (t >= next_scan) {
+            for (int i = 0; i < w->nflows; i++) {
+                struct flow *f = &w->flows[i];
+                if (f->state == FLOW_IDLE) {
+                    if (flow_start(epfd, f) < 0) {
+                        w->errors++;
+                    }
+                } else if (proto->type == SOCK_DGRAM && t - f->start_ns > UDP_TIMEOUT_NS) {
+                    w->timeouts++;
+                    f->start_ns = t;
+                    flow_send(epfd, f);
+                }
+            }
+            next_scan = t + TIMEOUT_SCAN_NS;
+        }
+
+        int nfds = epoll_wait(epfd, events, MAX_EVENTS, 50);
+        for (int i = 0; i < nfds; i++) {
+            struct flow *f = events[i].data.ptr;
+            int rc;
+
+            if (f->state == FLOW_CONNECTING) {
+                int err = 0;
+                socklen_t errlen = sizeof(err);
+                getsockopt(f->fd, SOL_SOCKET, SO_ERROR, &err, &errlen);
+                if (err != 0 || (events[i].events & (EPOLLERR | EPOLLHUP)) || flow_send(epfd, f) < 0) {
+                    w->errors++;
+                    flow_close(epfd, f);
+                }
+                continue;
+            }
+            if (f->state != FLOW_WAITING) {
+                continue;
+            }
+
+            rc = flow_read_reply(f);
+            if (rc < 0) {
+                w->errors++;
+                flow_close(epfd, f);
+                continue;
+            }
+            if (rc == 0) {
+                continue;
+            }
+
+            long long done = now_ns();
+            histogram_record(&w->hist, done - f->start_ns);
+            w->requests++;
+            if (proto->per_request) {
+                flow_close(epfd, f);
+                if (flow_start(epfd, f) < 0) {
+                    w->errors++;
+                }
+            } else {
+                f->start_ns = done;
+                if (flow_send(epfd, f) < 0) {
+                    w->errors++;
+                    flow_close(epfd, f);
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < w->nflows; i++) {
+        flow_close(epfd, &w->flows[i]);
+        frame_reader_free(w->flows[i].reader);
+    }
+    close(epfd);
+    return NULL;
+}
+
+// Print one JSON object describing the run
+void write_json(FILE *out, const char *host, int connections, int threads,
+                struct histogram *h, unsigned long long errors, unsigned long long timeouts,
+                double seconds) {
+    fprintf(out, "{\"timestamp\":%ld,\"protocol\":\"%s\",\"host\":\"%s\",\"port\":%d,"
+            "\"connections\":%d,\"threads\":%d,\"duration_s\":%.3f,"
+            "\"requests\":%llu,\"errors\":%llu,\"timeouts\":%llu,\"throughput_rps\":%.1f,"
+            "\"latency_us\":{\"min\":%.1f,\"mean\":%.1f,\"p50\":%.1f,\"p90\":%.1f,"
+            "\"p99\":%.1f,\"p99_9\":%.1f,\"max\":%.1f}",
+            (long)time(NULL), proto->name, host, ntohs(server_addr.sin_port),
+            connections, threads, seconds,
+            (unsigned long long)h->total, errors, timeouts, h->total / seconds,
+            h->total ? h->min / 1000.0 : 0.0, histogram_mean(h) / 1000.0,
+            histogram_percentile(h, 50) / 1000.0, histogram_percentile(h, 90) / 1000.0,
+            histogram_percentile(h, 99) / 1000.0, histogram_percentile(h, 99.9) / 1000.0,
+            h->max / 1000.0);
+    if (proto->wire == WIRE_MAC_BATCH) {
+        fprintf(out, ",\"batch\":%d,\"devices_per_sec\":%.1f", batch, h->total * batch / seconds);
+    }
+    fprintf(out, "}\n");
+}
+
+void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-P protocol] [-c connections] [-t threads] [-d seconds]\n", prog);
+    fprintf(stderr, "          [-H host] [-p port] [-m message] [-b batch] [-o results.jsonl]\n");
+    fprintf(stderr, "  -b  MAC addresses per mac-batch request, 1..%d (default %d)\n",
+            MAC_PROTO_MAX_BATCH, DEFAULT_BATCH);
+    fprintf(stderr, "  protocols:");
+    for (size_t i = 0; i < sizeof(protocols) / sizeof(protocols[0]); i++) {
+        fprintf(stderr, " %s (%d)", protocols[i].name, protocols[i].port);
+    }
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    const char *host = "127.0.0.1";
+    const char *message = NULL;
+    const char *output = NULL;
+    int connections = 64;
+    int threads = 4;
+    int port = 0;
+    int c;
+
+    proto = &protocols[0];
+    while ((c = getopt(argc, argv, "P:c:t:d:H:p:m:b:o:")) != -1) {
+        switch (c) {
+        case 'P':
+            proto = NULL;
+            for (size_t i = 0; i < sizeof(protocols) / sizeof(protocols[0]); i++) {
+                if (strcmp(optarg, protocols[i].name) == 0) {
+                    proto = &protocols[i];
+                }
+            }
+            if (proto == NULL) {
+                fprintf(stderr, "unknown protocol '%s'\n", optarg);
+                usage(argv[0]);
+            }
+            break;
+        case 'c': connections = atoi(optarg); break;
+        case 't': threads = atoi(optarg); break;
+        case 'd': duration = atoi(optarg); break;
+        case 'H': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'm': message = optarg; break;
+        case 'b': batch = atoi(optarg); break;
+        case 'o': output = optarg; break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (connections < 1 || threads < 1 || duration < 1) {
+        fprintf(stderr, "connections, threads and duration must be positive\n");
+        exit(EXIT_FAILURE);
+    }
+    if (batch < 1 || batch > MAC_PROTO_MAX_BATCH) {
+        fprintf(stderr, "batch must be between 1 and %d\n", MAC_PROTO_MAX_BATCH);
+        exit(EXIT_FAILURE);
+    }
+    if (threads > connections) {
+        threads = connections;
+    }
+    if (message == NULL) {
+        message = proto->message;
+    }
+    if (message != NULL && strlen(message) > BUFFER_SIZE) {
+        fprintf(stderr, "message longer than %d bytes\n", BUFFER_SIZE);
+        exit(EXIT_FAILURE);
+    }
+    build_request(message);
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port ? port : proto->port);
+    if (inet_pton(AF_INET, host, &server_addr.sin_addr) <= 0) {
+        fprintf(stderr, "invalid address '%s'\n", host);
+        exit(EXIT_FAILURE);
+    }
+
+    struct worker *workers = calloc(threads, sizeof(*workers));
+    if (workers == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    pthread_barrier_init(&barrier, NULL, threads + 1);
+
+    fprintf(stderr, "%s: %d connections from %d threads to %s:%d for %d s\n",
+            proto->name, connections, threads, host, ntohs(server_addr.sin_port), duration);
+    for (int i = 0; i < threads; i++) {
+        workers[i].nflows = connections / threads + (i < connections % threads);
+        workers[i].flows = calloc(workers[i].nflows, sizeof(struct flow));
+        if (workers[i].flows == NULL) {
+            perror("calloc");
+            exit(EXIT_FAILURE);
+        }
+        histogram_init(&workers[i].hist);
+        pthread_create(&workers[i].tid, NULL, worker_main, &workers[i]);
+    }
+    long long start = now_ns();
+    deadline_ns = start + duration * 1000000000LL;
+    pthread_barrier_wait(&barrier);
+
+    struct histogram *total = malloc(sizeof(*total));
+    unsigned long long errors = 0, timeouts = 0;
+    if (total == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    histogram_init(total);
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i].tid, NULL);
+        histogram_merge(total, &workers[i].hist);
+        errors += workers[i].errors;
+        timeouts += workers[i].timeouts;
+        free(workers[i].flows);
+    }
+    double seconds = (now_ns() - start) / 1e9;
+
+    write_json(stdout, host, connections, threads, total, errors, timeouts, seconds);
+    if (output != NULL) {
+        FILE *fp = fopen(output, "a");
+        if (fp == NULL) {
+            perror("fopen");
+            exit(EXIT_FAILURE);
+        }
+        write_json(fp, host, connections, threads, total, errors, timeouts, seconds);
+        fclose(fp);
+    }
+
+    free(total);
+    free(workers);
+    return 0;
+}
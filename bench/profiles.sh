@@ -0,0 +1,86 @@
+#!/bin/sh
+# Run the TCP servers under each socket tuning profile and print one table
+# row per server and profile. Used by the `benchmark-profiles` build target.
+#
+#   bench/profiles.sh BUILD_DIR [SECONDS] [PROFILE_FILE]
+#
+# Rows for "none" are the servers' own options. Request/reply rows come
+# from netbench over 64 kept-open connections; the setup row from
+# socket_options/connbench, one connection per request, which is where
+# the backlog and TCP_DEFER_ACCEPT show. Over loopback SO_BUSY_POLL and
+# Fast Open do little; run against another host for the full picture.
+set -e
+
+BUILD=$1
+SECONDS_PER_RUN=${2:-3}
+PROFILE_FILE=$3
+NETBENCH="$BUILD/bench/netbench"
+CONNBENCH="$BUILD/socket_options/connbench"
+
+if [ -z "$BUILD" ]; then
+    echo "usage: $0 BUILD_DIR [SECONDS] [PROFILE_FILE]" >&2
+    exit 1
+fi
+
+PROFILES="none low-latency bulk high-conn"
+LOAD=""
+if [ -n "$PROFILE_FILE" ]; then
+    LOAD="-P $PROFILE_FILE"
+    PROFILES="$PROFILES $(sed -n 's/^[[:space:]]*\[\(.*\)\][[:space:]]*$/\1/p' "$PROFILE_FILE")"
+fi
+
+# json_field JSON NAME: a number from netbench's one-line result
+json_field() {
+    echo "$1" | sed -n "s/.*\"$2\":\([0-9.]*\).*/\1/p"
+}
+
+# measure SERVER PROFILE SERVER_COMMAND -- netbench|connbench ARGS...
+measure() {
+    server=$1
+    name=$2
+    shift 2
+    cmd=""
+    while [ "$1" != "--" ]; do
+        cmd="$cmd $1"
+        shift
+    done
+    shift
+    if [ "$name" != none ]; then
+        cmd="$cmd $LOAD -p $name"
+    fi
+
+    $cmd > /dev/null 2>&1 &
+    pid=$!
+    sleep 0.5
+    if [ "$1" = connbench ]; then
+        shift
+        out=$("$CONNBENCH" -d "$SECONDS_PER_RUN" "$@" 2> /dev/null || true)
+        rate=$(echo "$out" | sed -n 's/.*: \([0-9]*\) connections\/sec/\1/p')
+        p99=$(echo "$out" | sed -n 's/.*p99 \([0-9.]*\) .*/\1/p')
+        unit="conn/s"
+    else
+        shift
+        out=$("$NETBENCH" -d "$SECONDS_PER_RUN" "$@" 2> /dev/null || true)
+        rate=$(json_field "$out" throughput_rps)
+        p99=$(json_field "$out" p99)
+        unit="req/s"
+    fi
+    # TERM, not INT: background jobs of a non-interactive shell ignore SIGINT
+    kill -TERM "$pid" 2> /dev/null || true
+    wait "$pid" 2> /dev/null || true
+    printf "%-16s %-12s %12s %-6s %10s\n" "$server" "$name" "${rate:-failed}" "$unit" "${p99:--}"
+}
+
+printf "%-16s %-12s %19s %10s\n" server profile rate "p99 us"
+for p in $PROFILES; do
+    measure tcp-blocking    "$p" "$BUILD/tcp/tcp.server" -q -b blocking     -- netbench -P tcp
+done
+for p in $PROFILES; do
+    measure sockopt-prefork "$p" "$BUILD/socket_options/server" -m prefork  -- netbench -P tcp
+done
+for p in $PROFILES; do
+    measure sockopt-setup   "$p" "$BUILD/socket_options/server" -m prefork  -- connbench
+done
+for p in $PROFILES; do
+    measure mac             "$p" "$BUILD/mac/mac_auth_server" -q            -- netbench -P mac -c 64
+done
@@ -0,0 +1,54 @@
+#!/bin/sh
+# Run every server in turn under bench/netbench and append one JSON line
+# per run to RESULTS. Used by the `benchmark` and `pgo-train` build targets.
+#
+#   bench/run.sh BUILD_DIR RESULTS [SECONDS]
+set -e
+
+BUILD=$1
+RESULTS=$2
+SECONDS_PER_RUN=${3:-5}
+NETBENCH="$BUILD/bench/netbench"
+
+if [ -z "$BUILD" ] || [ -z "$RESULTS" ]; then
+    echo "usage: $0 BUILD_DIR RESULTS [SECONDS]" >&2
+    exit 1
+fi
+
+# run_server NAME SERVER_COMMAND -- NETBENCH_ARGS...
+run_server() {
+    name=$1
+    shift
+    cmd=""
+    while [ "$1" != "--" ]; do
+        cmd="$cmd $1"
+        shift
+    done
+    shift
+
+    echo "== $name" >&2
+    $cmd > /dev/null 2>&1 &
+    pid=$!
+    sleep 0.5
+    "$NETBENCH" -d "$SECONDS_PER_RUN" -o "$RESULTS" "$@" > /dev/null || true
+    # TERM, not INT: background jobs of a non-interactive shell ignore
+    # SIGINT. Servers that catch it print their counters (and PGO builds
+    # write their profiles); one still running 5 s later is killed.
+    kill -TERM "$pid" 2> /dev/null || true
+    (sleep 5; kill -KILL "$pid" 2> /dev/null) &
+    watchdog=$!
+    wait "$pid" 2> /dev/null || true
+    kill "$watchdog" 2> /dev/null || true
+}
+
+run_server tcp-blocking   "$BUILD/tcp/tcp.server" -q -b blocking          -- -P tcp
+run_server tcp-uring      "$BUILD/tcp/tcp.server" -q -b uring             -- -P tcp
+run_server sockopt-fork   "$BUILD/socket_options/server" -m fork          -- -P tcp -c 16
+run_server sockopt-prefork "$BUILD/socket_options/server" -m prefork      -- -P tcp
+run_server multi-epoll    "$BUILD/multi/multi.protocol.server" -q -m epoll -- -P multi
+run_server multi-uring    "$BUILD/multi/multi.protocol.server" -q -m uring -- -P multi
+run_server multi-udp      "$BUILD/multi/multi.protocol.server" -q         -- -P multi-udp -c 16
+run_server udp            "$BUILD/udp/udp.server" -q                      -- -P udp -c 16
+run_server mac            "$BUILD/mac/mac_auth_server"                    -- -P mac -c 8
+run_server mac-batch      "$BUILD/mac/mac_auth_server" -q                 -- -P mac-batch -c 8
+run_server kx             "$BUILD/key_exchange/server" -q                 -- -P kx -c 8
@@ -0,0 +1,266 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <pthread.h>
+
+#include "framing.h"
+
+#define READER_CACHE_SIZE 16
+
+// Recycled readers, of any capacity; a new reader takes one of its own
+// size. Shared by all threads, because thread-per-connection servers free a
+// reader just before the thread exits.
+static struct frame_reader *reader_cache[READER_CACHE_SIZE];
+static int reader_cache_count = 0;
+static pthread_mutex_t reader_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Map capacity bytes of memfd-backed memory twice, back to back
+static char *map_mirrored(size_t capacity) {
+    int fd = memfd_create("frame_reader", MFD_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (ftruncate(fd, capacity) < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    // Reserve the whole window first so both halves land next to each other
+    char *base = mmap(NULL, 2 * capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    if (mmap(base, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+        mmap(base + capacity, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(base, 2 * capacity);
+        close(fd);
+        return NULL;
+    }
+
+    // The mappings keep the memory alive
+    close(fd);
+    return base;
+}
+
+struct frame_reader *frame_reader_new(size_t capacity) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+    if (capacity == 0) {
+        capacity = FRAME_READER_DEFAULT_CAPACITY;
+    }
+    capacity = (capacity + page - 1) / page * page;
+
+    struct frame_reader *r = NULL;
+
+    pthread_mutex_lock(&reader_cache_lock);
+    for (int i = reader_cache_count - 1; i >= 0; i--) {
+        if (reader_cache[i]->capacity == capacity) {
+            r = reader_cache[i];
+            reader_cache[i] = reader_cache[--reader_cache_count];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&reader_cache_lock);
+    if (r != NULL) {
+        frame_reader_reset(r);
+        return r;
+    }
+
+    r = malloc(sizeof(*r));
+    if (r == NULL) {
+        return NULL;
+    }
+    r->buf = map_mirrored(capacity);
+    if (r->buf == NULL) {
+        int saved = errno;
+        free(r);
+        errno = saved;
+        return NULL;
+    }
+    r->capacity = capacity;
+    r->max_frame = capacity - FRAME_HEADER_SIZE;
+    frame_reader_reset(r);
+    return r;
+}
+
+void frame_reader_free(struct frame_reader *r) {
+    if (r == NULL) {
+        return;
+    }
+    int cached = 0;
+
+    pthread_mutex_lock(&reader_cache_lock);
+    if (reader_cache_count < READER_CACHE_SIZE) {
+        reader_cache[reader_cache_count++] = r;
+        cached = 1;
+    }
+    pthread_mutex_unlock(&reader_cache_lock);
+    if (cached) {
+        return;
+    }
+    munmap(r->buf, 2 * r->capacity);
+    free(r);
+}
+
+void frame_reader_reset(struct frame_reader *r) {
+    r->head = 0;
+    r->used = 0;
+}
+
+char *frame_reader_space(struct frame_reader *r, size_t *avail) {
+    size_t tail = (r->head + r->used) % r->capacity;
+
+    *avail = r->capacity - r->used;
+    return r->buf + tail;
+}
+
+void frame_reader_commit(struct frame_reader *r, size_t n) {
+    r->used += n;
+}
+
+int frame_reader_feed(struct frame_reader *r, const void *data, size_t len) {
+    size_t avail;
+    char *dst = frame_reader_space(r, &avail);
+
+    if (len > avail) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    memcpy(dst, data, len);
+    frame_reader_commit(r, len);
+    return 0;
+}
+
+ssize_t frame_reader_fill(struct frame_reader *r, int fd) {
+    size_t avail;
+    char *dst = frame_reader_space(r, &avail);
+
+    if (avail == 0) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    ssize_t n = recv(fd, dst, avail, 0);
+    if (n > 0) {
+        frame_reader_commit(r, n);
+    }
+    return n;
+}
+
+int frame_reader_next(struct frame_reader *r, const char **payload, size_t *len) {
+    if (r->used < FRAME_HEADER_SIZE) {
+        return 0;
+    }
+
+    // The mirror mapping makes the header and payload contiguous even when
+    // they straddle the end of the ring
+    size_t frame_len = frame_decode_header(r->buf + r->head);
+
+    if (frame_len > r->max_frame) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (r->used < FRAME_HEADER_SIZE + frame_len) {
+        return 0;
+    }
+
+    *payload = r->buf + r->head + FRAME_HEADER_SIZE;
+    *len = frame_len;
+    r->head = (r->head + FRAME_HEADER_SIZE + frame_len) % r->capacity;
+    r->used -= FRAME_HEADER_SIZE + frame_len;
+    return 1;
+}
+
+int frame_read(struct frame_reader *r, int fd, const char **payload, size_t *len) {
+    while (1) {
+        int rc = frame_reader_next(r, payload, len);
+        if (rc != 0) {
+            return rc;
+        }
+
+        ssize_t n = frame_reader_fill(r, fd);
+        if (n == 0) {
+            return 0;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+    }
+}
+
+void frame_encode_header(char header[FRAME_HEADER_SIZE], uint32_t len) {
+    header[0] = (char)(len >> 24);
+    header[1] = (char)(len >> 16);
+    header[2] = (char)(len >> 8);
+    header[3] = (char)len;
+}
+
+uint32_t frame_decode_header(const char header[FRAME_HEADER_SIZE]) {
+    const unsigned char *p = (const unsigned char *)header;
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+int sendmsg_all(int fd, struct iovec *iov, int iovcnt, int flags) {
+    struct msghdr msg;
+
+    while (iovcnt > 0) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+
+        ssize_t n = sendmsg(fd, &msg, flags | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        // Step over what went out, finished pieces first
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+int frame_writev(int fd, const struct iovec *payload, int iovcnt) {
+    char header[FRAME_HEADER_SIZE];
+    struct iovec iov[1 + FRAME_MAX_IOV];
+    size_t len = 0;
+
+    if (iovcnt > FRAME_MAX_IOV) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (int i = 0; i < iovcnt; i++) {
+        iov[1 + i] = payload[i];
+        len += payload[i].iov_len;
+    }
+    if (len > UINT32_MAX) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    frame_encode_header(header, (uint32_t)len);
+    iov[0].iov_base = header;
+    iov[0].iov_len = FRAME_HEADER_SIZE;
+    return sendmsg_all(fd, iov, 1 + iovcnt, 0);
+}
+
+int frame_write(int fd, const void *payload, size_t len) {
+    struct iovec iov = { (void *)payload, len };
+    return frame_writev(fd, &iov, 1);
+}
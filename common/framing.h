@@ -0,0 +1,81 @@
+// Length-prefixed message framing for the TCP programs.
+//
+// Every message on the wire is a 4-byte big-endian payload length followed
+// by the payload. TCP may split a frame across reads or coalesce several
+// frames into one read; frame_reader reassembles both cases.
+//
+// The reader is a ring buffer whose storage is mapped twice, back to back,
+// in virtual memory. A frame that wraps past the end of the ring is still
+// contiguous when read through the mapping, so frames are parsed and handed
+// out in place: no per-message copy, no compaction and no clearing.
+#ifndef FRAMING_H
+#define FRAMING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define FRAME_HEADER_SIZE 4
+// Default ring size; also bounds the largest frame a reader accepts
+#define FRAME_READER_DEFAULT_CAPACITY (64 * 1024)
+// Most pieces frame_writev() takes for one payload
+#define FRAME_MAX_IOV 8
+
+struct frame_reader {
+    char *buf;        // capacity bytes, mapped twice contiguously
+    size_t capacity;  // multiple of the page size
+    size_t head;      // offset of the first unconsumed byte, < capacity
+    size_t used;      // bytes buffered and not yet consumed
+    size_t max_frame; // largest payload accepted
+};
+
+// Allocate a reader whose ring holds at least capacity bytes (0 for the
+// default). Returns NULL with errno set on failure. Freed readers are
+// recycled through a small cache and reused for the same capacity, so
+// creating one per connection usually avoids setting up new mappings.
+struct frame_reader *frame_reader_new(size_t capacity);
+void frame_reader_free(struct frame_reader *r);
+
+// Drop any buffered bytes so the reader can serve a new connection.
+void frame_reader_reset(struct frame_reader *r);
+
+// Contiguous free space to receive into, and how much of it there is.
+// After writing n bytes there, call frame_reader_commit(r, n).
+char *frame_reader_space(struct frame_reader *r, size_t *avail);
+void frame_reader_commit(struct frame_reader *r, size_t n);
+
+// Copy len bytes in (for data that already sits in another buffer, such as
+// an io_uring provided buffer). Returns -1 with errno = ENOBUFS if full.
+int frame_reader_feed(struct frame_reader *r, const void *data, size_t len);
+
+// One recv() into the ring. Returns bytes read, 0 on EOF, -1 on error.
+ssize_t frame_reader_fill(struct frame_reader *r, int fd);
+
+// Take the next complete frame. Returns 1 and points *payload at it (valid
+// until the next fill/feed/commit), 0 if more bytes are needed, or -1 with
+// errno = EMSGSIZE if the peer announced a frame larger than max_frame.
+int frame_reader_next(struct frame_reader *r, const char **payload, size_t *len);
+
+// Blocking helper: fill until a whole frame is available. Returns 1 with
+// the frame, 0 on orderly EOF, -1 on error (errno from recv(), or EMSGSIZE).
+int frame_read(struct frame_reader *r, int fd, const char **payload, size_t *len);
+
+// Write the 4-byte header for a payload of len bytes, and read it back.
+void frame_encode_header(char header[FRAME_HEADER_SIZE], uint32_t len);
+uint32_t frame_decode_header(const char header[FRAME_HEADER_SIZE]);
+
+// Send one frame (header and payload in a single writev-style call).
+// Returns 0 on success, -1 on error.
+int frame_write(int fd, const void *payload, size_t len);
+
+// Send one frame whose payload is iov[0..iovcnt) back to back, gathered by
+// the kernel rather than copied into one buffer first.
+int frame_writev(int fd, const struct iovec *iov, int iovcnt);
+
+// sendmsg() until every byte of iov has gone, resuming after partial
+// sends; iov is used up in the process. MSG_NOSIGNAL is always added.
+// Returns 0 on success, -1 on error.
+int sendmsg_all(int fd, struct iovec *iov, int iovcnt, int flags);
+
+#endif
@@ -0,0 +1,81 @@
+#include <string.h>
+
+#include "histogram.h"
+
+static int bucket_index(uint64_t value) {
+    if (value < HIST_LINEAR) {
+        return (int)value;
+    }
+    // Shift the value down until it has HIST_SUB_BITS significant bits;
+    // its top half then selects the sub-bucket within the row
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - HIST_SUB_BITS + 1;
+    return HIST_LINEAR + (shift - 1) * HIST_HALF + (int)((value >> shift) - HIST_HALF);
+}
+
+static uint64_t bucket_highest(int index) {
+    if (index < HIST_LINEAR) {
+        return index;
+    }
+    int shift = (index - HIST_LINEAR) / HIST_HALF + 1;
+    uint64_t sub = (index - HIST_LINEAR) % HIST_HALF + HIST_HALF;
+    return ((sub + 1) << shift) - 1;
+}
+
+void histogram_init(struct histogram *h) {
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+void histogram_record(struct histogram *h, uint64_t value) {
+    h->counts[bucket_index(value)]++;
+    h->total++;
+    h->sum += (double)value;
+    if (value < h->min) {
+        h->min = value;
+    }
+    if (value > h->max) {
+        h->max = value;
+    }
+}
+
+void histogram_merge(struct histogram *dst, const struct histogram *src) {
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->total += src->total;
+    dst->sum += src->sum;
+    if (src->min < dst->min) {
+        dst->min = src->min;
+    }
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+}
+
+uint64_t histogram_percentile(const struct histogram *h, double p) {
+    if (h->total == 0) {
+        return 0;
+    }
+    if (p >= 100.0) {
+        return h->max;
+    }
+
+    uint64_t rank = (uint64_t)(p / 100.0 * h->total + 0.5);
+    uint64_t seen = 0;
+    if (rank == 0) {
+        rank = 1;
+    }
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            uint64_t v = bucket_highest(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+double histogram_mean(const struct histogram *h) {
+    return h->total ? h->sum / h->total : 0.0;
+}
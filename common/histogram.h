@@ -0,0 +1,36 @@
+// Log-linear latency histogram in the style of HdrHistogram.
+//
+// Values below HIST_LINEAR are counted exactly. Above that, every power of
+// two is split into HIST_LINEAR / 2 equal sub-buckets, so a reported value
+// is within 1 / (HIST_LINEAR / 2) of the recorded one at any magnitude.
+// Recording is a couple of shifts and an increment; histograms from
+// several threads are combined with histogram_merge().
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+#define HIST_SUB_BITS 8
+#define HIST_LINEAR (1 << HIST_SUB_BITS)
+#define HIST_HALF (HIST_LINEAR / 2)
+// Linear range, then one row of HIST_HALF sub-buckets per remaining bit
+#define HIST_BUCKETS (HIST_LINEAR + (64 - HIST_SUB_BITS) * HIST_HALF)
+
+struct histogram {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    double sum;
+};
+
+void histogram_init(struct histogram *h);
+void histogram_record(struct histogram *h, uint64_t value);
+void histogram_merge(struct histogram *dst, const struct histogram *src);
+
+// Value at percentile p (0..100): the highest value equivalent to the
+// bucket that holds it. 0 for an empty histogram.
+uint64_t histogram_percentile(const struct histogram *h, double p);
+double histogram_mean(const struct histogram *h);
+
+#endif
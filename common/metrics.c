@@ -0,0 +1,333 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+#include "metrics.h"
+
+enum metric_type { METRIC_COUNTER, METRIC_GAUGE, METRIC_HISTOGRAM };
+
+static const char *const type_names[] = { "counter", "gauge", "histogram" };
+
+struct series {
+    char name[64];
+    char labels[64];
+    char help[96];
+    enum metric_type type;
+    metric_t offset;
+};
+
+struct registry {
+    unsigned nseries;
+    unsigned words;     // used in every slot
+    unsigned next_slot; // claimed so far, wrapping past METRICS_MAX_SLOTS
+    struct series series[METRICS_MAX_SERIES];
+    uint64_t slots[METRICS_MAX_SLOTS][METRICS_SLOT_WORDS] __attribute__((aligned(64)));
+};
+
+static struct registry *registry = NULL;
+
+__thread uint64_t *metrics_slot_tls = NULL;
+
+// Shared, so that children forked later update the parent's rows. The
+// kernel only backs the pages the rows actually touch.
+static struct registry *get_registry(void) {
+    if (registry == NULL) {
+        void *p = mmap(NULL, sizeof(struct registry), PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            perror("metrics: mmap");
+            exit(EXIT_FAILURE);
+        }
+        registry = p;
+    }
+    return registry;
+}
+
+void metrics_thread_init(void) {
+    struct registry *r = get_registry();
+    unsigned slot = __atomic_fetch_add(&r->next_slot, 1, __ATOMIC_RELAXED);
+
+    metrics_slot_tls = r->slots[slot % METRICS_MAX_SLOTS];
+}
+
+uint64_t *metrics_claim_slot(void) {
+    metrics_thread_init();
+    return metrics_slot_tls;
+}
+
+static metric_t add_series(const char *name, const char *labels, const char *help,
+                           enum metric_type type, unsigned words) {
+    struct registry *r = get_registry();
+    struct series *s;
+
+    if (r->nseries == METRICS_MAX_SERIES || r->words + words > METRICS_SLOT_WORDS) {
+        fprintf(stderr, "metrics: no room for %s\n", name);
+        exit(EXIT_FAILURE);
+    }
+    s = &r->series[r->nseries++];
+    snprintf(s->name, sizeof(s->name), "%s", name);
+    snprintf(s->labels, sizeof(s->labels), "%s", labels != NULL ? labels : "");
+    snprintf(s->help, sizeof(s->help), "%s", help);
+    s->type = type;
+    s->offset = r->words;
+    r->words += words;
+    return s->offset;
+}
+
+metric_t metrics_counter(const char *name, const char *labels, const char *help) {
+    return add_series(name, labels, help, METRIC_COUNTER, 1);
+}
+
+metric_t metrics_gauge(const char *name, const char *labels, const char *help) {
+    return add_series(name, labels, help, METRIC_GAUGE, 1);
+}
+
+metric_t metrics_histogram(const char *name, const char *labels, const char *help) {
+    return add_series(name, labels, help, METRIC_HISTOGRAM, METRICS_HIST_WORDS);
+}
+
+void metrics_register_server(struct server_metrics *m) {
+    m->accepts = metrics_counter("server_accepts_total", NULL, "Connections accepted");
+    m->active = metrics_gauge("server_connections_active", NULL, "Connections open now");
+    m->requests = metrics_counter("server_requests_total", NULL, "Requests answered");
+    m->bytes_in = metrics_counter("server_received_bytes_total", NULL, "Bytes read from clients");
+    m->bytes_out = metrics_counter("server_sent_bytes_total", NULL, "Bytes written to clients");
+}
+
+// Word w summed over the slots claimed so far
+static uint64_t sum(const struct registry *r, unsigned w) {
+    unsigned nslots = __atomic_load_n(&r->next_slot, __ATOMIC_RELAXED);
+    uint64_t total = 0;
+
+    if (nslots > METRICS_MAX_SLOTS) {
+        nslots = METRICS_MAX_SLOTS;
+    }
+    for (unsigned i = 0; i < nslots; i++) {
+        total += __atomic_load_n(&r->slots[i][w], __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+// "{labels}" or "{labels,extra}", or nothing for neither
+static void print_labels(FILE *out, const char *labels, const char *extra) {
+    if (*labels == '\0' && extra == NULL) {
+        return;
+    }
+    fprintf(out, "{%s%s%s}", labels, *labels != '\0' && extra != NULL ? "," : "",
+            extra != NULL ? extra : "");
+}
+
+static void print_series(FILE *out, const struct registry *r, const struct series *s) {
+    char le[32];
+    uint64_t count = 0;
+
+    switch (s->type) {
+    case METRIC_COUNTER:
+        fprintf(out, "%s", s->name);
+        print_labels(out, s->labels, NULL);
+        fprintf(out, " %llu\n", (unsigned long long)sum(r, s->offset));
+        break;
+    case METRIC_GAUGE:
+        fprintf(out, "%s", s->name);
+        print_labels(out, s->labels, NULL);
+        fprintf(out, " %lld\n", (long long)sum(r, s->offset));
+        break;
+    case METRIC_HISTOGRAM:
+        // Bucket b holds (2^(b-1), 2^b] us, so le = 2^b; the last one
+        // everything above
+        for (unsigned b = 0; b < METRICS_HIST_BUCKETS; b++) {
+            count += sum(r, s->offset + b);
+            if (b == METRICS_HIST_BUCKETS - 1) {
+                snprintf(le, sizeof(le), "le=\"+Inf\"");
+            } else {
+                snprintf(le, sizeof(le), "le=\"%g\"", (double)(1ULL << b) / 1e6);
+            }
+            fprintf(out, "%s_bucket", s->name);
+            print_labels(out, s->labels, le);
+            fprintf(out, " %llu\n", (unsigned long long)count);
+        }
+        fprintf(out, "%s_sum", s->name);
+        print_labels(out, s->labels, NULL);
+        fprintf(out, " %.6f\n", sum(r, s->offset + METRICS_HIST_BUCKETS) / 1e6);
+        fprintf(out, "%s_count", s->name);
+        print_labels(out, s->labels, NULL);
+        fprintf(out, " %llu\n", (unsigned long long)count);
+        break;
+    }
+}
+
+// The whole exposition in one malloc'd buffer
+static char *format(size_t *len) {
+    struct registry *r = get_registry();
+    char *buf = NULL;
+    FILE *out = open_memstream(&buf, len);
+
+    if (out == NULL) {
+        return NULL;
+    }
+    for (unsigned i = 0; i < r->nseries; i++) {
+        const struct series *s = &r->series[i];
+        if (i == 0 || strcmp(s->name, r->series[i - 1].name) != 0) {
+            fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", s->name, s->help, s->name,
+                    type_names[s->type]);
+        }
+        print_series(out, r, s);
+    }
+    if (fclose(out) != 0) {
+        free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == ENOTSOCK) {
+            n = write(fd, buf, len);
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int metrics_write(int fd) {
+    size_t len;
+    char *buf = format(&len);
+    int rc;
+
+    if (buf == NULL) {
+        return -1;
+    }
+    rc = write_all(fd, buf, len);
+    free(buf);
+    return rc;
+}
+
+// One scrape: read the request, whatever it asks for, and answer with
+// everything. A client that sends nothing for a second is answered anyway.
+static void answer(int fd) {
+    struct timeval timeout = { .tv_sec = 1 };
+    char request[1024], header[128];
+    size_t len;
+    char *body;
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (recv(fd, request, sizeof(request), 0) < 0 && errno != EAGAIN) {
+        return;
+    }
+    body = format(&len);
+    if (body == NULL) {
+        return;
+    }
+    int n = snprintf(header, sizeof(header),
+                     "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                     "Content-Length: %zu\r\n\r\n", len);
+    if (write_all(fd, header, n) == 0) {
+        write_all(fd, body, len);
+    }
+    free(body);
+}
+
+static void *serve(void *arg) {
+    int listen_fd = (int)(long)arg;
+
+    while (1) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                perror("metrics: accept");
+                sleep(1);
+            }
+            continue;
+        }
+        answer(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+static int open_endpoint(const char *where) {
+    int fd, one = 1;
+
+    if (strchr(where, '/') != NULL) {
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+        if (strlen(where) >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "metrics: socket path too long: %s\n", where);
+            return -1;
+        }
+        strcpy(addr.sun_path, where);
+        unlink(where); // left by a previous run
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            goto fail;
+        }
+    } else {
+        struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = INADDR_ANY };
+        char *end;
+        long port = strtol(where, &end, 10);
+
+        if (end == where || *end != '\0' || port <= 0 || port > 65535) {
+            fprintf(stderr, "metrics: expected a port or a socket path, not '%s'\n", where);
+            return -1;
+        }
+        addr.sin_port = htons(port);
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+            bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            goto fail;
+        }
+    }
+    if (listen(fd, 16) < 0) {
+        goto fail;
+    }
+    return fd;
+
+fail:
+    fprintf(stderr, "metrics: %s: %s\n", where, strerror(errno));
+    if (fd >= 0) {
+        close(fd);
+    }
+    return -1;
+}
+
+int metrics_serve(const char *where) {
+    sigset_t all, old;
+    pthread_t tid;
+    int fd = open_endpoint(where);
+    int rc;
+
+    if (fd < 0) {
+        return -1;
+    }
+    // The servers stop on signals that interrupt their own blocking calls,
+    // so this thread must never be the one to take them
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    rc = pthread_create(&tid, NULL, serve, (void *)(long)fd);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0) {
+        fprintf(stderr, "metrics: pthread_create: %s\n", strerror(rc));
+        close(fd);
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
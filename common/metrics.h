@@ -0,0 +1,101 @@
+// Counters, gauges and histograms for the servers, scraped in the
+// Prometheus text format.
+//
+// Every thread (or forked process) updates a slot of its own: a cache-line
+// aligned row of 64-bit words, one per counter or gauge and a few per
+// histogram, so updates from different threads never share a line. An
+// update is one relaxed atomic add to the caller's row. Nothing is summed
+// until a scrape, which walks every row.
+//
+// The rows live in a shared anonymous mapping created by the first
+// registration, so children forked after that count into it too and one
+// scrape endpoint in the parent reports the whole server. Register every
+// metric at startup, before any thread or child process starts updating.
+//
+// Histograms have power-of-two buckets of microseconds, from 1 us to
+// 2^30 us (18 minutes), and are exported in seconds. Bucket b counts
+// values in (2^(b-1), 2^b] us, so a value on a bound falls under that
+// bound's le as Prometheus expects; bucket 0 holds 0 and 1 us.
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+#define METRICS_MAX_SLOTS 256
+#define METRICS_SLOT_WORDS 1024 // per slot; a histogram takes METRICS_HIST_WORDS
+#define METRICS_MAX_SERIES 128
+#define METRICS_HIST_BUCKETS 32
+#define METRICS_HIST_WORDS (METRICS_HIST_BUCKETS + 1) // and the sum
+
+// A word offset into every slot
+typedef unsigned metric_t;
+
+extern __thread uint64_t *metrics_slot_tls;
+
+// Claim the calling thread's slot; see metrics_thread_init()
+uint64_t *metrics_claim_slot(void);
+
+static inline uint64_t *metrics_slot(void) {
+    uint64_t *slot = metrics_slot_tls;
+    return slot != NULL ? slot : metrics_claim_slot();
+}
+
+static inline void metrics_add(metric_t m, uint64_t n) {
+    __atomic_fetch_add(&metrics_slot()[m], n, __ATOMIC_RELAXED);
+}
+
+static inline void metrics_inc(metric_t m) {
+    metrics_add(m, 1);
+}
+
+// Gauges go up and down; rows are summed as signed at scrape time
+static inline void metrics_dec(metric_t m) {
+    metrics_add(m, (uint64_t)-1);
+}
+
+static inline void metrics_observe_us(metric_t m, uint64_t us) {
+    uint64_t *slot = metrics_slot();
+    unsigned bucket = us > 1 ? 64 - __builtin_clzll(us - 1) : 0;
+
+    if (bucket >= METRICS_HIST_BUCKETS) {
+        bucket = METRICS_HIST_BUCKETS - 1;
+    }
+    __atomic_fetch_add(&slot[m + bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&slot[m + METRICS_HIST_BUCKETS], us, __ATOMIC_RELAXED);
+}
+
+// Register a series. labels, say "result=\"granted\"", may be NULL; series
+// of one name must be registered one after another. Exits if the registry
+// is full, as that is a fixed limit and not a runtime condition.
+metric_t metrics_counter(const char *name, const char *labels, const char *help);
+metric_t metrics_gauge(const char *name, const char *labels, const char *help);
+metric_t metrics_histogram(const char *name, const char *labels, const char *help);
+
+// Give the calling thread, or a child just forked, a row of its own
+// rather than the one it would share. Optional: a thread that never calls
+// it claims a row on its first update, and a forked child keeps its
+// parent's, which is still correct, only contended. Rows are reused
+// round-robin past METRICS_MAX_SLOTS.
+void metrics_thread_init(void);
+
+// The series every TCP server exports
+struct server_metrics {
+    metric_t accepts;
+    metric_t active;
+    metric_t requests;
+    metric_t bytes_in;
+    metric_t bytes_out;
+};
+
+void metrics_register_server(struct server_metrics *m);
+
+// Write every series to fd in the Prometheus text format. Returns 0, or
+// -1 with errno set.
+int metrics_write(int fd);
+
+// Answer HTTP scrapes from a background thread. where is a TCP port, or a
+// Unix socket path (anything with a '/'). Returns 0, or -1 after saying
+// why on stderr.
+int metrics_serve(const char *where);
+
+#endif
@@ -0,0 +1,20 @@
+// Linked into every program of a -DPGO=generate build.
+//
+// Profiles are written by exit(), but several servers run until they are
+// killed. SIGINT/SIGTERM therefore dump the counters before exiting.
+// Programs that install their own handlers replace these and exit through
+// main() as usual.
+#include <signal.h>
+#include <unistd.h>
+
+extern void __gcov_dump(void);
+
+static void dump_and_exit(int sig) {
+    __gcov_dump();
+    _exit(128 + sig);
+}
+
+__attribute__((constructor)) static void install_dump_handlers(void) {
+    signal(SIGINT, dump_and_exit);
+    signal(SIGTERM, dump_and_exit);
+}
@@ -0,0 +1,240 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "sock_profile.h"
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+
+#define MAX_PROFILES 32
+#define U SOCK_PROFILE_UNSET
+
+static struct sock_profile profiles[MAX_PROFILES] = {
+    //  name           backlog  nodelay fastopen defer busy_poll sndbuf           rcvbuf
+    { "low-latency",   1024,    1,      256,     0,    50,       0,               0 },
+    { "bulk",          128,     0,      U,       0,    0,        4 * 1024 * 1024, 4 * 1024 * 1024 },
+    { "high-conn",     65535,   1,      4096,    5,    0,        64 * 1024,       64 * 1024 },
+};
+static int nprofiles = 3;
+
+// The options a profile can set, by config file key
+static const struct {
+    const char *key;
+    size_t offset;
+} fields[] = {
+    { "backlog", offsetof(struct sock_profile, backlog) },
+    { "nodelay", offsetof(struct sock_profile, nodelay) },
+    { "fastopen", offsetof(struct sock_profile, fastopen) },
+    { "defer_accept", offsetof(struct sock_profile, defer_accept) },
+    { "busy_poll", offsetof(struct sock_profile, busy_poll) },
+    { "sndbuf", offsetof(struct sock_profile, sndbuf) },
+    { "rcvbuf", offsetof(struct sock_profile, rcvbuf) },
+};
+
+static struct sock_profile *lookup(const char *name) {
+    for (int i = 0; i < nprofiles; i++) {
+        if (strcmp(profiles[i].name, name) == 0) {
+            return &profiles[i];
+        }
+    }
+    return NULL;
+}
+
+// A section replaces any profile of the same name wholesale
+static struct sock_profile *begin_profile(const char *name) {
+    struct sock_profile *p = lookup(name);
+
+    if (p == NULL) {
+        if (nprofiles == MAX_PROFILES) {
+            return NULL;
+        }
+        p = &profiles[nprofiles++];
+    }
+    snprintf(p->name, sizeof(p->name), "%s", name);
+    p->backlog = p->nodelay = p->fastopen = p->defer_accept = U;
+    p->busy_poll = p->sndbuf = p->rcvbuf = U;
+    return p;
+}
+
+static char *trim(char *s) {
+    char *end;
+
+    while (isspace((unsigned char)*s)) {
+        s++;
+    }
+    end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1])) {
+        *--end = '\0';
+    }
+    return s;
+}
+
+// A non-negative integer with an optional k or m suffix
+static int parse_value(const char *s, int *value) {
+    char *end;
+    long long v = strtoll(s, &end, 10);
+
+    if (end == s || v < 0) {
+        return -1;
+    }
+    if (*end == 'k' || *end == 'K') {
+        v *= 1024;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        v *= 1024 * 1024;
+        end++;
+    }
+    if (*end != '\0' || v > 0x7fffffff) {
+        return -1;
+    }
+    *value = (int)v;
+    return 0;
+}
+
+int sock_profiles_load(const char *path) {
+    FILE *fp = fopen(path, "r");
+    struct sock_profile *p = NULL;
+    char line[256];
+    int lineno = 0;
+    int count = 0;
+
+    if (fp == NULL) {
+        perror(path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char *hash = strchr(line, '#');
+        char *s, *eq;
+        size_t i;
+
+        lineno++;
+        if (hash != NULL) {
+            *hash = '\0';
+        }
+        s = trim(line);
+        if (*s == '\0') {
+            continue;
+        }
+        if (*s == '[') {
+            char *close = strchr(s, ']');
+            if (close == NULL || close[1] != '\0' || close == s + 1 ||
+                close - s - 1 >= SOCK_PROFILE_NAME_MAX) {
+                goto bad;
+            }
+            *close = '\0';
+            if ((p = begin_profile(s + 1)) == NULL) {
+                fprintf(stderr, "%s:%d: more than %d profiles\n", path, lineno, MAX_PROFILES);
+                fclose(fp);
+                return -1;
+            }
+            count++;
+            continue;
+        }
+        if (p == NULL || (eq = strchr(s, '=')) == NULL) {
+            goto bad;
+        }
+        *eq = '\0';
+        char *key = trim(s);
+        for (i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+            if (strcmp(fields[i].key, key) == 0) {
+                break;
+            }
+        }
+        if (i == sizeof(fields) / sizeof(fields[0]) ||
+            parse_value(trim(eq + 1), (int *)((char *)p + fields[i].offset)) < 0) {
+            goto bad;
+        }
+    }
+    fclose(fp);
+    return count;
+
+bad:
+    fprintf(stderr, "%s:%d: expected [profile] or one of backlog, nodelay, fastopen, "
+                    "defer_accept, busy_poll, sndbuf, rcvbuf = number\n", path, lineno);
+    fclose(fp);
+    return -1;
+}
+
+const struct sock_profile *sock_profile_find(const char *name) {
+    const struct sock_profile *p = lookup(name);
+
+    if (p == NULL) {
+        fprintf(stderr, "unknown socket profile '%s'; known:", name);
+        for (int i = 0; i < nprofiles; i++) {
+            fprintf(stderr, " %s", profiles[i].name);
+        }
+        fprintf(stderr, "\n");
+    }
+    return p;
+}
+
+// Set one option, saying why not if what is given
+static int set(int fd, int level, int name, int value, const char *what) {
+    if (setsockopt(fd, level, name, &value, sizeof(value)) < 0) {
+        if (what != NULL) {
+            fprintf(stderr, "setsockopt %s = %d: ", what, value);
+            perror(NULL);
+        }
+        return 1;
+    }
+    return 0;
+}
+
+// The options that go on every connection. Failures are only reported
+// for the listener, not again for every client.
+static int apply_connection(const struct sock_profile *p, int fd, int report) {
+    int failed = 0;
+
+    if (p->nodelay != U) {
+        failed += set(fd, IPPROTO_TCP, TCP_NODELAY, p->nodelay, report ? "TCP_NODELAY" : NULL);
+    }
+    if (p->busy_poll != U) {
+        failed += set(fd, SOL_SOCKET, SO_BUSY_POLL, p->busy_poll, report ? "SO_BUSY_POLL" : NULL);
+    }
+    return failed;
+}
+
+int sock_profile_apply_listener(const struct sock_profile *p, int fd) {
+    int failed = 0;
+
+    // 0 leaves the buffers to the kernel's autotuning
+    if (p->sndbuf > 0) {
+        failed += set(fd, SOL_SOCKET, SO_SNDBUF, p->sndbuf, "SO_SNDBUF");
+    }
+    if (p->rcvbuf > 0) {
+        failed += set(fd, SOL_SOCKET, SO_RCVBUF, p->rcvbuf, "SO_RCVBUF");
+    }
+    if (p->fastopen != U) {
+        failed += set(fd, IPPROTO_TCP, TCP_FASTOPEN, p->fastopen, "TCP_FASTOPEN");
+    }
+    if (p->defer_accept != U) {
+        failed += set(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, p->defer_accept, "TCP_DEFER_ACCEPT");
+    }
+    return failed + apply_connection(p, fd, 1);
+}
+
+int sock_profile_apply_accepted(const struct sock_profile *p, int fd) {
+    return apply_connection(p, fd, 0);
+}
+
+int sock_profile_backlog(const struct sock_profile *p, int fallback) {
+    return p != NULL && p->backlog != U ? p->backlog : fallback;
+}
+
+void sock_profile_describe(const struct sock_profile *p, char *buf, int len) {
+    int n = snprintf(buf, len, "%s:", p->name);
+
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]) && n < len; i++) {
+        int v = *(const int *)((const char *)p + fields[i].offset);
+        if (v != U) {
+            n += snprintf(buf + n, len - n, " %s=%d", fields[i].key, v);
+        }
+    }
+}
@@ -0,0 +1,70 @@
+// Named socket tuning profiles, shared by the TCP servers.
+//
+// A profile is a set of socket options and a listen() backlog. Three are
+// built in:
+//
+//   low-latency  TCP_NODELAY, SO_BUSY_POLL 50 us, TCP Fast Open, kernel
+//                buffer autotuning
+//   bulk         Nagle left on, 4 MB send and receive buffers
+//   high-conn    TCP_DEFER_ACCEPT (no wakeup until the client's first
+//                bytes), Fast Open, a 64K backlog (capped by somaxconn)
+//                and 64 KB buffers to bound memory per connection
+//
+// A config file adds profiles or overrides these, in sections:
+//
+//   # comment
+//   [edge]
+//   nodelay = 1
+//   busy_poll = 25      # us
+//   fastopen = 1024     # pending Fast Open requests, 0 off
+//   defer_accept = 3    # seconds
+//   sndbuf = 256k       # bytes, 0 for kernel autotuning; k and m suffixes
+//   rcvbuf = 256k
+//   backlog = 4096
+//
+// An option a profile leaves out is left as the program sets it.
+// Listener options are applied before listen(), so accepted sockets
+// inherit the buffers (and with them the window scale offered in the
+// SYN-ACK); TCP_NODELAY and SO_BUSY_POLL are set again on each accepted
+// socket rather than trusting inheritance.
+#ifndef SOCK_PROFILE_H
+#define SOCK_PROFILE_H
+
+#define SOCK_PROFILE_NAME_MAX 32
+#define SOCK_PROFILE_UNSET (-1)
+
+struct sock_profile {
+    char name[SOCK_PROFILE_NAME_MAX];
+    int backlog;
+    int nodelay;
+    int fastopen;
+    int defer_accept;
+    int busy_poll;
+    int sndbuf;
+    int rcvbuf;
+};
+
+// Read profiles from path into the registry. Returns how many were read,
+// or -1 after reporting the file or the offending line on stderr.
+int sock_profiles_load(const char *path);
+
+// A built-in or loaded profile, or NULL after listing the known names on
+// stderr
+const struct sock_profile *sock_profile_find(const char *name);
+
+// Apply the listener options to fd, which is bound but not yet listening.
+// Failures are reported on stderr and skipped, as an option the kernel
+// lacks should not keep a server from starting. Returns how many failed.
+int sock_profile_apply_listener(const struct sock_profile *p, int fd);
+
+// Apply the per-connection options to a socket returned by accept().
+// Failures, already reported for the listener, are only counted.
+int sock_profile_apply_accepted(const struct sock_profile *p, int fd);
+
+// The profile's backlog, or fallback if it does not set one. p may be NULL.
+int sock_profile_backlog(const struct sock_profile *p, int fallback);
+
+// One line listing what the profile sets
+void sock_profile_describe(const struct sock_profile *p, char *buf, int len);
+
+#endif
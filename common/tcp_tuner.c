@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <linux/tcp.h> // the full struct tcp_info; glibc's stops at 3.x
+
+#include "tcp_tuner.h"
+
+#define MIN_BUF (64 * 1024)
+#define MAX_BUF (16 * 1024 * 1024) // the kernel clamps further to [rw]mem_max
+#define MIN_LOWAT (16 * 1024)
+#define MAX_LOWAT (4 * 1024 * 1024)
+#define RCVBUF_SAMPLES 3 // in a row short of the window before taking over
+
+static const char export_header[] =
+    "time_ms,peer,rtt_us,rttvar_us,min_rtt_us,cwnd,ssthresh,mss,unacked,lost,"
+    "total_retrans,rcv_ooopack,delivery_rate,app_limited,bytes_acked,bytes_received,"
+    "notsent,sndbuf,rcvbuf,notsent_lowat,quickack\n";
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int tcp_sample_read(int fd, struct tcp_sample *s) {
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+
+    // Older kernels fill less; what they leave out reads as zero
+    memset(&info, 0, sizeof(info));
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) < 0) {
+        return -1;
+    }
+    memset(s, 0, sizeof(*s));
+    s->time_ms = now_ms();
+    s->rtt_us = info.tcpi_rtt;
+    s->rttvar_us = info.tcpi_rttvar;
+    s->min_rtt_us = info.tcpi_min_rtt;
+    s->snd_cwnd = info.tcpi_snd_cwnd;
+    s->snd_ssthresh = info.tcpi_snd_ssthresh;
+    s->snd_mss = info.tcpi_snd_mss;
+    s->unacked = info.tcpi_unacked;
+    s->lost = info.tcpi_lost;
+    s->total_retrans = info.tcpi_total_retrans;
+    s->rcv_ooopack = info.tcpi_rcv_ooopack;
+    s->rcv_space = info.tcpi_rcv_space;
+    s->notsent_bytes = info.tcpi_notsent_bytes;
+    s->app_limited = info.tcpi_delivery_rate_app_limited;
+    s->delivery_rate = info.tcpi_delivery_rate;
+    s->bytes_acked = info.tcpi_bytes_acked;
+    s->bytes_received = info.tcpi_bytes_received;
+    s->sndbuf_limited_us = info.tcpi_sndbuf_limited;
+    return 0;
+}
+
+void tcp_tuner_init(struct tcp_tuner *t, int fd, const char *peer, int tune, int export_fd) {
+    memset(t, 0, sizeof(*t));
+    t->fd = fd;
+    t->tune = tune;
+    t->export_fd = export_fd;
+    t->interval_ms = TCP_TUNER_DEFAULT_INTERVAL_MS;
+    snprintf(t->peer, sizeof(t->peer), "%s", peer);
+}
+
+static int get_option(int fd, int level, int name) {
+    int value = 0;
+    socklen_t len = sizeof(value);
+
+    getsockopt(fd, level, name, &value, &len);
+    return value;
+}
+
+static void set_option(struct tcp_tuner *t, int level, int name, int value, int *applied) {
+    if (setsockopt(t->fd, level, name, &value, sizeof(value)) == 0) {
+        *applied = value;
+        t->adjustments++;
+    }
+}
+
+static uint64_t clamp(uint64_t v, uint64_t lo, uint64_t hi) {
+    return v < lo ? lo : v > hi ? hi : v;
+}
+
+// More than a quarter away from the current value, so the options do not
+// flap with every sample's noise
+static int differs(uint64_t want, uint64_t have) {
+    return want > have + have / 4 || want < have - have / 4;
+}
+
+static void tune(struct tcp_tuner *t, const struct tcp_sample *s, const struct tcp_sample *prev) {
+    uint64_t window = (uint64_t)s->snd_cwnd * s->snd_mss;
+    uint64_t bdp = s->delivery_rate * s->min_rtt_us / 1000000;
+
+    // An app-limited rate undersells the path; the window does not
+    if (bdp < window) {
+        bdp = window;
+    }
+
+    uint64_t lowat = clamp(window, MIN_LOWAT, MAX_LOWAT);
+    if (t->notsent_lowat == 0 || differs(lowat, t->notsent_lowat)) {
+        set_option(t, IPPROTO_TCP, TCP_NOTSENT_LOWAT, (int)lowat, &t->notsent_lowat);
+    }
+
+    // The kernel reports twice what setsockopt() asked for, so compare in
+    // setsockopt() units. Take the send buffer over only once it has held
+    // the connection back; from then on it follows the BDP.
+    uint64_t want = clamp(2 * bdp + lowat, MIN_BUF, MAX_BUF);
+    uint64_t have = t->sndbuf ? (uint64_t)t->sndbuf : (uint64_t)get_option(t->fd, SOL_SOCKET, SO_SNDBUF) / 2;
+    if (t->sndbuf ? differs(want, have)
+                  : s->sndbuf_limited_us > prev->sndbuf_limited_us && want > have) {
+        set_option(t, SOL_SOCKET, SO_SNDBUF, (int)want, &t->sndbuf);
+    }
+
+    // The receive buffer is left to the kernel's autotuning while that
+    // keeps it growing. Only once it has stayed smaller than twice what a
+    // round trip delivers for several samples in a row, with the kernel no
+    // longer growing it, is it taken over; from then on it follows the
+    // receive window.
+    want = clamp(2 * (uint64_t)s->rcv_space, MIN_BUF, MAX_BUF);
+    if (t->rcvbuf) {
+        if (differs(want, t->rcvbuf)) {
+            set_option(t, SOL_SOCKET, SO_RCVBUF, (int)want, &t->rcvbuf);
+        }
+    } else {
+        int kernel = get_option(t->fd, SOL_SOCKET, SO_RCVBUF);
+
+        if (want > (uint64_t)kernel / 2 && kernel <= t->kernel_rcvbuf) {
+            t->rcvbuf_short++;
+        } else {
+            t->rcvbuf_short = 0;
+        }
+        t->kernel_rcvbuf = kernel;
+        if (t->rcvbuf_short >= RCVBUF_SAMPLES) {
+            set_option(t, SOL_SOCKET, SO_RCVBUF, (int)want, &t->rcvbuf);
+        }
+    }
+
+    // Quick ACKs while segments are going missing. The kernel drops back
+    // to delayed ACKs by itself, so this is renewed every lossy interval.
+    t->quickack = 0;
+    if (s->total_retrans > prev->total_retrans || s->rcv_ooopack > prev->rcv_ooopack) {
+        set_option(t, IPPROTO_TCP, TCP_QUICKACK, 1, &t->quickack);
+    }
+}
+
+static void export_sample(struct tcp_tuner *t, const struct tcp_sample *s) {
+    char line[512];
+    int n = snprintf(line, sizeof(line),
+                     "%llu,%s,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%llu,%d,%llu,%llu,%u,%d,%d,%d,%d\n",
+                     (unsigned long long)s->time_ms, t->peer, s->rtt_us, s->rttvar_us, s->min_rtt_us,
+                     s->snd_cwnd, s->snd_ssthresh, s->snd_mss, s->unacked, s->lost, s->total_retrans,
+                     s->rcv_ooopack, (unsigned long long)s->delivery_rate, s->app_limited,
+                     (unsigned long long)s->bytes_acked, (unsigned long long)s->bytes_received,
+                     s->notsent_bytes, get_option(t->fd, SOL_SOCKET, SO_SNDBUF),
+                     get_option(t->fd, SOL_SOCKET, SO_RCVBUF), t->notsent_lowat, t->quickack);
+
+    // One write() per line keeps lines whole between processes
+    if (n > 0 && write(t->export_fd, line, (size_t)n < sizeof(line) ? (size_t)n : sizeof(line) - 1) < 0) {
+        t->export_fd = -1;
+    }
+}
+
+int tcp_tuner_sample(struct tcp_tuner *t) {
+    struct tcp_sample s;
+
+    if (tcp_sample_read(t->fd, &s) < 0) {
+        return -1;
+    }
+    if (t->tune) {
+        tune(t, &s, &t->last);
+    }
+    if (t->export_fd >= 0) {
+        export_sample(t, &s);
+    }
+    t->last = s;
+    t->samples++;
+    t->next_ms = s.time_ms + t->interval_ms;
+    return 0;
+}
+
+int tcp_tuner_poll(struct tcp_tuner *t) {
+    if (!t->tune && t->export_fd < 0) {
+        return 0;
+    }
+    if (t->samples > 0 && now_ms() < t->next_ms) {
+        return 0;
+    }
+    return tcp_tuner_sample(t) == 0;
+}
+
+void tcp_tuner_print(const struct tcp_tuner *t, FILE *out) {
+    const struct tcp_sample *s = &t->last;
+
+    fprintf(out, "Transport %s: rtt %.2f ms (min %.2f), cwnd %u, %u retransmits, "
+            "delivery %.1f MB/s%s, %lu samples, %lu option changes\n",
+            t->peer, s->rtt_us / 1000.0, s->min_rtt_us / 1000.0, s->snd_cwnd, s->total_retrans,
+            s->delivery_rate / 1e6, s->app_limited ? " (app-limited)" : "", t->samples, t->adjustments);
+}
+
+int tcp_tuner_open_export(const char *path) {
+    struct stat st;
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) == 0 && st.st_size == 0 &&
+        write(fd, export_header, sizeof(export_header) - 1) < 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
@@ -0,0 +1,92 @@
+// Per-connection transport telemetry from TCP_INFO, and an autotuner.
+//
+// A tcp_tuner samples one socket's TCP_INFO at most once per interval:
+// smoothed and minimum RTT, congestion window, retransmissions, the
+// kernel's delivery rate estimate and how much sits unsent. Each sample
+// can be exported as a CSV line, so a throughput drop can be read off as
+// loss (retransmits up, cwnd down), a longer path (RTT up) or the
+// application (app-limited, nothing unsent).
+//
+// With tuning on, each sample also resizes the connection's options from
+// its bandwidth-delay product:
+//   SO_SNDBUF          2 x BDP plus the unsent allowance, only once the
+//                      kernel's own size falls short (setting it turns
+//                      the kernel's autotuning off for the socket)
+//   SO_RCVBUF          2 x the receive-side space estimate, only once
+//                      that has outgrown the kernel's size for several
+//                      samples in a row and the kernel stopped growing it
+//   TCP_NOTSENT_LOWAT  one congestion window, so what is written is sent
+//                      soon rather than queued stale behind the window
+//   TCP_QUICKACK       on while the connection is losing segments either
+//                      way, so the sender's recovery sees every ACK
+#ifndef TCP_TUNER_H
+#define TCP_TUNER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define TCP_TUNER_DEFAULT_INTERVAL_MS 1000
+
+struct tcp_sample {
+    uint64_t time_ms;        // CLOCK_MONOTONIC
+    uint32_t rtt_us;         // smoothed
+    uint32_t rttvar_us;
+    uint32_t min_rtt_us;
+    uint32_t snd_cwnd;       // segments
+    uint32_t snd_ssthresh;
+    uint32_t snd_mss;
+    uint32_t unacked;        // segments in flight
+    uint32_t lost;
+    uint32_t total_retrans;  // over the connection
+    uint32_t rcv_ooopack;    // out-of-order segments received
+    uint32_t rcv_space;      // the kernel's receive window estimate
+    uint32_t notsent_bytes;
+    int app_limited;         // delivery_rate was capped by the sender
+    uint64_t delivery_rate;  // bytes per second
+    uint64_t bytes_acked;
+    uint64_t bytes_received;
+    uint64_t sndbuf_limited_us; // time held back by the send buffer
+};
+
+struct tcp_tuner {
+    int fd;
+    int tune;              // adjust options, not only sample
+    int export_fd;         // CSV sink, -1 for none
+    char peer[48];
+    unsigned interval_ms;
+    uint64_t next_ms;
+    unsigned long samples;
+    struct tcp_sample last;
+    // Options as last applied; 0 while left to the kernel
+    int sndbuf;
+    int rcvbuf;
+    int notsent_lowat;
+    int quickack;
+    int kernel_rcvbuf;     // SO_RCVBUF at the last sample, while the kernel's
+    unsigned rcvbuf_short; // samples in a row it fell short of the window
+    unsigned long adjustments;
+};
+
+// Fill s from fd's TCP_INFO. Returns 0, or -1 with errno set.
+int tcp_sample_read(int fd, struct tcp_sample *s);
+
+// Watch fd, talking to peer (any label for the export). tune turns the
+// autotuner on; export_fd is from tcp_tuner_open_export() or -1.
+void tcp_tuner_init(struct tcp_tuner *t, int fd, const char *peer, int tune, int export_fd);
+
+// Sample, export and tune if an interval has passed since the last
+// sample. Cheap to call on every message. Returns 1 if it sampled.
+int tcp_tuner_poll(struct tcp_tuner *t);
+
+// Sample now whatever the interval, say just before closing
+int tcp_tuner_sample(struct tcp_tuner *t);
+
+// One line on the last sample and what the tuner changed
+void tcp_tuner_print(const struct tcp_tuner *t, FILE *out);
+
+// Open path for appending samples, writing the CSV header if it is new.
+// Lines are written whole with O_APPEND, so processes may share the file.
+// Returns the descriptor, or -1 with errno set.
+int tcp_tuner_open_export(const char *path);
+
+#endif
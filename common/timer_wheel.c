@@ -0,0 +1,211 @@
+#include <string.h>
+
+#include "timer_wheel.h"
+
+#define LEVEL0_MASK (TW_LEVEL0_SLOTS - 1)
+#define SLOT_MASK (TW_SLOTS - 1)
+
+// Bits of a tick above a level's slot index; levels count from 1 here
+static inline unsigned level_shift(int level) {
+    return TW_LEVEL0_BITS + (level - 1) * TW_LEVEL_BITS;
+}
+
+static void list_init(struct timer *head) {
+    head->next = head->prev = head;
+}
+
+static void list_append(struct timer *head, struct timer *t) {
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+void timer_wheel_init(struct timer_wheel *w, uint64_t now) {
+    memset(w, 0, sizeof(*w));
+    w->now = now;
+    for (int i = 0; i < TW_LEVEL0_SLOTS; i++) {
+        list_init(&w->level0[i]);
+    }
+    for (int level = 0; level < TW_LEVELS - 1; level++) {
+        for (int i = 0; i < TW_SLOTS; i++) {
+            list_init(&w->levels[level][i]);
+        }
+    }
+}
+
+// The slot a deadline belongs in from where the wheel stands, marked
+// occupied. A deadline already past goes in the slot expiring next.
+static struct timer *slot_for(struct timer_wheel *w, uint64_t expires) {
+    uint64_t delta = expires > w->now ? expires - w->now : 0;
+    int level = 1;
+
+    if (delta < TW_LEVEL0_SLOTS) {
+        unsigned i = (unsigned)((delta == 0 ? w->now : expires) & LEVEL0_MASK);
+        w->occupied0[i / 64] |= 1ULL << (i % 64);
+        return &w->level0[i];
+    }
+    if (delta > TW_MAX_DELAY) {
+        expires = w->now + TW_MAX_DELAY;
+        delta = TW_MAX_DELAY;
+    }
+    while (level < TW_LEVELS - 1 && delta >> level_shift(level + 1) != 0) {
+        level++;
+    }
+    unsigned i = (unsigned)(expires >> level_shift(level)) & SLOT_MASK;
+    w->occupied[level - 1] |= 1ULL << i;
+    return &w->levels[level - 1][i];
+}
+
+// Clear the occupied bit of a slot's list head. Heads outside the wheel
+// (the list being fired) have none.
+static void slot_emptied(struct timer_wheel *w, const struct timer *head) {
+    if (head >= w->level0 && head < w->level0 + TW_LEVEL0_SLOTS) {
+        size_t i = (size_t)(head - w->level0);
+        w->occupied0[i / 64] &= ~(1ULL << (i % 64));
+    } else if (head >= &w->levels[0][0] && head < &w->levels[0][0] + (TW_LEVELS - 1) * TW_SLOTS) {
+        size_t i = (size_t)(head - &w->levels[0][0]);
+        w->occupied[i / TW_SLOTS] &= ~(1ULL << (i % TW_SLOTS));
+    }
+}
+
+static void unlink_timer(struct timer_wheel *w, struct timer *t) {
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    if (t->next == t->prev) {
+        slot_emptied(w, t->next); // only the head is left
+    }
+    t->next = t->prev = NULL;
+    w->armed--;
+}
+
+void timer_arm(struct timer_wheel *w, struct timer *t, uint64_t expires) {
+    if (timer_armed(t)) {
+        unlink_timer(w, t);
+    }
+    t->expires = expires;
+    list_append(slot_for(w, expires), t);
+    w->armed++;
+}
+
+void timer_cancel(struct timer_wheel *w, struct timer *t) {
+    if (timer_armed(t)) {
+        unlink_timer(w, t);
+    }
+}
+
+// Move a slot's whole list onto the head to, leaving the slot empty
+static void list_take(struct timer_wheel *w, struct timer *head, struct timer *to) {
+    list_init(to);
+    if (head->next != head) {
+        to->next = head->next;
+        to->prev = head->prev;
+        to->next->prev = to;
+        to->prev->next = to;
+        list_init(head);
+        slot_emptied(w, head);
+    }
+}
+
+// File every timer of a coarser slot again, now that it is close enough to
+// land a level lower
+static void cascade(struct timer_wheel *w, int level, unsigned i) {
+    struct timer moving;
+
+    list_take(w, &w->levels[level - 1][i], &moving);
+    while (moving.next != &moving) {
+        struct timer *t = moving.next;
+        moving.next = t->next;
+        list_append(slot_for(w, t->expires), t);
+    }
+}
+
+// Index of the first set bit at or after bit i of an array of words, or
+// the number of bits if there is none
+static unsigned first_set(const uint64_t *words, unsigned nwords, unsigned i) {
+    for (unsigned word = i / 64; word < nwords; word++) {
+        uint64_t bits = words[word];
+        if (word == i / 64) {
+            bits &= ~0ULL << (i % 64);
+        }
+        if (bits != 0) {
+            return word * 64 + (unsigned)__builtin_ctzll(bits);
+        }
+    }
+    return nwords * 64;
+}
+
+// The first tick from w->now on with timers to fire or a slot to spread
+// out, given that any cascade due at w->now itself has been done. Past the
+// next level 2 slot the answer is that slot's tick, which is early but
+// cheap.
+static uint64_t next_event(const struct timer_wheel *w) {
+    unsigned i = (unsigned)(w->now & LEVEL0_MASK);
+    unsigned j = first_set(w->occupied0, TW_LEVEL0_SLOTS / 64, i);
+
+    if (j < TW_LEVEL0_SLOTS) {
+        return w->now - i + j;
+    }
+    // Slots before i belong to the next lap, which starts with a cascade
+    uint64_t lap = (w->now >> TW_LEVEL0_BITS) + 1;
+    unsigned s = (unsigned)(lap & SLOT_MASK);
+    if (first_set(w->occupied0, TW_LEVEL0_SLOTS / 64, 0) < i) {
+        return lap << TW_LEVEL0_BITS;
+    }
+    if (s != 0) {
+        unsigned k = first_set(&w->occupied[0], 1, s);
+        if (k < TW_SLOTS) {
+            return (lap - s + k) << TW_LEVEL0_BITS;
+        }
+    }
+    return ((lap + SLOT_MASK) & ~(uint64_t)SLOT_MASK) << TW_LEVEL0_BITS;
+}
+
+size_t timer_wheel_advance(struct timer_wheel *w, uint64_t now,
+                           void (*fire)(struct timer *t, void *arg), void *arg) {
+    size_t fired = 0;
+
+    while (w->now <= now && w->armed > 0) {
+        unsigned i = (unsigned)(w->now & LEVEL0_MASK);
+        if (i == 0) {
+            for (int level = 1; level < TW_LEVELS; level++) {
+                unsigned s = (unsigned)(w->now >> level_shift(level)) & SLOT_MASK;
+                cascade(w, level, s);
+                if (s != 0) {
+                    break;
+                }
+            }
+        }
+        if (w->level0[i].next == &w->level0[i]) {
+            uint64_t next = next_event(w);
+            w->now = next < now + 1 ? next : now + 1;
+            continue;
+        }
+
+        // Taken off the wheel first, so a timer re-armed by fire() for a
+        // whole lap later is not mistaken for one due now
+        struct timer due;
+        list_take(w, &w->level0[i], &due);
+        w->now++;
+        while (due.next != &due) {
+            struct timer *t = due.next;
+            unlink_timer(w, t);
+            fire(t, arg);
+            fired++;
+        }
+    }
+    if (w->now <= now) {
+        w->now = now + 1; // nothing armed
+    }
+    return fired;
+}
+
+uint64_t timer_wheel_next(const struct timer_wheel *w) {
+    if (w->armed == 0) {
+        return UINT64_MAX;
+    }
+    if ((w->now & LEVEL0_MASK) == 0) {
+        return w->now; // a cascade is due first
+    }
+    return next_event(w);
+}
@@ -0,0 +1,75 @@
+// Hierarchical timing wheel for connection deadlines.
+//
+// Time is counted in ticks (the caller picks the unit, say a millisecond).
+// Level 0 has one slot per tick for the next 256 ticks; each of the three
+// levels above has 64 slots, each 64 times coarser than a slot of the level
+// below, so the wheel reaches 2^26 ticks (18.6 hours of milliseconds)
+// ahead. Arming puts a timer straight into the slot its deadline falls in,
+// and cancelling unlinks it: both O(1) whatever the number of timers armed.
+// When level 0 wraps, the next slot of level 1 is spread over level 0 (and
+// likewise up the levels), so a timer moves at most three times before it
+// fires, and only if it lives that long.
+//
+// Timers are embedded in the caller's own structures: the wheel allocates
+// nothing, and a timer is three words. Occupancy bitmaps let
+// timer_wheel_advance() jump over empty slots and let timer_wheel_next()
+// say how long an event loop may sleep. Not thread safe; one wheel per
+// event loop.
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TW_LEVEL0_BITS 8
+#define TW_LEVEL_BITS 6
+#define TW_LEVELS 4
+#define TW_LEVEL0_SLOTS (1 << TW_LEVEL0_BITS)
+#define TW_SLOTS (1 << TW_LEVEL_BITS)
+// Further ahead than this, a timer waits in the wheel's last slot and is
+// filed again each time that slot comes round
+#define TW_MAX_DELAY ((1ULL << (TW_LEVEL0_BITS + (TW_LEVELS - 1) * TW_LEVEL_BITS)) - 1)
+
+struct timer {
+    struct timer *next, *prev; // NULL while not armed
+    uint64_t expires;          // tick
+};
+
+struct timer_wheel {
+    uint64_t now;  // the next tick to expire
+    size_t armed;
+    uint64_t occupied0[TW_LEVEL0_SLOTS / 64];
+    uint64_t occupied[TW_LEVELS - 1];
+    struct timer level0[TW_LEVEL0_SLOTS]; // list heads
+    struct timer levels[TW_LEVELS - 1][TW_SLOTS];
+};
+
+// An empty wheel whose first tick is now
+void timer_wheel_init(struct timer_wheel *w, uint64_t now);
+
+static inline void timer_init(struct timer *t) {
+    t->next = t->prev = NULL;
+}
+
+static inline int timer_armed(const struct timer *t) {
+    return t->next != NULL;
+}
+
+// Fire t at tick expires, or on the next advance if that has passed.
+// Re-arming an armed timer moves it.
+void timer_arm(struct timer_wheel *w, struct timer *t, uint64_t expires);
+// Disarm t; nothing happens if it is not armed
+void timer_cancel(struct timer_wheel *w, struct timer *t);
+
+// Fire every timer due at or before tick now, in tick order: each is
+// disarmed, then passed to fire(), which may re-arm or free it and arm or
+// cancel others. Returns how many fired.
+size_t timer_wheel_advance(struct timer_wheel *w, uint64_t now,
+                           void (*fire)(struct timer *t, void *arg), void *arg);
+
+// The tick by which timer_wheel_advance() must next run, possibly early
+// (when a coarser slot is due to be spread out); UINT64_MAX if nothing is
+// armed
+uint64_t timer_wheel_next(const struct timer_wheel *w);
+
+#endif
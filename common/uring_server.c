@@ -0,0 +1,556 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "uring_server.h"
+
+#define RING_ENTRIES 1024
+#define BUF_GROUP 0
+#define BUF_COUNT 1024 // must be a power of two
+#define BUF_SIZE 4096
+#define SENDQ_MAX (1 << 20) // replies a connection may have waiting to go out
+#define MIN_FDS 64 // first size of the per-descriptor tables
+
+// user_data layout: operation in the top byte, descriptor in the low bits
+enum uring_op { OP_ACCEPT = 1, OP_RECV, OP_SEND, OP_CLOSE, OP_POLL };
+#define UD(op, fd) (((uint64_t)(op) << 56) | (uint32_t)(fd))
+#define UD_OP(ud) ((int)((ud) >> 56))
+#define UD_FD(ud) ((int)(uint32_t)(ud))
+
+// Replies to one connection. Only one send is in flight at a time, from
+// sending; whatever is queued meanwhile collects in pending and goes out in
+// one send when the first completes, so replies leave in order.
+struct send_queue {
+    char *pending;
+    size_t pending_len;
+    size_t pending_cap;
+    char *sending;
+    size_t sending_len;
+    size_t sending_cap;
+    int busy;
+    int closing; // close once everything queued has been sent
+};
+
+struct uring {
+    int fd;
+    unsigned sq_entries;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_local_tail;
+    unsigned to_submit;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr;
+    size_t sq_len;
+    void *cq_ptr;
+    size_t cq_len;
+
+    struct io_uring_buf_ring *buf_ring;
+    char *buf_base;
+    unsigned buf_tail;
+
+    // Indexed by descriptor, nfds entries of each; grown as accept()
+    // hands out higher descriptors
+    struct send_queue *sendq;
+    int nfds;
+
+    // Per-connection state from ops->on_open, indexed by descriptor
+    void **conns;
+    const struct uring_server_ops *ops;
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static int uring_init(struct uring *r) {
+    struct io_uring_params p;
+
+    memset(r, 0, sizeof(*r));
+
+    // Only this thread submits, and completions are run when we wait, which
+    // avoids interrupting the loop with task work. Retry without the hints
+    // on kernels older than 6.1.
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    r->fd = sys_io_uring_setup(RING_ENTRIES, &p);
+    if (r->fd < 0 && errno == EINVAL) {
+        memset(&p, 0, sizeof(p));
+        r->fd = sys_io_uring_setup(RING_ENTRIES, &p);
+    }
+    if (r->fd < 0) {
+        return -1;
+    }
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        close(r->fd);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (r->cq_len > r->sq_len) {
+        r->sq_len = r->cq_len;
+    }
+    r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED) {
+        close(r->fd);
+        return -1;
+    }
+    r->cq_ptr = r->sq_ptr;
+
+    r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        munmap(r->sq_ptr, r->sq_len);
+        close(r->fd);
+        return -1;
+    }
+
+    char *sq = r->sq_ptr;
+    r->sq_entries = p.sq_entries;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->sq_local_tail = *r->sq_tail;
+
+    char *cq = r->cq_ptr;
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    // SQE slots map one to one onto the submission array
+    for (unsigned i = 0; i < p.sq_entries; i++) {
+        r->sq_array[i] = i;
+    }
+    return 0;
+}
+
+static void uring_free(struct uring *r) {
+    if (r->buf_base != NULL) {
+        free(r->buf_base);
+    }
+    if (r->buf_ring != NULL) {
+        munmap(r->buf_ring, BUF_COUNT * sizeof(struct io_uring_buf));
+    }
+    if (r->sendq != NULL) {
+        for (int fd = 0; fd < r->nfds; fd++) {
+            free(r->sendq[fd].pending);
+            free(r->sendq[fd].sending);
+        }
+        free(r->sendq);
+    }
+    free(r->conns);
+    munmap(r->sqes, r->sq_entries * sizeof(struct io_uring_sqe));
+    munmap(r->sq_ptr, r->sq_len);
+    close(r->fd);
+}
+
+// Hand a buffer (back) to the kernel through the provided buffer ring
+static void buf_ring_add(struct uring *r, unsigned bid) {
+    struct io_uring_buf *buf = &r->buf_ring->bufs[r->buf_tail & (BUF_COUNT - 1)];
+
+    buf->addr = (uint64_t)(uintptr_t)(r->buf_base + (size_t)bid * BUF_SIZE);
+    buf->len = BUF_SIZE;
+    buf->bid = bid;
+    r->buf_tail++;
+    __atomic_store_n(&r->buf_ring->tail, (uint16_t)r->buf_tail, __ATOMIC_RELEASE);
+}
+
+static int buf_ring_setup(struct uring *r) {
+    struct io_uring_buf_reg reg;
+
+    r->buf_ring = mmap(NULL, BUF_COUNT * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r->buf_ring == MAP_FAILED) {
+        r->buf_ring = NULL;
+        return -1;
+    }
+    r->buf_base = malloc((size_t)BUF_COUNT * BUF_SIZE);
+    if (r->buf_base == NULL) {
+        return -1;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)r->buf_ring;
+    reg.ring_entries = BUF_COUNT;
+    reg.bgid = BUF_GROUP;
+    if (sys_io_uring_register(r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        return -1;
+    }
+
+    r->buf_tail = 0;
+    for (unsigned i = 0; i < BUF_COUNT; i++) {
+        buf_ring_add(r, i);
+    }
+    return 0;
+}
+
+// Submit everything queued and wait for at least wait_nr completions
+static int uring_submit(struct uring *r, unsigned wait_nr) {
+    unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+
+    __atomic_store_n(r->sq_tail, r->sq_local_tail, __ATOMIC_RELEASE);
+    int ret = sys_io_uring_enter(r->fd, r->to_submit, wait_nr, flags);
+    if (ret >= 0) {
+        r->to_submit = 0;
+    }
+    return ret;
+}
+
+static struct io_uring_sqe *uring_get_sqe(struct uring *r, struct uring_server_stats *stats) {
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+
+    if (r->sq_local_tail - head >= r->sq_entries) {
+        // Ring full: push the queued entries to the kernel first
+        stats->enters++;
+        if (uring_submit(r, 0) < 0) {
+            return NULL;
+        }
+        head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+        if (r->sq_local_tail - head >= r->sq_entries) {
+            return NULL;
+        }
+    }
+
+    struct io_uring_sqe *sqe = &r->sqes[r->sq_local_tail & *r->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_local_tail++;
+    r->to_submit++;
+    return sqe;
+}
+
+static int arm_accept(struct uring *r, int listen_fd, struct uring_server_stats *stats) {
+    struct io_uring_sqe *sqe = uring_get_sqe(r, stats);
+    if (sqe == NULL) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = UD(OP_ACCEPT, listen_fd);
+    return 0;
+}
+
+static int arm_recv(struct uring *r, int fd, struct uring_server_stats *stats) {
+    struct io_uring_sqe *sqe = uring_get_sqe(r, stats);
+    if (sqe == NULL) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP;
+    sqe->user_data = UD(OP_RECV, fd);
+    return 0;
+}
+
+static int arm_poll(struct uring *r, int fd, struct uring_server_stats *stats) {
+    struct io_uring_sqe *sqe = uring_get_sqe(r, stats);
+    if (sqe == NULL) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = UD(OP_POLL, fd);
+    return 0;
+}
+
+// Make room in the per-descriptor tables for fd, doubling them
+static int grow_fds(struct uring *r, int fd) {
+    int n = r->nfds ? r->nfds : MIN_FDS;
+
+    if (fd < r->nfds) {
+        return 0;
+    }
+    while (n <= fd) {
+        n *= 2;
+    }
+    struct send_queue *sendq = realloc(r->sendq, n * sizeof(*sendq));
+    if (sendq == NULL) {
+        return -1;
+    }
+    r->sendq = sendq;
+    void **conns = realloc(r->conns, n * sizeof(*conns));
+    if (conns == NULL) {
+        return -1;
+    }
+    r->conns = conns;
+    memset(r->sendq + r->nfds, 0, (n - r->nfds) * sizeof(*sendq));
+    memset(r->conns + r->nfds, 0, (n - r->nfds) * sizeof(*conns));
+    r->nfds = n;
+    return 0;
+}
+
+static void submit_close(struct uring *r, int fd, struct uring_server_stats *stats) {
+    struct io_uring_sqe *sqe = uring_get_sqe(r, stats);
+    if (sqe == NULL) {
+        close(fd);
+        return;
+    }
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = fd;
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    sqe->user_data = UD(OP_CLOSE, fd);
+}
+
+// A send still in flight delays the close until it and the replies queued
+// behind it are out: a peer that shut down only its side still gets every
+// answer, and the descriptor cannot be reused while a completion for it
+// is outstanding
+static void queue_close(struct uring *r, int fd, struct uring_server_stats *stats) {
+    if (fd < r->nfds) {
+        struct send_queue *q = &r->sendq[fd];
+
+        if (r->conns[fd] != NULL) {
+            if (r->ops->on_close != NULL) {
+                r->ops->on_close(r->ops->ctx, r->conns[fd]);
+            }
+            r->conns[fd] = NULL;
+        }
+        if (q->busy) {
+            q->closing = 1;
+            return;
+        }
+        q->pending_len = 0;
+    }
+    submit_close(r, fd, stats);
+}
+
+// Send whatever is pending, if nothing is in flight
+static int start_send(struct uring *r, int fd, struct uring_server_stats *stats) {
+    struct send_queue *q = &r->sendq[fd];
+    char *buf;
+    size_t cap;
+
+    if (q->busy || q->pending_len == 0) {
+        return 0;
+    }
+    struct io_uring_sqe *sqe = uring_get_sqe(r, stats);
+    if (sqe == NULL) {
+        return -1;
+    }
+    buf = q->sending;
+    cap = q->sending_cap;
+    q->sending = q->pending;
+    q->sending_cap = q->pending_cap;
+    q->sending_len = q->pending_len;
+    q->pending = buf;
+    q->pending_cap = cap;
+    q->pending_len = 0;
+    q->busy = 1;
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)q->sending;
+    sqe->len = q->sending_len;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->user_data = UD(OP_SEND, fd);
+    return 0;
+}
+
+// Queue reply for fd and start sending it unless a send is in flight.
+// Returns -1 if the connection should be closed: it has too much waiting
+// for a peer that does not read, or the send could not be queued.
+static int queue_reply(struct uring *r, int fd, const struct uring_reply *reply,
+                       struct uring_server_stats *stats) {
+    struct send_queue *q = &r->sendq[fd];
+    size_t len = reply->len * reply->count;
+
+    if (len == 0) {
+        return 0;
+    }
+    if (q->pending_len + len > SENDQ_MAX) {
+        return -1;
+    }
+    if (q->pending_len + len > q->pending_cap) {
+        size_t cap = q->pending_cap ? q->pending_cap : BUF_SIZE;
+        while (cap < q->pending_len + len) {
+            cap *= 2;
+        }
+        char *p = realloc(q->pending, cap);
+        if (p == NULL) {
+            return -1;
+        }
+        q->pending = p;
+        q->pending_cap = cap;
+    }
+    for (unsigned i = 0; i < reply->count; i++) {
+        memcpy(q->pending + q->pending_len, reply->data, reply->len);
+        q->pending_len += reply->len;
+    }
+    return start_send(r, fd, stats);
+}
+
+// The send in flight on fd finished with res
+static void send_done(struct uring *r, int fd, int res, struct uring_server_stats *stats) {
+    struct send_queue *q = &r->sendq[fd];
+
+    q->busy = 0;
+    if (q->closing) {
+        if (res < 0 || (size_t)res < q->sending_len || q->pending_len == 0 ||
+            start_send(r, fd, stats) < 0) {
+            q->closing = 0;
+            q->pending_len = 0;
+            submit_close(r, fd, stats);
+        }
+    } else if (res < 0 || (size_t)res < q->sending_len || start_send(r, fd, stats) < 0) {
+        // The connection is broken; the recv side closes it
+        q->pending_len = 0;
+        shutdown(fd, SHUT_RDWR);
+    }
+}
+
+int uring_server_run(int listen_fd, const int *poll_fds, int npoll,
+                     const struct uring_server_ops *ops,
+                     struct uring_server_stats *stats,
+                     volatile int *stop) {
+    struct uring r;
+
+    if (uring_init(&r) < 0) {
+        return -1;
+    }
+    if (buf_ring_setup(&r) < 0) {
+        int saved = errno;
+        uring_free(&r);
+        errno = saved;
+        return -1;
+    }
+
+    r.ops = ops;
+
+    arm_accept(&r, listen_fd, stats);
+    for (int i = 0; i < npoll; i++) {
+        arm_poll(&r, poll_fds[i], stats);
+    }
+
+    while (!*stop) {
+        stats->enters++;
+        if (uring_submit(&r, 1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("io_uring_enter");
+            break;
+        }
+
+        unsigned head = *r.cq_head;
+        unsigned tail = __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE);
+
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &r.cqes[head & *r.cq_mask];
+            int op = UD_OP(cqe->user_data);
+            int fd = UD_FD(cqe->user_data);
+            int more = cqe->flags & IORING_CQE_F_MORE;
+
+            switch (op) {
+            case OP_ACCEPT:
+                if (cqe->res >= 0) {
+                    int client = cqe->res;
+
+                    stats->accepts++;
+                    if (grow_fds(&r, client) < 0) {
+                        perror("accept: out of memory");
+                        close(client);
+                    } else {
+                        r.conns[client] = ops->on_open != NULL ? ops->on_open(ops->ctx, client) : NULL;
+                        arm_recv(&r, client, stats);
+                    }
+                } else if (cqe->res != -EAGAIN && cqe->res != -ECONNABORTED) {
+                    fprintf(stderr, "accept: %s\n", strerror(-cqe->res));
+                }
+                if (!more) {
+                    arm_accept(&r, listen_fd, stats);
+                }
+                break;
+
+            case OP_RECV:
+                if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+                    unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+                    struct uring_reply reply = { NULL, 0, 0 };
+
+                    int rc = ops->on_data(ops->ctx, r.conns[fd], r.buf_base + (size_t)bid * BUF_SIZE,
+                                          cqe->res, &reply);
+                    buf_ring_add(&r, bid);
+                    if (rc >= 0) {
+                        stats->messages += reply.count;
+                        rc = queue_reply(&r, fd, &reply, stats);
+                    }
+                    if (rc < 0) {
+                        // Shutting the socket down ends a still-armed
+                        // multishot recv, whose final completion then
+                        // closes the descriptor
+                        if (more) {
+                            shutdown(fd, SHUT_RDWR);
+                        } else {
+                            queue_close(&r, fd, stats);
+                        }
+                        break;
+                    }
+                    if (!more) {
+                        arm_recv(&r, fd, stats);
+                    }
+                } else if (cqe->res == -ENOBUFS) {
+                    // Every buffer was in use; they have been recycled since
+                    if (!more) {
+                        arm_recv(&r, fd, stats);
+                    }
+                } else if (!more) {
+                    // EOF or error: the multishot recv is finished
+                    queue_close(&r, fd, stats);
+                }
+                break;
+
+            case OP_POLL:
+                if (cqe->res >= 0) {
+                    ops->on_readable(ops->ctx, fd);
+                }
+                if (!more) {
+                    arm_poll(&r, fd, stats);
+                }
+                break;
+
+            case OP_SEND:
+                send_done(&r, fd, cqe->res, stats);
+                break;
+
+            case OP_CLOSE:
+                // Only failures post completions
+                break;
+            }
+        }
+
+        __atomic_store_n(r.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    uring_free(&r);
+    return 0;
+}
@@ -0,0 +1,59 @@
+// io_uring TCP server loop shared by tcp/tcp.server.c and
+// multi/multi.protocol.server.c.
+//
+// The loop talks to the kernel through the raw io_uring syscalls, so it has
+// no dependency on liburing. It uses:
+//   - one multishot accept on the listening socket,
+//   - one multishot recv per connection, drawing buffers from a provided
+//     buffer ring,
+//   - at most one send in flight per connection; replies queued while it
+//     is are copied behind it and leave together in the next send, in order.
+// Under load, each io_uring_enter() call both submits and reaps many
+// messages, so the server makes far fewer than one syscall per request.
+#ifndef URING_SERVER_H
+#define URING_SERVER_H
+
+#include <stddef.h>
+
+// Response to a chunk of received data: count copies of the len bytes at
+// data, which are copied before on_data's caller returns. count = 0 sends
+// nothing.
+struct uring_reply {
+    const void *data;
+    size_t len;
+    unsigned count;
+};
+
+struct uring_server_ops {
+    // Optional. Called for every accepted connection; the returned pointer
+    // is passed back to on_data and on_close for that connection.
+    void *(*on_open)(void *ctx, int fd);
+    // Called for every chunk of bytes received on a TCP connection, which
+    // may hold part of a message or several. Fill in *reply, and return -1
+    // to close the connection.
+    int (*on_data)(void *ctx, void *conn, const char *data, size_t len,
+                   struct uring_reply *reply);
+    // Optional. Called once the connection is being closed.
+    void (*on_close)(void *ctx, void *conn);
+    // Called when one of the extra polled descriptors becomes readable.
+    // The descriptor must be non-blocking and should be drained.
+    void (*on_readable)(void *ctx, int fd);
+    void *ctx;
+};
+
+struct uring_server_stats {
+    unsigned long long enters;    // io_uring_enter() syscalls
+    unsigned long long accepts;   // connections accepted
+    unsigned long long messages;  // replies queued (uring_reply counts)
+};
+
+// Serve listen_fd (and watch poll_fds for readability) until *stop becomes
+// non-zero or a fatal error occurs. Returns 0 on a requested stop, -1 if
+// io_uring or one of the required features is unavailable (errno is set),
+// in which case the caller can fall back to another backend.
+int uring_server_run(int listen_fd, const int *poll_fds, int npoll,
+                     const struct uring_server_ops *ops,
+                     struct uring_server_stats *stats,
+                     volatile int *stop);
+
+#endif
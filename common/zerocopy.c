@@ -0,0 +1,196 @@
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
+#include "framing.h"
+#include "zerocopy.h"
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+void zc_init(struct zc_sender *z, int fd, size_t threshold) {
+    int one = 1;
+
+    memset(z, 0, sizeof(*z));
+    z->fd = fd;
+    z->threshold = threshold;
+    z->enabled = threshold > 0 &&
+                 setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+}
+
+// Account for completions lo..hi (inclusive, wrapping), then move done_id
+// past every finished send at the front
+static void complete_range(struct zc_sender *z, uint32_t lo, uint32_t hi, int copied) {
+    for (uint32_t id = lo;; id++) {
+        unsigned i = id % ZC_MAX_INFLIGHT;
+        if (id - z->done_id < zc_inflight(z) && !z->completed[i]) {
+            z->completed[i] = 1;
+            if (copied) {
+                z->bytes_copied += z->inflight[i];
+                z->enabled = 0; // pinning gains nothing on this route
+            }
+        }
+        if (id == hi) {
+            break;
+        }
+    }
+    while (z->done_id != z->next_id && z->completed[z->done_id % ZC_MAX_INFLIGHT]) {
+        z->completed[z->done_id % ZC_MAX_INFLIGHT] = 0;
+        z->done_id++;
+    }
+}
+
+// Drain the error queue without blocking. Returns how many notifications
+// were read, or -1 on a socket error.
+static int read_completions(struct zc_sender *z) {
+    char control[128];
+    struct msghdr msg;
+    int count = 0;
+
+    while (1) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(z->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return count;
+            }
+            return -1;
+        }
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+            struct sock_extended_err *serr = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0) {
+                continue;
+            }
+            complete_range(z, serr->ee_info, serr->ee_data,
+                           (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0);
+            count++;
+        }
+    }
+}
+
+int zc_wait(struct zc_sender *z, unsigned max_inflight, int timeout_ms) {
+    while (zc_inflight(z) > max_inflight) {
+        int n = read_completions(z);
+        if (n < 0) {
+            return -1;
+        }
+        if (n > 0) {
+            continue;
+        }
+
+        // The error queue wakes poll() with POLLERR whatever the events
+        struct pollfd pfd = { z->fd, 0, 0 };
+        int rc = poll(&pfd, 1, timeout_ms);
+        if (rc < 0 && errno != EINTR) {
+            return -1;
+        }
+        if (rc == 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        if (rc > 0 && read_completions(z) == 0) {
+            // POLLERR for a socket error rather than a notification
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(z->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err != 0) {
+                errno = err;
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// The socket's send timeout, which bounds each wait for completions too
+static int send_timeout_ms(int fd) {
+    struct timeval tv;
+    socklen_t len = sizeof(tv);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, &len) < 0 || (tv.tv_sec == 0 && tv.tv_usec == 0)) {
+        return -1;
+    }
+    return (int)(tv.tv_sec * 1000 + tv.tv_usec / 1000);
+}
+
+int zc_send_frame(struct zc_sender *z, const void *prefix, size_t prefix_len,
+                  const void *payload, size_t payload_len) {
+    char header[FRAME_HEADER_SIZE];
+    struct iovec iov[3];
+    const char *p = payload;
+
+    if (prefix_len + payload_len > UINT32_MAX) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    z->bytes_sent += FRAME_HEADER_SIZE + prefix_len + payload_len;
+    if (!z->enabled || payload_len < z->threshold) {
+        iov[0].iov_base = (void *)prefix;
+        iov[0].iov_len = prefix_len;
+        iov[1].iov_base = (void *)payload;
+        iov[1].iov_len = payload_len;
+        z->bytes_copied += FRAME_HEADER_SIZE + prefix_len + payload_len;
+        return frame_writev(z->fd, iov, 2);
+    }
+
+    // The header and prefix are copied; MSG_MORE keeps them in the same
+    // segment as the start of the payload
+    frame_encode_header(header, (uint32_t)(prefix_len + payload_len));
+    iov[0].iov_base = header;
+    iov[0].iov_len = FRAME_HEADER_SIZE;
+    iov[1].iov_base = (void *)prefix;
+    iov[1].iov_len = prefix_len;
+    z->bytes_copied += FRAME_HEADER_SIZE + prefix_len;
+    if (sendmsg_all(z->fd, iov, 2, MSG_MORE) < 0) {
+        return -1;
+    }
+
+    int timeout_ms = send_timeout_ms(z->fd);
+    while (payload_len > 0) {
+        if (zc_inflight(z) == ZC_MAX_INFLIGHT && zc_wait(z, ZC_MAX_INFLIGHT - 1, timeout_ms) < 0) {
+            return -1;
+        }
+        ssize_t n = send(z->fd, p, payload_len, MSG_ZEROCOPY | MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == ENOBUFS) {
+            // Out of option memory for notifications: wait for some, or
+            // if none are pending, copy the rest
+            if (zc_inflight(z) > 0) {
+                if (zc_wait(z, zc_inflight(z) - 1, timeout_ms) < 0) {
+                    return -1;
+                }
+                continue;
+            }
+            iov[0].iov_base = (void *)p;
+            iov[0].iov_len = payload_len;
+            z->bytes_copied += payload_len;
+            return sendmsg_all(z->fd, iov, 1, 0);
+        }
+        if (n < 0) {
+            return -1;
+        }
+        z->inflight[z->next_id % ZC_MAX_INFLIGHT] = n;
+        z->next_id++;
+        p += n;
+        payload_len -= n;
+    }
+    return 0;
+}
@@ -0,0 +1,58 @@
+// MSG_ZEROCOPY sends with completion tracking.
+//
+// A zero-copy send pins the caller's pages and hands them to the NIC
+// instead of copying them into socket buffers, so the memory must not be
+// written again until the kernel reports, on the socket's error queue,
+// that it is done with it. Each send() with MSG_ZEROCOPY gets the next
+// 32-bit id; completions arrive as ranges of ids, flagged when the kernel
+// had to copy after all (over loopback, say, or to a device without
+// scatter-gather).
+//
+// A zc_sender tracks the sends in flight on one socket, bounds them to
+// ZC_MAX_INFLIGHT so the notifications fit in the socket's option memory,
+// and counts how many bytes were really copied. Pays off from about 10 KB
+// a send; below the threshold it sends normally, and once the kernel
+// reports a copy it stops trying on that socket.
+#ifndef ZEROCOPY_H
+#define ZEROCOPY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ZC_MAX_INFLIGHT 64
+// Default threshold: smaller payloads are cheaper to copy than to pin
+#define ZC_DEFAULT_THRESHOLD (16 * 1024)
+
+struct zc_sender {
+    int fd;
+    int enabled;        // SO_ZEROCOPY accepted, and no copy reported yet
+    size_t threshold;   // payloads at least this big go zero-copy
+    uint32_t next_id;   // id of the next zero-copy send
+    uint32_t done_id;   // every id before this has completed
+    size_t inflight[ZC_MAX_INFLIGHT]; // bytes of each send in flight, by id
+    unsigned char completed[ZC_MAX_INFLIGHT];
+    uint64_t bytes_sent;
+    uint64_t bytes_copied; // by the kernel, including zero-copy fallbacks
+};
+
+// Turn on SO_ZEROCOPY for fd. If the kernel or socket does not support it,
+// every send is an ordinary copying one. threshold 0 disables zero-copy.
+void zc_init(struct zc_sender *z, int fd, size_t threshold);
+
+// Send one frame of prefix (copied, so it may be a temporary) followed by
+// payload, zero-copy if payload_len reaches the threshold. payload must
+// stay untouched until zc_wait() says nothing is in flight. Returns 0, or
+// -1 with errno from send().
+int zc_send_frame(struct zc_sender *z, const void *prefix, size_t prefix_len,
+                  const void *payload, size_t payload_len);
+
+// Read completions until at most max_inflight sends are outstanding,
+// waiting up to timeout_ms for each (-1 for ever). Returns 0, or -1 with
+// errno = ETIMEDOUT or the error from poll()/recvmsg().
+int zc_wait(struct zc_sender *z, unsigned max_inflight, int timeout_ms);
+
+static inline unsigned zc_inflight(const struct zc_sender *z) {
+    return z->next_id - z->done_id;
+}
+
+#endif
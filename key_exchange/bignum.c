@@ -0,0 +1,230 @@
+#include <string.h>
+
+#include "bignum.h"
+
+#define WINDOW 5
+#define TABLE_SIZE (1 << WINDOW)
+
+typedef unsigned __int128 u128;
+
+// All ones if a == b, else 0, without a branch
+static inline uint64_t ct_eq_mask(uint64_t a, uint64_t b) {
+    uint64_t x = a ^ b;
+    return ((x | (0 - x)) >> 63) - 1;
+}
+
+// r = a - b over n limbs; returns the borrow out
+static uint64_t sub_n(uint64_t *r, const uint64_t *a, const uint64_t *b, size_t n) {
+    uint64_t borrow = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        u128 d = (u128)a[i] - b[i] - borrow;
+        r[i] = (uint64_t)d;
+        borrow = (uint64_t)(d >> 64) & 1;
+    }
+    return borrow;
+}
+
+// x = 2x mod m, for x < m. Only used on public values during setup.
+static void double_mod(const struct mont_ctx *ctx, uint64_t *x) {
+    uint64_t carry = 0;
+
+    for (size_t i = 0; i < ctx->n; i++) {
+        uint64_t next = x[i] >> 63;
+        x[i] = x[i] << 1 | carry;
+        carry = next;
+    }
+    if (carry || bn_cmp(x, ctx->m, ctx->n) >= 0) {
+        sub_n(x, x, ctx->m, ctx->n);
+    }
+}
+
+// The lane form of ctx's modulus in radix-bit limbs
+static void lanes_init(const struct mont_ctx *ctx, struct mont_lanes *l, unsigned radix) {
+    uint64_t x[BN_MAX_LIMBS] = { 1 };
+
+    l->radix = radix;
+    l->n = (64 * ctx->n + 2 + radix - 1) / radix;
+    l->m0inv = ctx->m0inv & ((1ULL << radix) - 1);
+    bn_to_radix(l->m, l->n, radix, ctx->m, ctx->n);
+    for (size_t i = 0; i < 2 * radix * l->n; i++) {
+        double_mod(ctx, x);
+    }
+    bn_to_radix(l->rr, l->n, radix, x, ctx->n);
+}
+
+int mont_init(struct mont_ctx *ctx, const uint64_t *m, size_t n) {
+    uint64_t inv = 1;
+
+    if (n == 0 || n > BN_MAX_LIMBS || (m[0] & 1) == 0) {
+        return -1;
+    }
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->n = n;
+    memcpy(ctx->m, m, n * sizeof(*m));
+
+    // Newton's iteration doubles the correct low bits each round: 1, 2, 4..64
+    for (int i = 0; i < 6; i++) {
+        inv *= 2 - m[0] * inv;
+    }
+    ctx->m0inv = 0 - inv;
+
+    // R mod m and R^2 mod m by doubling 1; slow, but done once per modulus
+    ctx->one[0] = 1;
+    for (size_t i = 0; i < 64 * n; i++) {
+        double_mod(ctx, ctx->one);
+    }
+    memcpy(ctx->rr, ctx->one, n * sizeof(*m));
+    for (size_t i = 0; i < 64 * n; i++) {
+        double_mod(ctx, ctx->rr);
+    }
+    lanes_init(ctx, &ctx->l52, 52);
+    lanes_init(ctx, &ctx->l26, 26);
+    return 0;
+}
+
+void mont_mul(const struct mont_ctx *ctx, uint64_t *r, const uint64_t *a, const uint64_t *b) {
+    uint64_t t[BN_MAX_LIMBS + 1] = { 0 };
+    uint64_t d[BN_MAX_LIMBS];
+    size_t n = ctx->n;
+    const uint64_t *m = ctx->m;
+    const uint64_t m0inv = ctx->m0inv;
+
+    // One pass per limb of b: t = (t + a b[i] + q m) / 2^64, with q chosen
+    // to clear the low limb. Multiplying and reducing in the same sweep
+    // reads and writes t once instead of twice.
+    for (size_t i = 0; i < n; i++) {
+        uint64_t bi = b[i];
+        u128 p = (u128)a[0] * bi + t[0];
+        uint64_t lo = (uint64_t)p;
+        uint64_t c1 = (uint64_t)(p >> 64);
+        uint64_t q = lo * m0inv;
+        u128 s = (u128)q * m[0] + lo;
+        uint64_t c2 = (uint64_t)(s >> 64);
+
+        for (size_t j = 1; j < n; j++) {
+            p = (u128)a[j] * bi + t[j] + c1;
+            c1 = (uint64_t)(p >> 64);
+            s = (u128)q * m[j] + (uint64_t)p + c2;
+            c2 = (uint64_t)(s >> 64);
+            t[j - 1] = (uint64_t)s;
+        }
+        u128 top = (u128)t[n] + c1 + c2;
+        t[n - 1] = (uint64_t)top;
+        t[n] = (uint64_t)(top >> 64);
+    }
+
+    // t < 2m: subtract m unless that would go negative, choosing by mask
+    uint64_t borrow = sub_n(d, t, m, n);
+    uint64_t keep_t = 0 - (borrow & (t[n] ^ 1));
+    for (size_t i = 0; i < n; i++) {
+        r[i] = (t[i] & keep_t) | (d[i] & ~keep_t);
+    }
+}
+
+// r = table[index], reading every entry so the access pattern is the same
+// for every index
+static void table_select(uint64_t *r, const uint64_t (*table)[BN_MAX_LIMBS], uint64_t index, size_t n) {
+    memset(r, 0, n * sizeof(*r));
+    for (uint64_t i = 0; i < TABLE_SIZE; i++) {
+        uint64_t mask = ct_eq_mask(i, index);
+        for (size_t j = 0; j < n; j++) {
+            r[j] |= table[i][j] & mask;
+        }
+    }
+}
+
+uint64_t bn_bits_at(const uint64_t *exp, unsigned pos, unsigned width) {
+    uint64_t v = exp[pos / 64] >> (pos % 64);
+
+    if (pos % 64 + width > 64) {
+        v |= exp[pos / 64 + 1] << (64 - pos % 64);
+    }
+    return v & ((1ULL << width) - 1);
+}
+
+void bn_modexp(const struct mont_ctx *ctx, uint64_t *r, const uint64_t *base,
+               const uint64_t *exp, unsigned exp_bits) {
+    uint64_t table[TABLE_SIZE][BN_MAX_LIMBS];
+    uint64_t acc[BN_MAX_LIMBS], factor[BN_MAX_LIMBS];
+    uint64_t plain_one[BN_MAX_LIMBS] = { 1 };
+    size_t n = ctx->n;
+
+    // table[i] = base^i in Montgomery form
+    memcpy(table[0], ctx->one, n * sizeof(*r));
+    mont_mul(ctx, table[1], base, ctx->rr);
+    for (int i = 2; i < TABLE_SIZE; i++) {
+        mont_mul(ctx, table[i], table[i - 1], table[1]);
+    }
+
+    // Left to right, WINDOW bits at a time; the top window takes the
+    // remainder. Every window costs the same squarings and one multiply,
+    // by base^0 included.
+    memcpy(acc, ctx->one, n * sizeof(*r));
+    unsigned pos = exp_bits;
+    unsigned width = exp_bits % WINDOW ? exp_bits % WINDOW : WINDOW;
+    while (pos > 0) {
+        pos -= width;
+        for (unsigned i = 0; i < width; i++) {
+            mont_mul(ctx, acc, acc, acc);
+        }
+        table_select(factor, (const uint64_t (*)[BN_MAX_LIMBS])table, bn_bits_at(exp, pos, width), n);
+        mont_mul(ctx, acc, acc, factor);
+        width = WINDOW;
+    }
+
+    // Out of Montgomery form
+    mont_mul(ctx, r, acc, plain_one);
+    memset(table, 0, sizeof(table));
+}
+
+void bn_to_radix(uint64_t *r, size_t rn, unsigned radix, const uint64_t *a, size_t n) {
+    for (size_t i = 0; i < rn; i++) {
+        size_t bit = i * radix;
+        r[i] = bit < 64 * n ? bn_bits_at(a, (unsigned)bit, 64 * n - bit < radix ? 64 * n - bit : radix) : 0;
+    }
+}
+
+void bn_from_radix(uint64_t *r, size_t n, const uint64_t *a, size_t rn, unsigned radix) {
+    memset(r, 0, n * sizeof(*r));
+    for (size_t i = 0; i < rn; i++) {
+        size_t bit = i * radix;
+        if (bit / 64 < n) {
+            r[bit / 64] |= a[i] << (bit % 64);
+        }
+        if (bit % 64 + radix > 64 && bit / 64 + 1 < n) {
+            r[bit / 64 + 1] |= a[i] >> (64 - bit % 64);
+        }
+    }
+}
+
+int bn_from_bytes(uint64_t *r, size_t n, const unsigned char *in, size_t len) {
+    memset(r, 0, n * sizeof(*r));
+    for (size_t i = 0; i < len; i++) {
+        size_t bit = (len - 1 - i) * 8;
+        if (bit / 64 >= n) {
+            if (in[i] != 0) {
+                return -1;
+            }
+            continue;
+        }
+        r[bit / 64] |= (uint64_t)in[i] << (bit % 64);
+    }
+    return 0;
+}
+
+void bn_to_bytes(const uint64_t *a, size_t n, unsigned char *out, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        size_t bit = (len - 1 - i) * 8;
+        out[i] = bit / 64 < n ? (unsigned char)(a[bit / 64] >> (bit % 64)) : 0;
+    }
+}
+
+int bn_cmp(const uint64_t *a, const uint64_t *b, size_t n) {
+    for (size_t i = n; i-- > 0; ) {
+        if (a[i] != b[i]) {
+            return a[i] < b[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,88 @@
+// Fixed-size multiprecision arithmetic for finite-field Diffie-Hellman
+//
+// Numbers are arrays of 64-bit limbs, least significant first, all of the
+// modulus' length. Multiplication is Montgomery's (CIOS form), so modular
+// reduction costs no division. Modular exponentiation uses a fixed 5-bit
+// window over a fixed number of exponent bits, reads the window table with
+// masks rather than indexing, and ends every multiplication with a masked
+// rather than branching subtraction: neither the time taken nor the memory
+// touched depends on the exponent's value.
+//
+// bn_modexp_batch() runs many exponentiations modulo the same m at once,
+// one per SIMD lane: every lane does the same multiplications in step, so
+// eight 2048-bit numbers in 52-bit limbs cost one AVX-512 IFMA
+// multiplication's worth of instructions. The kernel is chosen on first
+// use from what the CPU supports.
+#ifndef BIGNUM_H
+#define BIGNUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BN_MAX_BITS 4096
+#define BN_MAX_LIMBS (BN_MAX_BITS / 64)
+// Limbs of the smallest radix the vector kernels use, with two bits spare
+#define BN_LANE_MAX_LIMBS ((BN_MAX_BITS + 2 + 25) / 26)
+
+// The modulus in 2^radix limbs for a vector kernel, with R = 2^(radix n) at
+// least 4m: products then stay below 2m without a final subtraction
+struct mont_lanes {
+    unsigned radix;
+    size_t n;
+    uint64_t m0inv; // -m^-1 mod 2^radix
+    uint64_t m[BN_LANE_MAX_LIMBS];
+    uint64_t rr[BN_LANE_MAX_LIMBS]; // R^2 mod m
+};
+
+// Montgomery parameters for one odd modulus m, with R = 2^(64 n)
+struct mont_ctx {
+    size_t n;                    // limbs
+    uint64_t m[BN_MAX_LIMBS];
+    uint64_t m0inv;              // -m^-1 mod 2^64
+    uint64_t rr[BN_MAX_LIMBS];   // R^2 mod m, to convert into Montgomery form
+    uint64_t one[BN_MAX_LIMBS];  // R mod m, 1 in Montgomery form
+    struct mont_lanes l52, l26;  // for the IFMA and AVX2 kernels
+};
+
+// Set up for the odd modulus m of n limbs. Returns -1 if m is even or n is
+// out of range.
+int mont_init(struct mont_ctx *ctx, const uint64_t *m, size_t n);
+
+// r = a * b / R mod m, for a, b < m. r may alias a or b.
+void mont_mul(const struct mont_ctx *ctx, uint64_t *r, const uint64_t *a, const uint64_t *b);
+
+// r = base^exp mod m, looking at the low exp_bits bits of exp (a buffer of
+// (exp_bits + 63) / 64 limbs). base must be below m. Constant time in base
+// and exp; only exp_bits and the modulus size are visible.
+void bn_modexp(const struct mont_ctx *ctx, uint64_t *r, const uint64_t *base,
+               const uint64_t *exp, unsigned exp_bits);
+
+// bn_modexp() for count (base, exp) pairs, all with exponents of exp_bits
+// bits; r[i] may alias base[i]. The same constant-time guarantees hold per
+// pair.
+void bn_modexp_batch(const struct mont_ctx *ctx, uint64_t *const *r, const uint64_t *const *base,
+                     const uint64_t *const *exp, unsigned exp_bits, size_t count);
+
+// The kernel bn_modexp_batch() runs: "ifma", "avx2" or "scalar"; and how
+// many pairs it works on at once. bn_batch_use() picks one by name instead,
+// returning -1 if the CPU does not support it.
+const char *bn_batch_kernel(void);
+size_t bn_batch_lanes(void);
+int bn_batch_use(const char *name);
+
+// n limbs of 64 bits to rn limbs of radix bits and back. The value must fit.
+void bn_to_radix(uint64_t *r, size_t rn, unsigned radix, const uint64_t *a, size_t n);
+void bn_from_radix(uint64_t *r, size_t n, const uint64_t *a, size_t rn, unsigned radix);
+
+// The width bits of exp starting at bit pos
+uint64_t bn_bits_at(const uint64_t *exp, unsigned pos, unsigned width);
+
+// Big-endian bytes to n limbs and back. bn_from_bytes() returns -1 if the
+// value does not fit in n limbs.
+int bn_from_bytes(uint64_t *r, size_t n, const unsigned char *in, size_t len);
+void bn_to_bytes(const uint64_t *a, size_t n, unsigned char *out, size_t len);
+
+// -1, 0 or 1 as a <, =, > b. Not constant time; for public values.
+int bn_cmp(const uint64_t *a, const uint64_t *b, size_t n);
+
+#endif
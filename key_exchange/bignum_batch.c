@@ -0,0 +1,346 @@
+#include <string.h>
+#include <immintrin.h>
+
+#include "bignum.h"
+
+// A smaller window than bn_modexp()'s: a lane table entry is eight numbers,
+// and the per-lane select reads every entry
+#define WINDOW 4
+#define TABLE_SIZE (1 << WINDOW)
+
+#define IFMA_LANES 8
+#define IFMA_MAX_LIMBS ((BN_MAX_BITS + 2 + 51) / 52)
+#define AVX2_LANES 4
+#define MAX_LANES IFMA_LANES
+
+#define TARGET_IFMA __attribute__((target("avx512f,avx512ifma")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+
+typedef unsigned __int128 u128;
+
+typedef void modexp_fn(const struct mont_ctx *ctx, uint64_t *const *r, const uint64_t *const *base,
+                       const uint64_t *const *exp, unsigned exp_bits, size_t count);
+
+// Lane numbers are kept limb-major: cols[j][k] is limb j of lane k, so a
+// row loads straight into a vector. Lanes past count hold 1.
+static void to_lanes(const struct mont_ctx *ctx, const struct mont_lanes *l, uint64_t (*cols)[MAX_LANES],
+                     const uint64_t *const *base, size_t count, size_t lanes) {
+    uint64_t limbs[BN_LANE_MAX_LIMBS];
+
+    for (size_t k = 0; k < lanes; k++) {
+        if (k < count) {
+            bn_to_radix(limbs, l->n, l->radix, base[k], ctx->n);
+        } else {
+            memset(limbs, 0, l->n * sizeof(*limbs));
+            limbs[0] = 1;
+        }
+        for (size_t j = 0; j < l->n; j++) {
+            cols[j][k] = limbs[j];
+        }
+    }
+    memset(limbs, 0, sizeof(limbs));
+}
+
+// x = x mod m for x <= m, choosing by mask as mont_mul() does
+static void reduce_once(const struct mont_ctx *ctx, uint64_t *x) {
+    uint64_t d[BN_MAX_LIMBS];
+    uint64_t borrow = 0;
+
+    for (size_t i = 0; i < ctx->n; i++) {
+        u128 diff = (u128)x[i] - ctx->m[i] - borrow;
+        d[i] = (uint64_t)diff;
+        borrow = (uint64_t)(diff >> 64) & 1;
+    }
+    uint64_t keep_x = 0 - borrow;
+    for (size_t i = 0; i < ctx->n; i++) {
+        x[i] = (x[i] & keep_x) | (d[i] & ~keep_x);
+    }
+}
+
+static void from_lanes(const struct mont_ctx *ctx, const struct mont_lanes *l, uint64_t (*cols)[MAX_LANES],
+                       uint64_t *const *r, size_t count) {
+    uint64_t limbs[BN_LANE_MAX_LIMBS];
+
+    for (size_t k = 0; k < count; k++) {
+        for (size_t j = 0; j < l->n; j++) {
+            limbs[j] = cols[j][k];
+        }
+        bn_from_radix(r[k], ctx->n, limbs, l->n, l->radix);
+        reduce_once(ctx, r[k]);
+    }
+    memset(limbs, 0, sizeof(limbs));
+}
+
+// Every lane's window at pos; lanes past count use exponent 0
+static void windows_at(uint64_t *index, const uint64_t *const *exp, size_t count, size_t lanes,
+                       unsigned pos, unsigned width) {
+    for (size_t k = 0; k < lanes; k++) {
+        index[k] = k < count ? bn_bits_at(exp[k], pos, width) : 0;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// AVX-512 IFMA: eight lanes of 52-bit limbs
+// ---------------------------------------------------------------------------
+
+// r = a b / R mod m in every lane, for a, b < 2m; r < 2m. The same pass as
+// mont_mul(), but with 52-bit limbs in 64-bit words a column can take many
+// products before it overflows, so carries wait until the end. Column i + j
+// collects a[j] b[i] and m[j] q: the low half of each product lands there,
+// the high half one column up.
+TARGET_IFMA
+static void ifma_mul(const struct mont_lanes *l, const __m512i *m, __m512i *r, const __m512i *a, const __m512i *b) {
+    __m512i t[2 * IFMA_MAX_LIMBS + 1];
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i m0inv = _mm512_set1_epi64((long long)l->m0inv);
+    const __m512i mask = _mm512_set1_epi64((1LL << 52) - 1);
+    size_t n = l->n;
+
+    for (size_t i = 0; i <= 2 * n; i++) {
+        t[i] = zero;
+    }
+    for (size_t i = 0; i < n; i++) {
+        __m512i *ti = t + i;
+        __m512i bi = b[i];
+        __m512i q = _mm512_madd52lo_epu64(zero, _mm512_madd52lo_epu64(ti[0], a[0], bi), m0inv);
+
+        for (size_t j = 0; j < n; j++) {
+            ti[j] = _mm512_madd52lo_epu64(_mm512_madd52lo_epu64(ti[j], a[j], bi), m[j], q);
+            ti[j + 1] = _mm512_madd52hi_epu64(_mm512_madd52hi_epu64(ti[j + 1], a[j], bi), m[j], q);
+        }
+        // The low 52 bits of column i are now zero
+        ti[1] = _mm512_add_epi64(ti[1], _mm512_srli_epi64(ti[0], 52));
+    }
+    for (size_t i = n; i < 2 * n; i++) {
+        t[i + 1] = _mm512_add_epi64(t[i + 1], _mm512_srli_epi64(t[i], 52));
+        r[i - n] = _mm512_and_si512(t[i], mask);
+    }
+}
+
+TARGET_IFMA
+static void ifma_modexp(const struct mont_ctx *ctx, uint64_t *const *r, const uint64_t *const *base,
+                        const uint64_t *const *exp, unsigned exp_bits, size_t count) {
+    const struct mont_lanes *l = &ctx->l52;
+    size_t n = l->n;
+    __m512i table[TABLE_SIZE][IFMA_MAX_LIMBS];
+    __m512i m[IFMA_MAX_LIMBS], rr[IFMA_MAX_LIMBS], one[IFMA_MAX_LIMBS];
+    __m512i acc[IFMA_MAX_LIMBS], factor[IFMA_MAX_LIMBS];
+    uint64_t cols[IFMA_MAX_LIMBS][MAX_LANES];
+    uint64_t index[MAX_LANES];
+
+    for (size_t j = 0; j < n; j++) {
+        m[j] = _mm512_set1_epi64((long long)l->m[j]);
+        rr[j] = _mm512_set1_epi64((long long)l->rr[j]);
+        one[j] = _mm512_set1_epi64(j == 0);
+    }
+
+    // table[i] = base^i in Montgomery form, per lane
+    to_lanes(ctx, l, cols, base, count, IFMA_LANES);
+    for (size_t j = 0; j < n; j++) {
+        table[1][j] = _mm512_loadu_si512(cols[j]);
+    }
+    ifma_mul(l, m, table[1], table[1], rr);
+    ifma_mul(l, m, table[0], one, rr);
+    for (int i = 2; i < TABLE_SIZE; i++) {
+        ifma_mul(l, m, table[i], table[i - 1], table[1]);
+    }
+
+    memcpy(acc, table[0], n * sizeof(*acc));
+    unsigned pos = exp_bits;
+    unsigned width = exp_bits % WINDOW ? exp_bits % WINDOW : WINDOW;
+    while (pos > 0) {
+        pos -= width;
+        for (unsigned i = 0; i < width; i++) {
+            ifma_mul(l, m, acc, acc, acc);
+        }
+        // Each lane picks its own entry; every entry is read for every lane
+        windows_at(index, exp, count, IFMA_LANES, pos, width);
+        __m512i want = _mm512_loadu_si512(index);
+        for (int i = 0; i < TABLE_SIZE; i++) {
+            __mmask8 hit = _mm512_cmpeq_epi64_mask(want, _mm512_set1_epi64(i));
+            for (size_t j = 0; j < n; j++) {
+                factor[j] = _mm512_mask_mov_epi64(i == 0 ? table[0][j] : factor[j], hit, table[i][j]);
+            }
+        }
+        ifma_mul(l, m, acc, acc, factor);
+        width = WINDOW;
+    }
+
+    ifma_mul(l, m, acc, acc, one);
+    for (size_t j = 0; j < n; j++) {
+        _mm512_storeu_si512(cols[j], acc[j]);
+    }
+    from_lanes(ctx, l, cols, r, count);
+    memset(table, 0, sizeof(table));
+    memset(cols, 0, sizeof(cols));
+}
+
+// ---------------------------------------------------------------------------
+// AVX2: four lanes of 26-bit limbs, whose products fit a 32x32-bit multiply
+// ---------------------------------------------------------------------------
+
+// As ifma_mul(), with each product whole in one column
+TARGET_AVX2
+static void avx2_mul(const struct mont_lanes *l, const __m256i *m, __m256i *r, const __m256i *a, const __m256i *b) {
+    __m256i t[2 * BN_LANE_MAX_LIMBS + 1];
+    const __m256i m0inv = _mm256_set1_epi64x((long long)l->m0inv);
+    const __m256i mask = _mm256_set1_epi64x((1LL << 26) - 1);
+    size_t n = l->n;
+
+    for (size_t i = 0; i <= 2 * n; i++) {
+        t[i] = _mm256_setzero_si256();
+    }
+    for (size_t i = 0; i < n; i++) {
+        __m256i *ti = t + i;
+        __m256i bi = b[i];
+        __m256i low = _mm256_add_epi64(ti[0], _mm256_mul_epu32(a[0], bi));
+        __m256i q = _mm256_and_si256(_mm256_mul_epu32(low, m0inv), mask);
+
+        for (size_t j = 0; j < n; j++) {
+            ti[j] = _mm256_add_epi64(ti[j], _mm256_add_epi64(_mm256_mul_epu32(a[j], bi),
+                                                             _mm256_mul_epu32(m[j], q)));
+        }
+        ti[1] = _mm256_add_epi64(ti[1], _mm256_srli_epi64(ti[0], 26));
+    }
+    for (size_t i = n; i < 2 * n; i++) {
+        t[i + 1] = _mm256_add_epi64(t[i + 1], _mm256_srli_epi64(t[i], 26));
+        r[i - n] = _mm256_and_si256(t[i], mask);
+    }
+}
+
+TARGET_AVX2
+static void avx2_modexp(const struct mont_ctx *ctx, uint64_t *const *r, const uint64_t *const *base,
+                        const uint64_t *const *exp, unsigned exp_bits, size_t count) {
+    const struct mont_lanes *l = &ctx->l26;
+    size_t n = l->n;
+    __m256i table[TABLE_SIZE][BN_LANE_MAX_LIMBS];
+    __m256i m[BN_LANE_MAX_LIMBS], rr[BN_LANE_MAX_LIMBS], one[BN_LANE_MAX_LIMBS];
+    __m256i acc[BN_LANE_MAX_LIMBS], factor[BN_LANE_MAX_LIMBS];
+    uint64_t cols[BN_LANE_MAX_LIMBS][MAX_LANES];
+    uint64_t index[MAX_LANES];
+
+    for (size_t j = 0; j < n; j++) {
+        m[j] = _mm256_set1_epi64x((long long)l->m[j]);
+        rr[j] = _mm256_set1_epi64x((long long)l->rr[j]);
+        one[j] = _mm256_set1_epi64x(j == 0);
+    }
+
+    to_lanes(ctx, l, cols, base, count, AVX2_LANES);
+    for (size_t j = 0; j < n; j++) {
+        table[1][j] = _mm256_loadu_si256((const __m256i *)cols[j]);
+    }
+    avx2_mul(l, m, table[1], table[1], rr);
+    avx2_mul(l, m, table[0], one, rr);
+    for (int i = 2; i < TABLE_SIZE; i++) {
+        avx2_mul(l, m, table[i], table[i - 1], table[1]);
+    }
+
+    memcpy(acc, table[0], n * sizeof(*acc));
+    unsigned pos = exp_bits;
+    unsigned width = exp_bits % WINDOW ? exp_bits % WINDOW : WINDOW;
+    while (pos > 0) {
+        pos -= width;
+        for (unsigned i = 0; i < width; i++) {
+            avx2_mul(l, m, acc, acc, acc);
+        }
+        windows_at(index, exp, count, AVX2_LANES, pos, width);
+        __m256i want = _mm256_loadu_si256((const __m256i *)index);
+        for (size_t j = 0; j < n; j++) {
+            factor[j] = _mm256_setzero_si256();
+        }
+        for (int i = 0; i < TABLE_SIZE; i++) {
+            __m256i hit = _mm256_cmpeq_epi64(want, _mm256_set1_epi64x(i));
+            for (size_t j = 0; j < n; j++) {
+                factor[j] = _mm256_or_si256(factor[j], _mm256_and_si256(table[i][j], hit));
+            }
+        }
+        avx2_mul(l, m, acc, acc, factor);
+        width = WINDOW;
+    }
+
+    avx2_mul(l, m, acc, acc, one);
+    for (size_t j = 0; j < n; j++) {
+        _mm256_storeu_si256((__m256i *)cols[j], acc[j]);
+    }
+    from_lanes(ctx, l, cols, r, count);
+    memset(table, 0, sizeof(table));
+    memset(cols, 0, sizeof(cols));
+}
+
+// ---------------------------------------------------------------------------
+// Dispatch
+// ---------------------------------------------------------------------------
+
+static void scalar_modexp(const struct mont_ctx *ctx, uint64_t *const *r, const uint64_t *const *base,
+                          const uint64_t *const *exp, unsigned exp_bits, size_t count) {
+    for (size_t k = 0; k < count; k++) {
+        bn_modexp(ctx, r[k], base[k], exp[k], exp_bits);
+    }
+}
+
+static int has_ifma(void) {
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512ifma");
+}
+
+static int has_avx2(void) {
+    return __builtin_cpu_supports("avx2");
+}
+
+static int has_scalar(void) {
+    return 1;
+}
+
+static const struct kernel {
+    const char *name;
+    size_t lanes;
+    int (*supported)(void);
+    modexp_fn *modexp;
+} kernels[] = { // fastest first
+    { "ifma", IFMA_LANES, has_ifma, ifma_modexp },
+    { "avx2", AVX2_LANES, has_avx2, avx2_modexp },
+    { "scalar", 1, has_scalar, scalar_modexp },
+};
+
+#define NKERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+// Chosen on first use; threads racing to choose all store the same one
+static const struct kernel *selected;
+
+static const struct kernel *kernel(void) {
+    const struct kernel *k = __atomic_load_n(&selected, __ATOMIC_ACQUIRE);
+
+    if (k == NULL) {
+        for (k = kernels; !k->supported(); k++) {
+        }
+        __atomic_store_n(&selected, k, __ATOMIC_RELEASE);
+    }
+    return k;
+}
+
+const char *bn_batch_kernel(void) {
+    return kernel()->name;
+}
+
+size_t bn_batch_lanes(void) {
+    return kernel()->lanes;
+}
+
+int bn_batch_use(const char *name) {
+    for (size_t i = 0; i < NKERNELS; i++) {
+        if (strcmp(kernels[i].name, name) == 0 && kernels[i].supported()) {
+            __atomic_store_n(&selected, &kernels[i], __ATOMIC_RELEASE);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void bn_modexp_batch(const struct mont_ctx *ctx, uint64_t *const *r, const uint64_t *const *base,
+                     const uint64_t *const *exp, unsigned exp_bits, size_t count) {
+    const struct kernel *k = kernel();
+
+    for (size_t i = 0; i < count; i += k->lanes) {
+        size_t group = count - i < k->lanes ? count - i : k->lanes;
+        k->modexp(ctx, r + i, base + i, exp + i, exp_bits, group);
+    }
+}
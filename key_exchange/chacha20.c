@@ -0,0 +1,71 @@
+#include <string.h>
+
+#include "chacha20.h"
+
+static inline uint32_t rol(uint32_t x, int n) {
+    return x << n | x >> (32 - n);
+}
+
+static inline uint32_t load32_le(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+#define QUARTER(a, b, c, d)                      \
+    do {                                         \
+        a += b; d ^= a; d = rol(d, 16);          \
+        c += d; b ^= c; b = rol(b, 12);          \
+        a += b; d ^= a; d = rol(d, 8);           \
+        c += d; b ^= c; b = rol(b, 7);           \
+    } while (0)
+
+static void block(uint8_t out[64], const uint32_t in[16]) {
+    uint32_t x[16];
+
+    memcpy(x, in, sizeof(x));
+    for (int i = 0; i < 10; i++) {
+        QUARTER(x[0], x[4], x[8], x[12]);
+        QUARTER(x[1], x[5], x[9], x[13]);
+        QUARTER(x[2], x[6], x[10], x[14]);
+        QUARTER(x[3], x[7], x[11], x[15]);
+        QUARTER(x[0], x[5], x[10], x[15]);
+        QUARTER(x[1], x[6], x[11], x[12]);
+        QUARTER(x[2], x[7], x[8], x[13]);
+        QUARTER(x[3], x[4], x[9], x[14]);
+    }
+    for (int i = 0; i < 16; i++) {
+        uint32_t v = x[i] + in[i];
+        out[4 * i] = (uint8_t)v;
+        out[4 * i + 1] = (uint8_t)(v >> 8);
+        out[4 * i + 2] = (uint8_t)(v >> 16);
+        out[4 * i + 3] = (uint8_t)(v >> 24);
+    }
+    memset(x, 0, sizeof(x));
+}
+
+void chacha20_xor(uint8_t *out, const uint8_t *in, size_t len, const uint8_t key[CHACHA20_KEY_BYTES],
+                  const uint8_t nonce[CHACHA20_NONCE_BYTES], uint32_t counter) {
+    uint32_t state[16] = { 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574 }; // "expand 32-byte k"
+    uint8_t stream[64];
+
+    for (int i = 0; i < 8; i++) {
+        state[4 + i] = load32_le(key + 4 * i);
+    }
+    state[12] = counter;
+    for (int i = 0; i < 3; i++) {
+        state[13 + i] = load32_le(nonce + 4 * i);
+    }
+
+    while (len > 0) {
+        size_t n = len < sizeof(stream) ? len : sizeof(stream);
+        block(stream, state);
+        for (size_t i = 0; i < n; i++) {
+            out[i] = in[i] ^ stream[i];
+        }
+        state[12]++;
+        out += n;
+        in += n;
+        len -= n;
+    }
+    memset(stream, 0, sizeof(stream));
+    memset(state, 0, sizeof(state));
+}
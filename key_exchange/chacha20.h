@@ -0,0 +1,16 @@
+// ChaCha20 stream cipher (RFC 8439)
+#ifndef CHACHA20_H
+#define CHACHA20_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CHACHA20_KEY_BYTES 32
+#define CHACHA20_NONCE_BYTES 12
+
+// out = in XOR the keystream for key and nonce, starting at block counter.
+// Encryption and decryption are the same operation; in and out may alias.
+void chacha20_xor(uint8_t *out, const uint8_t *in, size_t len, const uint8_t key[CHACHA20_KEY_BYTES],
+                  const uint8_t nonce[CHACHA20_NONCE_BYTES], uint32_t counter);
+
+#endif
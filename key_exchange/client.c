@@ -3,8 +3,11 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <fcntl.h>
+#include <time.h>
 #include <arpa/inet.h>
 #include <math.h>
+#include "kx_proto.h"
 
 // Function to compute (base^exp) % mod
 long long int power(long long int base, long long int exp, long long int mod) {
@@ -18,37 +21,168 @@ long long int power(long long int base, long long int exp, long long int mod) {
     return res;
 }
 
-int main() {
+void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-m x25519|modp2048|modp3072|modp4096] [-H host] [-p port]\n"
+                    "       [-s session_file] [-c count]\n", prog);
+    fprintf(stderr, "  -m  negotiate this handshake; without it, the P = 23 exchange\n");
+    fprintf(stderr, "  -s  resume with the ticket in this file if it has one, and keep the\n");
+    fprintf(stderr, "      ticket for next time\n");
+    fprintf(stderr, "  -c  reconnect and exchange keys this many times, and print the rate\n");
+    exit(1);
+}
+
+long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int connect_server(const struct sockaddr_in *server_addr) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (sock < 0) {
+        perror("Socket creation failed");
+        exit(1);
+    }
+    if (connect(sock, (const struct sockaddr *)server_addr, sizeof(*server_addr)) < 0) {
+        perror("Connection failed");
+        exit(1);
+    }
+    return sock;
+}
+
+// The session file holds a struct kx_session, private to its owner
+int load_session(const char *path, struct kx_session *session) {
+    int fd = open(path, O_RDONLY);
+    ssize_t n = fd < 0 ? -1 : read(fd, session, sizeof(*session));
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    return n == (ssize_t)sizeof(*session) ? 0 : -1;
+}
+
+void save_session(const char *path, const struct kx_session *session) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+    if (fd < 0 || write(fd, session, sizeof(*session)) != (ssize_t)sizeof(*session)) {
+        perror(path);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+// count negotiated exchanges, one connection each. With a session file,
+// each resumes if it can and falls back to a full handshake for a new
+// ticket if the server refuses.
+int run_negotiated(const struct sockaddr_in *server_addr, unsigned char mode,
+                   const char *session_path, long count) {
+    unsigned char secret[KX_MAX_KEY];
+    struct kx_session session;
+    int have_session = session_path != NULL && load_session(session_path, &session) == 0;
+    long handshakes = 0, resumptions = 0;
+    long long start = now_ns();
+
+    for (long i = 0; i < count; i++) {
+        int sock = connect_server(server_addr);
+        ssize_t len = 0;
+
+        if (have_session) {
+            len = kx_resume(sock, &session, secret);
+            if (len > 0) {
+                resumptions++;
+            } else if (len == 0) {
+                if (count == 1) {
+                    printf("Server refused the ticket; doing a full handshake.\n");
+                }
+                close(sock);
+                sock = connect_server(server_addr);
+            }
+        }
+        if (len == 0) {
+            len = kx_handshake(sock, mode, 0, NULL, secret, session_path != NULL ? &session : NULL);
+            handshakes++;
+        }
+        close(sock);
+        if (len < 0) {
+            return 1;
+        }
+        if (session_path != NULL) {
+            have_session = 1;
+            save_session(session_path, &session);
+        }
+        if (count == 1) {
+            printf("%s (%s).\n", resumptions > 0 ? "Resumed the session" : "Exchanged public keys",
+                   kx_mode_name(mode));
+            kx_print_secret("Client", secret, len);
+        }
+    }
+
+    if (count > 1) {
+        double seconds = (now_ns() - start) / 1e9;
+        printf("%ld exchanges in %.2f s (%.0f/sec): %ld full handshakes, %ld resumptions\n",
+               count, seconds, count / seconds, handshakes, resumptions);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned char mode = KX_MODE_REJECT; // the original exchange
+    const char *host = "127.0.0.1";
+    const char *session_path = NULL;
+    int port = KX_PORT;
+    long count = 1;
+    int c;
+
+    // -m negotiates a real handshake; without it, the P = 23 exchange
+    // that every server understands
+    while ((c = getopt(argc, argv, "m:H:p:s:c:")) != -1) {
+        switch (c) {
+        case 'm':
+            if ((mode = kx_mode_find(optarg)) == KX_MODE_REJECT) {
+                usage(argv[0]);
+            }
+            break;
+        case 'H': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 's': session_path = optarg; break;
+        case 'c': count = atol(optarg); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (count < 1 || ((session_path != NULL || count > 1) && mode == KX_MODE_REJECT)) {
+        usage(argv[0]);
+    }
+
     // Publicly known numbers (must match the server's)
     long long int P = 23;
     long long int G = 5;
 
     // Client's private key (a)
     long long int a = 4;
-    printf("Client's private key (a): %lld\n", a);
+    if (mode == KX_MODE_REJECT) {
+        printf("Client's private key (a): %lld\n", a);
+    }
 
     int client_sock;
     struct sockaddr_in server_addr;
 
-    // Create socket
-    client_sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (client_sock < 0) {
-        perror("Socket creation failed");
-        exit(1);
-    }
-    printf("TCP client socket created.\n");
-
     // Configure server address
     memset(&server_addr, '\0', sizeof(server_addr));
     server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(8080);
-    server_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
-
-    // Connect to server
-    if (connect(client_sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        perror("Connection failed");
+    server_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &server_addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid address %s\n", host);
         exit(1);
     }
+
+    if (mode != KX_MODE_REJECT) {
+        return run_negotiated(&server_addr, mode, session_path, count);
+    }
+
+    // Connect to server
+    client_sock = connect_server(&server_addr);
     printf("Connected to server.\n");
 
     // 1. Calculate client's public key (A)
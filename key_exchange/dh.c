@@ -0,0 +1,214 @@
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/random.h>
+
+#include "dh.h"
+
+#define GENERATOR 2
+#define BATCH 16 // pairs per bn_modexp_batch() call, bounding stack use
+
+// RFC 3526 section 3: the 2048-bit MODP group, generator 2
+static const char modp2048[] =
+    "FFFFFFFFFFFFFFFFC90FDAA22168C234C4C6628B80DC1CD129024E088A67CC74"
+    "020BBEA63B139B22514A08798E3404DDEF9519B3CD3A431B302B0A6DF25F1437"
+    "4FE1356D6D51C245E485B576625E7EC6F44C42E9A637ED6B0BFF5CB6F406B7ED"
+    "EE386BFB5A899FA5AE9F24117C4B1FE649286651ECE45B3DC2007CB8A163BF05"
+    "98DA48361C55D39A69163FA8FD24CF5F83655D23DCA3AD961C62F356208552BB"
+    "9ED529077096966D670C354E4ABC9804F1746C08CA18217C32905E462E36CE3B"
+    "E39E772C180E86039B2783A2EC07A28FB5C55DF06F4C52C9DE2BCBF695581718"
+    "3995497CEA956AE515D2261898FA051015728E5A8AACAA68FFFFFFFFFFFFFFFF";
+
+// RFC 3526 section 4: the 3072-bit MODP group, generator 2
+static const char modp3072[] =
+    "FFFFFFFFFFFFFFFFC90FDAA22168C234C4C6628B80DC1CD129024E088A67CC74"
+    "020BBEA63B139B22514A08798E3404DDEF9519B3CD3A431B302B0A6DF25F1437"
+    "4FE1356D6D51C245E485B576625E7EC6F44C42E9A637ED6B0BFF5CB6F406B7ED"
+    "EE386BFB5A899FA5AE9F24117C4B1FE649286651ECE45B3DC2007CB8A163BF05"
+    "98DA48361C55D39A69163FA8FD24CF5F83655D23DCA3AD961C62F356208552BB"
+    "9ED529077096966D670C354E4ABC9804F1746C08CA18217C32905E462E36CE3B"
+    "E39E772C180E86039B2783A2EC07A28FB5C55DF06F4C52C9DE2BCBF695581718"
+    "3995497CEA956AE515D2261898FA051015728E5A8AAAC42DAD33170D04507A33"
+    "A85521ABDF1CBA64ECFB850458DBEF0A8AEA71575D060C7DB3970F85A6E1E4C7"
+    "ABF5AE8CDB0933D71E8C94E04A25619DCEE3D2261AD2EE6BF12FFA06D98A0864"
+    "D87602733EC86A64521F2B18177B200CBBE117577A615D6C770988C0BAD946E2"
+    "08E24FA074E5AB3143DB5BFCE0FD108E4B82D120A93AD2CAFFFFFFFFFFFFFFFF";
+
+// RFC 3526 section 5: the 4096-bit MODP group, generator 2
+static const char modp4096[] =
+    "FFFFFFFFFFFFFFFFC90FDAA22168C234C4C6628B80DC1CD129024E088A67CC74"
+    "020BBEA63B139B22514A08798E3404DDEF9519B3CD3A431B302B0A6DF25F1437"
+    "4FE1356D6D51C245E485B576625E7EC6F44C42E9A637ED6B0BFF5CB6F406B7ED"
+    "EE386BFB5A899FA5AE9F24117C4B1FE649286651ECE45B3DC2007CB8A163BF05"
+    "98DA48361C55D39A69163FA8FD24CF5F83655D23DCA3AD961C62F356208552BB"
+    "9ED529077096966D670C354E4ABC9804F1746C08CA18217C32905E462E36CE3B"
+    "E39E772C180E86039B2783A2EC07A28FB5C55DF06F4C52C9DE2BCBF695581718"
+    "3995497CEA956AE515D2261898FA051015728E5A8AAAC42DAD33170D04507A33"
+    "A85521ABDF1CBA64ECFB850458DBEF0A8AEA71575D060C7DB3970F85A6E1E4C7"
+    "ABF5AE8CDB0933D71E8C94E04A25619DCEE3D2261AD2EE6BF12FFA06D98A0864"
+    "D87602733EC86A64521F2B18177B200CBBE117577A615D6C770988C0BAD946E2"
+    "08E24FA074E5AB3143DB5BFCE0FD108E4B82D120A92108011A723C12A787E6D7"
+    "88719A10BDBA5B2699C327186AF4E23C1A946834B6150BDA2583E9CA2AD44CE8"
+    "DBBBC2DB04DE8EF92E8EFC141FBECAA6287C59474E6BC05D99B2964FA090C3A2"
+    "233BA186515BE7ED1F612970CEE2D7AFB81BDD762170481CD0069127D5B05AA9"
+    "93B4EA988D8FDDC186FFB7DC90A6C08F4DF435C934063199FFFFFFFFFFFFFFFF";
+
+// Exponent lengths are RFC 3526's upper estimates of twice the strength
+static struct dh_group groups[] = {
+    { "modp2048", 2048, 320, 2048 / 8 },
+    { "modp3072", 3072, 420, 3072 / 8 },
+    { "modp4096", 4096, 480, 4096 / 8 },
+};
+static const char *const primes[] = { modp2048, modp3072, modp4096 };
+static pthread_once_t groups_once = PTHREAD_ONCE_INIT;
+
+static int hex_value(char c) {
+    return c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+}
+
+static void groups_init(void) {
+    unsigned char bytes[DH_MAX_BYTES];
+    uint64_t p[BN_MAX_LIMBS];
+
+    for (size_t i = 0; i < sizeof(groups) / sizeof(groups[0]); i++) {
+        struct dh_group *g = &groups[i];
+        size_t n = g->bits / 64;
+        for (size_t j = 0; j < g->bytes; j++) {
+            bytes[j] = (unsigned char)(hex_value(primes[i][2 * j]) << 4 | hex_value(primes[i][2 * j + 1]));
+        }
+        bn_from_bytes(p, n, bytes, g->bytes);
+        mont_init(&g->mont, p, n);
+        memcpy(g->p_minus_1, p, n * sizeof(*p));
+        g->p_minus_1[0]--; // p is odd
+    }
+}
+
+const struct dh_group *dh_group_find(unsigned bits) {
+    pthread_once(&groups_once, groups_init);
+    for (size_t i = 0; i < sizeof(groups) / sizeof(groups[0]); i++) {
+        if (groups[i].bits == bits) {
+            return &groups[i];
+        }
+    }
+    return NULL;
+}
+
+// A random exponent of exactly exp_bits bits, the top one set so it is
+// never short (or zero)
+static int random_exponent(const struct dh_group *group, struct dh_key *key) {
+    size_t exp_limbs = (group->exp_bits + 63) / 64;
+    size_t got = 0;
+
+    memset(key, 0, sizeof(*key));
+    key->group = group;
+    while (got < exp_limbs * sizeof(uint64_t)) {
+        ssize_t r = getrandom((char *)key->x + got, exp_limbs * sizeof(uint64_t) - got, 0);
+        if (r < 0 && errno != EINTR) {
+            return -1;
+        }
+        got += r > 0 ? (size_t)r : 0;
+    }
+    if (group->exp_bits % 64 != 0) {
+        key->x[exp_limbs - 1] &= (1ULL << (group->exp_bits % 64)) - 1;
+    }
+    key->x[(group->exp_bits - 1) / 64] |= 1ULL << ((group->exp_bits - 1) % 64);
+    return 0;
+}
+
+int dh_keygen(const struct dh_group *group, struct dh_key *key) {
+    uint64_t base[BN_MAX_LIMBS] = { GENERATOR };
+    uint64_t y[BN_MAX_LIMBS];
+
+    if (random_exponent(group, key) < 0) {
+        return -1;
+    }
+    bn_modexp(&group->mont, y, base, key->x, group->exp_bits);
+    bn_to_bytes(y, group->mont.n, key->pub, group->bytes);
+    return 0;
+}
+
+int dh_keygen_batch(const struct dh_group *group, struct dh_key *const *keys, size_t count) {
+    static const uint64_t base[BN_MAX_LIMBS] = { GENERATOR };
+    uint64_t y[BATCH][BN_MAX_LIMBS];
+    uint64_t *r[BATCH];
+    const uint64_t *bases[BATCH], *exps[BATCH];
+
+    for (size_t done = 0; done < count; done += BATCH) {
+        size_t n = count - done < BATCH ? count - done : BATCH;
+        for (size_t i = 0; i < n; i++) {
+            if (random_exponent(group, keys[done + i]) < 0) {
+                return -1;
+            }
+            r[i] = y[i];
+            bases[i] = base;
+            exps[i] = keys[done + i]->x;
+        }
+        bn_modexp_batch(&group->mont, r, bases, exps, group->exp_bits, n);
+        for (size_t i = 0; i < n; i++) {
+            bn_to_bytes(y[i], group->mont.n, keys[done + i]->pub, group->bytes);
+        }
+    }
+    return 0;
+}
+
+// The peer's public value as a number, or -1 if it is outside [2, p - 2]:
+// 0, 1 and p - 1 would pin the secret to a known value
+static int peer_value(const struct dh_group *group, const unsigned char *peer, uint64_t *y) {
+    static const uint64_t one[BN_MAX_LIMBS] = { 1 };
+    size_t n = group->mont.n;
+
+    if (bn_from_bytes(y, n, peer, group->bytes) < 0 ||
+        bn_cmp(y, one, n) <= 0 || bn_cmp(y, group->p_minus_1, n) >= 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int dh_derive(const struct dh_key *key, const unsigned char *peer, unsigned char *secret) {
+    const struct dh_group *group = key->group;
+    uint64_t y[BN_MAX_LIMBS], z[BN_MAX_LIMBS];
+
+    if (peer_value(group, peer, y) < 0) {
+        return -1;
+    }
+    bn_modexp(&group->mont, z, y, key->x, group->exp_bits);
+    bn_to_bytes(z, group->mont.n, secret, group->bytes);
+    memset(z, 0, sizeof(z));
+    return 0;
+}
+
+void dh_derive_batch(const struct dh_key *const *keys, const unsigned char *const *peers,
+                     unsigned char *const *secrets, int *results, size_t count) {
+    uint64_t y[BATCH][BN_MAX_LIMBS];
+    uint64_t *r[BATCH];
+    const uint64_t *bases[BATCH], *exps[BATCH];
+    size_t index[BATCH];
+
+    // Pairs with a bad peer value drop out before the exponentiations
+    for (size_t next = 0; next < count; ) {
+        const struct dh_group *group = keys[next]->group;
+        size_t n = 0;
+        for (; next < count && n < BATCH; next++) {
+            results[next] = peer_value(group, peers[next], y[n]);
+            if (results[next] == 0) {
+                r[n] = y[n];
+                bases[n] = y[n];
+                exps[n] = keys[next]->x;
+                index[n++] = next;
+            }
+        }
+        bn_modexp_batch(&group->mont, r, bases, exps, group->exp_bits, n);
+        for (size_t i = 0; i < n; i++) {
+            bn_to_bytes(y[i], group->mont.n, secrets[index[i]], group->bytes);
+        }
+        memset(y, 0, n * sizeof(y[0]));
+    }
+}
+
+void dh_key_clear(struct dh_key *key) {
+    // A volatile pointer keeps the compiler from dropping the dead store
+    volatile unsigned char *p = (volatile unsigned char *)key->x;
+    for (size_t i = 0; i < sizeof(key->x); i++) {
+        p[i] = 0;
+    }
+}
@@ -0,0 +1,53 @@
+// Finite-field Diffie-Hellman over the RFC 3526 MODP groups
+//
+// Public values travel as big-endian numbers of exactly the group's size.
+// Private exponents are drawn from getrandom() and are as long as RFC 3526
+// suggests for the group's strength, which makes them several times
+// shorter than the modulus and each exponentiation correspondingly cheaper.
+#ifndef DH_H
+#define DH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bignum.h"
+
+#define DH_MAX_BYTES (BN_MAX_BITS / 8)
+
+struct dh_group {
+    const char *name;
+    unsigned bits;
+    unsigned exp_bits; // private exponent length
+    size_t bytes;      // public values and the shared secret on the wire
+    struct mont_ctx mont;
+    uint64_t p_minus_1[BN_MAX_LIMBS];
+};
+
+struct dh_key {
+    const struct dh_group *group;
+    uint64_t x[BN_MAX_LIMBS]; // private exponent
+    unsigned char pub[DH_MAX_BYTES];
+};
+
+// The 2048, 3072 or 4096-bit group, or NULL for another size. Safe from
+// any thread; the groups are set up on first use.
+const struct dh_group *dh_group_find(unsigned bits);
+
+// A fresh key pair. Returns -1 with errno set if getrandom() fails.
+int dh_keygen(const struct dh_group *group, struct dh_key *key);
+
+// The shared secret for the peer's public value, group->bytes long.
+// Returns -1 if the peer's value is outside [2, p - 2].
+int dh_derive(const struct dh_key *key, const unsigned char *peer, unsigned char *secret);
+
+// dh_keygen() and dh_derive() for count keys of one group at once, on
+// bn_modexp_batch(). results[i] is what dh_derive() would return for pair i;
+// a bad peer value fails its own pair only.
+int dh_keygen_batch(const struct dh_group *group, struct dh_key *const *keys, size_t count);
+void dh_derive_batch(const struct dh_key *const *keys, const unsigned char *const *peers,
+                     unsigned char *const *secrets, int *results, size_t count);
+
+// Wipe the private exponent
+void dh_key_clear(struct dh_key *key);
+
+#endif
@@ -0,0 +1,412 @@
+// Handshake benchmark for the Diffie-Hellman engine
+//
+// First checks the Montgomery exponentiation: against power() for random
+// one-limb moduli, by Fermat (2^(p-1) = 1) for every group, and that both
+// sides of an exchange agree; and every batch kernel the CPU supports
+// against bn_modexp(). Then, for each RFC 3526 group, times one side of a
+// handshake (key generation plus deriving the secret, so two
+// exponentiations) and prints handshakes/sec, and times deriving secrets
+// BURST at a time with each batch kernel, as server.c does under load.
+// X25519 is checked against the RFC 7748 test vectors and timed the same
+// way (two scalar multiplications), as is the toy P = 23 exchange of
+// server.c and client.c.
+// Last, the server's side of a ticket resumption: open the ticket, derive
+// the secrets and seal the next ticket, after checking SHA-256, HMAC and
+// ChaCha20 against their RFC vectors and tickets against tampering,
+// expiry and key rotation. -c runs the checks alone, as ctest does.
+//
+//   ./kx_bench [-c] [-d seconds per group]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/random.h>
+
+#include "dh.h"
+#include "kx_ticket.h"
+#include "x25519.h"
+
+#define SMALL_CHECKS 10000
+#define BATCH_CHECKS 11 // not a multiple of any kernel's lanes
+#define BURST 64
+
+static const char *const kernels[] = { "ifma", "avx2", "scalar" };
+
+long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// The original helper from server.c and client.c
+long long int power(long long int base, long long int exp, long long int mod) {
+    long long int res = 1;
+    base %= mod;
+    while (exp > 0) {
+        if (exp % 2 == 1) res = (res * base) % mod;
+        base = (base * base) % mod;
+        exp /= 2;
+    }
+    return res;
+}
+
+// xorshift64*, so runs are reproducible
+static uint64_t rng_state = 0x2545F4914F6CDD1DULL;
+
+uint64_t random64(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+void check(int ok, const char *what) {
+    if (!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void from_hex(unsigned char *out, const char *hex) {
+    for (size_t i = 0; hex[2 * i] != '\0'; i++) {
+        sscanf(hex + 2 * i, "%2hhx", &out[i]);
+    }
+}
+
+// RFC 7748 section 5.2 and 6.1
+void x25519_self_test(void) {
+    static const char *vectors[][3] = {
+        { "a546e36bf0527c9d3b16154b82465edd62144c0ac1fc5a18506a2244ba449ac4",
+          "e6db6867583030db3594c1a424b15f7c726624ec26b3353b10a903a6d0ab1c4c",
+          "c3da55379de9c6908e94ea4df28d084f32eccf03491c71f754b4075577a28552" },
+        { "4b66e9d4d1b4673c5ad22691957d6af5c11b6421e0ea01d42ca4169e7918ba0d",
+          "e5210f12786811d3f4b7959d0538ae2c31dbe7106fc03c3efc4cd549c715a493",
+          "95cbde9476e8907d7aade45cb4b873f88b595a68799fa152e6f8f7647aac7957" },
+        { "77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a",
+          "de9edb7d7b7dc1b4d35b61c2ece435373f8343c85b78674dadfc7e146f882b4f",
+          "4a5d9d5ba4ce2de1728e3bf480350f25e07e21c947d19e3376f09b3c1e161742" },
+    };
+    static const uint8_t base[X25519_BYTES] = { 9 };
+    uint8_t k[X25519_BYTES], u[X25519_BYTES], want[X25519_BYTES], out[X25519_BYTES];
+    uint8_t a[X25519_BYTES], b[X25519_BYTES], pa[X25519_BYTES], pb[X25519_BYTES];
+
+    for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+        from_hex(k, vectors[i][0]);
+        from_hex(u, vectors[i][1]);
+        from_hex(want, vectors[i][2]);
+        check(x25519(out, k, u) == 0 && memcmp(out, want, sizeof(out)) == 0, "x25519 test vector");
+    }
+
+    // Vector 3 is Alice's side of the section 6.1 exchange; Bob's public
+    // key derives from his private key, and his side gets the same secret
+    from_hex(a, vectors[2][0]);
+    from_hex(b, "5dab087e624a8a4b79e17f8b83800ee66f3bb1292618b6fd1c2f8b27ff88e0eb");
+    from_hex(want, vectors[2][1]);
+    check(x25519(pb, b, base) == 0 && memcmp(pb, want, sizeof(pb)) == 0, "x25519 public key");
+    from_hex(want, vectors[2][2]);
+    check(x25519(pa, a, base) == 0 && x25519(out, b, pa) == 0 &&
+          memcmp(out, want, sizeof(out)) == 0, "x25519 shared secret");
+
+    memset(u, 0, sizeof(u));
+    check(x25519(out, a, u) < 0, "x25519 rejects the zero point");
+}
+
+void check_hex(const uint8_t *got, const char *hex, const char *what) {
+    uint8_t want[64];
+    size_t len = strlen(hex) / 2;
+
+    from_hex(want, hex);
+    check(memcmp(got, want, len) == 0, what);
+}
+
+void ticket_self_test(void) {
+    static const char abc[] = "abc";
+    uint8_t out[64], zero[64] = { 0 }, key[CHACHA20_KEY_BYTES], nonce[CHACHA20_NONCE_BYTES] = { 0 };
+    uint8_t hmac_key[20];
+    struct sha256 s;
+
+    sha256_init(&s);
+    sha256_update(&s, abc, 3);
+    sha256_final(&s, out);
+    check_hex(out, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", "SHA-256 of \"abc\"");
+    // RFC 4231 test case 1
+    memset(hmac_key, 0x0b, sizeof(hmac_key));
+    hmac_sha256(hmac_key, sizeof(hmac_key), "Hi There", 8, NULL, 0, out);
+    check_hex(out, "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7", "HMAC-SHA256");
+    // RFC 8439 section 2.3.2
+    for (int i = 0; i < CHACHA20_KEY_BYTES; i++) {
+        key[i] = (uint8_t)i;
+    }
+    nonce[3] = 0x09;
+    nonce[7] = 0x4a;
+    chacha20_xor(out, zero, 64, key, nonce, 1);
+    check_hex(out, "10f1e7e4d13b5915500fdd1fa32071c4c7d1f4c733c068030422aa9ac3d46c4e"
+                   "d2826446079faa0914c2d705d98b02a2b5129cd1de164eb9cbd083e8a2503c4e", "ChaCha20 block");
+
+    struct kx_tickets t;
+    uint8_t session[KX_SESSION_BYTES], opened[KX_SESSION_BYTES], ticket[KX_TICKET_BYTES];
+    unsigned char mode;
+    long long issued;
+    check(kx_tickets_init(&t, 1000) == 0, "kx_tickets_init");
+    memset(session, 0x5a, sizeof(session));
+    kx_ticket_seal(&t, KX_MODE_X25519, 100, session, ticket);
+    check(kx_ticket_open(&t, ticket, 200, &mode, &issued, opened) == 0 && mode == KX_MODE_X25519 &&
+          issued == 100 && memcmp(opened, session, sizeof(session)) == 0, "ticket round trip");
+    check(kx_ticket_open(&t, ticket, 1100, &mode, &issued, opened) < 0, "an expired ticket is refused");
+    for (int i = 0; i < KX_TICKET_BYTES; i++) {
+        ticket[i] ^= 1;
+        check(kx_ticket_open(&t, ticket, 200, &mode, &issued, opened) < 0, "a tampered ticket is refused");
+        ticket[i] ^= 1;
+    }
+    kx_tickets_rotate(&t);
+    check(kx_ticket_open(&t, ticket, 200, &mode, &issued, opened) == 0, "a ticket opens after one rotation");
+    kx_tickets_rotate(&t);
+    check(kx_ticket_open(&t, ticket, 200, &mode, &issued, opened) < 0, "a ticket is refused after two");
+    kx_tickets_clear(&t);
+}
+
+// Random values below m (top limb cleared) and full-length exponents
+void batch_self_test(const struct mont_ctx *ctx, unsigned exp_bits) {
+    static uint64_t base[BATCH_CHECKS][BN_MAX_LIMBS], exp[BATCH_CHECKS][BN_MAX_LIMBS];
+    static uint64_t want[BATCH_CHECKS][BN_MAX_LIMBS], got[BATCH_CHECKS][BN_MAX_LIMBS];
+    uint64_t *r[BATCH_CHECKS];
+    const uint64_t *b[BATCH_CHECKS], *e[BATCH_CHECKS];
+
+    for (int i = 0; i < BATCH_CHECKS; i++) {
+        for (size_t j = 0; j < BN_MAX_LIMBS; j++) {
+            base[i][j] = j + 1 < ctx->n ? random64() : 0;
+            exp[i][j] = random64();
+        }
+        base[i][0] |= ctx->n == 1 ? 0 : 1;
+        base[i][0] %= ctx->n == 1 ? ctx->m[0] : UINT64_MAX;
+        bn_modexp(ctx, want[i], base[i], exp[i], exp_bits);
+        r[i] = got[i];
+        b[i] = base[i];
+        e[i] = exp[i];
+    }
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        if (bn_batch_use(kernels[k]) < 0) {
+            continue;
+        }
+        memset(got, 0xff, sizeof(got));
+        bn_modexp_batch(ctx, r, b, e, exp_bits, BATCH_CHECKS);
+        for (int i = 0; i < BATCH_CHECKS; i++) {
+            check(bn_cmp(got[i], want[i], ctx->n) == 0, kernels[k]);
+        }
+    }
+}
+
+void self_test(void) {
+    const char *best = bn_batch_kernel();
+    struct mont_ctx ctx;
+
+    // power() is exact below 2^31
+    for (int i = 0; i < SMALL_CHECKS; i++) {
+        uint64_t m = (random64() % (1ULL << 31)) | 1;
+        uint64_t base = random64() % m;
+        uint64_t exp = random64() >> 32;
+        uint64_t r;
+        if (m < 3) {
+            continue;
+        }
+        mont_init(&ctx, &m, 1);
+        bn_modexp(&ctx, &r, &base, &exp, 32);
+        check(r == (uint64_t)power(base, exp, m), "modexp against power()");
+        if (i % 100 == 0) {
+            batch_self_test(&ctx, 64);
+        }
+    }
+
+    for (unsigned bits = 2048; bits <= 4096; bits += 1024) {
+        const struct dh_group *g = dh_group_find(bits);
+        uint64_t two[BN_MAX_LIMBS] = { 2 }, r[BN_MAX_LIMBS], one[BN_MAX_LIMBS] = { 1 };
+        unsigned char s1[DH_MAX_BYTES], s2[DH_MAX_BYTES];
+        struct dh_key a, b;
+
+        bn_modexp(&g->mont, r, two, g->p_minus_1, g->bits);
+        check(bn_cmp(r, one, g->mont.n) == 0, "2^(p-1) mod p == 1");
+        batch_self_test(&g->mont, g->exp_bits);
+
+        check(dh_keygen(g, &a) == 0 && dh_keygen(g, &b) == 0, "dh_keygen");
+        check(dh_derive(&a, b.pub, s1) == 0 && dh_derive(&b, a.pub, s2) == 0, "dh_derive");
+        check(memcmp(s1, s2, g->bytes) == 0, "both sides derive the same secret");
+
+        memset(s1, 0, sizeof(s1));
+        s1[g->bytes - 1] = 1;
+        check(dh_derive(&a, s1, s2) < 0, "a peer value of 1 is rejected");
+    }
+    x25519_self_test();
+    ticket_self_test();
+    bn_batch_use(best);
+    printf("self test passed\n");
+}
+
+void bench_group(const struct dh_group *g, double seconds) {
+    unsigned char secret[DH_MAX_BYTES];
+    struct dh_key peer, key;
+    long handshakes = 0;
+
+    dh_keygen(g, &peer);
+    long long start = now_ns();
+    long long end = start + (long long)(seconds * 1e9);
+    long long t;
+    do {
+        dh_keygen(g, &key);
+        dh_derive(&key, peer.pub, secret);
+        handshakes++;
+    } while ((t = now_ns()) < end);
+
+    double elapsed = (t - start) / 1e9;
+    printf("%-9s %4u-bit p, %3u-bit exponent: %8.1f handshakes/sec (%8.1f us each)\n",
+           g->name, g->bits, g->exp_bits, handshakes / elapsed, elapsed * 1e6 / handshakes);
+    dh_key_clear(&key);
+    dh_key_clear(&peer);
+}
+
+// Deriving BURST secrets from the same server key pair per call, each
+// kernel in turn; the one chosen for this CPU is starred
+void bench_burst(const struct dh_group *g, double seconds) {
+    const char *best = bn_batch_kernel();
+    static unsigned char secrets[BURST][DH_MAX_BYTES];
+    const struct dh_key *keys[BURST];
+    const unsigned char *peers[BURST];
+    unsigned char *out[BURST];
+    int results[BURST];
+    struct dh_key peer, key;
+
+    dh_keygen(g, &peer);
+    dh_keygen(g, &key);
+    for (int i = 0; i < BURST; i++) {
+        keys[i] = &key;
+        peers[i] = peer.pub;
+        out[i] = secrets[i];
+    }
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        long derives = 0;
+        if (bn_batch_use(kernels[k]) < 0) {
+            continue;
+        }
+        long long start = now_ns();
+        long long end = start + (long long)(seconds * 1e9);
+        long long t;
+        do {
+            dh_derive_batch(keys, peers, out, results, BURST);
+            derives += BURST;
+        } while ((t = now_ns()) < end);
+
+        double elapsed = (t - start) / 1e9;
+        printf("%-9s burst of %d, %-6s kernel%s %8.1f derives/sec    (%8.1f us each)\n", g->name, BURST,
+               kernels[k], strcmp(kernels[k], best) == 0 ? "*:" : ": ", derives / elapsed,
+               elapsed * 1e6 / derives);
+    }
+    bn_batch_use(best);
+    dh_key_clear(&key);
+    dh_key_clear(&peer);
+}
+
+void bench_x25519(double seconds) {
+    uint8_t peer_priv[X25519_BYTES], peer[X25519_BYTES];
+    uint8_t priv[X25519_BYTES], pub[X25519_BYTES], secret[X25519_BYTES];
+    long handshakes = 0;
+
+    x25519_keygen(peer_priv, peer);
+    long long start = now_ns();
+    long long end = start + (long long)(seconds * 1e9);
+    long long t;
+    do {
+        x25519_keygen(priv, pub);
+        x25519(secret, priv, peer);
+        handshakes++;
+    } while ((t = now_ns()) < end);
+
+    double elapsed = (t - start) / 1e9;
+    printf("%-9s %4u-bit p, %3u-bit scalar:   %8.1f handshakes/sec (%8.1f us each)\n",
+           "x25519", 255, 255, handshakes / elapsed, elapsed * 1e6 / handshakes);
+}
+
+// What answer_resume() in server.c does for one client
+void bench_resume(double seconds) {
+    uint8_t session[KX_SESSION_BYTES], secret[KX_SESSION_BYTES], next[KX_SESSION_BYTES];
+    uint8_t ticket[KX_TICKET_BYTES], client_nonce[KX_NONCE_BYTES] = { 1 }, server_nonce[KX_NONCE_BYTES];
+    struct kx_tickets t;
+    unsigned char mode;
+    long long issued;
+    long resumptions = 0;
+
+    kx_tickets_init(&t, 3600 * 1000000000LL);
+    memset(session, 0x5a, sizeof(session));
+    kx_ticket_seal(&t, KX_MODE_X25519, now_ns(), session, ticket);
+    long long start = now_ns();
+    long long end = start + (long long)(seconds * 1e9);
+    long long t_now;
+    do {
+        t_now = now_ns();
+        if (kx_ticket_open(&t, ticket, t_now, &mode, &issued, session) < 0 ||
+            getrandom(server_nonce, sizeof(server_nonce), 0) != sizeof(server_nonce)) {
+            check(0, "ticket reopens");
+        }
+        kx_resume_secrets(session, client_nonce, server_nonce, secret, next);
+        kx_ticket_seal(&t, mode, issued, next, ticket);
+        resumptions++;
+    } while (t_now < end);
+
+    double elapsed = (t_now - start) / 1e9;
+    printf("%-9s open, derive, reseal ticket: %8.1f resumptions/sec (%8.1f us each)\n",
+           "resume", resumptions / elapsed, elapsed * 1e6 / resumptions);
+    kx_tickets_clear(&t);
+}
+
+void bench_legacy(double seconds) {
+    volatile long long sink = 0;
+    long handshakes = 0;
+
+    long long start = now_ns();
+    long long end = start + (long long)(seconds * 1e9);
+    long long t;
+    do {
+        for (int i = 0; i < 1000; i++) {
+            sink += power(5, 3 + (i & 7), 23) + power(8, 3 + (i & 7), 23);
+        }
+        handshakes += 1000;
+    } while ((t = now_ns()) < end);
+
+    double elapsed = (t - start) / 1e9;
+    printf("%-9s %4u-bit p, %3u-bit exponent: %8.1f handshakes/sec (%8.3f us each)\n",
+           "toy", 5, 3, handshakes / elapsed, elapsed * 1e6 / handshakes);
+}
+
+int main(int argc, char *argv[]) {
+    double seconds = 2;
+    int check_only = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "cd:")) != -1) {
+        switch (c) {
+        case 'c': check_only = 1; break;
+        case 'd': seconds = atof(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-c] [-d seconds per group]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (seconds <= 0) {
+        fprintf(stderr, "seconds must be positive\n");
+        exit(EXIT_FAILURE);
+    }
+
+    self_test();
+    if (check_only) {
+        return 0;
+    }
+    bench_legacy(seconds);
+    for (unsigned bits = 2048; bits <= 4096; bits += 1024) {
+        bench_group(dh_group_find(bits), seconds);
+    }
+    for (unsigned bits = 2048; bits <= 4096; bits += 1024) {
+        bench_burst(dh_group_find(bits), seconds);
+    }
+    bench_x25519(seconds);
+    bench_resume(seconds);
+    return 0;
+}
@@ -0,0 +1,271 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+
+#include "kx_pool.h"
+
+#define REFILL_BATCH 8 // most pairs made per pass
+#define MISS_BATCH 64   // most misses made per kx_keygen_batch()
+
+static struct kx_ring *ring_for(struct kx_pool *pool, unsigned char mode) {
+    if (mode < KX_MODE_MODP2048 || mode >= KX_MODE_MODP2048 + KX_MODES) {
+        return NULL;
+    }
+    return &pool->rings[mode - KX_MODE_MODP2048];
+}
+
+static size_t ring_ready(struct kx_ring *r) {
+    size_t head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    size_t tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+
+    // The two loads are not one snapshot; clamp what a race can produce
+    return head - tail > r->mask + 1 ? 0 : head - tail;
+}
+
+// Slot i holds seq == i while free for the producer at position i, and
+// seq == i + 1 once filled for the consumer at position i. A consumer hands
+// it back to the producer one lap later with seq = i + capacity.
+static int ring_put(struct kx_ring *r, const struct kx_key *key) {
+    size_t pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    struct kx_pool_slot *slot;
+
+    while (1) {
+        slot = &r->slots[pos & r->mask];
+        intptr_t diff = (intptr_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&r->head, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return 0; // full
+        } else {
+            pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+        }
+    }
+    memcpy(&slot->key, key, sizeof(*key));
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static int ring_take(struct kx_ring *r, struct kx_key *key) {
+    size_t pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+    struct kx_pool_slot *slot;
+
+    while (1) {
+        slot = &r->slots[pos & r->mask];
+        intptr_t diff = (intptr_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&r->tail, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return 0; // empty, or the next pair is still being copied in
+        } else {
+            pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+        }
+    }
+    memcpy(key, &slot->key, sizeof(*key));
+    memset(&slot->key, 0, sizeof(slot->key));
+    __atomic_store_n(&slot->seq, pos + r->mask + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// Top up the emptiest ring by a few pairs at a time, so a run on one mode
+// does not wait behind a ring that is nearly full: as many as the batch
+// kernel makes for the price of one (see bignum.h), fewer if there is less
+// room. Sleep once every ring is full. SCHED_IDLE keeps refilling off CPUs
+// that have handshakes to run.
+static void *refill_main(void *arg) {
+    struct kx_pool *pool = arg;
+    struct sched_param param = { 0 };
+    struct kx_key keys[REFILL_BATCH];
+    struct kx_key *key_ptrs[REFILL_BATCH];
+    size_t batch = bn_batch_lanes() < REFILL_BATCH ? bn_batch_lanes() : REFILL_BATCH;
+
+    for (int i = 0; i < REFILL_BATCH; i++) {
+        key_ptrs[i] = &keys[i];
+    }
+
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+
+    while (!__atomic_load_n(&pool->stop, __ATOMIC_RELAXED)) {
+        struct kx_ring *emptiest = NULL;
+        size_t lowest = SIZE_MAX;
+        int index = 0;
+
+        for (int i = 0; i < KX_MODES; i++) {
+            size_t ready = ring_ready(&pool->rings[i]);
+            if (ready <= pool->rings[i].mask && ready < lowest) {
+                lowest = ready;
+                emptiest = &pool->rings[i];
+                index = i;
+            }
+        }
+        if (emptiest == NULL) {
+            sem_wait(&pool->refill);
+            continue;
+        }
+        size_t n = emptiest->mask + 1 - lowest < batch ? emptiest->mask + 1 - lowest : batch;
+        if (kx_keygen_batch(KX_MODE_MODP2048 + index, key_ptrs, n) < 0) {
+            continue; // getrandom() is not expected to fail once seeded
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (ring_put(emptiest, &keys[i])) {
+                __atomic_add_fetch(&emptiest->made, 1, __ATOMIC_RELAXED);
+            }
+            kx_key_clear(&keys[i]);
+        }
+    }
+    return NULL;
+}
+
+struct kx_pool *kx_pool_new(size_t keys, int threads) {
+    struct kx_pool *pool;
+    size_t capacity = 1;
+
+    if (keys == 0 || threads < 1) {
+        errno = EINVAL;
+        return NULL;
+    }
+    while (capacity < keys) {
+        capacity <<= 1;
+    }
+    if (posix_memalign((void **)&pool, 64, sizeof(*pool)) != 0) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(pool, 0, sizeof(*pool));
+    for (int i = 0; i < KX_MODES; i++) {
+        struct kx_ring *r = &pool->rings[i];
+        r->mask = capacity - 1;
+        r->slots = calloc(capacity, sizeof(*r->slots));
+        if (r->slots == NULL) {
+            goto fail;
+        }
+        for (size_t j = 0; j < capacity; j++) {
+            r->slots[j].seq = j;
+        }
+    }
+    sem_init(&pool->refill, 0, 0);
+    pool->threads = calloc(threads, sizeof(*pool->threads));
+    if (pool->threads == NULL) {
+        goto fail;
+    }
+    for (int i = 0; i < threads; i++) {
+        int rc = pthread_create(&pool->threads[i], NULL, refill_main, pool);
+        if (rc != 0) {
+            kx_pool_free(pool);
+            errno = rc;
+            return NULL;
+        }
+        pool->nthreads++;
+    }
+    return pool;
+
+fail:
+    for (int i = 0; i < KX_MODES; i++) {
+        free(pool->rings[i].slots);
+    }
+    free(pool);
+    errno = ENOMEM;
+    return NULL;
+}
+
+void kx_pool_free(struct kx_pool *pool) {
+    if (pool == NULL) {
+        return;
+    }
+    __atomic_store_n(&pool->stop, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < pool->nthreads; i++) {
+        sem_post(&pool->refill);
+    }
+    for (int i = 0; i < pool->nthreads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    for (int i = 0; i < KX_MODES; i++) {
+        struct kx_ring *r = &pool->rings[i];
+        memset(r->slots, 0, (r->mask + 1) * sizeof(*r->slots));
+        free(r->slots);
+    }
+    sem_destroy(&pool->refill);
+    free(pool->threads);
+    free(pool);
+}
+
+int kx_pool_take(struct kx_pool *pool, unsigned char mode, struct kx_key *key) {
+    struct kx_ring *r = ring_for(pool, mode);
+
+    if (r == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (ring_take(r, key)) {
+        __atomic_add_fetch(&r->hits, 1, __ATOMIC_RELAXED);
+        sem_post(&pool->refill);
+        return 1;
+    }
+    __atomic_add_fetch(&r->misses, 1, __ATOMIC_RELAXED);
+    sem_post(&pool->refill);
+    return kx_keygen(mode, key) < 0 ? -1 : 0;
+}
+
+int kx_pool_take_batch(struct kx_pool *pool, const unsigned char *modes, struct kx_key *const *keys,
+                       size_t count) {
+    struct kx_key *missed[MISS_BATCH];
+    int hits = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (ring_for(pool, modes[i]) == NULL) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    for (int m = 0; m < KX_MODES; m++) {
+        struct kx_ring *r = &pool->rings[m];
+        unsigned char mode = KX_MODE_MODP2048 + m;
+        size_t n = 0;
+
+        for (size_t i = 0; i < count; i++) {
+            if (modes[i] != mode) {
+                continue;
+            }
+            if (ring_take(r, keys[i])) {
+                __atomic_add_fetch(&r->hits, 1, __ATOMIC_RELAXED);
+                hits++;
+            } else {
+                __atomic_add_fetch(&r->misses, 1, __ATOMIC_RELAXED);
+                missed[n++] = keys[i];
+            }
+            sem_post(&pool->refill);
+            if (n == MISS_BATCH) {
+                if (kx_keygen_batch(mode, missed, n) < 0) {
+                    return -1;
+                }
+                n = 0;
+            }
+        }
+        if (n > 0 && kx_keygen_batch(mode, missed, n) < 0) {
+            return -1;
+        }
+    }
+    return hits;
+}
+
+void kx_pool_read_stats(struct kx_pool *pool, unsigned char mode, struct kx_pool_stats *stats) {
+    struct kx_ring *r = ring_for(pool, mode);
+
+    memset(stats, 0, sizeof(*stats));
+    if (r == NULL) {
+        return;
+    }
+    stats->hits = __atomic_load_n(&r->hits, __ATOMIC_RELAXED);
+    stats->misses = __atomic_load_n(&r->misses, __ATOMIC_RELAXED);
+    stats->made = __atomic_load_n(&r->made, __ATOMIC_RELAXED);
+    stats->ready = ring_ready(r);
+    stats->capacity = r->mask + 1;
+}
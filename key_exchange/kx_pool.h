@@ -0,0 +1,76 @@
+// Pool of ready-made ephemeral key pairs, one ring per handshake mode
+//
+// Background threads fill the rings with pairs from getrandom(), so a
+// handshake only has to derive the shared secret. Each ring is a bounded
+// multi-producer multi-consumer queue (a sequence number per slot, claimed
+// with compare-and-swap); taking a key never blocks and never takes a
+// lock. A key leaves the ring by copy and its slot is wiped before it is
+// reused, so every pair is handed out exactly once.
+//
+// When a ring runs dry, kx_pool_take() makes the pair itself and counts a
+// miss; the pool only ever moves key generation off the hot path.
+// kx_pool_take_batch() makes its misses in one batch per mode.
+#ifndef KX_POOL_H
+#define KX_POOL_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "kx_proto.h"
+
+struct kx_pool_slot {
+    size_t seq;
+    struct kx_key key;
+};
+
+// The producers' index, the consumers' index, the read-only fields and the
+// counters each get a cache line, so one side's writes do not keep
+// invalidating the other's reads
+struct kx_ring {
+    size_t head __attribute__((aligned(64))); // next slot to fill
+    size_t tail __attribute__((aligned(64))); // next slot to take
+    size_t mask __attribute__((aligned(64)));
+    struct kx_pool_slot *slots;
+    unsigned long long hits __attribute__((aligned(64))); // taken from the ring
+    unsigned long long misses; // made on the spot
+    unsigned long long made;   // by the background threads
+};
+
+struct kx_pool_stats {
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long made;
+    size_t ready;    // in the ring right now
+    size_t capacity;
+};
+
+struct kx_pool {
+    struct kx_ring rings[KX_MODES];
+    sem_t refill; // posted after every take
+    int stop;
+    int nthreads;
+    pthread_t *threads;
+};
+
+// A pool of at least keys pairs per mode (rounded up to a power of two),
+// filled by threads background threads, which start right away. NULL with
+// errno set on failure.
+struct kx_pool *kx_pool_new(size_t keys, int threads);
+// Stop the threads and wipe every key left in the pool
+void kx_pool_free(struct kx_pool *pool);
+
+// A key pair for mode: from the pool if one is ready, otherwise made on the
+// spot. Safe from any thread. Returns 1 for a pooled pair, 0 for a fresh
+// one, -1 with errno set if getrandom() fails.
+int kx_pool_take(struct kx_pool *pool, unsigned char mode, struct kx_key *key);
+// kx_pool_take() for count pairs, of modes[i] each; the pairs the pool
+// cannot supply are made together with kx_keygen_batch(). Returns how many
+// came from the pool, or -1 with errno set.
+int kx_pool_take_batch(struct kx_pool *pool, const unsigned char *modes, struct kx_key *const *keys,
+                       size_t count);
+
+// The counters for one mode, read while the pool is in use
+void kx_pool_read_stats(struct kx_pool *pool, unsigned char mode, struct kx_pool_stats *stats);
+
+#endif
@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+
+#include "kx_proto.h"
+
+static const struct {
+    unsigned char mode;
+    const char *name;
+    unsigned bits; // MODP group size, 0 for X25519
+} modes[] = {
+    { KX_MODE_MODP2048, "modp2048", 2048 },
+    { KX_MODE_MODP3072, "modp3072", 3072 },
+    { KX_MODE_MODP4096, "modp4096", 4096 },
+    { KX_MODE_X25519, "x25519", 0 },
+};
+
+#define NMODES (sizeof(modes) / sizeof(modes[0]))
+#define BATCH 64 // pairs gathered per dh_*_batch() call
+
+const char *kx_mode_name(unsigned char mode) {
+    for (size_t i = 0; i < NMODES; i++) {
+        if (modes[i].mode == mode) {
+            return modes[i].name;
+        }
+    }
+    return NULL;
+}
+
+unsigned char kx_mode_find(const char *name) {
+    for (size_t i = 0; i < NMODES; i++) {
+        if (strcmp(modes[i].name, name) == 0) {
+            return modes[i].mode;
+        }
+    }
+    return KX_MODE_REJECT;
+}
+
+static unsigned mode_bits(unsigned char mode) {
+    for (size_t i = 0; i < NMODES; i++) {
+        if (modes[i].mode == mode) {
+            return modes[i].bits;
+        }
+    }
+    return 0;
+}
+
+int send_all(int fd, const void *buf, size_t len) {
+    for (size_t done = 0; done < len; ) {
+        ssize_t n = send(fd, (const char *)buf + done, len - done, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+int recv_all(int fd, void *buf, size_t len) {
+    for (size_t done = 0; done < len; ) {
+        ssize_t n = recv(fd, (char *)buf + done, len - done, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+// Send [mode][pub] and receive the peer's public key, the client first.
+// The client also checks that the server accepted the mode.
+static int swap_keys(int sock, unsigned char mode, int server, const unsigned char *pub,
+                     unsigned char *peer, size_t len) {
+    unsigned char msg[1 + KX_MAX_KEY];
+    unsigned char reply;
+
+    msg[0] = mode;
+    memcpy(msg + 1, pub, len);
+    if (server) {
+        return recv_all(sock, peer, len) < 0 || send_all(sock, msg, 1 + len) < 0 ? -1 : 0;
+    }
+    if (send_all(sock, msg, 1 + len) < 0 || recv_all(sock, &reply, 1) < 0) {
+        return -1;
+    }
+    if (reply != mode) {
+        fprintf(stderr, "Server does not support %s\n", kx_mode_name(mode & ~KX_FLAG_TICKET));
+        return -1;
+    }
+    return recv_all(sock, peer, len);
+}
+
+size_t kx_key_len(unsigned char mode) {
+    if (mode == KX_MODE_X25519) {
+        return X25519_BYTES;
+    }
+    const struct dh_group *group = dh_group_find(mode_bits(mode));
+    return group != NULL ? group->bytes : 0;
+}
+
+int kx_keygen(unsigned char mode, struct kx_key *key) {
+    key->mode = mode;
+    if (mode == KX_MODE_X25519) {
+        return x25519_keygen(key->x25519.priv, key->x25519.pub);
+    }
+    return dh_keygen(dh_group_find(mode_bits(mode)), &key->dh);
+}
+
+const unsigned char *kx_key_pub(const struct kx_key *key) {
+    return key->mode == KX_MODE_X25519 ? key->x25519.pub : key->dh.pub;
+}
+
+int kx_derive(const struct kx_key *key, const unsigned char *peer, unsigned char *secret) {
+    if (key->mode == KX_MODE_X25519) {
+        return x25519(secret, key->x25519.priv, peer);
+    }
+    return dh_derive(&key->dh, peer, secret);
+}
+
+int kx_keygen_batch(unsigned char mode, struct kx_key *const *keys, size_t count) {
+    const struct dh_group *group = dh_group_find(mode_bits(mode));
+    struct dh_key *dh[BATCH];
+
+    for (size_t done = 0; done < count; ) {
+        size_t n = 0;
+        for (; done < count && n < BATCH; done++) {
+            keys[done]->mode = mode;
+            if (mode == KX_MODE_X25519) {
+                if (x25519_keygen(keys[done]->x25519.priv, keys[done]->x25519.pub) < 0) {
+                    return -1;
+                }
+            } else {
+                dh[n++] = &keys[done]->dh;
+            }
+        }
+        if (n > 0 && dh_keygen_batch(group, dh, n) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void kx_derive_batch(const struct kx_key *const *keys, const unsigned char *const *peers,
+                     unsigned char *const *secrets, int *results, size_t count) {
+    const struct dh_key *dh[BATCH];
+    const unsigned char *dh_peers[BATCH];
+    unsigned char *dh_secrets[BATCH];
+    int dh_results[BATCH];
+    size_t index[BATCH];
+
+    for (size_t i = 0; i < count; i++) {
+        if (keys[i]->mode == KX_MODE_X25519) {
+            results[i] = kx_derive(keys[i], peers[i], secrets[i]);
+        }
+    }
+    // One sweep per group, so each batch shares a modulus
+    for (size_t g = 0; g < NMODES; g++) {
+        if (modes[g].bits == 0) {
+            continue;
+        }
+        for (size_t next = 0; next < count; ) {
+            size_t n = 0;
+            for (; next < count && n < BATCH; next++) {
+                if (keys[next]->mode == modes[g].mode) {
+                    dh[n] = &keys[next]->dh;
+                    dh_peers[n] = peers[next];
+                    dh_secrets[n] = secrets[next];
+                    index[n++] = next;
+                }
+            }
+            dh_derive_batch(dh, dh_peers, dh_secrets, dh_results, n);
+            for (size_t i = 0; i < n; i++) {
+                results[index[i]] = dh_results[i];
+            }
+        }
+    }
+}
+
+void kx_key_clear(struct kx_key *key) {
+    if (key->mode == KX_MODE_X25519) {
+        memset(key->x25519.priv, 0, sizeof(key->x25519.priv));
+    } else {
+        dh_key_clear(&key->dh);
+    }
+}
+
+ssize_t kx_handshake(int sock, unsigned char mode, int server, struct kx_key *key,
+                     unsigned char *secret, struct kx_session *session) {
+    unsigned char peer[KX_MAX_KEY];
+    const char *name = kx_mode_name(mode);
+    size_t len = kx_key_len(mode);
+    struct kx_key fresh;
+    ssize_t rc = -1;
+
+    if (name == NULL) {
+        unsigned char reject = KX_MODE_REJECT;
+        fprintf(stderr, "Unknown handshake mode 0x%02x\n", mode);
+        if (server) {
+            send_all(sock, &reject, 1);
+        }
+        return -1;
+    }
+    if (key == NULL) {
+        key = &fresh;
+        if (kx_keygen(mode, key) < 0) {
+            perror("getrandom");
+            return -1;
+        }
+    }
+
+    unsigned char wire_mode = session != NULL ? mode | KX_FLAG_TICKET : mode;
+    if (swap_keys(sock, wire_mode, server, kx_key_pub(key), peer, len) < 0 ||
+        (session != NULL && recv_all(sock, session->ticket, KX_TICKET_BYTES) < 0)) {
+        fprintf(stderr, "Exchange failed: connection closed\n");
+    } else if (kx_derive(key, peer, secret) < 0) {
+        fprintf(stderr, "Peer's public key is out of range or of low order\n");
+    } else {
+        rc = (ssize_t)len;
+        if (session != NULL) {
+            session->mode = mode;
+            kx_session_secret(secret, len, session->secret);
+        }
+    }
+    kx_key_clear(key);
+    return rc;
+}
+
+void kx_session_secret(const unsigned char *shared, size_t len, uint8_t out[KX_SESSION_BYTES]) {
+    static const char label[] = "kx resumption";
+
+    hmac_sha256(shared, len, label, sizeof(label) - 1, NULL, 0, out);
+}
+
+void kx_resume_secrets(const uint8_t session[KX_SESSION_BYTES],
+                       const uint8_t client_nonce[KX_NONCE_BYTES],
+                       const uint8_t server_nonce[KX_NONCE_BYTES],
+                       uint8_t secret[KX_SESSION_BYTES], uint8_t next[KX_SESSION_BYTES]) {
+    static const char resume[] = "kx resume", ratchet[] = "kx ratchet";
+    uint8_t nonces[2 * KX_NONCE_BYTES];
+
+    memcpy(nonces, client_nonce, KX_NONCE_BYTES);
+    memcpy(nonces + KX_NONCE_BYTES, server_nonce, KX_NONCE_BYTES);
+    hmac_sha256(session, KX_SESSION_BYTES, resume, sizeof(resume) - 1, nonces, sizeof(nonces), secret);
+    hmac_sha256(session, KX_SESSION_BYTES, ratchet, sizeof(ratchet) - 1, nonces, sizeof(nonces), next);
+}
+
+ssize_t kx_resume(int sock, struct kx_session *session, unsigned char *secret) {
+    unsigned char msg[1 + KX_TICKET_BYTES + KX_NONCE_BYTES];
+    uint8_t *client_nonce = msg + 1 + KX_TICKET_BYTES;
+    uint8_t server_nonce[KX_NONCE_BYTES];
+    unsigned char reply;
+
+    msg[0] = KX_MODE_RESUME;
+    memcpy(msg + 1, session->ticket, KX_TICKET_BYTES);
+    if (getrandom(client_nonce, KX_NONCE_BYTES, 0) != KX_NONCE_BYTES) {
+        perror("getrandom");
+        return -1;
+    }
+    if (send_all(sock, msg, sizeof(msg)) < 0 || recv_all(sock, &reply, 1) < 0) {
+        fprintf(stderr, "Resumption failed: connection closed\n");
+        return -1;
+    }
+    if (reply != KX_MODE_RESUME) {
+        return 0;
+    }
+    if (recv_all(sock, server_nonce, KX_NONCE_BYTES) < 0 ||
+        recv_all(sock, session->ticket, KX_TICKET_BYTES) < 0) {
+        fprintf(stderr, "Resumption failed: connection closed\n");
+        return -1;
+    }
+    uint8_t next[KX_SESSION_BYTES];
+    kx_resume_secrets(session->secret, client_nonce, server_nonce, secret, next);
+    memcpy(session->secret, next, sizeof(next));
+    memset(next, 0, sizeof(next));
+    return KX_SESSION_BYTES;
+}
+
+void kx_print_secret(const char *who, const unsigned char *secret, size_t len) {
+    printf("--------------------------------------------\n");
+    printf("Shared Secret Key computed by %s: ", who);
+    for (size_t i = 0; i < len && i < 16; i++) {
+        printf("%02x", secret[i]);
+    }
+    printf("... (%zu bytes)\n", len);
+    printf("--------------------------------------------\n");
+}
@@ -0,0 +1,124 @@
+// Handshake negotiation between key_exchange/server.c and client.c
+//
+// A negotiating client opens with one mode byte and its public key; the
+// server answers with the same mode byte and its public key, or with
+// KX_MODE_REJECT and closes. Public keys are big-endian for the MODP
+// groups and little-endian for X25519, each at its fixed size.
+//
+// A client that sets KX_FLAG_TICKET on the mode byte also gets a session
+// ticket after the server's public key (see kx_ticket.h). On a later
+// connection it may resume instead: it sends KX_MODE_RESUME, the ticket and
+// a random nonce, and the server answers KX_MODE_RESUME, its own nonce and
+// a new ticket, or KX_MODE_REJECT. Both sides then derive the new shared
+// secret, and the next resumption secret, with HMAC-SHA256 over the two
+// nonces, so resuming costs no exponentiation.
+//
+// The original client instead opens with its public key A as an 8-byte
+// long long in host byte order. For P = 23, A < 23, so that first byte is
+// below KX_MODE_BASE on either byte order, and the server can tell the two
+// apart from the first byte alone.
+#ifndef KX_PROTO_H
+#define KX_PROTO_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "dh.h"
+#include "sha256.h"
+#include "x25519.h"
+
+// Default server port, clear of tcp/ and socket_options/ on 8080
+#define KX_PORT 8090
+
+#define KX_MODE_BASE 0x80
+#define KX_MODE_REJECT 0x80
+#define KX_MODE_MODP2048 0x81
+#define KX_MODE_MODP3072 0x82
+#define KX_MODE_MODP4096 0x83
+#define KX_MODE_X25519 0x84
+#define KX_MODE_RESUME 0x85
+#define KX_FLAG_TICKET 0x40 // on a handshake mode: send a ticket too
+
+#define KX_MODES 4 // KX_MODE_MODP2048 .. KX_MODE_X25519
+
+// Largest public key or shared secret of any mode
+#define KX_MAX_KEY DH_MAX_BYTES
+
+#define KX_TICKET_BYTES 73
+#define KX_NONCE_BYTES 16
+#define KX_SESSION_BYTES SHA256_BYTES // resumption secret, and resumed keys
+
+// What a client keeps between connections to resume
+struct kx_session {
+    unsigned char mode; // of the full handshake
+    uint8_t ticket[KX_TICKET_BYTES];
+    uint8_t secret[KX_SESSION_BYTES];
+};
+
+// An ephemeral key pair for one mode
+struct kx_key {
+    unsigned char mode;
+    union {
+        struct dh_key dh;
+        struct {
+            uint8_t priv[X25519_BYTES];
+            uint8_t pub[X25519_BYTES];
+        } x25519;
+    };
+};
+
+// "x25519", "modp2048", ..., or NULL for an unknown mode
+const char *kx_mode_name(unsigned char mode);
+// The mode for a name as printed by kx_mode_name(), or KX_MODE_REJECT
+unsigned char kx_mode_find(const char *name);
+// Length of a public key, and of the shared secret, for a mode; 0 for an
+// unknown mode
+size_t kx_key_len(unsigned char mode);
+
+// A fresh key pair. Returns -1 with errno set if getrandom() fails.
+int kx_keygen(unsigned char mode, struct kx_key *key);
+const unsigned char *kx_key_pub(const struct kx_key *key);
+// The shared secret for the peer's public key, kx_key_len() bytes. Returns
+// -1 if the peer's key is out of range or a low-order point.
+int kx_derive(const struct kx_key *key, const unsigned char *peer, unsigned char *secret);
+// kx_keygen() and kx_derive() for count keys at once. The MODP ones are
+// batched by group onto dh_keygen_batch() and dh_derive_batch(); X25519
+// ones run one at a time. kx_derive_batch() takes any mix of modes and sets
+// results[i] to what kx_derive() would return.
+int kx_keygen_batch(unsigned char mode, struct kx_key *const *keys, size_t count);
+void kx_derive_batch(const struct kx_key *const *keys, const unsigned char *const *peers,
+                     unsigned char *const *secrets, int *results, size_t count);
+// Wipe the private key
+void kx_key_clear(struct kx_key *key);
+
+// send()/recv() the whole buffer. -1 on error or EOF.
+int send_all(int fd, const void *buf, size_t len);
+int recv_all(int fd, void *buf, size_t len);
+
+// One negotiated handshake over a blocking socket. The client calls it
+// right after connecting; a server after reading the client's mode byte,
+// which it passes in. key is a pair made for mode, or NULL for a fresh one;
+// either way it is wiped afterwards. A client that passes a session asks
+// for a ticket and gets it there. Returns the length of the shared secret
+// written to secret (KX_MAX_KEY bytes of room), or -1 after printing why.
+ssize_t kx_handshake(int sock, unsigned char mode, int server, struct kx_key *key,
+                     unsigned char *secret, struct kx_session *session);
+
+// Client side of a resumption. On success, writes KX_SESSION_BYTES of new
+// shared secret, updates the session for the next one and returns
+// KX_SESSION_BYTES; returns 0 if the server refused the ticket, -1 on a
+// connection error.
+ssize_t kx_resume(int sock, struct kx_session *session, unsigned char *secret);
+
+// The resumption secret of a full handshake's shared secret
+void kx_session_secret(const unsigned char *shared, size_t len, uint8_t out[KX_SESSION_BYTES]);
+// The shared secret of a resumption, and the resumption secret after it
+void kx_resume_secrets(const uint8_t session[KX_SESSION_BYTES],
+                       const uint8_t client_nonce[KX_NONCE_BYTES],
+                       const uint8_t server_nonce[KX_NONCE_BYTES],
+                       uint8_t secret[KX_SESSION_BYTES], uint8_t next[KX_SESSION_BYTES]);
+
+// Print the first bytes of a shared secret, enough to compare both ends
+void kx_print_secret(const char *who, const unsigned char *secret, size_t len);
+
+#endif
@@ -0,0 +1,125 @@
+#include <string.h>
+#include <errno.h>
+#include <sys/random.h>
+
+#include "kx_ticket.h"
+
+#define ID_BYTES 4
+#define TAG_BYTES 16
+#define PLAIN_BYTES (1 + 8 + KX_SESSION_BYTES) // mode, issued, secret
+#define CIPHER_AT (ID_BYTES + CHACHA20_NONCE_BYTES)
+#define TAG_AT (CIPHER_AT + PLAIN_BYTES)
+
+_Static_assert(TAG_AT + TAG_BYTES == KX_TICKET_BYTES, "ticket layout");
+
+static int fill_random(void *buf, size_t len) {
+    size_t got = 0;
+
+    while (got < len) {
+        ssize_t r = getrandom((char *)buf + got, len - got, 0);
+        if (r < 0 && errno != EINTR) {
+            return -1;
+        }
+        got += r > 0 ? (size_t)r : 0;
+    }
+    return 0;
+}
+
+static void put_le(uint8_t *p, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+static uint64_t get_le(const uint8_t *p, int bytes) {
+    uint64_t v = 0;
+
+    for (int i = bytes - 1; i >= 0; i--) {
+        v = v << 8 | p[i];
+    }
+    return v;
+}
+
+static int new_key(struct kx_ticket_key *key, uint32_t id) {
+    struct kx_ticket_key fresh = { .id = id };
+
+    if (fill_random(fresh.enc, sizeof(fresh.enc)) < 0 || fill_random(fresh.mac, sizeof(fresh.mac)) < 0) {
+        return -1;
+    }
+    *key = fresh;
+    memset(&fresh, 0, sizeof(fresh));
+    return 0;
+}
+
+int kx_tickets_init(struct kx_tickets *t, long long lifetime_ns) {
+    memset(t, 0, sizeof(*t));
+    t->lifetime_ns = lifetime_ns;
+    return new_key(&t->keys[0], 0);
+}
+
+int kx_tickets_rotate(struct kx_tickets *t) {
+    uint32_t id = t->current + 1;
+
+    if (new_key(&t->keys[id % KX_TICKET_KEYS], id) < 0) {
+        return -1;
+    }
+    __atomic_store_n(&t->current, id, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void kx_tickets_clear(struct kx_tickets *t) {
+    memset(t->keys, 0, sizeof(t->keys));
+}
+
+void kx_ticket_seal(struct kx_tickets *t, unsigned char mode, long long issued_ns,
+                    const uint8_t secret[KX_SESSION_BYTES], uint8_t ticket[KX_TICKET_BYTES]) {
+    uint32_t id = __atomic_load_n(&t->current, __ATOMIC_ACQUIRE);
+    struct kx_ticket_key *key = &t->keys[id % KX_TICKET_KEYS];
+    uint8_t plain[PLAIN_BYTES];
+    uint8_t tag[SHA256_BYTES];
+
+    // A counter never repeats a nonce under one key, and costs no syscall
+    put_le(ticket, id, ID_BYTES);
+    memset(ticket + ID_BYTES, 0, CHACHA20_NONCE_BYTES);
+    put_le(ticket + ID_BYTES + 4, __atomic_fetch_add(&key->sealed, 1, __ATOMIC_RELAXED), 8);
+
+    plain[0] = mode;
+    put_le(plain + 1, (uint64_t)issued_ns, 8);
+    memcpy(plain + 9, secret, KX_SESSION_BYTES);
+    chacha20_xor(ticket + CIPHER_AT, plain, PLAIN_BYTES, key->enc, ticket + ID_BYTES, 0);
+    hmac_sha256(key->mac, sizeof(key->mac), ticket, TAG_AT, NULL, 0, tag);
+    memcpy(ticket + TAG_AT, tag, TAG_BYTES);
+    memset(plain, 0, sizeof(plain));
+}
+
+int kx_ticket_open(struct kx_tickets *t, const uint8_t ticket[KX_TICKET_BYTES], long long now_ns,
+                   unsigned char *mode, long long *issued_ns, uint8_t secret[KX_SESSION_BYTES]) {
+    uint32_t current = __atomic_load_n(&t->current, __ATOMIC_ACQUIRE);
+    uint32_t id = (uint32_t)get_le(ticket, ID_BYTES);
+    struct kx_ticket_key *key = &t->keys[id % KX_TICKET_KEYS];
+    uint8_t plain[PLAIN_BYTES];
+    uint8_t tag[SHA256_BYTES];
+    uint8_t diff = 0;
+
+    if (id != current && (current == 0 || id != current - 1)) {
+        return -1;
+    }
+    hmac_sha256(key->mac, sizeof(key->mac), ticket, TAG_AT, NULL, 0, tag);
+    for (int i = 0; i < TAG_BYTES; i++) {
+        diff |= tag[i] ^ ticket[TAG_AT + i];
+    }
+    if (diff != 0) {
+        return -1;
+    }
+
+    chacha20_xor(plain, ticket + CIPHER_AT, PLAIN_BYTES, key->enc, ticket + ID_BYTES, 0);
+    *mode = plain[0];
+    *issued_ns = (long long)get_le(plain + 1, 8);
+    memcpy(secret, plain + 9, KX_SESSION_BYTES);
+    memset(plain, 0, sizeof(plain));
+    if (now_ns - *issued_ns >= t->lifetime_ns || now_ns < *issued_ns) {
+        memset(secret, 0, KX_SESSION_BYTES);
+        return -1;
+    }
+    return 0;
+}
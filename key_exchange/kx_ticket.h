@@ -0,0 +1,54 @@
+// Session tickets for resuming a key exchange without a new one
+//
+// After a full handshake the server seals the session's resumption secret
+// into a ticket only it can open, and hands the ticket to the client; the
+// server itself keeps no per-session state. A ticket is
+//
+//   key id (4) | nonce (12) | ChaCha20(mode, issued, secret) (41) | tag (16)
+//
+// with the tag a truncated HMAC-SHA256 over everything before it
+// (encrypt-then-MAC). Sealing and opening use separate keys.
+//
+// Ticket keys rotate: a ticket opens under the current key or the one
+// before it, and only within the ticket lifetime of its first handshake.
+// kx_tickets_rotate() runs in one thread while others seal and open; the
+// key a rotation overwrites went out of use two rotations earlier.
+#ifndef KX_TICKET_H
+#define KX_TICKET_H
+
+#include <stdint.h>
+
+#include "chacha20.h"
+#include "kx_proto.h"
+#include "sha256.h"
+
+#define KX_TICKET_KEYS 4 // ring of keys; two are accepted at a time
+
+struct kx_ticket_key {
+    uint32_t id;
+    uint64_t sealed; // tickets sealed so far; the nonce
+    uint8_t enc[CHACHA20_KEY_BYTES];
+    uint8_t mac[SHA256_BYTES];
+};
+
+struct kx_tickets {
+    struct kx_ticket_key keys[KX_TICKET_KEYS];
+    uint32_t current; // id of the sealing key
+    long long lifetime_ns;
+};
+
+// Fresh keys from getrandom(). -1 with errno set on failure.
+int kx_tickets_init(struct kx_tickets *t, long long lifetime_ns);
+// Start sealing under a new key; tickets under the previous one still open
+int kx_tickets_rotate(struct kx_tickets *t);
+// Wipe every key
+void kx_tickets_clear(struct kx_tickets *t);
+
+void kx_ticket_seal(struct kx_tickets *t, unsigned char mode, long long issued_ns,
+                    const uint8_t secret[KX_SESSION_BYTES], uint8_t ticket[KX_TICKET_BYTES]);
+// Check and decrypt a ticket. Returns -1 if it was tampered with, is under
+// a retired key or has outlived its lifetime at now_ns.
+int kx_ticket_open(struct kx_tickets *t, const uint8_t ticket[KX_TICKET_BYTES], long long now_ns,
+                   unsigned char *mode, long long *issued_ns, uint8_t secret[KX_SESSION_BYTES]);
+
+#endif
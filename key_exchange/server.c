@@ -1,10 +1,63 @@
 // server.c
+// Key exchange server
+//
+// Serves handshakes until SIGINT or SIGTERM, many clients at once: -w
+// worker threads each own a SO_REUSEPORT listener and a non-blocking epoll
+// loop, so a slow client only holds a connection slot, never a thread. A
+// client sends its request (see kx_proto.h), gets the server's public key
+// back and is disconnected; one that has not finished within -t
+// milliseconds is dropped.
+//
+// The server's ephemeral key pairs come from a kx_pool filled by -g
+// background threads, so the only exponentiation or scalar multiplication
+// left while a client waits is deriving the secret. Those are batched: the
+// handshakes completed in one epoll_wait() round are derived together with
+// bn_modexp_batch(), several to a SIMD kernel, so a reconnect storm costs
+// far less than one exponentiation per client in turn. Clients of the original
+// P = 23 exchange are still answered, with a fresh private key each time.
+//
+// A client that asks for one gets a session ticket with its handshake, and
+// can later resume with it: two HMACs and a ticket to check and reseal
+// instead of a key exchange. Ticket keys rotate every -r seconds, and on
+// SIGHUP; a ticket is good for -l seconds after the handshake it came from.
+//
+// On exit, prints handshakes per second per mode, the handshake latency
+// distribution (accept to reply sent) and how often the pool was empty.
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/random.h>
+#include <sys/socket.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
 #include <math.h>
+#include "histogram.h"
+#include "metrics.h"
+#include "kx_pool.h"
+#include "kx_ticket.h"
+
+#define BACKLOG 4096 // capped by net.core.somaxconn
+#define MAX_EVENTS 256
+#define ACCEPT_BATCH 64
+#define STOP_CHECK_MS 100
+#define DEFAULT_DEADLINE_MS 5000
+#define DEFAULT_POOL_KEYS 256
+#define DEFAULT_POOL_THREADS 1
+#define DEFAULT_ROTATE_S 3600
+#define DEFAULT_LIFETIME_S 7200
+
+// The original exchange: an 8-byte public key each way
+#define LEGACY_P 23 // A prime number
+#define LEGACY_G 5  // A primitive root modulo P
+#define LEGACY_BYTES ((size_t)sizeof(long long int))
 
 // Function to compute (base^exp) % mod
 long long int power(long long int base, long long int exp, long long int mod) {
@@ -18,68 +71,662 @@ long long int power(long long int base, long long int exp, long long int mod) {
     return res;
 }
 
-int main() {
-    // Publicly known numbers
-    long long int P = 23; // A prime number
-    long long int G = 5;  // A primitive root modulo P
+// A client from accept until its reply is sent. Every connection gets the
+// same deadline, so the list is in accept order: expiring is popping from
+// the front and adding is appending at the back.
+struct kx_conn {
+    int fd;
+    size_t want;   // request length, known from the first byte
+    size_t in_len;
+    size_t out_len;
+    size_t out_sent;
+    long long accept_ns;
+    long long deadline_ns;
+    struct kx_conn *prev, *next;
+    char ip[INET_ADDRSTRLEN];
+    int port;
+    unsigned char in[1 + KX_MAX_KEY];
+    unsigned char out[1 + KX_MAX_KEY + KX_TICKET_BYTES];
+};
+
+struct worker {
+    pthread_t tid;
+    int id;
+    int listen_fd;
+    int epfd;
+    struct kx_conn deadlines; // list sentinel
+    struct kx_conn *pending[MAX_EVENTS]; // handshakes to derive this round
+    int npending;
+    struct kx_key keys[MAX_EVENTS];      // and their key pairs and secrets
+    unsigned char secrets[MAX_EVENTS][KX_MAX_KEY];
+    struct histogram latency; // accept to reply sent, ns
+    unsigned long long handshakes[KX_MODES];
+    unsigned long long legacy;
+    unsigned long long tickets;  // issued with a handshake
+    unsigned long long resumed;
+    unsigned long long refused;  // bad or expired tickets
+    unsigned long long rejected; // unknown mode
+    unsigned long long invalid;  // peer key out of range
+    unsigned long long timeouts;
+    unsigned long long dropped;  // disconnects before the reply
+};
+
+static int quiet = 0;
+static long long deadline_ns = DEFAULT_DEADLINE_MS * 1000000LL;
+static struct kx_pool *pool;
+static struct kx_tickets tickets;
+
+// Scraped with -M. A request is a finished exchange of any kind, and the
+// handshake latency is accept to reply sent, as for the summary on exit.
+static struct server_metrics metrics;
+static metric_t handshake_metrics[KX_MODES];
+static metric_t legacy_metric, resumed_metric, refused_metric, timeout_metric, latency_metric;
+
+// Set by SIGINT/SIGTERM: stop and print statistics
+static volatile sig_atomic_t stop_requested = 0;
+// Set by SIGHUP: rotate the ticket key now
+static volatile sig_atomic_t rotate_requested = 0;
+
+void handle_sighup(int sig) {
+    (void)sig;
+    rotate_requested = 1;
+}
+
+void handle_stop(int sig) {
+    (void)sig;
+    // Read by the workers, hence atomic rather than a plain store
+    __atomic_store_n(&stop_requested, 1, __ATOMIC_RELAXED);
+}
+
+long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// ---------------------------------------------------------------------------
+// Workers
+// ---------------------------------------------------------------------------
+
+void conn_close(struct worker *w, struct kx_conn *c) {
+    c->prev->next = c->next;
+    c->next->prev = c->prev;
+    epoll_ctl(w->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    free(c);
+    metrics_dec(metrics.active);
+}
+
+void accept_clients(struct worker *w) {
+    struct sockaddr_in address;
+    socklen_t addrlen;
+    struct epoll_event ev;
+
+    for (int accepted = 0; accepted < ACCEPT_BATCH; accepted++) {
+        addrlen = sizeof(address);
+        int fd = accept4(w->listen_fd, (struct sockaddr *)&address, &addrlen, SOCK_NONBLOCK);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept");
+            }
+            return;
+        }
+
+        struct kx_conn *c = malloc(sizeof(*c));
+        if (c == NULL) {
+            perror("Out of memory for a new client");
+            close(fd);
+            continue;
+        }
+        metrics_inc(metrics.accepts);
+        metrics_inc(metrics.active);
+        c->fd = fd;
+        c->want = 1;
+        c->in_len = 0;
+        c->out_len = 0;
+        c->out_sent = 0;
+        c->accept_ns = now_ns();
+        c->deadline_ns = c->accept_ns + deadline_ns;
+        inet_ntop(AF_INET, &address.sin_addr, c->ip, INET_ADDRSTRLEN);
+        c->port = ntohs(address.sin_port);
+        c->prev = w->deadlines.prev;
+        c->next = &w->deadlines;
+        w->deadlines.prev->next = c;
+        w->deadlines.prev = c;
+
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = c;
+        if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl client");
+            conn_close(w, c);
+            continue;
+        }
+        if (!quiet) {
+            printf("Client %s:%d connected.\n", c->ip, c->port);
+        }
+    }
+}
+
+// The original exchange, with a private key from [2, P - 2]
+void answer_legacy(struct worker *w, struct kx_conn *c) {
+    long long int A, B, b, secret;
+    unsigned char r;
+
+    if (getrandom(&r, 1, 0) != 1) {
+        r = 0;
+    }
+    b = 2 + r % (LEGACY_P - 3);
+    memcpy(&A, c->in, LEGACY_BYTES);
+    B = power(LEGACY_G, b, LEGACY_P);
+    secret = power(A, b, LEGACY_P);
+    memcpy(c->out, &B, LEGACY_BYTES);
+    c->out_len = LEGACY_BYTES;
+    w->legacy++;
+    metrics_inc(legacy_metric);
+    if (!quiet) {
+        printf("Client %s:%d: P = 23 exchange, shared secret %lld\n", c->ip, c->port, secret);
+    }
+}
+
+void print_secret(struct kx_conn *c, const char *what, const unsigned char *secret) {
+    printf("Client %s:%d: %s, shared secret ", c->ip, c->port, what);
+    for (size_t i = 0; i < 8; i++) {
+        printf("%02x", secret[i]);
+    }
+    printf("...\n");
+}
+
+// The reply to [mode][public key]: [mode][public key] with a pooled key
+// pair, and a ticket if the client asked for one
+void answer_mode(struct worker *w, struct kx_conn *c, const struct kx_key *key, const unsigned char *secret) {
+    unsigned char mode = c->in[0] & ~KX_FLAG_TICKET;
+    size_t len = c->want - 1;
+
+    c->out[0] = c->in[0];
+    memcpy(c->out + 1, kx_key_pub(key), len);
+    c->out_len = 1 + len;
+    w->handshakes[mode - KX_MODE_MODP2048]++;
+    metrics_inc(handshake_metrics[mode - KX_MODE_MODP2048]);
+    if (c->in[0] & KX_FLAG_TICKET) {
+        uint8_t session[KX_SESSION_BYTES];
+        kx_session_secret(secret, len, session);
+        kx_ticket_seal(&tickets, mode, c->accept_ns, session, c->out + c->out_len);
+        c->out_len += KX_TICKET_BYTES;
+        memset(session, 0, sizeof(session));
+        w->tickets++;
+    }
+    if (!quiet) {
+        print_secret(c, kx_mode_name(mode), secret);
+    }
+}
+
+// [resume][ticket][client nonce] -> [resume][server nonce][new ticket], or
+// a refusal, after which the client falls back to a full handshake. The new
+// ticket carries the next resumption secret and the original issue time.
+void answer_resume(struct worker *w, struct kx_conn *c) {
+    const uint8_t *ticket = c->in + 1;
+    const uint8_t *client_nonce = ticket + KX_TICKET_BYTES;
+    uint8_t *server_nonce = c->out + 1;
+    uint8_t session[KX_SESSION_BYTES], secret[KX_SESSION_BYTES], next[KX_SESSION_BYTES];
+    unsigned char mode;
+    long long issued;
+
+    if (kx_ticket_open(&tickets, ticket, c->accept_ns, &mode, &issued, session) < 0 ||
+        getrandom(server_nonce, KX_NONCE_BYTES, 0) != KX_NONCE_BYTES) {
+        if (!quiet) {
+            printf("Client %s:%d: ticket refused.\n", c->ip, c->port);
+        }
+        c->out[0] = KX_MODE_REJECT;
+        c->out_len = 1;
+        w->refused++;
+        metrics_inc(refused_metric);
+        return;
+    }
+    kx_resume_secrets(session, client_nonce, server_nonce, secret, next);
+    c->out[0] = KX_MODE_RESUME;
+    kx_ticket_seal(&tickets, mode, issued, next, c->out + 1 + KX_NONCE_BYTES);
+    c->out_len = 1 + KX_NONCE_BYTES + KX_TICKET_BYTES;
+    w->resumed++;
+    metrics_inc(resumed_metric);
+    if (!quiet) {
+        print_secret(c, "resumed", secret);
+    }
+    memset(session, 0, sizeof(session));
+    memset(secret, 0, sizeof(secret));
+    memset(next, 0, sizeof(next));
+}
+
+// Send what is left of the reply; once it is all out the handshake is
+// done. Returns 1 when finished, 0 to wait for room, -1 on error.
+int conn_flush(struct worker *w, struct kx_conn *c) {
+    while (c->out_sent < c->out_len) {
+        ssize_t n = send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct epoll_event ev = { .events = EPOLLOUT, .data.ptr = c };
+            epoll_ctl(w->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+            return 0;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        c->out_sent += n;
+        metrics_add(metrics.bytes_out, n);
+    }
+    long long elapsed = now_ns() - c->accept_ns;
+    histogram_record(&w->latency, elapsed);
+    metrics_observe_us(latency_metric, elapsed / 1000);
+    metrics_inc(metrics.requests);
+    return 1;
+}
+
+// Send the reply, and close the connection unless it has to wait for room
+void conn_reply(struct worker *w, struct kx_conn *c) {
+    int rc = conn_flush(w, c);
+    if (rc != 0) {
+        w->dropped += rc < 0;
+        conn_close(w, c);
+    }
+}
+
+// Derive the secrets for every handshake that completed this round in one
+// kx_derive_batch(), then reply to each. Clients whose key is unusable are
+// dropped.
+void answer_pending(struct worker *w) {
+    struct kx_key *key_ptrs[MAX_EVENTS];
+    unsigned char modes[MAX_EVENTS];
+    const unsigned char *peers[MAX_EVENTS];
+    unsigned char *secret_ptrs[MAX_EVENTS];
+    int results[MAX_EVENTS];
+    int n = w->npending;
+
+    if (n <= 0) {
+        return;
+    }
+    for (int i = 0; i < n; i++) {
+        struct kx_conn *c = w->pending[i];
+        modes[i] = c->in[0] & ~KX_FLAG_TICKET;
+        key_ptrs[i] = &w->keys[i];
+        peers[i] = c->in + 1;
+        secret_ptrs[i] = w->secrets[i];
+    }
+    w->npending = 0;
+    if (kx_pool_take_batch(pool, modes, key_ptrs, n) < 0) {
+        perror("getrandom");
+        for (int i = 0; i < n; i++) {
+            conn_close(w, w->pending[i]);
+        }
+        memset(w->keys, 0, n * sizeof(w->keys[0]));
+        return;
+    }
+    kx_derive_batch((const struct kx_key *const *)key_ptrs, peers, secret_ptrs, results, n);
+
+    for (int i = 0; i < n; i++) {
+        struct kx_conn *c = w->pending[i];
+        if (results[i] < 0) {
+            if (!quiet) {
+                printf("Client %s:%d sent an invalid public key.\n", c->ip, c->port);
+            }
+            w->invalid++;
+            conn_close(w, c);
+        } else {
+            answer_mode(w, c, &w->keys[i], w->secrets[i]);
+            conn_reply(w, c);
+        }
+        kx_key_clear(&w->keys[i]);
+        memset(w->secrets[i], 0, sizeof(w->secrets[i]));
+    }
+}
+
+// Collect the request; its first byte says how long it is. Answer it once
+// it is complete, or queue it for answer_pending() if it is a handshake,
+// and close the connection after the reply.
+void conn_on_event(struct worker *w, struct kx_conn *c) {
+    if (c->out_len > 0) {
+        conn_reply(w, c);
+        return;
+    }
 
-    // Server's private key (b)
-    long long int b = 3;
-    printf("Server's private key (b): %lld\n", b);
+    while (c->in_len < c->want) {
+        ssize_t n = recv(c->fd, c->in + c->in_len, c->want - c->in_len, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return; // wait for the rest
+        }
+        if (n <= 0) {
+            if (!quiet) {
+                printf("Client %s:%d disconnected.\n", c->ip, c->port);
+            }
+            w->dropped++;
+            conn_close(w, c);
+            return;
+        }
+        metrics_add(metrics.bytes_in, n);
+        if (c->in_len == 0) {
+            size_t len = kx_key_len(c->in[0] & ~KX_FLAG_TICKET);
+            if (c->in[0] < KX_MODE_BASE) {
+                c->want = LEGACY_BYTES;
+            } else if (c->in[0] == KX_MODE_RESUME) {
+                c->want = 1 + KX_TICKET_BYTES + KX_NONCE_BYTES;
+            } else if (len == 0) {
+                unsigned char reject = KX_MODE_REJECT;
+                if (!quiet) {
+                    printf("Client %s:%d asked for unknown mode 0x%02x.\n", c->ip, c->port, c->in[0]);
+                }
+                send(c->fd, &reject, 1, MSG_NOSIGNAL);
+                w->rejected++;
+                conn_close(w, c);
+                return;
+            } else {
+                c->want = 1 + len;
+            }
+        }
+        c->in_len += n;
+    }
 
-    int server_sock, client_sock;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t addr_size;
+    if (c->in[0] < KX_MODE_BASE) {
+        answer_legacy(w, c);
+    } else if (c->in[0] == KX_MODE_RESUME) {
+        answer_resume(w, c);
+    } else {
+        w->pending[w->npending++] = c;
+        return;
+    }
+    conn_reply(w, c);
+}
+
+// Drop clients past their deadline. Returns the epoll_wait() timeout until
+// the next deadline, capped so that a stop request is noticed.
+int expire_deadlines(struct worker *w) {
+    long long t = now_ns();
+    long long next = t + STOP_CHECK_MS * 1000000LL;
+
+    while (w->deadlines.next != &w->deadlines && w->deadlines.next->deadline_ns <= t) {
+        struct kx_conn *c = w->deadlines.next;
+        if (!quiet) {
+            printf("Client %s:%d did not finish within the deadline, dropping it.\n", c->ip, c->port);
+        }
+        w->timeouts++;
+        metrics_inc(timeout_metric);
+        conn_close(w, c);
+    }
+    if (w->deadlines.next != &w->deadlines && w->deadlines.next->deadline_ns < next) {
+        next = w->deadlines.next->deadline_ns;
+    }
+    return (int)((next - t + 999999) / 1000000);
+}
 
-    // Create socket
-    server_sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_sock < 0) {
+void *worker_main(void *arg) {
+    struct worker *w = arg;
+    struct epoll_event ev, events[MAX_EVENTS];
+
+    w->deadlines.next = w->deadlines.prev = &w->deadlines;
+    w->epfd = epoll_create1(0);
+    if (w->epfd < 0) {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; // the listener
+    if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->listen_fd, &ev) < 0) {
+        perror("epoll_ctl listener");
+        exit(EXIT_FAILURE);
+    }
+
+    while (!__atomic_load_n(&stop_requested, __ATOMIC_RELAXED)) {
+        int timeout = expire_deadlines(w);
+        int nfds = epoll_wait(w->epfd, events, MAX_EVENTS, timeout);
+        for (int i = 0; i < nfds; i++) {
+            if (events[i].data.ptr == NULL) {
+                accept_clients(w);
+            } else {
+                conn_on_event(w, events[i].data.ptr);
+            }
+        }
+        answer_pending(w);
+        if (!quiet) {
+            fflush(stdout);
+        }
+    }
+
+    while (w->deadlines.next != &w->deadlines) {
+        conn_close(w, w->deadlines.next);
+    }
+    close(w->epfd);
+    close(w->listen_fd);
+    return NULL;
+}
+
+int open_listener(struct sockaddr_in *address) {
+    int opt = 1;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+
+    if (fd < 0) {
         perror("Socket creation failed");
-        exit(1);
+        exit(EXIT_FAILURE);
+    }
+    // Every worker binds its own listener to the same port; the kernel
+    // spreads incoming connections across them
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        perror("setsockopt");
+        exit(EXIT_FAILURE);
+    }
+    if (bind(fd, (struct sockaddr *)address, sizeof(*address)) < 0) {
+        perror("Bind failed");
+        exit(EXIT_FAILURE);
+    }
+    if (listen(fd, BACKLOG) < 0) {
+        perror("listen");
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-b address] [-p port] [-w workers] [-t deadline_ms]\n"
+                    "       [-n keys] [-g threads] [-r rotate_s] [-l lifetime_s] [-M port|path] [-q]\n", prog);
+    fprintf(stderr, "  -b  address to listen on (default 127.0.0.1)\n");
+    fprintf(stderr, "  -p  port to listen on (default %d)\n", KX_PORT);
+    fprintf(stderr, "  -w  worker threads (default: one per online CPU)\n");
+    fprintf(stderr, "  -t  drop clients that have not finished after this many milliseconds\n");
+    fprintf(stderr, "      (default %d)\n", DEFAULT_DEADLINE_MS);
+    fprintf(stderr, "  -n  ready key pairs kept per mode (default %d)\n", DEFAULT_POOL_KEYS);
+    fprintf(stderr, "  -g  threads generating key pairs (default %d)\n", DEFAULT_POOL_THREADS);
+    fprintf(stderr, "  -r  seconds between ticket key rotations (default %d)\n", DEFAULT_ROTATE_S);
+    fprintf(stderr, "  -l  seconds a ticket stays good after its handshake (default %d)\n",
+            DEFAULT_LIFETIME_S);
+    fprintf(stderr, "  -M  serve Prometheus metrics on this TCP port or Unix socket path\n");
+    fprintf(stderr, "  -q  do not log every handshake\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    struct sockaddr_in server_addr;
+    const char *bind_address = "127.0.0.1";
+    int port = KX_PORT;
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int nworkers = ncpus > 0 ? (int)ncpus : 1;
+    long pool_keys = DEFAULT_POOL_KEYS;
+    int pool_threads = DEFAULT_POOL_THREADS;
+    long long rotate_ns = DEFAULT_ROTATE_S * 1000000000LL;
+    long long lifetime_ns = DEFAULT_LIFETIME_S * 1000000000LL;
+    struct sigaction sa;
+    sigset_t handled, old_mask;
+    const char *metrics_endpoint = NULL;
+    int c;
+
+    while ((c = getopt(argc, argv, "b:p:w:t:n:g:r:l:M:q")) != -1) {
+        switch (c) {
+        case 'b': bind_address = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'w': nworkers = atoi(optarg); break;
+        case 't': deadline_ns = atoll(optarg) * 1000000LL; break;
+        case 'n': pool_keys = atol(optarg); break;
+        case 'g': pool_threads = atoi(optarg); break;
+        case 'r': rotate_ns = atoll(optarg) * 1000000000LL; break;
+        case 'l': lifetime_ns = atoll(optarg) * 1000000000LL; break;
+        case 'M': metrics_endpoint = optarg; break;
+        case 'q': quiet = 1; break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (nworkers < 1 || deadline_ns <= 0 || pool_keys < 1 || pool_threads < 1 ||
+        rotate_ns <= 0 || lifetime_ns <= 0) {
+        fprintf(stderr, "workers, deadline, keys, threads, rotation and lifetime must be positive\n");
+        exit(EXIT_FAILURE);
+    }
+    if (port <= 0 || port > 65535) {
+        fprintf(stderr, "invalid port %d\n", port);
+        exit(EXIT_FAILURE);
+    }
+    metrics_register_server(&metrics);
+    for (int m = 0; m < KX_MODES; m++) {
+        char labels[32];
+        snprintf(labels, sizeof(labels), "mode=\"%s\"", kx_mode_name(KX_MODE_MODP2048 + m));
+        handshake_metrics[m] = metrics_counter("kx_exchanges_total", labels, "Exchanges answered");
+    }
+    legacy_metric = metrics_counter("kx_exchanges_total", "mode=\"legacy\"", "Exchanges answered");
+    resumed_metric = metrics_counter("kx_exchanges_total", "mode=\"resumed\"", "Exchanges answered");
+    refused_metric = metrics_counter("kx_tickets_refused_total", NULL, "Bad or expired tickets");
+    timeout_metric = metrics_counter("server_timeouts_total", "kind=\"request\"",
+                                     "Connections closed by a deadline");
+    latency_metric = metrics_histogram("kx_handshake_seconds", NULL, "Accept to reply sent");
+    if (metrics_endpoint != NULL && metrics_serve(metrics_endpoint) < 0) {
+        exit(EXIT_FAILURE);
     }
-    printf("TCP server socket created.\n");
 
     // Configure server address
     memset(&server_addr, '\0', sizeof(server_addr));
     server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(8080);
-    server_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
-
-    // Bind socket to the address
-    if (bind(server_sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        perror("Bind failed");
-        exit(1);
+    server_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, bind_address, &server_addr.sin_addr) != 1) {
+        fprintf(stderr, "invalid address %s\n", bind_address);
+        exit(EXIT_FAILURE);
     }
-    printf("Bind to port 8080.\n");
 
-    // Listen for connections
-    listen(server_sock, 5);
-    printf("Listening...\n");
+    // Workers, and the pool's threads, inherit a mask with the handled
+    // signals blocked, so they are always delivered to the main thread
+    sigemptyset(&handled);
+    sigaddset(&handled, SIGHUP);
+    sigaddset(&handled, SIGINT);
+    sigaddset(&handled, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &handled, &old_mask);
 
-    addr_size = sizeof(client_addr);
-    client_sock = accept(server_sock, (struct sockaddr*)&client_addr, &addr_size);
-    printf("Client connected.\n");
+    if (kx_tickets_init(&tickets, lifetime_ns) < 0) {
+        perror("kx_tickets_init");
+        exit(EXIT_FAILURE);
+    }
+    pool = kx_pool_new(pool_keys, pool_threads);
+    if (pool == NULL) {
+        perror("kx_pool_new");
+        exit(EXIT_FAILURE);
+    }
+    struct worker *workers = calloc(nworkers, sizeof(*workers));
+    if (workers == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < nworkers; i++) {
+        workers[i].id = i;
+        workers[i].listen_fd = open_listener(&server_addr);
+        histogram_init(&workers[i].latency);
+    }
+    for (int i = 0; i < nworkers; i++) {
+        if (pthread_create(&workers[i].tid, NULL, worker_main, &workers[i]) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
 
-    // 1. Calculate server's public key (B)
-    long long int B = power(G, b, P);
+    // No SA_RESTART, so the main thread's poll() returns and a rotation
+    // request is handled right away
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_sighup;
+    sigaction(SIGHUP, &sa, NULL);
+    sa.sa_handler = handle_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
 
-    // 2. Receive client's public key (A)
-    long long int A;
-    recv(client_sock, &A, sizeof(A), 0);
-    printf("Received client's public key (A): %lld\n", A);
+    printf("Listening on %s:%d (%d workers, %ld key pairs per mode).\n",
+           bind_address, port, nworkers, pool_keys);
+    fflush(stdout);
+    long long start = now_ns();
+    long long next_rotation = start + rotate_ns;
 
-    // 3. Send server's public key (B) to client
-    send(client_sock, &B, sizeof(B), 0);
-    printf("Sent server's public key (B): %lld\n", B);
+    while (!stop_requested) {
+        long long t = now_ns();
+        if (rotate_requested || t >= next_rotation) {
+            rotate_requested = 0;
+            if (kx_tickets_rotate(&tickets) < 0) {
+                perror("Ticket key rotation failed");
+            } else {
+                printf("Rotated the ticket key.\n");
+            }
+            next_rotation = t + rotate_ns;
+            fflush(stdout);
+        }
+        long long wait_ms = (next_rotation - t) / 1000000 + 1;
+        poll(NULL, 0, wait_ms > 60000 ? 60000 : (int)wait_ms);
+    }
 
-    // 4. Calculate the shared secret key
-    long long int shared_secret = power(A, b, P);
-    printf("--------------------------------------------\n");
-    printf("Shared Secret Key computed by Server: %lld\n", shared_secret);
-    printf("--------------------------------------------\n");
+    struct histogram *total = malloc(sizeof(*total));
+    unsigned long long handshakes[KX_MODES] = { 0 }, all = 0;
+    unsigned long long legacy = 0, issued = 0, resumed = 0, refused = 0, rejected = 0, invalid = 0, timeouts = 0, dropped = 0;
+    if (total == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    histogram_init(total);
+    for (int i = 0; i < nworkers; i++) {
+        pthread_join(workers[i].tid, NULL);
+        histogram_merge(total, &workers[i].latency);
+        for (int m = 0; m < KX_MODES; m++) {
+            handshakes[m] += workers[i].handshakes[m];
+        }
+        legacy += workers[i].legacy;
+        issued += workers[i].tickets;
+        resumed += workers[i].resumed;
+        refused += workers[i].refused;
+        rejected += workers[i].rejected;
+        invalid += workers[i].invalid;
+        timeouts += workers[i].timeouts;
+        dropped += workers[i].dropped;
+    }
+    double seconds = (now_ns() - start) / 1e9;
 
+    for (int m = 0; m < KX_MODES; m++) {
+        all += handshakes[m];
+    }
+    all += legacy;
+    printf("%llu handshakes in %.1f s (%.0f/sec), %llu P = 23; %llu unknown mode, %llu invalid keys,\n"
+           "%llu timed out, %llu dropped\n",
+           all, seconds, all / seconds, legacy, rejected, invalid, timeouts, dropped);
+    for (int m = 0; m < KX_MODES; m++) {
+        struct kx_pool_stats s;
+        unsigned char mode = KX_MODE_MODP2048 + m;
+        kx_pool_read_stats(pool, mode, &s);
+        printf("  %-9s %8llu handshakes; pool: %llu taken, %llu empty, %zu/%zu ready\n",
+               kx_mode_name(mode), handshakes[m], s.hits, s.misses, s.ready, s.capacity);
+    }
+    printf("%llu tickets issued, %llu resumptions (%.0f/sec), %llu tickets refused\n",
+           issued, resumed, resumed / seconds, refused);
+    printf("Latency, accept to reply (us): p50 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+           histogram_percentile(total, 50) / 1000.0, histogram_percentile(total, 99) / 1000.0,
+           histogram_percentile(total, 99.9) / 1000.0, total->max / 1000.0);
 
-    close(client_sock);
-    close(server_sock);
+    kx_pool_free(pool);
+    kx_tickets_clear(&tickets);
+    free(total);
+    free(workers);
     return 0;
-}
\ No newline at end of file
+}
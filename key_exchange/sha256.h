@@ -0,0 +1,27 @@
+// SHA-256 (FIPS 180-4) and HMAC-SHA256 (RFC 2104)
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_BYTES 32
+#define SHA256_BLOCK 64
+
+struct sha256 {
+    uint32_t h[8];
+    uint64_t len; // bytes hashed so far
+    uint8_t buf[SHA256_BLOCK];
+    size_t buf_len;
+};
+
+void sha256_init(struct sha256 *s);
+void sha256_update(struct sha256 *s, const void *data, size_t len);
+void sha256_final(struct sha256 *s, uint8_t out[SHA256_BYTES]);
+
+// HMAC over the concatenation of the len1 bytes at data1 and the len2
+// bytes at data2 (either may be empty)
+void hmac_sha256(const uint8_t *key, size_t key_len, const void *data1, size_t len1,
+                 const void *data2, size_t len2, uint8_t out[SHA256_BYTES]);
+
+#endif
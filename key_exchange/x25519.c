@@ -0,0 +1,274 @@
+#include <string.h>
+#include <errno.h>
+#include <sys/random.h>
+
+#include "x25519.h"
+
+#define MASK51 ((1ULL << 51) - 1)
+
+typedef unsigned __int128 u128;
+typedef uint64_t fe[5];
+
+static uint64_t load64_le(const uint8_t *p) {
+    uint64_t v = 0;
+
+    for (int i = 7; i >= 0; i--) {
+        v = v << 8 | p[i];
+    }
+    return v;
+}
+
+static void store64_le(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+// Bits 0, 51, 102, 153 and 204 start at these bytes and shifts; the top
+// bit of the encoding is ignored, as RFC 7748 requires
+static void fe_frombytes(fe h, const uint8_t s[X25519_BYTES]) {
+    h[0] = load64_le(s) & MASK51;
+    h[1] = (load64_le(s + 6) >> 3) & MASK51;
+    h[2] = (load64_le(s + 12) >> 6) & MASK51;
+    h[3] = (load64_le(s + 19) >> 1) & MASK51;
+    h[4] = (load64_le(s + 24) >> 12) & MASK51;
+}
+
+static void fe_carry(fe h) {
+    for (int i = 0; i < 4; i++) {
+        h[i + 1] += h[i] >> 51;
+        h[i] &= MASK51;
+    }
+    h[0] += 19 * (h[4] >> 51);
+    h[4] &= MASK51;
+}
+
+// Fully reduce mod p and encode little-endian
+static void fe_tobytes(uint8_t s[X25519_BYTES], const fe f) {
+    fe h;
+    uint64_t q;
+
+    memcpy(h, f, sizeof(h));
+    fe_carry(h);
+    fe_carry(h);
+    // Now h < 2^255 + a little; q = 1 exactly when h >= p
+    q = (h[0] + 19) >> 51;
+    q = (h[1] + q) >> 51;
+    q = (h[2] + q) >> 51;
+    q = (h[3] + q) >> 51;
+    q = (h[4] + q) >> 51;
+    h[0] += 19 * q;
+    for (int i = 0; i < 4; i++) {
+        h[i + 1] += h[i] >> 51;
+        h[i] &= MASK51;
+    }
+    h[4] &= MASK51;
+
+    store64_le(s, h[0] | h[1] << 51);
+    store64_le(s + 8, h[1] >> 13 | h[2] << 38);
+    store64_le(s + 16, h[2] >> 26 | h[3] << 25);
+    store64_le(s + 24, h[3] >> 39 | h[4] << 12);
+}
+
+static void fe_add(fe h, const fe f, const fe g) {
+    for (int i = 0; i < 5; i++) {
+        h[i] = f[i] + g[i];
+    }
+}
+
+// h = f - g, adding 4p first so no limb goes negative for inputs below 2^53
+static void fe_sub(fe h, const fe f, const fe g) {
+    h[0] = f[0] + 0x1FFFFFFFFFFFB4ULL - g[0];
+    for (int i = 1; i < 5; i++) {
+        h[i] = f[i] + 0x1FFFFFFFFFFFFCULL - g[i];
+    }
+    fe_carry(h);
+}
+
+// Limbs above 2^255 wrap around multiplied by 19, since 2^255 = 19 mod p
+static void fe_mul(fe h, const fe f, const fe g) {
+    uint64_t f0 = f[0], f1 = f[1], f2 = f[2], f3 = f[3], f4 = f[4];
+    uint64_t g0 = g[0], g1 = g[1], g2 = g[2], g3 = g[3], g4 = g[4];
+    uint64_t g1_19 = 19 * g1, g2_19 = 19 * g2, g3_19 = 19 * g3, g4_19 = 19 * g4;
+    u128 r0, r1, r2, r3, r4;
+    uint64_t c;
+
+    r0 = (u128)f0 * g0 + (u128)f1 * g4_19 + (u128)f2 * g3_19 + (u128)f3 * g2_19 + (u128)f4 * g1_19;
+    r1 = (u128)f0 * g1 + (u128)f1 * g0 + (u128)f2 * g4_19 + (u128)f3 * g3_19 + (u128)f4 * g2_19;
+    r2 = (u128)f0 * g2 + (u128)f1 * g1 + (u128)f2 * g0 + (u128)f3 * g4_19 + (u128)f4 * g3_19;
+    r3 = (u128)f0 * g3 + (u128)f1 * g2 + (u128)f2 * g1 + (u128)f3 * g0 + (u128)f4 * g4_19;
+    r4 = (u128)f0 * g4 + (u128)f1 * g3 + (u128)f2 * g2 + (u128)f3 * g1 + (u128)f4 * g0;
+
+    r1 += (uint64_t)(r0 >> 51);
+    h[0] = (uint64_t)r0 & MASK51;
+    r2 += (uint64_t)(r1 >> 51);
+    h[1] = (uint64_t)r1 & MASK51;
+    r3 += (uint64_t)(r2 >> 51);
+    h[2] = (uint64_t)r2 & MASK51;
+    r4 += (uint64_t)(r3 >> 51);
+    h[3] = (uint64_t)r3 & MASK51;
+    c = (uint64_t)(r4 >> 51);
+    h[4] = (uint64_t)r4 & MASK51;
+    h[0] += 19 * c;
+    h[1] += h[0] >> 51;
+    h[0] &= MASK51;
+}
+
+// Squaring shares the symmetric cross products, 15 multiplies instead of 25
+static void fe_sq(fe h, const fe f) {
+    uint64_t f0 = f[0], f1 = f[1], f2 = f[2], f3 = f[3], f4 = f[4];
+    uint64_t f0_2 = 2 * f0, f1_2 = 2 * f1;
+    uint64_t f1_38 = 38 * f1, f2_38 = 38 * f2, f3_38 = 38 * f3;
+    uint64_t f3_19 = 19 * f3, f4_19 = 19 * f4;
+    u128 r0, r1, r2, r3, r4;
+    uint64_t c;
+
+    r0 = (u128)f0 * f0 + (u128)f1_38 * f4 + (u128)f2_38 * f3;
+    r1 = (u128)f0_2 * f1 + (u128)f2_38 * f4 + (u128)f3_19 * f3;
+    r2 = (u128)f0_2 * f2 + (u128)f1 * f1 + (u128)f3_38 * f4;
+    r3 = (u128)f0_2 * f3 + (u128)f1_2 * f2 + (u128)f4_19 * f4;
+    r4 = (u128)f0_2 * f4 + (u128)f1_2 * f3 + (u128)f2 * f2;
+
+    r1 += (uint64_t)(r0 >> 51);
+    h[0] = (uint64_t)r0 & MASK51;
+    r2 += (uint64_t)(r1 >> 51);
+    h[1] = (uint64_t)r1 & MASK51;
+    r3 += (uint64_t)(r2 >> 51);
+    h[2] = (uint64_t)r2 & MASK51;
+    r4 += (uint64_t)(r3 >> 51);
+    h[3] = (uint64_t)r3 & MASK51;
+    c = (uint64_t)(r4 >> 51);
+    h[4] = (uint64_t)r4 & MASK51;
+    h[0] += 19 * c;
+    h[1] += h[0] >> 51;
+    h[0] &= MASK51;
+}
+
+static void fe_sq_n(fe h, const fe f, int n) {
+    fe_sq(h, f);
+    while (--n > 0) {
+        fe_sq(h, h);
+    }
+}
+
+static void fe_mul_small(fe h, const fe f, uint64_t k) {
+    u128 r;
+    uint64_t c = 0;
+
+    for (int i = 0; i < 5; i++) {
+        r = (u128)f[i] * k + c;
+        h[i] = (uint64_t)r & MASK51;
+        c = (uint64_t)(r >> 51);
+    }
+    h[0] += 19 * c;
+}
+
+// out = z^(p - 2) = 1/z, by the usual chain of 254 squarings and 11
+// multiplies
+static void fe_invert(fe out, const fe z) {
+    fe z2, z9, z11, z2_5_0, z2_10_0, z2_20_0, z2_50_0, z2_100_0, t;
+
+    fe_sq(z2, z);
+    fe_sq_n(t, z2, 2);
+    fe_mul(z9, t, z);
+    fe_mul(z11, z9, z2);
+    fe_sq(t, z11);
+    fe_mul(z2_5_0, t, z9);
+    fe_sq_n(t, z2_5_0, 5);
+    fe_mul(z2_10_0, t, z2_5_0);
+    fe_sq_n(t, z2_10_0, 10);
+    fe_mul(z2_20_0, t, z2_10_0);
+    fe_sq_n(t, z2_20_0, 20);
+    fe_mul(t, t, z2_20_0);
+    fe_sq_n(t, t, 10);
+    fe_mul(z2_50_0, t, z2_10_0);
+    fe_sq_n(t, z2_50_0, 50);
+    fe_mul(z2_100_0, t, z2_50_0);
+    fe_sq_n(t, z2_100_0, 100);
+    fe_mul(t, t, z2_100_0);
+    fe_sq_n(t, t, 50);
+    fe_mul(t, t, z2_50_0);
+    fe_sq_n(t, t, 5);
+    fe_mul(out, t, z11);
+}
+
+// Swap f and g if swap is 1, without a branch
+static void fe_cswap(fe f, fe g, uint64_t swap) {
+    uint64_t mask = 0 - swap;
+
+    for (int i = 0; i < 5; i++) {
+        uint64_t x = mask & (f[i] ^ g[i]);
+        f[i] ^= x;
+        g[i] ^= x;
+    }
+}
+
+int x25519(uint8_t out[X25519_BYTES], const uint8_t scalar[X25519_BYTES],
+           const uint8_t u[X25519_BYTES]) {
+    uint8_t k[X25519_BYTES];
+    fe x1, x2 = { 1 }, z2 = { 0 }, x3, z3 = { 1 };
+    fe a, aa, b, bb, e, c, d, da, cb, t;
+    uint64_t swap = 0;
+    uint8_t zero = 0;
+
+    memcpy(k, scalar, sizeof(k));
+    k[0] &= 248;
+    k[31] &= 127;
+    k[31] |= 64;
+    fe_frombytes(x1, u);
+    memcpy(x3, x1, sizeof(x3));
+
+    // RFC 7748 section 5
+    for (int pos = 254; pos >= 0; pos--) {
+        uint64_t bit = (k[pos / 8] >> (pos % 8)) & 1;
+        swap ^= bit;
+        fe_cswap(x2, x3, swap);
+        fe_cswap(z2, z3, swap);
+        swap = bit;
+
+        fe_add(a, x2, z2);
+        fe_sq(aa, a);
+        fe_sub(b, x2, z2);
+        fe_sq(bb, b);
+        fe_sub(e, aa, bb);
+        fe_add(c, x3, z3);
+        fe_sub(d, x3, z3);
+        fe_mul(da, d, a);
+        fe_mul(cb, c, b);
+        fe_add(t, da, cb);
+        fe_sq(x3, t);
+        fe_sub(t, da, cb);
+        fe_sq(t, t);
+        fe_mul(z3, x1, t);
+        fe_mul(x2, aa, bb);
+        fe_mul_small(t, e, 121665);
+        fe_add(t, aa, t);
+        fe_mul(z2, e, t);
+    }
+    fe_cswap(x2, x3, swap);
+    fe_cswap(z2, z3, swap);
+
+    fe_invert(z2, z2);
+    fe_mul(x2, x2, z2);
+    fe_tobytes(out, x2);
+    memset(k, 0, sizeof(k));
+
+    for (int i = 0; i < X25519_BYTES; i++) {
+        zero |= out[i];
+    }
+    return zero == 0 ? -1 : 0;
+}
+
+int x25519_keygen(uint8_t priv[X25519_BYTES], uint8_t pub[X25519_BYTES]) {
+    static const uint8_t base[X25519_BYTES] = { 9 };
+    size_t got = 0;
+
+    while (got < X25519_BYTES) {
+        ssize_t r = getrandom(priv + got, X25519_BYTES - got, 0);
+        if (r < 0 && errno != EINTR) {
+            return -1;
+        }
+        got += r > 0 ? (size_t)r : 0;
+    }
+    return x25519(pub, priv, base);
+}
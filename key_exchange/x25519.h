@@ -0,0 +1,24 @@
+// X25519 Diffie-Hellman (RFC 7748)
+//
+// Field elements mod 2^255 - 19 are five 51-bit limbs in 64-bit words, so
+// a product of two limbs fits comfortably in 128 bits and carries are
+// deferred until after each multiplication. Scalar multiplication is the
+// Montgomery ladder with masked swaps: the same operations, in the same
+// order, for every scalar.
+#ifndef X25519_H
+#define X25519_H
+
+#include <stdint.h>
+
+#define X25519_BYTES 32
+
+// out = scalar * u. Returns -1 if the result is all zero, which happens
+// only for a peer point of small order.
+int x25519(uint8_t out[X25519_BYTES], const uint8_t scalar[X25519_BYTES],
+           const uint8_t u[X25519_BYTES]);
+
+// A random private key from getrandom() and its public key. Returns -1
+// with errno set if getrandom() fails.
+int x25519_keygen(uint8_t priv[X25519_BYTES], uint8_t pub[X25519_BYTES]);
+
+#endif
@@ -0,0 +1,132 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "auth_cache.h"
+
+// Only the owning thread writes the counters, so a relaxed load and store
+// is enough; it keeps readers on other threads free of data races
+#define STAT_ADD(cache, field, n) \
+    __atomic_store_n(&(cache)->stats.field, (cache)->stats.field + (n), __ATOMIC_RELAXED)
+
+static size_t bucket_of(const struct auth_cache *cache, uint32_t ip, uint64_t mac) {
+    uint64_t h = mac * 0x9E3779B97F4A7C15ULL + ip * 0xC2B2AE3D27D4EB4FULL;
+    return (size_t)(h >> cache->shift);
+}
+
+struct auth_cache *auth_cache_new(size_t capacity) {
+    struct auth_cache *cache = calloc(1, sizeof(*cache));
+    unsigned bits = 1;
+
+    if (cache == NULL) {
+        return NULL;
+    }
+    // About one bucket per entry keeps the chains short
+    while (((size_t)1 << bits) < capacity) {
+        bits++;
+    }
+    cache->capacity = capacity;
+    cache->shift = 64 - bits;
+    cache->entries = calloc(capacity, sizeof(*cache->entries));
+    cache->buckets = calloc((size_t)1 << bits, sizeof(*cache->buckets));
+    if (cache->entries == NULL || cache->buckets == NULL) {
+        auth_cache_free(cache);
+        return NULL;
+    }
+    for (size_t i = 0; i < capacity; i++) {
+        cache->entries[i].hash_next = cache->free_list;
+        cache->free_list = &cache->entries[i];
+    }
+    cache->lru.lru_next = cache->lru.lru_prev = &cache->lru;
+    return cache;
+}
+
+void auth_cache_free(struct auth_cache *cache) {
+    if (cache != NULL) {
+        free(cache->entries);
+        free(cache->buckets);
+        free(cache);
+    }
+}
+
+static void lru_unlink(struct auth_cache_entry *e) {
+    e->lru_prev->lru_next = e->lru_next;
+    e->lru_next->lru_prev = e->lru_prev;
+}
+
+static void lru_push_front(struct auth_cache *cache, struct auth_cache_entry *e) {
+    e->lru_prev = &cache->lru;
+    e->lru_next = cache->lru.lru_next;
+    cache->lru.lru_next->lru_prev = e;
+    cache->lru.lru_next = e;
+}
+
+// Unhash and unlink e and put it back on the free list
+static void remove_entry(struct auth_cache *cache, struct auth_cache_entry *e) {
+    struct auth_cache_entry **pp = &cache->buckets[bucket_of(cache, e->ip, e->mac)];
+
+    while (*pp != e) {
+        pp = &(*pp)->hash_next;
+    }
+    *pp = e->hash_next;
+    lru_unlink(e);
+    e->hash_next = cache->free_list;
+    cache->free_list = e;
+    STAT_ADD(cache, size, -1);
+}
+
+struct auth_cache_entry *auth_cache_lookup(struct auth_cache *cache, uint32_t ip, uint64_t mac,
+                                           uint64_t generation, long long now_ns) {
+    struct auth_cache_entry *e = cache->buckets[bucket_of(cache, ip, mac)];
+
+    while (e != NULL && (e->ip != ip || e->mac != mac)) {
+        e = e->hash_next;
+    }
+    if (e != NULL && (e->expires_ns <= now_ns || e->generation != generation)) {
+        remove_entry(cache, e);
+        STAT_ADD(cache, expired, 1);
+        e = NULL;
+    }
+    if (e == NULL) {
+        STAT_ADD(cache, misses, 1);
+        return NULL;
+    }
+    lru_unlink(e);
+    lru_push_front(cache, e);
+    STAT_ADD(cache, hits, 1);
+    return e;
+}
+
+struct auth_cache_entry *auth_cache_insert(struct auth_cache *cache, uint32_t ip, uint64_t mac,
+                                           uint64_t generation, long long expires_ns) {
+    if (cache->capacity == 0) {
+        return NULL;
+    }
+    if (cache->free_list == NULL) {
+        remove_entry(cache, cache->lru.lru_prev);
+        STAT_ADD(cache, evictions, 1);
+    }
+
+    struct auth_cache_entry *e = cache->free_list;
+    cache->free_list = e->hash_next;
+    e->ip = ip;
+    e->mac = mac;
+    e->generation = generation;
+    e->expires_ns = expires_ns;
+    e->value = 0;
+    e->count = 0;
+
+    size_t b = bucket_of(cache, ip, mac);
+    e->hash_next = cache->buckets[b];
+    cache->buckets[b] = e;
+    lru_push_front(cache, e);
+    STAT_ADD(cache, size, 1);
+    return e;
+}
+
+void auth_cache_read_stats(const struct auth_cache *cache, struct auth_cache_stats *out) {
+    out->hits = __atomic_load_n(&cache->stats.hits, __ATOMIC_RELAXED);
+    out->misses = __atomic_load_n(&cache->stats.misses, __ATOMIC_RELAXED);
+    out->evictions = __atomic_load_n(&cache->stats.evictions, __ATOMIC_RELAXED);
+    out->expired = __atomic_load_n(&cache->stats.expired, __ATOMIC_RELAXED);
+    out->size = __atomic_load_n(&cache->stats.size, __ATOMIC_RELAXED);
+}
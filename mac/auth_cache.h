@@ -0,0 +1,65 @@
+// Bounded LRU cache of authentication decisions, keyed on client IP and
+// MAC address, with a time-to-live per entry.
+//
+// Each entry also records the whitelist generation it was decided under
+// (whitelist_generation()); an entry from an older generation is treated
+// as a miss, so a reload takes effect on the very next connection.
+//
+// A cache belongs to one worker thread and takes no locks. The counters are
+// written with relaxed atomic stores, so another thread may read them for
+// reporting while the owner is running.
+#ifndef AUTH_CACHE_H
+#define AUTH_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct auth_cache_entry {
+    uint32_t ip;         // network byte order
+    uint64_t mac;        // MAC_EMPTY for entries keyed on the IP alone
+    uint64_t generation;
+    long long expires_ns;
+    // Owned by the caller
+    int value;
+    unsigned count;
+    struct auth_cache_entry *hash_next;
+    struct auth_cache_entry *lru_prev, *lru_next;
+};
+
+struct auth_cache_stats {
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions; // dropped to make room
+    unsigned long long expired;   // past their TTL or from an older whitelist
+    unsigned long long size;
+};
+
+struct auth_cache {
+    struct auth_cache_entry *entries;
+    struct auth_cache_entry **buckets;
+    struct auth_cache_entry *free_list;
+    struct auth_cache_entry lru; // sentinel: lru.lru_next is the most recent
+    unsigned shift;
+    size_t capacity;
+    struct auth_cache_stats stats;
+};
+
+// A cache of at most capacity entries, or NULL with errno set
+struct auth_cache *auth_cache_new(size_t capacity);
+void auth_cache_free(struct auth_cache *cache);
+
+// The live entry for (ip, mac), marked most recently used, or NULL. Entries
+// past expires_ns or from another generation are removed and count as
+// misses.
+struct auth_cache_entry *auth_cache_lookup(struct auth_cache *cache, uint32_t ip, uint64_t mac,
+                                           uint64_t generation, long long now_ns);
+
+// Add an entry for (ip, mac), which must not be in the cache, evicting the
+// least recently used one if the cache is full. value and count start at 0.
+struct auth_cache_entry *auth_cache_insert(struct auth_cache *cache, uint32_t ip, uint64_t mac,
+                                           uint64_t generation, long long expires_ns);
+
+// Copy the counters; safe from any thread while the owner is running
+void auth_cache_read_stats(const struct auth_cache *cache, struct auth_cache_stats *out);
+
+#endif
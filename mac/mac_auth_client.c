@@ -2,74 +2,382 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <time.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
-#include <netdb.h> 
+#include <netdb.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include "framing.h"
+#include "mac_proto.h"
+#include "mac_set.h"
 
 #define SERVER_PORT 5555
-#define BUFFER_SIZE 1024
-#define MAC_STR_LEN 18 // "xx:xx:xx:xx:xx:xx\0"
+#define NETLINK_BUFFER_SIZE 32768
+// How long a discovered MAC address is trusted before the next dump
+#define DEFAULT_REFRESH_S 60
+#define MAX_BACKOFF_S 30
+
+// One interface from the RTM_GETLINK dump
+struct link {
+    char name[IF_NAMESIZE];
+    int index;
+    unsigned flags;      // IFF_*
+    unsigned short type; // ARPHRD_*
+    uint64_t mac;        // MAC_EMPTY without a 6-byte hardware address
+};
+
+// The chosen interface and when to look again
+static struct {
+    struct link link;
+    long long expires_ns;
+} discovered = { .expires_ns = -1 };
+
+long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief Lists every network interface with one RTM_GETLINK netlink dump.
+ * @param links Array to fill.
+ * @param max Capacity of links; further interfaces are ignored.
+ * @return The number of interfaces found, or -1 on failure.
+ *
+ * NOTE: Netlink is Linux specific. One request returns all interfaces, in
+ * place of opening and parsing /sys/class/net/<iface>/address per
+ * interface.
+ */
+int link_dump(struct link *links, int max) {
+    struct {
+        struct nlmsghdr nh;
+        struct ifinfomsg ifi;
+    } req;
+    char buf[NETLINK_BUFFER_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+    int count = 0;
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+
+    if (fd < 0) {
+        perror("netlink socket");
+        return -1;
+    }
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifi));
+    req.nh.nlmsg_type = RTM_GETLINK;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nh.nlmsg_seq = 1;
+    req.ifi.ifi_family = AF_UNSPEC;
+    if (send(fd, &req, req.nh.nlmsg_len, 0) < 0) {
+        perror("netlink send");
+        close(fd);
+        return -1;
+    }
+
+    while (1) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            perror("netlink recv");
+            close(fd);
+            return -1;
+        }
+        for (struct nlmsghdr *nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, (size_t)n); nh = NLMSG_NEXT(nh, n)) {
+            if (nh->nlmsg_type == NLMSG_DONE) {
+                close(fd);
+                return count;
+            }
+            if (nh->nlmsg_type == NLMSG_ERROR) {
+                fprintf(stderr, "[!] RTM_GETLINK dump failed\n");
+                close(fd);
+                return -1;
+            }
+            if (nh->nlmsg_type != RTM_NEWLINK || count == max) {
+                continue;
+            }
+
+            struct ifinfomsg *ifi = NLMSG_DATA(nh);
+            struct link *l = &links[count];
+            memset(l, 0, sizeof(*l));
+            l->index = ifi->ifi_index;
+            l->flags = ifi->ifi_flags;
+            l->type = ifi->ifi_type;
+            l->mac = MAC_EMPTY;
+            int len = IFLA_PAYLOAD(nh);
+            for (struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+                if (rta->rta_type == IFLA_IFNAME) {
+                    snprintf(l->name, sizeof(l->name), "%s", (const char *)RTA_DATA(rta));
+                } else if (rta->rta_type == IFLA_ADDRESS && RTA_PAYLOAD(rta) == MAC_BYTES) {
+                    l->mac = mac_unpack(RTA_DATA(rta));
+                }
+            }
+            count++;
+        }
+    }
+}
+
+// How well an interface suits authentication; higher is better, 0 never.
+// Wanted by name beats everything; otherwise an Ethernet-type interface that
+// is up and running, with a real address, lowest index first.
+int link_score(const struct link *l, const char *wanted) {
+    if (l->mac == MAC_EMPTY || l->mac == 0) {
+        return 0;
+    }
+    if (wanted != NULL) {
+        return strcmp(l->name, wanted) == 0;
+    }
+    if ((l->flags & IFF_LOOPBACK) || l->type != ARPHRD_ETHER) {
+        return 0;
+    }
+    return 1 + !!(l->flags & IFF_UP) + !!(l->flags & IFF_RUNNING);
+}
 
 /**
- * @brief Gets the MAC address of a given network interface (Linux specific).
- * * @param interface_name The name of the network interface (e.g., "eth0", "wlan0").
- * @param mac_address_str Buffer to store the resulting MAC address string.
- * @return 0 on success, -1 on failure.
- * * NOTE: This function is specific to Linux systems that expose network
- * information through the /sys filesystem. This is a common but not
- * universal standard. On other systems (like Windows or macOS), a different,
- * platform-specific API would be needed.
+ * @brief Finds this machine's MAC address, using the cached answer while it is fresh.
+ * @param wanted Interface name to use, or NULL to pick one by link_score().
+ * @param refresh_ns How long the answer is cached.
+ * @return The chosen interface, or NULL if none qualifies.
  */
-int get_mac_address(const char* interface_name, char* mac_address_str) {
-    char path[128];
-    FILE *fp;
+const struct link *local_link(const char *wanted, long long refresh_ns) {
+    struct link links[256];
+    int best = -1, best_score = 0;
+    long long t = now_ns();
 
-    snprintf(path, sizeof(path), "/sys/class/net/%s/address", interface_name);
+    if (discovered.expires_ns > t) {
+        return &discovered.link;
+    }
+    int n = link_dump(links, sizeof(links) / sizeof(links[0]));
+    for (int i = 0; i < n; i++) {
+        int score = link_score(&links[i], wanted);
+        if (score > best_score) {
+            best = i;
+            best_score = score;
+        }
+    }
+    if (best < 0) {
+        discovered.expires_ns = -1;
+        return NULL;
+    }
+    discovered.link = links[best];
+    discovered.expires_ns = t + refresh_ns;
+    return &discovered.link;
+}
+
+int server_connect(const struct sockaddr_in *serv_addr) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
 
-    fp = fopen(path, "r");
-    if (fp == NULL) {
-        perror("Error opening MAC address file. The interface may not exist or you may lack permissions");
+    if (sock < 0) {
+        perror("socket");
         return -1;
     }
+    if (connect(sock, (const struct sockaddr *)serv_addr, sizeof(*serv_addr)) < 0) {
+        perror("Connection Failed");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
 
-    if (fgets(mac_address_str, MAC_STR_LEN, fp) == NULL) {
-        perror("Error reading MAC address from file");
-        fclose(fp);
+// Text protocol: one connection per device, like the original client
+int authenticate_text(const struct sockaddr_in *serv_addr, const char *mac_address) {
+    struct frame_reader *reader;
+    const char *response;
+    size_t response_len;
+    int sock = server_connect(serv_addr);
+
+    if (sock < 0) {
         return -1;
     }
 
-    fclose(fp);
-    
-    // Remove the trailing newline character, if it exists
-    mac_address_str[strcspn(mac_address_str, "\n")] = 0;
+    // Send the MAC address to the server
+    frame_write(sock, mac_address, strlen(mac_address));
 
+    // Receive the authentication response from the server
+    reader = frame_reader_new(0);
+    if (reader == NULL || frame_read(reader, sock, &response, &response_len) <= 0) {
+        printf("[!] Server closed connection or read error.\n");
+    } else {
+        printf("%s: %.*s\n", mac_address, (int)response_len, response);
+    }
+
+    frame_reader_free(reader);
+    close(sock);
     return 0;
 }
 
+// One binary request of n <= MAC_PROTO_MAX_BATCH addresses on an open
+// connection; fills status[] with a mac_status per address. Returns -1 if
+// the connection failed or the reply is malformed.
+int query_batch(int sock, struct frame_reader *reader, const uint64_t *macs, size_t n,
+                unsigned char *status) {
+    unsigned char request[MAC_PROTO_MAX_REQUEST];
+    const char *response;
+    size_t response_len;
 
-int main() {
-    int sock = 0;
-    struct sockaddr_in serv_addr;
-    char buffer[BUFFER_SIZE] = {0};
-    char mac_address[MAC_STR_LEN];
-    const char *server_host = "127.0.0.1"; // Change to server IP if not local
-    
-    // --- Get Local MAC Address ---
-    // IMPORTANT: Change "eth0" to your primary network interface name.
-    // You can find it by running the `ip addr` or `ifconfig` command in your terminal.
-    // Common names include "eth0", "enp0s3", "wlan0", "wlp2s0".
-    if (get_mac_address("eth0", mac_address) != 0) {
-        fprintf(stderr, "[!] Could not retrieve MAC address for 'eth0'.\n");
-        fprintf(stderr, "[!] Please check the interface name and try again.\n");
-        exit(EXIT_FAILURE);
+    request[0] = MAC_PROTO_BINARY;
+    for (size_t i = 0; i < n; i++) {
+        mac_pack(macs[i], request + 1 + i * MAC_BYTES);
     }
-    printf("[*] This machine's MAC address is: %s\n", mac_address);
+    if (frame_write(sock, request, 1 + n * MAC_BYTES) < 0 ||
+        frame_read(reader, sock, &response, &response_len) <= 0) {
+        return -1;
+    }
+    if (response_len != 1 + n || (unsigned char)response[0] != MAC_PROTO_BINARY) {
+        return -1;
+    }
+    memcpy(status, response + 1, n);
+    return 0;
+}
+
+// Binary protocol: every device in batches over one connection
+int authenticate_batch(const struct sockaddr_in *serv_addr, const uint64_t *macs, size_t count) {
+    unsigned char status[MAC_PROTO_MAX_BATCH];
+    char mac[MAC_STR_LEN + 1];
+    struct frame_reader *reader;
+    int rc = 0;
+    int sock = server_connect(serv_addr);
 
-    // Create the socket
-    if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        printf("\n Socket creation error \n");
+    if (sock < 0) {
         return -1;
     }
+    reader = frame_reader_new(0);
+    if (reader == NULL) {
+        perror("frame_reader_new");
+        close(sock);
+        return -1;
+    }
+
+    for (size_t done = 0; done < count; ) {
+        size_t n = count - done < MAC_PROTO_MAX_BATCH ? count - done : MAC_PROTO_MAX_BATCH;
+
+        if (query_batch(sock, reader, macs + done, n, status) < 0) {
+            printf("[!] Server closed connection or sent a malformed reply.\n");
+            rc = -1;
+            break;
+        }
+        for (size_t i = 0; i < n; i++) {
+            mac_format(macs[done + i], mac);
+            printf("%s: %s\n", mac, status[i] == MAC_STATUS_GRANTED ? "granted" : "denied");
+        }
+        done += n;
+    }
+
+    frame_reader_free(reader);
+    close(sock);
+    return rc;
+}
+
+// Agent mode: authenticate this machine every interval seconds over one
+// persistent binary connection, reconnecting with exponential backoff when
+// it breaks. A line is printed whenever the outcome changes.
+void run_agent(const struct sockaddr_in *serv_addr, const char *wanted, int interval,
+               long long refresh_ns) {
+    struct frame_reader *reader = frame_reader_new(0);
+    char mac[MAC_STR_LEN + 1];
+    int sock = -1;
+    int backoff = 1;
+    int last = -1; // a mac_status, or -1 before the first answer
+
+    if (reader == NULL) {
+        perror("frame_reader_new");
+        exit(EXIT_FAILURE);
+    }
+    while (1) {
+        const struct link *l = local_link(wanted, refresh_ns);
+        unsigned char status;
+
+        if (l == NULL) {
+            fprintf(stderr, "[!] No usable network interface%s%s.\n",
+                    wanted != NULL ? " named " : "", wanted != NULL ? wanted : "");
+            sleep(interval);
+            continue;
+        }
+        // The server closes idle connections; one retry on a fresh
+        // connection tells that apart from a server that is down
+        for (int attempt = 0; attempt < 2; attempt++) {
+            if (sock < 0) {
+                sock = server_connect(serv_addr);
+                frame_reader_reset(reader);
+            }
+            if (sock >= 0 && query_batch(sock, reader, &l->mac, 1, &status) == 0) {
+                break;
+            }
+            if (sock >= 0) {
+                close(sock);
+                sock = -1;
+            }
+        }
+        if (sock < 0) {
+            fprintf(stderr, "[!] Server unreachable, retrying in %d s.\n", backoff);
+            sleep(backoff);
+            backoff = backoff * 2 < MAX_BACKOFF_S ? backoff * 2 : MAX_BACKOFF_S;
+            continue;
+        }
+        backoff = 1;
+        if (status != last) {
+            mac_format(l->mac, mac);
+            printf("[*] %s (%s): %s\n", mac, l->name, status == MAC_STATUS_GRANTED ? "granted" : "denied");
+            fflush(stdout);
+            last = status;
+        }
+        sleep(interval);
+    }
+}
+
+void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-b] [-H host] [-i interface] [-a seconds] [-r seconds] [MAC address...]\n", prog);
+    fprintf(stderr, "  -b  binary protocol: all addresses in batches over one connection\n");
+    fprintf(stderr, "      (default: the text protocol, one connection per address)\n");
+    fprintf(stderr, "  -H  server address (default 127.0.0.1)\n");
+    fprintf(stderr, "  -i  interface whose address to use (default: the first Ethernet\n");
+    fprintf(stderr, "      interface that is up, found with a netlink dump)\n");
+    fprintf(stderr, "  -a  run as an agent: re-authenticate every this many seconds over one\n");
+    fprintf(stderr, "      persistent connection, printing a line when the answer changes\n");
+    fprintf(stderr, "  -r  agent only: look the interface up again after this many seconds\n");
+    fprintf(stderr, "      (default %d)\n", DEFAULT_REFRESH_S);
+    fprintf(stderr, "  Without addresses, this machine's own address is authenticated.\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    struct sockaddr_in serv_addr;
+    char mac_address[MAC_STR_LEN + 1];
+    const char *server_host = "127.0.0.1"; // Change to server IP if not local
+    const char *interface = NULL;
+    int binary = 0;
+    int interval = 0;
+    int refresh = DEFAULT_REFRESH_S;
+    int c;
+
+    while ((c = getopt(argc, argv, "bH:i:a:r:")) != -1) {
+        switch (c) {
+        case 'b':
+            binary = 1;
+            break;
+        case 'H':
+            server_host = optarg;
+            break;
+        case 'i':
+            interface = optarg;
+            break;
+        case 'a':
+            interval = atoi(optarg);
+            break;
+        case 'r':
+            refresh = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (interval < 0 || refresh < 0) {
+        usage(argv[0]);
+    }
 
     serv_addr.sin_family = AF_INET;
     serv_addr.sin_port = htons(SERVER_PORT);
@@ -80,30 +388,48 @@ int main() {
         return -1;
     }
 
-    // Connect to the server
-    printf("[*] Connecting to server at %s:%d...\n", server_host, SERVER_PORT);
-    if (connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
-        perror("Connection Failed");
-        return -1;
+    if (interval > 0) {
+        printf("[*] Agent authenticating with %s:%d every %d s\n", server_host, SERVER_PORT, interval);
+        fflush(stdout);
+        run_agent(&serv_addr, interface, interval, refresh * 1000000000LL);
     }
-    printf("[*] Connection successful.\n");
 
-    // Send the MAC address to the server
-    send(sock, mac_address, strlen(mac_address), 0);
+    char *own[] = { mac_address };
+    char **addresses = argv + optind;
+    int count = argc - optind;
+    if (count == 0) {
+        const struct link *l = local_link(interface, 0);
+        if (l == NULL) {
+            fprintf(stderr, "[!] Could not find a usable network interface%s%s.\n",
+                    interface != NULL ? " named " : "", interface != NULL ? interface : "");
+            exit(EXIT_FAILURE);
+        }
+        mac_format(l->mac, mac_address);
+        printf("[*] This machine's MAC address is: %s (%s)\n", mac_address, l->name);
+        addresses = own;
+        count = 1;
+    }
 
-    // Receive the authentication response from the server
-    int valread = read(sock, buffer, BUFFER_SIZE - 1);
-    if (valread <= 0) {
-        printf("[!] Server closed connection or read error.\n");
-    } else {
-       buffer[valread] = '\0'; // Null-terminate the received string
-       printf("\n--- Server Response ---\n");
-       printf("%s\n", buffer);
-       printf("-----------------------\n");
+    printf("[*] Authenticating %d device(s) with %s:%d...\n", count, server_host, SERVER_PORT);
+    if (!binary) {
+        for (int i = 0; i < count; i++) {
+            authenticate_text(&serv_addr, addresses[i]);
+        }
+        return 0;
     }
 
-    // Clean up the connection
-    close(sock);
-    printf("[*] Connection closed.\n");
-    return 0;
+    uint64_t *macs = malloc(count * sizeof(*macs));
+    if (macs == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < count; i++) {
+        if (mac_parse(addresses[i], strlen(addresses[i]), &macs[i]) < 0) {
+            fprintf(stderr, "[!] \"%s\" is not a MAC address\n", addresses[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    int rc = authenticate_batch(&serv_addr, macs, count);
+    free(macs);
+    return rc < 0 ? EXIT_FAILURE : 0;
 }
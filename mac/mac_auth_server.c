@@ -1,109 +1,928 @@
+// MAC address authentication server
+//
+// A device connects, sends its MAC address as one text frame, gets a
+// "200"/"403" frame back and is disconnected. A gateway instead keeps one
+// connection open and sends batches of packed MAC addresses, each answered
+// with one status byte per device (see mac_proto.h). -w worker threads each
+// own a SO_REUSEPORT listener and a non-blocking epoll loop, so a slow
+// client only occupies a connection slot, never a thread. A client that has
+// sent no request within -t milliseconds of connecting is dropped, and a
+// binary client is closed after -k milliseconds without a batch. The main
+// thread only handles whitelist reloads (SIGHUP / inotify) and, on SIGINT
+// or SIGTERM, prints devices authenticated per second and the decision
+// latency distribution (accept or first byte of a batch, to reply).
+//
+// Devices reconnect constantly, so each worker keeps a decision cache keyed
+// on client IP and MAC: a repeat within -e milliseconds is answered without
+// a whitelist lookup or a log line. Denials are also counted per client IP;
+// an IP denied -r times within -e milliseconds is refused at accept time,
+// before anything is read, until that window runs out. Both caches are
+// dropped on every whitelist reload. SIGUSR1 prints their counters.
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <libgen.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/inotify.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include "framing.h"
+#include "auth_cache.h"
+#include "histogram.h"
+#include "mac_proto.h"
+#include "mac_set.h"
+#include "metrics.h"
+#include "sock_profile.h"
 
 #define PORT 5555
-#define MAX_CLIENTS 5
-#define BUFFER_SIZE 1024
+#define BACKLOG 4096 // capped by net.core.somaxconn
+#define MAX_EVENTS 256
+#define DEFAULT_DEADLINE_MS 2000
+#define DEFAULT_IDLE_MS 300000
+#define STOP_CHECK_MS 100
+#define ACCEPT_BATCH 64
+// Largest text frame a client may send; a MAC address is 17 bytes
+#define MAX_REQUEST 64
+#define MAX_FRAME (FRAME_HEADER_SIZE + MAC_PROTO_MAX_REQUEST)
+#define DEFAULT_CACHE_ENTRIES 4096
+#define DEFAULT_CACHE_TTL_MS 30000
+#define DEFAULT_REJECT_AFTER 10
+
+#define RESPONSE_OK "200: Authentication Successful"
+#define RESPONSE_DENIED "403: Authentication Failed - MAC Address Not Recognized"
+
+// The two replies, framed once at startup
+struct framed_response {
+    size_t len;
+    char buf[FRAME_HEADER_SIZE + 64];
+};
+
+static struct framed_response response_ok, response_denied;
 
 // --- Whitelist of Authorized MAC Addresses ---
-// Add your client's MAC address here for authentication to succeed.
+// Used when no whitelist file is given with -f. Add your client's MAC
+// address here for authentication to succeed.
 const char *authorized_macs[] = {
     "02:42:76:c2:f4:73",
-    "00:15:5d:5d:f3:bd",
+    "00:15:5d:5d:f3:bd",
     NULL // Sentinel value to mark the end of the array
 };
 
-// Function to check if a given MAC address is in the whitelist
-int is_authorized(const char *mac) {
-    for (int i = 0; authorized_macs[i] != NULL; i++) {
-        if (strcmp(mac, authorized_macs[i]) == 0) {
-            return 1; // Found
+// A connection waiting for a request. Every new connection gets the same
+// read deadline, so the deadline list is in accept order: expiring is
+// popping from the front and adding is appending at the back. Binary
+// clients between batches sit on a second list, ordered the same way by
+// the idle timeout.
+//
+// A text request is tiny and the connection carries exactly one, so it is
+// collected in a small inline buffer rather than a frame_reader ring, which
+// would cost a memfd and mappings per connection. A binary client moves to
+// a heap buffer sized for the largest batch.
+struct auth_conn {
+    int fd;
+    char *in; // inline_in or a MAX_FRAME heap buffer
+    size_t in_len;
+    size_t in_cap;
+    long long request_ns; // accept, or the first byte of the current batch
+    unsigned long long batches; // answered on this connection
+    long long deadline_ns;
+    struct auth_conn *prev, *next;
+    uint32_t ip_key; // network byte order
+    char ip[INET_ADDRSTRLEN];
+    int port;
+    char inline_in[FRAME_HEADER_SIZE + MAX_REQUEST];
+};
+
+struct worker {
+    pthread_t tid;
+    int id;
+    int listen_fd;
+    int epfd;
+    struct auth_conn deadlines; // list sentinel: waiting for a first request
+    struct auth_conn idle;      // list sentinel: binary clients between batches
+    struct histogram latency;   // accept to reply, ns
+    struct auth_cache *decisions; // (ip, mac) -> granted
+    struct auth_cache *denials;   // (ip, MAC_EMPTY) -> denials this window
+    unsigned long long granted;
+    unsigned long long denied;
+    unsigned long long batches;  // binary requests
+    unsigned long long batched;  // devices in them
+    unsigned long long rejected; // refused at accept by the denial limit
+    unsigned long long timeouts;
+    unsigned long long dropped;  // disconnects and bad frames
+};
+
+static int quiet = 0;
+static long long deadline_ns = DEFAULT_DEADLINE_MS * 1000000LL;
+static long long idle_ns = DEFAULT_IDLE_MS * 1000000LL;
+static size_t cache_entries = DEFAULT_CACHE_ENTRIES;
+static long long cache_ttl_ns = DEFAULT_CACHE_TTL_MS * 1000000LL;
+static unsigned reject_after = DEFAULT_REJECT_AFTER;
+static const struct sock_profile *profile = NULL; // -p, NULL for none
+
+// Scraped with -M; the same events as the per-worker counters above
+static struct server_metrics metrics;
+static metric_t granted_metric, denied_metric, rejected_metric, dropped_metric;
+static metric_t request_timeout_metric, idle_timeout_metric, latency_metric;
+
+// Set by SIGHUP: reload the whitelist file
+static volatile sig_atomic_t reload_requested = 0;
+// Set by SIGINT/SIGTERM: stop and print statistics
+static volatile sig_atomic_t stop_requested = 0;
+// Set by SIGUSR1: print the cache counters
+static volatile sig_atomic_t stats_requested = 0;
+
+void handle_sighup(int sig) {
+    (void)sig;
+    reload_requested = 1;
+}
+
+void handle_sigusr1(int sig) {
+    (void)sig;
+    stats_requested = 1;
+}
+
+void handle_stop(int sig) {
+    (void)sig;
+    // Read by the workers, hence atomic rather than a plain store
+    __atomic_store_n(&stop_requested, 1, __ATOMIC_RELAXED);
+}
+
+long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void frame_response(struct framed_response *r, const char *text) {
+    size_t len = strlen(text);
+
+    frame_encode_header(r->buf, (uint32_t)len);
+    memcpy(r->buf + FRAME_HEADER_SIZE, text, len);
+    r->len = FRAME_HEADER_SIZE + len;
+}
+
+// Count a denial against the client's IP
+void note_denial(struct worker *w, uint32_t ip, uint64_t generation, long long t) {
+    struct auth_cache_entry *e;
+
+    if (w->denials == NULL) {
+        return;
+    }
+    e = auth_cache_lookup(w->denials, ip, MAC_EMPTY, generation, t);
+    if (e == NULL) {
+        e = auth_cache_insert(w->denials, ip, MAC_EMPTY, generation, t + cache_ttl_ns);
+    }
+    if (e != NULL) {
+        e->count++;
+    }
+}
+
+// Has this IP used up its denials for the current window?
+int over_denial_limit(struct worker *w, uint32_t ip, long long t) {
+    struct auth_cache_entry *e;
+
+    if (w->denials == NULL) {
+        return 0;
+    }
+    e = auth_cache_lookup(w->denials, ip, MAC_EMPTY, whitelist_generation(), t);
+    return e != NULL && e->count >= reject_after;
+}
+
+// Build the whitelist from the file, or from authorized_macs[] without one,
+// and swap it in. Lookups in progress finish on the old set. On failure the
+// current whitelist stays in place.
+int load_whitelist(const char *path) {
+    struct mac_set *set;
+    uint64_t key;
+
+    if (path == NULL) {
+        set = mac_set_new(0);
+        for (int i = 0; set != NULL && authorized_macs[i] != NULL; i++) {
+            if (mac_parse(authorized_macs[i], strlen(authorized_macs[i]), &key) < 0) {
+                fprintf(stderr, "[!] Skipping malformed built-in MAC address \"%s\"\n", authorized_macs[i]);
+                continue;
+            }
+            mac_set_add(set, key);
         }
+    } else {
+        set = mac_set_load(path);
+    }
+    if (set == NULL) {
+        perror("[!] Could not load the whitelist");
+        return -1;
     }
-    return 0; // Not found
+
+    whitelist_publish(set);
+    printf("[*] Whitelist loaded: %zu MAC addresses\n", whitelist_size());
+    return 0;
 }
 
-int main() {
-    int server_fd, new_socket;
+// Watch the whitelist's directory rather than the file itself, so that
+// editors and deploy tools that replace the file by rename() are noticed
+int watch_whitelist(const char *path) {
+    char dir[4096];
+
+    snprintf(dir, sizeof(dir), "%s", path);
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        perror("inotify_init1");
+        return -1;
+    }
+    if (inotify_add_watch(fd, dirname(dir), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        perror("inotify_add_watch");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Drain pending inotify events. Returns 1 if one of them was for the file.
+int whitelist_changed(int inotify_fd, const char *path) {
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    char copy[4096];
+    int changed = 0;
+
+    snprintf(copy, sizeof(copy), "%s", path);
+    const char *name = basename(copy);
+    while (1) {
+        ssize_t n = read(inotify_fd, events, sizeof(events));
+        if (n <= 0) {
+            return changed;
+        }
+        for (char *p = events; p < events + n; ) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            if (ev->len > 0 && strcmp(ev->name, name) == 0) {
+                changed = 1;
+            }
+            p += sizeof(*ev) + ev->len;
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Workers
+// ---------------------------------------------------------------------------
+
+void conn_append(struct auth_conn *list, struct auth_conn *c) {
+    c->prev = list->prev;
+    c->next = list;
+    list->prev->next = c;
+    list->prev = c;
+}
+
+void conn_close(struct worker *w, struct auth_conn *c) {
+    c->prev->next = c->next;
+    c->next->prev = c->prev;
+    epoll_ctl(w->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    if (c->in != c->inline_in) {
+        free(c->in);
+    }
+    free(c);
+    metrics_dec(metrics.active);
+}
+
+// Accept at most ACCEPT_BATCH clients per wakeup; the listener is level
+// triggered, so the rest are picked up on the next round, after the
+// clients already waiting have been answered
+void accept_clients(struct worker *w) {
     struct sockaddr_in address;
+    socklen_t addrlen;
+    struct epoll_event ev;
+
+    for (int accepted = 0; accepted < ACCEPT_BATCH; accepted++) {
+        addrlen = sizeof(address);
+        int fd = accept4(w->listen_fd, (struct sockaddr *)&address, &addrlen, SOCK_NONBLOCK);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept");
+            }
+            return;
+        }
+        metrics_inc(metrics.accepts);
+
+        struct auth_conn *c = malloc(sizeof(*c));
+        if (c == NULL) {
+            perror("[!] Out of memory for a new client");
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        c->in = c->inline_in;
+        c->in_len = 0;
+        c->in_cap = sizeof(c->inline_in);
+        c->batches = 0;
+        c->request_ns = now_ns();
+        c->ip_key = address.sin_addr.s_addr;
+        if (over_denial_limit(w, c->ip_key, c->request_ns)) {
+            // Answer without reading; a full socket buffer only loses the reply
+            send(fd, response_denied.buf, response_denied.len, MSG_NOSIGNAL);
+            close(fd);
+            free(c);
+            w->rejected++;
+            metrics_inc(rejected_metric);
+            continue;
+        }
+        c->deadline_ns = c->request_ns + deadline_ns;
+        if (profile != NULL) {
+            sock_profile_apply_accepted(profile, fd);
+        }
+        inet_ntop(AF_INET, &address.sin_addr, c->ip, INET_ADDRSTRLEN);
+        c->port = ntohs(address.sin_port);
+
+        conn_append(&w->deadlines, c);
+        metrics_inc(metrics.active);
+
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = c;
+        if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl client");
+            conn_close(w, c);
+            continue;
+        }
+        if (!quiet) {
+            printf("[*] Accepted connection from %s:%d\n", c->ip, c->port);
+        }
+    }
+}
+
+// The decision for one device: from the cache if this IP asked about it
+// recently, otherwise from the whitelist, and then cached. Only fresh
+// decisions are logged.
+int decide(struct worker *w, struct auth_conn *c, uint64_t key, uint64_t generation, long long t) {
+    struct auth_cache_entry *cached = NULL;
+    char mac[MAC_STR_LEN + 1];
+    int authorized;
+
+    if (w->decisions != NULL &&
+        (cached = auth_cache_lookup(w->decisions, c->ip_key, key, generation, t)) != NULL) {
+        return cached->value;
+    }
+    authorized = whitelist_contains(key);
+    if (w->decisions != NULL &&
+        (cached = auth_cache_insert(w->decisions, c->ip_key, key, generation, t + cache_ttl_ns)) != NULL) {
+        cached->value = authorized;
+    }
+    if (!quiet) {
+        mac_format(key, mac);
+        if (authorized) {
+            printf("[*] MAC address %s from %s:%d is authorized.\n", mac, c->ip, c->port);
+        } else {
+            printf("[!] Unauthorized MAC address %s from %s:%d\n", mac, c->ip, c->port);
+        }
+    }
+    return authorized;
+}
+
+// Text request: one MAC address, a text reply, and the connection is done
+void answer_text(struct worker *w, struct auth_conn *c, const char *mac, size_t mac_len) {
+    // Read the generation first, so a cached decision never outlives the
+    // whitelist it was made against
+    uint64_t generation = whitelist_generation();
+    uint64_t key;
+    int authorized;
+    long long t = now_ns();
+
+    if (mac_parse(mac, mac_len, &key) < 0) {
+        authorized = 0; // Not a MAC address, so nothing to cache
+        if (!quiet) {
+            printf("[!] Malformed MAC address %.*s from %s:%d\n", (int)mac_len, mac, c->ip, c->port);
+        }
+    } else {
+        authorized = decide(w, c, key, generation, t);
+    }
+
+    const struct framed_response *response;
+    if (authorized) {
+        response = &response_ok;
+        w->granted++;
+        metrics_inc(granted_metric);
+    } else {
+        response = &response_denied;
+        w->denied++;
+        metrics_inc(denied_metric);
+        note_denial(w, c->ip_key, generation, t);
+    }
+
+    // The reply fits in an empty socket buffer, so this does not block
+    send(c->fd, response->buf, response->len, MSG_NOSIGNAL);
+    long long elapsed = now_ns() - c->request_ns;
+    histogram_record(&w->latency, elapsed);
+    metrics_observe_us(latency_metric, elapsed / 1000);
+    metrics_inc(metrics.requests);
+    metrics_add(metrics.bytes_out, response->len);
+}
+
+// Binary request: a batch of packed MAC addresses, answered with one status
+// byte each. Denials here do not count towards -r: a gateway asking about
+// many devices on one connection is not a reconnect storm. Returns -1 if
+// the request is malformed or the reply could not be sent whole.
+int answer_batch(struct worker *w, struct auth_conn *c, const unsigned char *macs, size_t len) {
+    char reply[FRAME_HEADER_SIZE + 1 + MAC_PROTO_MAX_BATCH];
+    uint64_t generation = whitelist_generation();
+    size_t count = len / MAC_BYTES;
+    size_t granted = 0;
+    long long t = now_ns();
+
+    if (count == 0 || len % MAC_BYTES != 0) {
+        return -1;
+    }
+    frame_encode_header(reply, (uint32_t)(1 + count));
+    reply[FRAME_HEADER_SIZE] = (char)MAC_PROTO_BINARY;
+    for (size_t i = 0; i < count; i++) {
+        int authorized = decide(w, c, mac_unpack(macs + i * MAC_BYTES), generation, t);
+        reply[FRAME_HEADER_SIZE + 1 + i] = authorized ? MAC_STATUS_GRANTED : MAC_STATUS_DENIED;
+        granted += authorized != 0;
+    }
+    w->granted += granted;
+    w->denied += count - granted;
+    w->batches++;
+    c->batches++;
+    w->batched += count;
+    metrics_add(granted_metric, granted);
+    metrics_add(denied_metric, count - granted);
+
+    // One reply is outstanding at a time unless the client pipelines, and it
+    // fits in the socket buffer; a client that stops reading is dropped
+    size_t reply_len = FRAME_HEADER_SIZE + 1 + count;
+    if (send(c->fd, reply, reply_len, MSG_NOSIGNAL) != (ssize_t)reply_len) {
+        return -1;
+    }
+    long long elapsed = now_ns() - c->request_ns;
+    histogram_record(&w->latency, elapsed);
+    metrics_observe_us(latency_metric, elapsed / 1000);
+    metrics_inc(metrics.requests);
+    metrics_add(metrics.bytes_out, reply_len);
+    return 0;
+}
+
+// Is a whole frame buffered? Returns 1 and its payload length, 0 if more
+// bytes are needed, -1 if the frame is too large. The inline buffer only
+// holds a text request; a batch gets a heap buffer on its first use.
+int conn_frame(struct auth_conn *c, size_t *len) {
+    if (c->in_len < FRAME_HEADER_SIZE) {
+        return 0;
+    }
+    *len = frame_decode_header(c->in);
+    if (*len > MAX_REQUEST && c->in == c->inline_in) {
+        if (*len > MAC_PROTO_MAX_REQUEST || (c->in = malloc(MAX_FRAME)) == NULL) {
+            c->in = c->inline_in;
+            return -1;
+        }
+        memcpy(c->in, c->inline_in, c->in_len);
+        c->in_cap = MAX_FRAME;
+    }
+    if (*len > c->in_cap - FRAME_HEADER_SIZE) {
+        return -1;
+    }
+    return c->in_len >= FRAME_HEADER_SIZE + *len;
+}
+
+// Move a binary connection to the back of the idle list after a batch.
+// Every idle timeout is the same length, so the list stays sorted.
+void conn_rearm(struct worker *w, struct auth_conn *c, long long t) {
+    c->prev->next = c->next;
+    c->next->prev = c->prev;
+    c->deadline_ns = t + idle_ns;
+    conn_append(&w->idle, c);
+}
+
+// Read what the client sent and answer every complete frame. A text request
+// is answered and the connection closed; after a batch the connection waits
+// for the next one. Anything else that ends the connection counts as
+// dropped, except a client closing between batches.
+void conn_on_readable(struct worker *w, struct auth_conn *c) {
+    size_t len;
+    int rc;
+
+    while (1) {
+        while ((rc = conn_frame(c, &len)) > 0) {
+            const char *payload = c->in + FRAME_HEADER_SIZE;
+            if (len == 0 || (unsigned char)payload[0] != MAC_PROTO_BINARY) {
+                answer_text(w, c, payload, len);
+                conn_close(w, c);
+                return;
+            }
+            if (answer_batch(w, c, (const unsigned char *)payload + 1, len - 1) < 0) {
+                rc = -1;
+                break;
+            }
+            c->in_len -= FRAME_HEADER_SIZE + len;
+            memmove(c->in, c->in + FRAME_HEADER_SIZE + len, c->in_len);
+            c->request_ns = now_ns();
+            conn_rearm(w, c, c->request_ns);
+        }
+        if (rc < 0) {
+            break;
+        }
+
+        ssize_t n = recv(c->fd, c->in + c->in_len, c->in_cap - c->in_len, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return; // wait for the rest
+        }
+        if (n <= 0) {
+            break; // EOF or error
+        }
+        if (c->in_len == 0 && c->batches > 0) {
+            c->request_ns = now_ns(); // the next batch starts arriving
+        }
+        c->in_len += n;
+        metrics_add(metrics.bytes_in, n);
+    }
+
+    if (rc == 0 && c->in_len == 0 && c->batches > 0) {
+        conn_close(w, c); // a gateway hanging up between batches
+        return;
+    }
+    if (!quiet) {
+        printf("[!] Client %s:%d disconnected or sent a bad frame.\n", c->ip, c->port);
+    }
+    w->dropped++;
+    metrics_inc(dropped_metric);
+    conn_close(w, c);
+}
+
+// Drop clients past their deadline. Returns the epoll_wait() timeout until
+// the next deadline, capped so that a stop request is noticed.
+int expire_deadlines(struct worker *w) {
+    long long t = now_ns();
+    long long next = t + STOP_CHECK_MS * 1000000LL;
+
+    while (w->deadlines.next != &w->deadlines && w->deadlines.next->deadline_ns <= t) {
+        struct auth_conn *c = w->deadlines.next;
+        if (!quiet) {
+            printf("[!] Client %s:%d sent nothing within the deadline, dropping it.\n", c->ip, c->port);
+        }
+        w->timeouts++;
+        metrics_inc(request_timeout_metric);
+        conn_close(w, c);
+    }
+    while (w->idle.next != &w->idle && w->idle.next->deadline_ns <= t) {
+        struct auth_conn *c = w->idle.next;
+        if (!quiet) {
+            printf("[*] Client %s:%d has been idle too long, closing it.\n", c->ip, c->port);
+        }
+        metrics_inc(idle_timeout_metric);
+        conn_close(w, c);
+    }
+    if (w->deadlines.next != &w->deadlines && w->deadlines.next->deadline_ns < next) {
+        next = w->deadlines.next->deadline_ns;
+    }
+    if (w->idle.next != &w->idle && w->idle.next->deadline_ns < next) {
+        next = w->idle.next->deadline_ns;
+    }
+    return (int)((next - t + 999999) / 1000000);
+}
+
+void *worker_main(void *arg) {
+    struct worker *w = arg;
+    struct epoll_event ev, events[MAX_EVENTS];
+
+    w->deadlines.next = w->deadlines.prev = &w->deadlines;
+    w->idle.next = w->idle.prev = &w->idle;
+    w->epfd = epoll_create1(0);
+    if (w->epfd < 0) {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; // the listener
+    if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->listen_fd, &ev) < 0) {
+        perror("epoll_ctl listener");
+        exit(EXIT_FAILURE);
+    }
+
+    while (!__atomic_load_n(&stop_requested, __ATOMIC_RELAXED)) {
+        int timeout = expire_deadlines(w);
+        int nfds = epoll_wait(w->epfd, events, MAX_EVENTS, timeout);
+        for (int i = 0; i < nfds; i++) {
+            if (events[i].data.ptr == NULL) {
+                accept_clients(w);
+            } else {
+                conn_on_readable(w, events[i].data.ptr);
+            }
+        }
+    }
+
+    while (w->deadlines.next != &w->deadlines) {
+        conn_close(w, w->deadlines.next);
+    }
+    while (w->idle.next != &w->idle) {
+        conn_close(w, w->idle.next);
+    }
+    close(w->epfd);
+    close(w->listen_fd);
+    return NULL;
+}
+
+int open_listener(struct sockaddr_in *address) {
     int opt = 1;
-    int addrlen = sizeof(address);
-    char buffer[BUFFER_SIZE] = {0};
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
 
-    // Creating socket file descriptor
-    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
+    if (fd < 0) {
         perror("socket failed");
         exit(EXIT_FAILURE);
     }
-
-    // Forcefully attaching socket to the port 5555
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt))) {
+    // Every worker binds its own listener to port 5555; the kernel spreads
+    // incoming connections across them
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
         perror("setsockopt");
         exit(EXIT_FAILURE);
     }
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY; // Listen on all available interfaces
-    address.sin_port = htons(PORT);
-
-    // Bind the socket to the network address and port
-    if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+    if (profile != NULL) {
+        sock_profile_apply_listener(profile, fd);
+    }
+    if (bind(fd, (struct sockaddr *)address, sizeof(*address)) < 0) {
         perror("bind failed");
         exit(EXIT_FAILURE);
     }
-
-    // Start listening for incoming connections
-    if (listen(server_fd, MAX_CLIENTS) < 0) {
+    if (listen(fd, sock_profile_backlog(profile, BACKLOG)) < 0) {
         perror("listen");
         exit(EXIT_FAILURE);
     }
+    return fd;
+}
 
-    printf("[*] Server listening on port %d\n", PORT);
-    printf("[*] Waiting for a connection...\n");
+// Sum the cache counters over the workers and print them. The counters are
+// read while the workers run, so the sums are not one consistent snapshot.
+void print_cache_stats(const char *name, struct worker *workers, int nworkers,
+                       struct auth_cache *(*pick)(struct worker *)) {
+    struct auth_cache_stats sum = { 0 }, s;
+    size_t capacity = 0;
 
-    // Main server loop to accept and handle connections
-    while (1) {
-        if ((new_socket = accept(server_fd, (struct sockaddr *)&address, (socklen_t*)&addrlen)) < 0) {
-            perror("accept");
-            continue; // Continue to the next iteration on accept failure
-        }
-        
-        char client_ip[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &address.sin_addr, client_ip, INET_ADDRSTRLEN);
-        printf("\n[*] Accepted connection from %s:%d\n", client_ip, ntohs(address.sin_port));
-
-        // Clear buffer and read the MAC address from the client
-        memset(buffer, 0, BUFFER_SIZE);
-        int valread = read(new_socket, buffer, BUFFER_SIZE - 1); // -1 to leave space for null terminator
-        if (valread <= 0) {
-            printf("[!] Client disconnected or read error.\n");
-            close(new_socket);
-            continue;
+    for (int i = 0; i < nworkers; i++) {
+        if (pick(&workers[i]) == NULL) {
+            return; // disabled
         }
+        auth_cache_read_stats(pick(&workers[i]), &s);
+        sum.hits += s.hits;
+        sum.misses += s.misses;
+        sum.evictions += s.evictions;
+        sum.expired += s.expired;
+        sum.size += s.size;
+        capacity += pick(&workers[i])->capacity;
+    }
+    unsigned long long lookups = sum.hits + sum.misses;
+    printf("[*] %s cache: %llu hits, %llu misses (%.1f%% hit), %llu evictions, %llu expired, %llu/%zu entries\n",
+           name, sum.hits, sum.misses, lookups > 0 ? 100.0 * sum.hits / lookups : 0.0,
+           sum.evictions, sum.expired, sum.size, capacity);
+}
 
-        printf("[*] Received MAC address: %s\n", buffer);
+struct auth_cache *pick_decisions(struct worker *w) {
+    return w->decisions;
+}
 
-        // Authenticate the MAC address
-        const char *response;
-        if (is_authorized(buffer)) {
-            response = "200: Authentication Successful";
-            printf("[*] MAC address %s is authorized.\n", buffer);
-        } else {
-            response = "403: Authentication Failed - MAC Address Not Recognized";
-            printf("[!] Unauthorized MAC address: %s\n", buffer);
+struct auth_cache *pick_denials(struct worker *w) {
+    return w->denials;
+}
+
+void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-f whitelist_file] [-w workers] [-t deadline_ms] [-k idle_ms]\n"
+                    "       [-c entries] [-e ttl_ms] [-r denials] [-p profile] [-P file] [-M port|path] [-q]\n", prog);
+    fprintf(stderr, "  -f  one MAC address per line; reloaded when the file changes or on SIGHUP\n");
+    fprintf(stderr, "  -w  worker threads (default: one per online CPU)\n");
+    fprintf(stderr, "  -t  drop clients that have not sent their MAC address after this many\n");
+    fprintf(stderr, "      milliseconds (default %d)\n", DEFAULT_DEADLINE_MS);
+    fprintf(stderr, "  -k  close binary clients idle for this many milliseconds (default %d)\n",
+            DEFAULT_IDLE_MS);
+    fprintf(stderr, "  -c  decision cache entries per worker, 0 to disable (default %d)\n",
+            DEFAULT_CACHE_ENTRIES);
+    fprintf(stderr, "  -e  how long a cached decision or a denial count lasts, in milliseconds\n");
+    fprintf(stderr, "      (default %d)\n", DEFAULT_CACHE_TTL_MS);
+    fprintf(stderr, "  -r  refuse a client IP at accept after this many denials within -e ms,\n");
+    fprintf(stderr, "      counted per worker; 0 to disable (default %d)\n", DEFAULT_REJECT_AFTER);
+    fprintf(stderr, "  -p  socket tuning profile: low-latency, bulk, high-conn or one from -P\n");
+    fprintf(stderr, "  -P  load socket tuning profiles from file\n");
+    fprintf(stderr, "  -M  serve Prometheus metrics on this TCP port or Unix socket path\n");
+    fprintf(stderr, "  -q  do not log every connection\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    struct sockaddr_in address;
+    const char *whitelist_path = NULL;
+    int inotify_fd = -1;
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int nworkers = ncpus > 0 ? (int)ncpus : 1;
+    struct sigaction sa;
+    sigset_t handled, old_mask;
+    const char *profile_name = NULL;
+    const char *metrics_endpoint = NULL;
+    int c;
+
+    while ((c = getopt(argc, argv, "f:w:t:k:c:e:r:p:P:M:q")) != -1) {
+        switch (c) {
+        case 'f':
+            whitelist_path = optarg;
+            break;
+        case 'w':
+            nworkers = atoi(optarg);
+            break;
+        case 't':
+            deadline_ns = atoll(optarg) * 1000000LL;
+            break;
+        case 'k':
+            idle_ns = atoll(optarg) * 1000000LL;
+            break;
+        case 'c':
+            cache_entries = strtoul(optarg, NULL, 10);
+            break;
+        case 'e':
+            cache_ttl_ns = atoll(optarg) * 1000000LL;
+            break;
+        case 'r':
+            reject_after = strtoul(optarg, NULL, 10);
+            break;
+        case 'p':
+            profile_name = optarg;
+            break;
+        case 'M':
+            metrics_endpoint = optarg;
+            break;
+        case 'P':
+            if (sock_profiles_load(optarg) < 0) {
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'q':
+            quiet = 1;
+            break;
+        default:
+            usage(argv[0]);
         }
+    }
+    if (nworkers < 1 || deadline_ns <= 0 || idle_ns <= 0 || cache_ttl_ns <= 0) {
+        fprintf(stderr, "workers, deadline, idle timeout and cache TTL must be positive\n");
+        exit(EXIT_FAILURE);
+    }
+    if (profile_name != NULL && (profile = sock_profile_find(profile_name)) == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    metrics_register_server(&metrics);
+    granted_metric = metrics_counter("auth_decisions_total", "result=\"granted\"", "Devices authenticated");
+    denied_metric = metrics_counter("auth_decisions_total", "result=\"denied\"", "Devices authenticated");
+    rejected_metric = metrics_counter("auth_rejected_total", NULL, "Clients refused at accept by the denial limit");
+    request_timeout_metric = metrics_counter("server_timeouts_total", "kind=\"request\"",
+                                             "Connections closed by a deadline");
+    idle_timeout_metric = metrics_counter("server_timeouts_total", "kind=\"idle\"",
+                                          "Connections closed by a deadline");
+    dropped_metric = metrics_counter("server_dropped_total", NULL, "Disconnects and bad frames");
+    latency_metric = metrics_histogram("auth_decision_seconds", NULL,
+                                       "Accept or first byte of a batch, to reply");
+    if (metrics_endpoint != NULL && metrics_serve(metrics_endpoint) < 0) {
+        exit(EXIT_FAILURE);
+    }
+    frame_response(&response_ok, RESPONSE_OK);
+    frame_response(&response_denied, RESPONSE_DENIED);
 
-        // Send the response back to the client
-        send(new_socket, response, strlen(response), 0);
-        
-        // Close the connection with the client
-        close(new_socket);
-        printf("[*] Connection with %s closed.\n", client_ip);
+    if (load_whitelist(whitelist_path) < 0) {
+        exit(EXIT_FAILURE);
     }
+    if (whitelist_path != NULL) {
+        inotify_fd = watch_whitelist(whitelist_path);
+    }
+
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY; // Listen on all available interfaces
+    address.sin_port = htons(PORT);
+
+    // Workers inherit a mask with the handled signals blocked, so they are
+    // always delivered to the main thread
+    sigemptyset(&handled);
+    sigaddset(&handled, SIGHUP);
+    sigaddset(&handled, SIGUSR1);
+    sigaddset(&handled, SIGINT);
+    sigaddset(&handled, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &handled, &old_mask);
 
+    struct worker *workers = calloc(nworkers, sizeof(*workers));
+    if (workers == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < nworkers; i++) {
+        workers[i].id = i;
+        workers[i].listen_fd = open_listener(&address);
+        histogram_init(&workers[i].latency);
+        if (cache_entries > 0) {
+            workers[i].decisions = auth_cache_new(cache_entries);
+            if (workers[i].decisions == NULL) {
+                perror("[!] Could not allocate the decision cache");
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (reject_after > 0) {
+            workers[i].denials = auth_cache_new(cache_entries > 0 ? cache_entries : DEFAULT_CACHE_ENTRIES);
+            if (workers[i].denials == NULL) {
+                perror("[!] Could not allocate the denial cache");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    for (int i = 0; i < nworkers; i++) {
+        if (pthread_create(&workers[i].tid, NULL, worker_main, &workers[i]) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // No SA_RESTART, so a blocked poll() returns and the request is handled
+    // right away
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_sighup;
+    sigaction(SIGHUP, &sa, NULL);
+    sa.sa_handler = handle_sigusr1;
+    sigaction(SIGUSR1, &sa, NULL);
+    sa.sa_handler = handle_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+    printf("[*] Server listening on port %d (%d workers, %lld ms read deadline)\n",
+           PORT, nworkers, deadline_ns / 1000000);
+    if (profile != NULL) {
+        char description[256];
+        sock_profile_describe(profile, description, sizeof(description));
+        printf("[*] Socket profile %s\n", description);
+    }
+    fflush(stdout);
+    long long start = now_ns();
+
+    struct pollfd pfd = { .fd = inotify_fd, .events = POLLIN };
+    while (!stop_requested) {
+        int ready = poll(&pfd, inotify_fd >= 0 ? 1 : 0, -1);
+        if (reload_requested) {
+            reload_requested = 0;
+            printf("[*] SIGHUP: reloading the whitelist\n");
+            load_whitelist(whitelist_path);
+        }
+        if (ready > 0 && whitelist_changed(inotify_fd, whitelist_path)) {
+            printf("[*] %s changed: reloading the whitelist\n", whitelist_path);
+            load_whitelist(whitelist_path);
+        }
+        if (stats_requested) {
+            stats_requested = 0;
+            print_cache_stats("Decision", workers, nworkers, pick_decisions);
+            print_cache_stats("Denial", workers, nworkers, pick_denials);
+        }
+        if (ready < 0 && errno != EINTR) {
+            perror("poll");
+        }
+        fflush(stdout);
+    }
+
+    struct histogram *total = malloc(sizeof(*total));
+    unsigned long long granted = 0, denied = 0, batched = 0, batches = 0, rejected = 0, timeouts = 0, dropped = 0;
+    if (total == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    histogram_init(total);
+    for (int i = 0; i < nworkers; i++) {
+        pthread_join(workers[i].tid, NULL);
+        histogram_merge(total, &workers[i].latency);
+        granted += workers[i].granted;
+        denied += workers[i].denied;
+        batched += workers[i].batched;
+        batches += workers[i].batches;
+        rejected += workers[i].rejected;
+        timeouts += workers[i].timeouts;
+        dropped += workers[i].dropped;
+    }
+    double seconds = (now_ns() - start) / 1e9;
+
+    printf("[*] %llu authentications in %.1f s (%.0f/sec): %llu granted, %llu denied, %llu in %llu batches,\n"
+           "    %llu refused at accept, %llu timed out, %llu dropped\n",
+           granted + denied, seconds, (granted + denied) / seconds, granted, denied,
+           batched, batches, rejected, timeouts, dropped);
+    printf("[*] Decision latency (us): p50 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+           histogram_percentile(total, 50) / 1000.0, histogram_percentile(total, 99) / 1000.0,
+           histogram_percentile(total, 99.9) / 1000.0, total->max / 1000.0);
+
+    print_cache_stats("Decision", workers, nworkers, pick_decisions);
+    print_cache_stats("Denial", workers, nworkers, pick_denials);
+
+    for (int i = 0; i < nworkers; i++) {
+        auth_cache_free(workers[i].decisions);
+        auth_cache_free(workers[i].denials);
+    }
+    free(total);
+    free(workers);
     return 0;
 }
@@ -0,0 +1,47 @@
+// Wire format of the MAC authentication server (mac_auth_server.c)
+//
+// Both directions carry frames (common/framing.h). The server tells the two
+// request formats apart by the first payload byte:
+//
+//   text    "xx:xx:xx:xx:xx:xx", one device per connection. The reply is
+//           "200: ..." or "403: ..." and the server then closes. Kept for
+//           existing clients.
+//   binary  MAC_PROTO_BINARY, then 1..MAC_PROTO_MAX_BATCH addresses of
+//           MAC_BYTES each, most significant byte first. The reply is
+//           MAC_PROTO_BINARY followed by one mac_status byte per address,
+//           in request order. The connection stays open for the next batch.
+//
+// MAC_PROTO_BINARY is not printable ASCII, so it never starts a text request.
+#ifndef MAC_PROTO_H
+#define MAC_PROTO_H
+
+#include <stdint.h>
+
+#define MAC_PROTO_BINARY 0xB1
+#define MAC_PROTO_MAX_BATCH 1024
+#define MAC_BYTES 6
+// Payload of the largest binary request
+#define MAC_PROTO_MAX_REQUEST (1 + MAC_PROTO_MAX_BATCH * MAC_BYTES)
+
+enum mac_status {
+    MAC_STATUS_GRANTED = 0,
+    MAC_STATUS_DENIED = 1,
+};
+
+static inline void mac_pack(uint64_t mac, unsigned char out[MAC_BYTES]) {
+    for (int i = MAC_BYTES - 1; i >= 0; i--) {
+        out[i] = (unsigned char)mac;
+        mac >>= 8;
+    }
+}
+
+static inline uint64_t mac_unpack(const unsigned char in[MAC_BYTES]) {
+    uint64_t mac = 0;
+
+    for (int i = 0; i < MAC_BYTES; i++) {
+        mac = mac << 8 | in[i];
+    }
+    return mac;
+}
+
+#endif
@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "mac_set.h"
+
+#define MIN_CAPACITY 16
+#define MAX_READERS 1024
+#define LINE_SIZE 256
+
+// ---------------------------------------------------------------------------
+// Parsing
+// ---------------------------------------------------------------------------
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c |= 0x20; // lower case
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+int mac_parse(const char *s, size_t len, uint64_t *mac) {
+    uint64_t value = 0;
+
+    if (len != MAC_STR_LEN) {
+        return -1;
+    }
+    for (int i = 0; i < 6; i++) {
+        int hi = hex_value(s[i * 3]);
+        int lo = hex_value(s[i * 3 + 1]);
+        if (hi < 0 || lo < 0) {
+            return -1;
+        }
+        if (i < 5 && s[i * 3 + 2] != ':' && s[i * 3 + 2] != '-') {
+            return -1;
+        }
+        value = (value << 8) | (uint64_t)(hi << 4 | lo);
+    }
+    *mac = value;
+    return 0;
+}
+
+void mac_format(uint64_t mac, char out[MAC_STR_LEN + 1]) {
+    snprintf(out, MAC_STR_LEN + 1, "%02x:%02x:%02x:%02x:%02x:%02x",
+             (unsigned)(mac >> 40) & 0xff, (unsigned)(mac >> 32) & 0xff,
+             (unsigned)(mac >> 24) & 0xff, (unsigned)(mac >> 16) & 0xff,
+             (unsigned)(mac >> 8) & 0xff, (unsigned)mac & 0xff);
+}
+
+// ---------------------------------------------------------------------------
+// Hash set
+// ---------------------------------------------------------------------------
+
+static int set_alloc(struct mac_set *set, size_t capacity) {
+    unsigned bits = 0;
+
+    while (((size_t)1 << bits) < capacity) {
+        bits++;
+    }
+    set->slots = malloc(((size_t)1 << bits) * sizeof(*set->slots));
+    if (set->slots == NULL) {
+        return -1;
+    }
+    // MAC_EMPTY is all ones
+    memset(set->slots, 0xff, ((size_t)1 << bits) * sizeof(*set->slots));
+    set->shift = 64 - bits;
+    set->mask = ((size_t)1 << bits) - 1;
+    set->count = 0;
+    return 0;
+}
+
+struct mac_set *mac_set_new(size_t expected) {
+    struct mac_set *set = malloc(sizeof(*set));
+    size_t capacity = MIN_CAPACITY;
+
+    if (set == NULL) {
+        return NULL;
+    }
+    // Keep the load factor at or below one half
+    while (capacity < expected * 2) {
+        capacity *= 2;
+    }
+    if (set_alloc(set, capacity) < 0) {
+        free(set);
+        return NULL;
+    }
+    return set;
+}
+
+void mac_set_free(struct mac_set *set) {
+    if (set != NULL) {
+        free(set->slots);
+        free(set);
+    }
+}
+
+static void set_insert(struct mac_set *set, uint64_t mac) {
+    size_t i = (size_t)((mac * 0x9E3779B97F4A7C15ULL) >> set->shift);
+
+    while (set->slots[i] != MAC_EMPTY) {
+        if (set->slots[i] == mac) {
+            return;
+        }
+        i = (i + 1) & set->mask;
+    }
+    set->slots[i] = mac;
+    set->count++;
+}
+
+int mac_set_add(struct mac_set *set, uint64_t mac) {
+    if ((set->count + 1) * 2 > set->mask + 1) {
+        struct mac_set bigger;
+        if (set_alloc(&bigger, (set->mask + 1) * 2) < 0) {
+            return -1;
+        }
+        for (size_t i = 0; i <= set->mask; i++) {
+            if (set->slots[i] != MAC_EMPTY) {
+                set_insert(&bigger, set->slots[i]);
+            }
+        }
+        free(set->slots);
+        *set = bigger;
+    }
+    set_insert(set, mac);
+    return 0;
+}
+
+struct mac_set *mac_set_load(const char *path) {
+    char line[LINE_SIZE];
+    int lineno = 0;
+    uint64_t mac;
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return NULL;
+    }
+    struct mac_set *set = mac_set_new(0);
+    if (set == NULL) {
+        fclose(fp);
+        return NULL;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        lineno++;
+        char *start = line + strspn(line, " \t");
+        size_t len = strcspn(start, " \t\r\n#");
+        if (len == 0) {
+            continue;
+        }
+        if (mac_parse(start, len, &mac) < 0) {
+            fprintf(stderr, "%s:%d: not a MAC address: %.*s\n", path, lineno, (int)len, start);
+            continue;
+        }
+        if (mac_set_add(set, mac) < 0) {
+            int saved = errno;
+            mac_set_free(set);
+            fclose(fp);
+            errno = saved;
+            return NULL;
+        }
+    }
+
+    fclose(fp);
+    return set;
+}
+
+// ---------------------------------------------------------------------------
+// Published whitelist
+//
+// Every reader thread owns a slot holding the epoch it entered its current
+// lookup in, or 0 while it is outside one. The writer swaps the pointer,
+// advances the epoch, and waits for every slot to be 0 or at the new epoch:
+// readers that entered later can only have seen the new set.
+// ---------------------------------------------------------------------------
+
+struct reader_slot {
+    uint64_t epoch;
+    int in_use;
+} __attribute__((aligned(64)));
+
+static struct mac_set *current_set = NULL;
+static uint64_t global_epoch = 1;
+static struct reader_slot reader_slots[MAX_READERS];
+static int reader_high_water = 0;
+static pthread_mutex_t reader_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t reader_key;
+static pthread_once_t reader_key_once = PTHREAD_ONCE_INIT;
+static __thread struct reader_slot *my_slot = NULL;
+
+static void release_slot(void *slot) {
+    pthread_mutex_lock(&reader_lock);
+    ((struct reader_slot *)slot)->in_use = 0;
+    pthread_mutex_unlock(&reader_lock);
+}
+
+static void make_reader_key(void) {
+    pthread_key_create(&reader_key, release_slot);
+}
+
+// Claim a slot for this thread on its first lookup; it is released when the
+// thread exits, so thread-per-connection servers do not run out
+static struct reader_slot *claim_slot(void) {
+    struct reader_slot *slot = NULL;
+
+    pthread_once(&reader_key_once, make_reader_key);
+    pthread_mutex_lock(&reader_lock);
+    for (int i = 0; i < MAX_READERS; i++) {
+        if (!reader_slots[i].in_use) {
+            slot = &reader_slots[i];
+            slot->in_use = 1;
+            if (i >= reader_high_water) {
+                __atomic_store_n(&reader_high_water, i + 1, __ATOMIC_RELEASE);
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&reader_lock);
+
+    if (slot == NULL) {
+        fprintf(stderr, "whitelist: more than %d concurrent reader threads\n", MAX_READERS);
+        abort();
+    }
+    pthread_setspecific(reader_key, slot);
+    return slot;
+}
+
+int whitelist_contains(uint64_t mac) {
+    if (my_slot == NULL) {
+        my_slot = claim_slot();
+    }
+
+    // Announce the epoch before loading the pointer (both sequentially
+    // consistent, so the writer cannot miss this reader)
+    __atomic_store_n(&my_slot->epoch, __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+    const struct mac_set *set = __atomic_load_n(&current_set, __ATOMIC_SEQ_CST);
+    int found = set != NULL && mac_set_contains(set, mac);
+    __atomic_store_n(&my_slot->epoch, 0, __ATOMIC_RELEASE);
+    return found;
+}
+
+size_t whitelist_size(void) {
+    const struct mac_set *set = __atomic_load_n(&current_set, __ATOMIC_ACQUIRE);
+    return set != NULL ? set->count : 0;
+}
+
+uint64_t whitelist_generation(void) {
+    return __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+}
+
+void whitelist_publish(struct mac_set *set) {
+    struct mac_set *old = __atomic_exchange_n(&current_set, set, __ATOMIC_SEQ_CST);
+    uint64_t epoch = __atomic_add_fetch(&global_epoch, 1, __ATOMIC_SEQ_CST);
+    int readers = __atomic_load_n(&reader_high_water, __ATOMIC_ACQUIRE);
+
+    // Wait out readers that entered before the swap
+    for (int i = 0; i < readers; i++) {
+        while (1) {
+            uint64_t seen = __atomic_load_n(&reader_slots[i].epoch, __ATOMIC_ACQUIRE);
+            if (seen == 0 || seen >= epoch) {
+                break;
+            }
+            sched_yield();
+        }
+    }
+    mac_set_free(old);
+}
@@ -0,0 +1,72 @@
+// MAC address whitelist: 48-bit keys in an open-addressing hash set, and a
+// published "current" set that can be replaced while lookups are running.
+//
+// Lookups are one multiply, a shift and (at load factor <= 1/2) usually a
+// single probe, independent of the number of entries.
+//
+// Replacement is RCU style: whitelist_publish() swaps the pointer
+// atomically, then waits until no reader can still be inside the old set
+// before freeing it. Readers never block and never take a lock.
+#ifndef MAC_SET_H
+#define MAC_SET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MAC_STR_LEN 17      // "xx:xx:xx:xx:xx:xx"
+#define MAC_EMPTY UINT64_MAX // never a valid 48-bit MAC
+
+struct mac_set {
+    uint64_t *slots;
+    unsigned shift; // 64 - log2(capacity)
+    size_t mask;
+    size_t count;
+};
+
+// Parse "xx:xx:xx:xx:xx:xx" (either case, ':' or '-') into the low 48 bits
+// of *mac. Returns 0, or -1 if s is not a MAC address.
+int mac_parse(const char *s, size_t len, uint64_t *mac);
+void mac_format(uint64_t mac, char out[MAC_STR_LEN + 1]);
+
+// A set sized for about expected entries; it grows as needed
+struct mac_set *mac_set_new(size_t expected);
+void mac_set_free(struct mac_set *set);
+int mac_set_add(struct mac_set *set, uint64_t mac);
+
+// Read one MAC per line; blank lines and '#' comments are skipped, and
+// malformed lines are reported and skipped. NULL with errno on failure.
+struct mac_set *mac_set_load(const char *path);
+
+static inline int mac_set_contains(const struct mac_set *set, uint64_t mac) {
+    size_t i = (size_t)((mac * 0x9E3779B97F4A7C15ULL) >> set->shift);
+
+    while (1) {
+        uint64_t slot = set->slots[i];
+        if (slot == mac) {
+            return 1;
+        }
+        if (slot == MAC_EMPTY) {
+            return 0;
+        }
+        i = (i + 1) & set->mask;
+    }
+}
+
+// Replace the published set. The previous one is freed once every reader
+// that might be using it has finished. Call from one thread at a time.
+void whitelist_publish(struct mac_set *set);
+
+// Look mac up in the published set. Safe from any thread, concurrently
+// with whitelist_publish(). 0 if nothing is published yet.
+int whitelist_contains(uint64_t mac);
+
+// Entries in the published set
+size_t whitelist_size(void);
+
+// Advances on every whitelist_publish(). Read it before a lookup: the
+// lookup then used the set of that generation or a newer one, so anything
+// derived from it can be tagged with the generation and dropped once the
+// generation moves on.
+uint64_t whitelist_generation(void);
+
+#endif
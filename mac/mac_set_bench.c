@@ -0,0 +1,140 @@
+// Lookup microbenchmark for the MAC whitelist
+//
+// For whitelists of 10, 10k and 1M random MACs, times lookups of random
+// keys (half of them present) through the hash set and through the
+// published whitelist (epoch bookkeeping included). The old strcmp() scan
+// over a string array is timed too, for comparison.
+//
+//   ./mac_set_bench [-n lookups]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "mac_set.h"
+
+#define DEFAULT_LOOKUPS 10000000
+#define PROBE_KEYS 4096 // power of two
+
+long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// xorshift64*, so runs are reproducible
+static uint64_t rng_state = 0x2545F4914F6CDD1DULL;
+
+uint64_t random_mac(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (rng_state * 0x2545F4914F6CDD1DULL) >> 16;
+}
+
+// The previous implementation: strcmp() down an array of strings
+int linear_contains(char **macs, size_t n, const char *mac) {
+    for (size_t i = 0; i < n; i++) {
+        if (strcmp(mac, macs[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void bench(size_t entries, long lookups) {
+    uint64_t *members = malloc(entries * sizeof(*members));
+    uint64_t probes[PROBE_KEYS];
+    char probe_strs[PROBE_KEYS][MAC_STR_LEN + 1];
+    struct mac_set *set = mac_set_new(entries);
+    volatile long found = 0;
+
+    if (members == NULL || set == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < entries; i++) {
+        members[i] = random_mac();
+        mac_set_add(set, members[i]);
+    }
+    for (int i = 0; i < PROBE_KEYS; i++) {
+        probes[i] = (i & 1) ? members[random_mac() % entries] : random_mac();
+        mac_format(probes[i], probe_strs[i]);
+    }
+
+    long long start = now_ns();
+    for (long i = 0; i < lookups; i++) {
+        found += mac_set_contains(set, probes[i & (PROBE_KEYS - 1)]);
+    }
+    double set_ns = (double)(now_ns() - start) / lookups;
+
+    // Parsing the string as well, which is what the server pays per login
+    start = now_ns();
+    for (long i = 0; i < lookups; i++) {
+        uint64_t key;
+        mac_parse(probe_strs[i & (PROBE_KEYS - 1)], MAC_STR_LEN, &key);
+        found += mac_set_contains(set, key);
+    }
+    double parse_ns = (double)(now_ns() - start) / lookups;
+
+    whitelist_publish(set);
+    start = now_ns();
+    for (long i = 0; i < lookups; i++) {
+        found += whitelist_contains(probes[i & (PROBE_KEYS - 1)]);
+    }
+    double published_ns = (double)(now_ns() - start) / lookups;
+
+    // The linear scan gets fewer lookups so the 1M case finishes
+    char **strs = malloc(entries * sizeof(*strs));
+    for (size_t i = 0; i < entries; i++) {
+        strs[i] = malloc(MAC_STR_LEN + 1);
+        mac_format(members[i], strs[i]);
+    }
+    long linear_lookups = lookups / (long)entries + 1;
+    if (linear_lookups > lookups) {
+        linear_lookups = lookups;
+    }
+    if (linear_lookups < 100) {
+        linear_lookups = 100;
+    }
+    start = now_ns();
+    for (long i = 0; i < linear_lookups; i++) {
+        found += linear_contains(strs, entries, probe_strs[i & (PROBE_KEYS - 1)]);
+    }
+    double linear_ns = (double)(now_ns() - start) / linear_lookups;
+
+    printf("%8zu entries: hash set %6.1f ns/op, parse+lookup %6.1f ns/op, published %6.1f ns/op, strcmp scan %12.1f ns/op\n",
+           entries, set_ns, parse_ns, published_ns, linear_ns);
+
+    for (size_t i = 0; i < entries; i++) {
+        free(strs[i]);
+    }
+    free(strs);
+    free(members);
+}
+
+int main(int argc, char *argv[]) {
+    long lookups = DEFAULT_LOOKUPS;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:")) != -1) {
+        switch (c) {
+        case 'n': lookups = atol(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-n lookups]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (lookups < 1) {
+        fprintf(stderr, "lookups must be positive\n");
+        exit(EXIT_FAILURE);
+    }
+
+    bench(10, lookups);
+    bench(10000, lookups);
+    bench(1000000, lookups);
+    // The last published set is freed on exit
+    whitelist_publish(NULL);
+    return 0;
+}
@@ -0,0 +1,277 @@
+// Load test for multi.protocol.server.c
+//
+// Phase 1 opens -c TCP connections from -t threads and measures the
+// connection setup rate (connect + first echo round trip).
+// Phase 2 keeps every connection busy with one outstanding message for -d
+// seconds and reports the echo latency distribution.
+//
+// Run it once against `multi.protocol.server -q -m threaded` and once
+// against `multi.protocol.server -q -m epoll` to compare the two designs.
+//
+// Messages are length-prefixed frames (common/framing.h); -r is the size
+// of the framed reply, header included. The same test drives
+// tcp/tcp.server.c, whose reply frame is 21 bytes long:
+//   tcp.server -q -b blocking & multi.loadtest -p 8080 -r 21
+//   tcp.server -q -b uring    & multi.loadtest -p 8080 -r 21
+// and Ctrl-C on the server prints its syscalls per request.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include "framing.h"
+
+#define PORT 12345
+#define REPLY_LEN (FRAME_HEADER_SIZE + 16) // framed "Message received"
+#define MAX_REPLY_LEN 1024
+#define MAX_EVENTS 256
+
+struct client {
+    int fd;
+    int got;
+    long long sent_ns;
+};
+
+struct worker {
+    pthread_t tid;
+    int nconns;
+    struct client *clients;
+    long long *samples;
+    size_t nsamples;
+    size_t cap;
+    int connect_failed; // phase 1, read by main between the barriers
+    int failed;         // phase 2, read by main after the join
+};
+
+static const char *server_ip = "127.0.0.1";
+static const char *message = "Hello, TCP server!";
+// message with its frame header, built once in main()
+static char framed_message[FRAME_HEADER_SIZE + 64];
+static size_t framed_len;
+static int port = PORT;
+static int reply_len = REPLY_LEN;
+static int duration = 5;
+// Waited on twice: once at the end of phase 1, and once more after main
+// has set phase1_end_ns, which the workers read only then
+static pthread_barrier_t barrier;
+static long long phase1_end_ns;
+
+long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void record(struct worker *w, long long ns) {
+    if (w->nsamples == w->cap) {
+        w->cap = w->cap ? w->cap * 2 : 65536;
+        w->samples = realloc(w->samples, w->cap * sizeof(*w->samples));
+        if (w->samples == NULL) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    w->samples[w->nsamples++] = ns;
+}
+
+// Blocking connect plus one echo, so a connection only counts once the
+// server is actually serving it
+int open_client(struct sockaddr_in *addr) {
+    char buffer[MAX_REPLY_LEN];
+    int opt = 1;
+    int got = 0;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    if (connect(fd, (struct sockaddr *)addr, sizeof(*addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    if (send(fd, framed_message, framed_len, 0) < 0) {
+        close(fd);
+        return -1;
+    }
+    while (got < reply_len) {
+        int n = read(fd, buffer, reply_len - got);
+        if (n <= 0) {
+            close(fd);
+            return -1;
+        }
+        got += n;
+    }
+    return fd;
+}
+
+void *worker_main(void *arg) {
+    struct worker *w = arg;
+    struct sockaddr_in addr;
+    struct epoll_event ev, events[MAX_EVENTS];
+    char buffer[MAX_REPLY_LEN];
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, server_ip, &addr.sin_addr);
+
+    // Phase 1: connection setup
+    for (int i = 0; i < w->nconns; i++) {
+        w->clients[i].fd = open_client(&addr);
+        if (w->clients[i].fd < 0) {
+            w->connect_failed++;
+        }
+    }
+    pthread_barrier_wait(&barrier);
+    pthread_barrier_wait(&barrier);
+
+    // Phase 2: closed-loop echo, one message in flight per connection
+    int epfd = epoll_create1(0);
+    for (int i = 0; i < w->nconns; i++) {
+        struct client *c = &w->clients[i];
+        if (c->fd < 0) {
+            continue;
+        }
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+        c->got = 0;
+        c->sent_ns = now_ns();
+        send(c->fd, framed_message, framed_len, MSG_NOSIGNAL);
+    }
+
+    long long deadline = phase1_end_ns + duration * 1000000000LL;
+    while (now_ns() < deadline) {
+        int nfds = epoll_wait(epfd, events, MAX_EVENTS, 100);
+        for (int i = 0; i < nfds; i++) {
+            struct client *c = events[i].data.ptr;
+            int n = read(c->fd, buffer, reply_len - c->got);
+            if (n <= 0) {
+                epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+                w->failed++;
+                continue;
+            }
+            c->got += n;
+            if (c->got < reply_len) {
+                continue;
+            }
+            long long t = now_ns();
+            record(w, t - c->sent_ns);
+            c->got = 0;
+            c->sent_ns = t;
+            send(c->fd, framed_message, framed_len, MSG_NOSIGNAL);
+        }
+    }
+
+    close(epfd);
+    for (int i = 0; i < w->nconns; i++) {
+        if (w->clients[i].fd >= 0) {
+            close(w->clients[i].fd);
+        }
+    }
+    return NULL;
+}
+
+int cmp_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+double percentile_us(long long *sorted, size_t n, double p) {
+    if (n == 0) {
+        return 0.0;
+    }
+    size_t idx = (size_t)(p / 100.0 * (n - 1));
+    return sorted[idx] / 1000.0;
+}
+
+int main(int argc, char *argv[]) {
+    int connections = 1000;
+    int threads = 4;
+    int c;
+
+    while ((c = getopt(argc, argv, "c:t:d:H:p:r:")) != -1) {
+        switch (c) {
+        case 'c': connections = atoi(optarg); break;
+        case 't': threads = atoi(optarg); break;
+        case 'd': duration = atoi(optarg); break;
+        case 'H': server_ip = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'r': reply_len = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-c connections] [-t threads] [-d seconds] [-H host] [-p port] [-r reply_bytes]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (connections < 1 || threads < 1 || duration < 1 || reply_len < 1 || reply_len > MAX_REPLY_LEN) {
+        fprintf(stderr, "connections, threads, duration and reply size must be positive\n");
+        exit(EXIT_FAILURE);
+    }
+    if (threads > connections) {
+        threads = connections;
+    }
+
+    frame_encode_header(framed_message, strlen(message));
+    memcpy(framed_message + FRAME_HEADER_SIZE, message, strlen(message));
+    framed_len = FRAME_HEADER_SIZE + strlen(message);
+
+    struct worker *workers = calloc(threads, sizeof(*workers));
+    pthread_barrier_init(&barrier, NULL, threads + 1);
+
+    printf("Opening %d connections from %d threads to %s:%d\n", connections, threads, server_ip, port);
+    long long start = now_ns();
+    for (int i = 0; i < threads; i++) {
+        workers[i].nconns = connections / threads + (i < connections % threads);
+        workers[i].clients = calloc(workers[i].nconns, sizeof(struct client));
+        pthread_create(&workers[i].tid, NULL, worker_main, &workers[i]);
+    }
+    pthread_barrier_wait(&barrier);
+    phase1_end_ns = now_ns();
+    pthread_barrier_wait(&barrier);
+
+    int failed_connect = 0;
+    for (int i = 0; i < threads; i++) {
+        failed_connect += workers[i].connect_failed;
+    }
+    double setup_s = (phase1_end_ns - start) / 1e9;
+    printf("Connection setup: %d ok, %d failed, %.3f s, %.0f connections/sec\n",
+           connections - failed_connect, failed_connect, setup_s,
+           (connections - failed_connect) / setup_s);
+
+    size_t total = 0;
+    int failed = 0;
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i].tid, NULL);
+        total += workers[i].nsamples;
+        failed += workers[i].failed;
+    }
+
+    long long *all = malloc((total ? total : 1) * sizeof(*all));
+    size_t off = 0;
+    for (int i = 0; i < threads; i++) {
+        memcpy(all + off, workers[i].samples, workers[i].nsamples * sizeof(*all));
+        off += workers[i].nsamples;
+        free(workers[i].samples);
+        free(workers[i].clients);
+    }
+    qsort(all, total, sizeof(*all), cmp_ll);
+
+    printf("Echo: %zu round trips in %d s, %.0f req/sec, %d connection errors\n",
+           total, duration, total / (double)duration, failed);
+    printf("Latency (us): p50 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+           percentile_us(all, total, 50), percentile_us(all, total, 99),
+           percentile_us(all, total, 99.9), percentile_us(all, total, 100));
+
+    free(all);
+    free(workers);
+    return 0;
+}
@@ -1,116 +1,714 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <pthread.h>
+#include <sched.h>
+#include <linux/filter.h>
+#include "framing.h"
+#include "metrics.h"
+#include "uring_server.h"
 
 #define PORT 12345
 #define MAX_CLIENTS 5
+#define BUFFER_SIZE 1024
+#define MAX_EVENTS 256
+#define OUT_BUFFER_SIZE 4096
+
+#define REPLY "Message received"
+#define REPLY_LEN (sizeof(REPLY) - 1)
+#define FRAMED_REPLY_LEN (FRAME_HEADER_SIZE + REPLY_LEN)
+
+// Server modes, selected with -m on the command line
+enum server_mode { MODE_EPOLL, MODE_URING, MODE_THREADED };
+
+// What an epoll registration refers to
+enum conn_kind { KIND_TCP_LISTENER, KIND_UDP, KIND_TCP_CLIENT };
+
+// Per-connection state for the epoll reactor. Incoming frames are
+// reassembled in place in the reader; replies that could not be written
+// immediately are parked in out[] until the socket is writable again.
+struct conn {
+    int fd;
+    enum conn_kind kind;
+    struct frame_reader *in;
+    int eof;        // the peer has shut down its side; close once flushed
+    size_t out_len;
+    size_t out_off;
+    char out[OUT_BUFFER_SIZE];
+};
+
+static int quiet = 0;
+// REPLY with its frame header, built once in main() for the TCP paths
+static char framed_reply[FRAMED_REPLY_LEN];
+static volatile int stop_requested = 0; // never set: the server runs until killed
+
+// Scraped with -M. Requests are TCP frames; datagrams are counted apart.
+static struct server_metrics metrics;
+static metric_t datagrams_metric;
 
 void *handle_tcp(void *arg) {
-    int client_socket = *((int *)arg);
-    char buffer[1024] = {0};
-    int valread;
+    int client_socket = (int)(long)arg;
+    struct frame_reader *reader = frame_reader_new(0);
+    const char *payload;
+    size_t len;
 
-    while ((valread = read(client_socket, buffer, 1024)) > 0) {
-        printf("Received from TCP client: %s\n", buffer);
-        send(client_socket, "Message received", strlen("Message received"), 0);
-        memset(buffer, 0, sizeof(buffer));
+    while (reader != NULL && frame_read(reader, client_socket, &payload, &len) > 0) {
+        if (!quiet) {
+            printf("Received from TCP client: %.*s\n", (int)len, payload);
+        }
+        send(client_socket, framed_reply, FRAMED_REPLY_LEN, MSG_NOSIGNAL);
+        metrics_inc(metrics.requests);
+        metrics_add(metrics.bytes_in, FRAME_HEADER_SIZE + len);
+        metrics_add(metrics.bytes_out, FRAMED_REPLY_LEN);
     }
 
+    frame_reader_free(reader);
     close(client_socket);
+    metrics_dec(metrics.active);
     pthread_exit(NULL);
 }
 
-int main() {
-    int tcp_sock, udp_sock, new_socket;
+int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) {
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// Answer one UDP datagram. Shared by both server modes.
+void handle_udp_datagram(int udp_sock, char *buffer, int n, struct sockaddr_in *from, socklen_t len) {
+    if (!quiet) {
+        printf("Received from UDP client: %.*s\n", n, buffer);
+    }
+    sendto(udp_sock, REPLY, REPLY_LEN, MSG_CONFIRM, (const struct sockaddr *)from, len);
+    metrics_inc(datagrams_metric);
+    metrics_add(metrics.bytes_in, n);
+    metrics_add(metrics.bytes_out, REPLY_LEN);
+}
+
+// ---------------------------------------------------------------------------
+// Threaded mode: select() on the listeners, one thread per TCP client
+// ---------------------------------------------------------------------------
+
+void run_threaded(int tcp_sock, int udp_sock) {
     struct sockaddr_in address;
-    int opt = 1;
-    int addrlen = sizeof(address);
-    char buffer[1024] = {0};
+    socklen_t addrlen;
+    char buffer[BUFFER_SIZE];
     pthread_t tid;
+    fd_set readfds;
+    int max_sd, new_socket;
 
-    // Create TCP socket
-    if ((tcp_sock = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
-        perror("TCP socket failed");
+    while (1) {
+        FD_ZERO(&readfds);
+        FD_SET(tcp_sock, &readfds);
+        FD_SET(udp_sock, &readfds);
+        max_sd = (tcp_sock > udp_sock) ? tcp_sock : udp_sock;
+
+        int activity = select(max_sd + 1, &readfds, NULL, NULL, NULL);
+
+        if (activity < 0) {
+            perror("select error");
+            continue;
+        }
+
+        if (FD_ISSET(tcp_sock, &readfds)) {
+            addrlen = sizeof(address);
+            if ((new_socket = accept(tcp_sock, (struct sockaddr *)&address, &addrlen)) < 0) {
+                perror("accept");
+                exit(EXIT_FAILURE);
+            }
+
+            metrics_inc(metrics.accepts);
+            metrics_inc(metrics.active);
+
+            // Pass the descriptor by value so the next accept() cannot race
+            // with the new thread reading it
+            if (pthread_create(&tid, NULL, handle_tcp, (void *)(long)new_socket) != 0) {
+                printf("Failed to create thread\n");
+                close(new_socket);
+                metrics_dec(metrics.active);
+            } else {
+                pthread_detach(tid);
+            }
+        }
+
+        if (FD_ISSET(udp_sock, &readfds)) {
+            addrlen = sizeof(address);
+            int n = recvfrom(udp_sock, buffer, BUFFER_SIZE, 0, (struct sockaddr *)&address, &addrlen);
+            if (n >= 0) {
+                handle_udp_datagram(udp_sock, buffer, n, &address, addrlen);
+            }
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Epoll mode: one edge-triggered, non-blocking reactor for everything
+// ---------------------------------------------------------------------------
+
+struct conn *conn_new(int fd, enum conn_kind kind) {
+    struct conn *c = malloc(sizeof(*c));
+    if (c == NULL) {
+        return NULL;
+    }
+    c->in = frame_reader_new(0);
+    if (c->in == NULL) {
+        free(c);
+        return NULL;
+    }
+    c->fd = fd;
+    c->kind = kind;
+    c->eof = 0;
+    c->out_len = 0;
+    c->out_off = 0;
+    return c;
+}
+
+void conn_close(int epfd, struct conn *c) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    frame_reader_free(c->in);
+    free(c);
+    metrics_dec(metrics.active);
+}
+
+// Write as much of the pending output as the socket accepts.
+// Returns 0 on success (possibly with data still pending), -1 on error.
+int conn_flush(struct conn *c) {
+    while (c->out_off < c->out_len) {
+        ssize_t n = send(c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        c->out_off += n;
+    }
+    c->out_off = 0;
+    c->out_len = 0;
+    return 0;
+}
+
+// Queue one reply, sending directly when nothing is pending.
+// Returns 1 if queued/sent, 0 if the output buffer is full, -1 on error.
+int conn_reply(struct conn *c) {
+    if (c->out_len == 0) {
+        ssize_t n = send(c->fd, framed_reply, FRAMED_REPLY_LEN, MSG_NOSIGNAL);
+        if (n == (ssize_t)FRAMED_REPLY_LEN) {
+            return 1;
+        }
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return -1;
+            }
+            n = 0;
+        }
+        memcpy(c->out, framed_reply + n, FRAMED_REPLY_LEN - n);
+        c->out_len = FRAMED_REPLY_LEN - n;
+        return 1;
+    }
+    if (c->out_len + FRAMED_REPLY_LEN > sizeof(c->out)) {
+        return 0;
+    }
+    memcpy(c->out + c->out_len, framed_reply, FRAMED_REPLY_LEN);
+    c->out_len += FRAMED_REPLY_LEN;
+    return 1;
+}
+
+// Answer every complete frame, then read more, until EAGAIN (required with
+// EPOLLET) or until the output buffer fills up. In that case the remaining
+// frames stay in the reader and processing resumes on EPOLLOUT. A peer
+// that shuts down its side still gets every reply already queued.
+// Returns -1 when the connection should be closed.
+int conn_on_readable(struct conn *c) {
+    const char *payload;
+    size_t len;
+    int rc;
+
+    while (1) {
+        while (c->out_len + FRAMED_REPLY_LEN <= sizeof(c->out)) {
+            rc = frame_reader_next(c->in, &payload, &len);
+            if (rc < 0) {
+                return -1;
+            }
+            if (rc == 0) {
+                break;
+            }
+            if (!quiet) {
+                printf("Received from TCP client: %.*s\n", (int)len, payload);
+            }
+            if (conn_reply(c) < 0) {
+                return -1;
+            }
+            metrics_inc(metrics.requests);
+            metrics_add(metrics.bytes_out, FRAMED_REPLY_LEN);
+        }
+        if (c->out_len + FRAMED_REPLY_LEN > sizeof(c->out)) {
+            return 0;
+        }
+
+        // Receive straight into the reader's ring, no intermediate copy
+        ssize_t n = frame_reader_fill(c->in, c->fd);
+        if (n > 0) {
+            metrics_add(metrics.bytes_in, n);
+            continue;
+        } else if (n == 0) {
+            // Every frame is answered; close once the replies are out
+            c->eof = 1;
+            return c->out_len > 0 ? 0 : -1;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        } else if (errno != EINTR) {
+            return -1;
+        }
+    }
+}
+
+void accept_all(int epfd, int tcp_sock) {
+    struct sockaddr_in address;
+    socklen_t addrlen;
+    struct epoll_event ev;
+
+    while (1) {
+        addrlen = sizeof(address);
+        int fd = accept4(tcp_sock, (struct sockaddr *)&address, &addrlen, SOCK_NONBLOCK);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept");
+            }
+            return;
+        }
+
+        struct conn *c = conn_new(fd, KIND_TCP_CLIENT);
+        if (c == NULL) {
+            close(fd);
+            continue;
+        }
+        metrics_inc(metrics.accepts);
+        metrics_inc(metrics.active);
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = c;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl client");
+            conn_close(epfd, c);
+        }
+    }
+}
+
+void drain_udp(int udp_sock) {
+    struct sockaddr_in address;
+    socklen_t addrlen;
+    char buffer[BUFFER_SIZE];
+
+    while (1) {
+        addrlen = sizeof(address);
+        int n = recvfrom(udp_sock, buffer, BUFFER_SIZE, 0, (struct sockaddr *)&address, &addrlen);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        handle_udp_datagram(udp_sock, buffer, n, &address, addrlen);
+    }
+}
+
+void run_epoll(int tcp_sock, int udp_sock) {
+    struct epoll_event ev, events[MAX_EVENTS];
+    struct conn tcp_listener = { .fd = tcp_sock, .kind = KIND_TCP_LISTENER };
+    struct conn udp_listener = { .fd = udp_sock, .kind = KIND_UDP };
+
+    int epfd = epoll_create1(0);
+    if (epfd < 0) {
+        perror("epoll_create1");
         exit(EXIT_FAILURE);
     }
 
-    // Set TCP socket options
-    if (setsockopt(tcp_sock, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt))) {
-        perror("setsockopt");
+    if (set_nonblocking(tcp_sock) < 0 || set_nonblocking(udp_sock) < 0) {
+        perror("fcntl O_NONBLOCK");
         exit(EXIT_FAILURE);
     }
 
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(PORT);
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = &tcp_listener;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, tcp_sock, &ev) < 0) {
+        perror("epoll_ctl TCP");
+        exit(EXIT_FAILURE);
+    }
+    ev.data.ptr = &udp_listener;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, udp_sock, &ev) < 0) {
+        perror("epoll_ctl UDP");
+        exit(EXIT_FAILURE);
+    }
+
+    while (1) {
+        int nfds = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if (nfds < 0) {
+            if (errno != EINTR) {
+                perror("epoll_wait");
+            }
+            continue;
+        }
+
+        for (int i = 0; i < nfds; i++) {
+            struct conn *c = events[i].data.ptr;
+            uint32_t e = events[i].events;
+
+            if (c->kind == KIND_TCP_LISTENER) {
+                accept_all(epfd, c->fd);
+                continue;
+            }
+            if (c->kind == KIND_UDP) {
+                drain_udp(c->fd);
+                continue;
+            }
+
+            if (e & (EPOLLERR | EPOLLHUP)) {
+                conn_close(epfd, c);
+                continue;
+            }
+            if (e & EPOLLOUT) {
+                int was_full = c->out_len + FRAMED_REPLY_LEN > sizeof(c->out);
+                if (conn_flush(c) < 0) {
+                    conn_close(epfd, c);
+                    continue;
+                }
+                // Reading stopped early because of back-pressure; with
+                // edge triggering no new EPOLLIN will arrive for that data
+                if (was_full && !(e & EPOLLIN) && conn_on_readable(c) < 0) {
+                    conn_close(epfd, c);
+                    continue;
+                }
+                if (c->eof && c->out_len == 0) {
+                    conn_close(epfd, c);
+                    continue;
+                }
+            }
+            if (e & (EPOLLIN | EPOLLRDHUP)) {
+                if (conn_on_readable(c) < 0) {
+                    conn_close(epfd, c);
+                    continue;
+                }
+            }
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// io_uring mode: TCP through multishot accept/recv, UDP through a multishot
+// poll that drains the socket like the epoll reactor does
+// ---------------------------------------------------------------------------
+
+void *uring_on_tcp_open(void *ctx, int fd) {
+    (void)ctx;
+    (void)fd;
+    metrics_inc(metrics.accepts);
+    metrics_inc(metrics.active);
+    return frame_reader_new(0);
+}
+
+void uring_on_tcp_close(void *ctx, void *conn) {
+    (void)ctx;
+    frame_reader_free(conn);
+    metrics_dec(metrics.active);
+}
+
+// Provided buffers are recycled as soon as this returns, so the chunk is
+// copied into the connection's reader and every complete frame answered
+int uring_on_tcp_data(void *ctx, void *conn, const char *data, size_t len,
+                      struct uring_reply *reply) {
+    struct frame_reader *reader = conn;
+    const char *payload;
+    size_t payload_len;
+    int rc;
+
+    (void)ctx;
+    if (reader == NULL || frame_reader_feed(reader, data, len) < 0) {
+        return -1;
+    }
+    reply->data = framed_reply;
+    reply->len = FRAMED_REPLY_LEN;
+    while ((rc = frame_reader_next(reader, &payload, &payload_len)) > 0) {
+        if (!quiet) {
+            printf("Received from TCP client: %.*s\n", (int)payload_len, payload);
+        }
+        reply->count++;
+    }
+    metrics_add(metrics.bytes_in, len);
+    metrics_add(metrics.requests, reply->count);
+    metrics_add(metrics.bytes_out, reply->count * FRAMED_REPLY_LEN);
+    return rc;
+}
+
+void uring_on_udp_readable(void *ctx, int fd) {
+    (void)ctx;
+    drain_udp(fd);
+}
+
+void run_uring(int tcp_sock, int udp_sock) {
+    struct uring_server_ops ops = {
+        .on_open = uring_on_tcp_open,
+        .on_data = uring_on_tcp_data,
+        .on_close = uring_on_tcp_close,
+        .on_readable = uring_on_udp_readable,
+    };
+    struct uring_server_stats stats = { 0 };
+
+    if (set_nonblocking(udp_sock) < 0) {
+        perror("fcntl O_NONBLOCK");
+        exit(EXIT_FAILURE);
+    }
+    if (uring_server_run(tcp_sock, &udp_sock, 1, &ops, &stats, &stop_requested) < 0) {
+        perror("io_uring unavailable, falling back to epoll");
+        run_epoll(tcp_sock, udp_sock);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Worker sharding: every worker owns a SO_REUSEPORT TCP listener and UDP
+// socket bound to the same port, runs its own reactor and is pinned to a CPU
+// ---------------------------------------------------------------------------
+
+struct worker {
+    pthread_t tid;
+    enum server_mode mode;
+    int id;
+    int cpu;
+    int tcp_sock;
+    int udp_sock;
+};
+
+void set_reuse_options(int sock) {
+    int opt = 1;
+
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt))) {
+        perror("setsockopt SO_REUSEADDR");
+        exit(EXIT_FAILURE);
+    }
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt))) {
+        perror("setsockopt SO_REUSEPORT");
+        exit(EXIT_FAILURE);
+    }
+}
+
+int open_tcp_listener(struct sockaddr_in *address, int backlog) {
+    int tcp_sock;
+
+    // Create TCP socket
+    if ((tcp_sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        perror("TCP socket failed");
+        exit(EXIT_FAILURE);
+    }
+
+    // Set TCP socket options
+    set_reuse_options(tcp_sock);
 
     // Bind TCP socket
-    if (bind(tcp_sock, (struct sockaddr *)&address, sizeof(address)) < 0) {
+    if (bind(tcp_sock, (struct sockaddr *)address, sizeof(*address)) < 0) {
         perror("TCP bind failed");
         exit(EXIT_FAILURE);
     }
 
     // Listen for TCP connections
-    if (listen(tcp_sock, MAX_CLIENTS) < 0) {
+    if (listen(tcp_sock, backlog) < 0) {
         perror("listen");
         exit(EXIT_FAILURE);
     }
+    return tcp_sock;
+}
+
+int open_udp_socket(struct sockaddr_in *address) {
+    int udp_sock;
 
     // Create UDP socket
-    if ((udp_sock = socket(AF_INET, SOCK_DGRAM, 0)) == 0) {
+    if ((udp_sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
         perror("UDP socket failed");
         exit(EXIT_FAILURE);
     }
 
+    // Several workers share the port, so UDP needs SO_REUSEPORT as well
+    set_reuse_options(udp_sock);
+
     // Bind UDP socket
-    if (bind(udp_sock, (struct sockaddr *)&address, sizeof(address)) < 0) {
+    if (bind(udp_sock, (struct sockaddr *)address, sizeof(*address)) < 0) {
         perror("UDP bind failed");
         exit(EXIT_FAILURE);
     }
+    return udp_sock;
+}
 
-    printf("Server listening on port %d\n", PORT);
+// Attach a classic BPF program to a reuseport group that picks the socket
+// whose index matches the CPU handling the packet (cpu % nworkers). Sockets
+// join the group in bind order, and worker i is pinned to CPU i, so a flow
+// stays on the core that took its interrupt. That only holds with one
+// worker per CPU; main() checks.
+int attach_cpu_steering(int sock, int nworkers) {
+    struct sock_filter code[] = {
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, (unsigned)nworkers },
+        { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+    struct sock_fprog prog = { .len = sizeof(code) / sizeof(code[0]), .filter = code };
 
-    fd_set readfds;
-    int max_sd;
+    return setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+}
 
-    while (1) {
-        FD_ZERO(&readfds);
-        FD_SET(tcp_sock, &readfds);
-        FD_SET(udp_sock, &readfds);
-        max_sd = (tcp_sock > udp_sock) ? tcp_sock : udp_sock;
+void *worker_main(void *arg) {
+    struct worker *w = arg;
+    cpu_set_t set;
 
-        int activity = select(max_sd + 1, &readfds, NULL, NULL, NULL);
+    CPU_ZERO(&set);
+    CPU_SET(w->cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        fprintf(stderr, "Worker %d: could not pin to CPU %d\n", w->id, w->cpu);
+    }
 
-        if (activity < 0) {
-            perror("select error");
-        }
+    if (w->mode == MODE_URING) {
+        run_uring(w->tcp_sock, w->udp_sock);
+    } else {
+        run_epoll(w->tcp_sock, w->udp_sock);
+    }
+    return NULL;
+}
 
-        if (FD_ISSET(tcp_sock, &readfds)) {
-            if ((new_socket = accept(tcp_sock, (struct sockaddr *)&address, (socklen_t*)&addrlen)) < 0) {
-                perror("accept");
-                exit(EXIT_FAILURE);
-            }
+void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-m epoll|uring|threaded] [-w workers] [-b] [-q] [-M port|path]\n", prog);
+    fprintf(stderr, "  -m  event loop: edge-triggered epoll reactor (default), io_uring\n");
+    fprintf(stderr, "      or select() plus one thread per TCP client\n");
+    fprintf(stderr, "  -w  number of event loop workers, each with its own SO_REUSEPORT\n");
+    fprintf(stderr, "      sockets and pinned to one CPU (default: online CPUs)\n");
+    fprintf(stderr, "  -b  steer packets to the worker on the receiving CPU with a\n");
+    fprintf(stderr, "      SO_ATTACH_REUSEPORT_CBPF program\n");
+    fprintf(stderr, "  -q  do not print every received message\n");
+    fprintf(stderr, "  -M  serve Prometheus metrics on this TCP port or Unix socket path\n");
+    exit(EXIT_FAILURE);
+}
 
-            if (pthread_create(&tid, NULL, handle_tcp, &new_socket) != 0) {
-                printf("Failed to create thread\n");
+int main(int argc, char *argv[]) {
+    struct sockaddr_in address;
+    enum server_mode mode = MODE_EPOLL;
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int nworkers = ncpus > 0 ? (int)ncpus : 1;
+    int steering = 0;
+    const char *metrics_endpoint = NULL;
+    int c;
+
+    while ((c = getopt(argc, argv, "m:w:bqM:")) != -1) {
+        switch (c) {
+        case 'm':
+            if (strcmp(optarg, "epoll") == 0) {
+                mode = MODE_EPOLL;
+            } else if (strcmp(optarg, "uring") == 0) {
+                mode = MODE_URING;
+            } else if (strcmp(optarg, "threaded") == 0) {
+                mode = MODE_THREADED;
+            } else {
+                usage(argv[0]);
             }
+            break;
+        case 'w':
+            nworkers = atoi(optarg);
+            if (nworkers < 1) {
+                usage(argv[0]);
+            }
+            break;
+        case 'b':
+            steering = 1;
+            break;
+        case 'q':
+            quiet = 1;
+            break;
+        case 'M':
+            metrics_endpoint = optarg;
+            break;
+        default:
+            usage(argv[0]);
         }
+    }
+    metrics_register_server(&metrics);
+    datagrams_metric = metrics_counter("server_datagrams_total", NULL, "UDP datagrams answered");
+    if (metrics_endpoint != NULL && metrics_serve(metrics_endpoint) < 0) {
+        exit(EXIT_FAILURE);
+    }
 
-        if (FD_ISSET(udp_sock, &readfds)) {
-            int len, n;
-            len = sizeof(address);
-            n = recvfrom(udp_sock, (char *)buffer, 1024, MSG_WAITALL, (struct sockaddr *) &address, &len);
-            buffer[n] = '\0';
-            printf("Received from UDP client: %s\n", buffer);
-            sendto(udp_sock, "Message received", strlen("Message received"), MSG_CONFIRM, (const struct sockaddr *) &address, len);
+    frame_encode_header(framed_reply, REPLY_LEN);
+    memcpy(framed_reply + FRAME_HEADER_SIZE, REPLY, REPLY_LEN);
+
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(PORT);
+
+    if (mode == MODE_THREADED) {
+        int tcp_sock = open_tcp_listener(&address, MAX_CLIENTS);
+        int udp_sock = open_udp_socket(&address);
+
+        printf("Server listening on port %d (threaded mode)\n", PORT);
+        run_threaded(tcp_sock, udp_sock);
+        return 0;
+    }
+
+    // Bind every socket from this thread, in worker order, so that the
+    // reuseport group index of worker i's sockets is i
+    struct worker *workers = calloc(nworkers, sizeof(*workers));
+    if (workers == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < nworkers; i++) {
+        workers[i].mode = mode;
+        workers[i].id = i;
+        workers[i].cpu = ncpus > 0 ? i % ncpus : 0;
+        // The reactor drains the accept queue in bursts, so give it room
+        // to absorb connection storms
+        workers[i].tcp_sock = open_tcp_listener(&address, SOMAXCONN);
+        workers[i].udp_sock = open_udp_socket(&address);
+    }
+
+    if (steering && nworkers > 1 && nworkers != ncpus) {
+        // With fewer or more workers, cpu % nworkers is not the worker
+        // pinned to that CPU
+        fprintf(stderr, "CPU steering needs one worker per CPU (%ld), not %d; "
+                        "using the kernel's default flow hash\n", ncpus, nworkers);
+    } else if (steering && nworkers > 1) {
+        if (attach_cpu_steering(workers[0].tcp_sock, nworkers) < 0 ||
+            attach_cpu_steering(workers[0].udp_sock, nworkers) < 0) {
+            perror("setsockopt SO_ATTACH_REUSEPORT_CBPF");
+            fprintf(stderr, "Falling back to the kernel's default flow hash\n");
+        } else {
+            printf("CPU steering program attached\n");
+        }
+    }
+
+    printf("Server listening on port %d (%s mode, %d worker%s)\n",
+           PORT, mode == MODE_URING ? "io_uring" : "epoll", nworkers, nworkers == 1 ? "" : "s");
+
+    for (int i = 0; i < nworkers; i++) {
+        if (pthread_create(&workers[i].tid, NULL, worker_main, &workers[i]) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
         }
     }
+    for (int i = 0; i < nworkers; i++) {
+        pthread_join(workers[i].tid, NULL);
+    }
 
+    free(workers);
     return 0;
 }
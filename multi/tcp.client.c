@@ -4,6 +4,7 @@
 #include <unistd.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include "framing.h"
 
 #define PORT 12345
 
@@ -11,7 +12,9 @@ int main() {
     int sock = 0;
     struct sockaddr_in serv_addr;
     char *hello = "Hello, TCP server!";
-    char buffer[1024] = {0};
+    struct frame_reader *reader;
+    const char *reply;
+    size_t reply_len;
 
     if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
         printf("\n Socket creation error \n");
@@ -31,9 +34,13 @@ int main() {
         return -1;
     }
 
-    send(sock, hello, strlen(hello), 0);
-    read(sock, buffer, 1024);
-    printf("Received from server: %s\n", buffer);
+    frame_write(sock, hello, strlen(hello));
+    reader = frame_reader_new(0);
+    if (reader != NULL && frame_read(reader, sock, &reply, &reply_len) > 0) {
+        printf("Received from server: %.*s\n", (int)reply_len, reply);
+    }
+    frame_reader_free(reader);
+    close(sock);
 
     return 0;
 }
@@ -8,10 +8,43 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <sys/time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include "framing.h"
+#include "tcp_tuner.h"
 
 #define SERVER_IP "127.0.0.1"
 #define PORT 8080
 #define BUFFER_SIZE 1024
+#define MAX_DEPTHS 32
+#define DEFAULT_REQUESTS 100000
+#define DEFAULT_MESSAGE_SIZE 32
+#define STALL_TIMEOUT_MS 10000
+
+// Messages sent in pipelined and load modes, one payload per request
+struct message_set {
+    char **items;
+    size_t *lens;
+    size_t count;
+};
+
+// One in-flight request, stored at slot seq % depth
+struct pending {
+    unsigned long long seq;
+    long long sent_ns;
+    int done;
+};
+
+struct pipeline_result {
+    size_t completed;
+    size_t errors;
+    double seconds;
+    long long *latencies; // completed entries, in ns
+};
+
+// TCP_INFO sampling of the connection, with -a and -T
+static struct tcp_tuner tuner;
 
 void configure_client_socket(int sockfd) {
     int opt = 1;
@@ -44,40 +77,230 @@ void configure_client_socket(int sockfd) {
     }
 }
 
-int main() {
-    int sockfd;
-    struct sockaddr_in server_addr;
-    char buffer[BUFFER_SIZE];
-    char message[BUFFER_SIZE];
-    
-    // Create socket
-    if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        perror("socket creation failed");
-        exit(EXIT_FAILURE);
+long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int cmp_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+double percentile_us(long long *sorted, size_t n, double p) {
+    if (n == 0) {
+        return 0.0;
     }
-    printf("Client socket created\n");
-    
-    // Configure client socket options
-    configure_client_socket(sockfd);
-    
-    // Set up server address
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(PORT);
-    
-    if (inet_pton(AF_INET, SERVER_IP, &server_addr.sin_addr) <= 0) {
-        perror("invalid address");
-        close(sockfd);
+    return sorted[(size_t)(p / 100.0 * (n - 1))] / 1000.0;
+}
+
+void message_set_add(struct message_set *set, const char *text, size_t len) {
+    set->items = realloc(set->items, (set->count + 1) * sizeof(*set->items));
+    set->lens = realloc(set->lens, (set->count + 1) * sizeof(*set->lens));
+    if (set->items == NULL || set->lens == NULL) {
+        perror("realloc failed");
         exit(EXIT_FAILURE);
     }
-    
-    // Connect to server
-    if (connect(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-        perror("connection failed");
-        close(sockfd);
+    set->items[set->count] = strndup(text, len);
+    set->lens[set->count] = len;
+    set->count++;
+}
+
+// One message per line; empty lines are skipped
+void load_messages(struct message_set *set, FILE *fp) {
+    char line[BUFFER_SIZE];
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        size_t len = strcspn(line, "\n");
+        if (len > 0) {
+            message_set_add(set, line, len);
+        }
+    }
+}
+
+void synthetic_messages(struct message_set *set, size_t size) {
+    char payload[BUFFER_SIZE];
+
+    memset(payload, 'x', size);
+    message_set_add(set, payload, size);
+}
+
+// The server answers "Server received: <payload>", and every payload starts
+// with "#<seq> ", so the sequence number comes back in the reply
+int parse_reply_seq(const char *reply, size_t len, unsigned long long *seq) {
+    const char *hash = memchr(reply, '#', len);
+    char digits[24];
+    size_t n = 0;
+
+    if (hash == NULL) {
+        return -1;
+    }
+    hash++;
+    while (hash + n < reply + len && n < sizeof(digits) - 1 && hash[n] >= '0' && hash[n] <= '9') {
+        digits[n] = hash[n];
+        n++;
+    }
+    if (n == 0) {
+        return -1;
+    }
+    digits[n] = '\0';
+    *seq = strtoull(digits, NULL, 10);
+    return 0;
+}
+
+// Send total requests over one non-blocking connection, keeping up to depth
+// of them in flight. Requests are appended to a single output buffer so a
+// burst leaves in one send(), and replies are matched back to their request
+// by sequence number.
+int run_pipeline(int sockfd, struct frame_reader *reader, const struct message_set *set,
+                 int depth, size_t total, int verbose, struct pipeline_result *result) {
+    struct pending *slots = calloc(depth, sizeof(*slots));
+    size_t out_cap = (size_t)depth * (FRAME_HEADER_SIZE + BUFFER_SIZE + 24);
+    char *out = malloc(out_cap);
+    size_t out_len = 0, out_off = 0;
+    unsigned long long next_seq = 0, oldest = 0;
+    int rc = 0;
+
+    result->completed = 0;
+    result->errors = 0;
+    result->latencies = malloc((total ? total : 1) * sizeof(*result->latencies));
+    if (slots == NULL || out == NULL || result->latencies == NULL) {
+        perror("malloc failed");
         exit(EXIT_FAILURE);
     }
-    printf("Connected to server %s:%d\n", SERVER_IP, PORT);
-    
+
+    long long start = now_ns();
+    while (result->completed < total) {
+        // Top the window up. The oldest unanswered request bounds it, so a
+        // slot is never reused while its request is still outstanding.
+        // Bytes not yet sent move to the front first; a frame that does not
+        // fit behind them waits for the next round.
+        if (out_off > 0) {
+            memmove(out, out + out_off, out_len - out_off);
+            out_len -= out_off;
+            out_off = 0;
+        }
+        while (next_seq < total && next_seq < oldest + depth) {
+            const char *text = set->items[next_seq % set->count];
+            size_t text_len = set->lens[next_seq % set->count];
+            char *frame = out + out_len;
+            size_t room = out_cap - out_len;
+            int n;
+
+            if (room <= FRAME_HEADER_SIZE) {
+                break;
+            }
+            n = snprintf(frame + FRAME_HEADER_SIZE, room - FRAME_HEADER_SIZE,
+                         "#%llu %.*s", next_seq, (int)text_len, text);
+            if (n < 0 || (size_t)n >= room - FRAME_HEADER_SIZE) {
+                break;
+            }
+            frame_encode_header(frame, n);
+            out_len += FRAME_HEADER_SIZE + n;
+            slots[next_seq % depth].seq = next_seq;
+            slots[next_seq % depth].sent_ns = now_ns();
+            slots[next_seq % depth].done = 0;
+            next_seq++;
+        }
+
+        struct pollfd pfd = { .fd = sockfd, .events = POLLIN };
+        if (out_off < out_len) {
+            pfd.events |= POLLOUT;
+        }
+        int ready = poll(&pfd, 1, STALL_TIMEOUT_MS);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll failed");
+            rc = -1;
+            break;
+        }
+        if (ready == 0) {
+            fprintf(stderr, "No reply for %d ms, %zu requests outstanding\n",
+                    STALL_TIMEOUT_MS, (size_t)(next_seq - result->completed));
+            rc = -1;
+            break;
+        }
+
+        if (pfd.revents & POLLOUT) {
+            ssize_t n = send(sockfd, out + out_off, out_len - out_off, MSG_NOSIGNAL);
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("send failed");
+                rc = -1;
+                break;
+            }
+            if (n > 0) {
+                out_off += n;
+            }
+        }
+
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t n = frame_reader_fill(reader, sockfd);
+            if (n == 0) {
+                printf("Server disconnected\n");
+                rc = -1;
+                break;
+            }
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("recv failed");
+                rc = -1;
+                break;
+            }
+
+            const char *reply;
+            size_t reply_len;
+            unsigned long long seq;
+            long long t = now_ns();
+            int got;
+            while ((got = frame_reader_next(reader, &reply, &reply_len)) > 0) {
+                if (parse_reply_seq(reply, reply_len, &seq) < 0 || seq < oldest || seq >= next_seq ||
+                    slots[seq % depth].done) {
+                    result->errors++;
+                    continue;
+                }
+                slots[seq % depth].done = 1;
+                result->latencies[result->completed++] = t - slots[seq % depth].sent_ns;
+                if (verbose) {
+                    printf("Server [#%llu, %.1f us]: %.*s\n", seq,
+                           (t - slots[seq % depth].sent_ns) / 1000.0, (int)reply_len, reply);
+                }
+            }
+            if (got < 0) {
+                perror("bad frame from server");
+                rc = -1;
+                break;
+            }
+            while (oldest < next_seq && slots[oldest % depth].done) {
+                oldest++;
+            }
+            tcp_tuner_poll(&tuner);
+        }
+    }
+    result->seconds = (now_ns() - start) / 1e9;
+
+    free(slots);
+    free(out);
+    return rc;
+}
+
+void print_pipeline_result(int depth, struct pipeline_result *result) {
+    qsort(result->latencies, result->completed, sizeof(*result->latencies), cmp_ll);
+    printf("depth %4d: %8zu requests in %6.3f s, %9.0f req/sec, latency (us) p50 %8.1f  p99 %8.1f  p99.9 %8.1f, %zu errors\n",
+           depth, result->completed, result->seconds,
+           result->seconds > 0 ? result->completed / result->seconds : 0.0,
+           percentile_us(result->latencies, result->completed, 50),
+           percentile_us(result->latencies, result->completed, 99),
+           percentile_us(result->latencies, result->completed, 99.9),
+           result->errors);
+}
+
+void run_interactive(int sockfd, struct frame_reader *reader) {
+    const char *reply;
+    size_t reply_len;
+    char message[BUFFER_SIZE];
+
     printf("Type messages to send to server (type 'exit' to quit):\n");
     
     while (1) {
@@ -90,7 +313,7 @@ int main() {
         }
         
         // Send message to server
-        if (send(sockfd, message, strlen(message), 0) < 0) {
+        if (frame_write(sockfd, message, strlen(message)) < 0) {
             perror("send failed");
             break;
         }
@@ -101,15 +324,12 @@ int main() {
             break;
         }
         
-        // Clear buffer
-        memset(buffer, 0, BUFFER_SIZE);
-        
         // Receive response from server
-        int bytes_received = recv(sockfd, buffer, BUFFER_SIZE - 1, 0);
-        if (bytes_received > 0) {
-            buffer[bytes_received] = '\0';
-            printf("Server: %s", buffer);
-        } else if (bytes_received == 0) {
+        int rc = frame_read(reader, sockfd, &reply, &reply_len);
+        if (rc > 0) {
+            printf("Server: %.*s", (int)reply_len, reply);
+            tcp_tuner_poll(&tuner);
+        } else if (rc == 0) {
             printf("Server disconnected\n");
             break;
         } else {
@@ -121,7 +341,169 @@ int main() {
             }
         }
     }
+}
+
+void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-k depth[,depth...]] [-b] [-n requests] [-f file] [-s bytes] [-a] [-T file]\n", prog);
+    fprintf(stderr, "  (no options)  interactive: one message per line, one reply at a time\n");
+    fprintf(stderr, "  -k  pipelined: keep up to depth requests in flight; messages come from\n");
+    fprintf(stderr, "      -f or stdin, and each reply is printed with its sequence number\n");
+    fprintf(stderr, "  -b  load generator: no output per reply, -n requests at every depth\n");
+    fprintf(stderr, "      given to -k (default 1,4,16,64)\n");
+    fprintf(stderr, "  -n  requests per depth in load mode (default %d)\n", DEFAULT_REQUESTS);
+    fprintf(stderr, "  -f  read messages from file, one per line, reused round-robin\n");
+    fprintf(stderr, "  -s  synthetic message size in load mode without -f (default %d)\n", DEFAULT_MESSAGE_SIZE);
+    fprintf(stderr, "  -a  autotune socket buffers, TCP_NOTSENT_LOWAT and TCP_QUICKACK from\n");
+    fprintf(stderr, "      TCP_INFO samples\n");
+    fprintf(stderr, "  -T  append a CSV line per TCP_INFO sample to file\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    int sockfd;
+    struct sockaddr_in server_addr;
+    struct frame_reader *reader;
+    struct message_set messages = { 0 };
+    int depths[MAX_DEPTHS];
+    int ndepths = 0;
+    int pipelined = 0;
+    int load = 0;
+    size_t requests = DEFAULT_REQUESTS;
+    size_t message_size = DEFAULT_MESSAGE_SIZE;
+    const char *message_file = NULL;
+    int autotune = 0;
+    int telemetry_fd = -1;
+    char peer[32];
+    int c;
+
+    while ((c = getopt(argc, argv, "k:bn:f:s:aT:")) != -1) {
+        switch (c) {
+        case 'k': {
+            char *list = strdup(optarg);
+            for (char *tok = strtok(list, ","); tok != NULL && ndepths < MAX_DEPTHS; tok = strtok(NULL, ",")) {
+                depths[ndepths] = atoi(tok);
+                if (depths[ndepths] < 1) {
+                    fprintf(stderr, "pipeline depth must be positive\n");
+                    exit(EXIT_FAILURE);
+                }
+                ndepths++;
+            }
+            free(list);
+            pipelined = 1;
+            break;
+        }
+        case 'b': load = 1; break;
+        case 'n': requests = strtoul(optarg, NULL, 10); break;
+        case 'f': message_file = optarg; break;
+        case 's': message_size = strtoul(optarg, NULL, 10); break;
+        case 'a': autotune = 1; break;
+        case 'T':
+            telemetry_fd = tcp_tuner_open_export(optarg);
+            if (telemetry_fd < 0) {
+                perror(optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (load && ndepths == 0) {
+        int defaults[] = { 1, 4, 16, 64 };
+        memcpy(depths, defaults, sizeof(defaults));
+        ndepths = 4;
+    }
+    if (requests == 0 || message_size == 0 || message_size > BUFFER_SIZE - 64) {
+        fprintf(stderr, "requests must be positive and message size between 1 and %d\n", BUFFER_SIZE - 64);
+        exit(EXIT_FAILURE);
+    }
+
+    // Pipelined and load modes take their messages up front
+    if (pipelined || load) {
+        if (message_file != NULL) {
+            FILE *fp = fopen(message_file, "r");
+            if (fp == NULL) {
+                perror("fopen failed");
+                exit(EXIT_FAILURE);
+            }
+            load_messages(&messages, fp);
+            fclose(fp);
+        } else if (load) {
+            synthetic_messages(&messages, message_size);
+        } else {
+            load_messages(&messages, stdin);
+        }
+        if (messages.count == 0) {
+            fprintf(stderr, "no messages to send\n");
+            exit(EXIT_FAILURE);
+        }
+    }
     
+    // Create socket
+    if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        perror("socket creation failed");
+        exit(EXIT_FAILURE);
+    }
+    printf("Client socket created\n");
+    
+    // Configure client socket options
+    configure_client_socket(sockfd);
+    
+    // Set up server address
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(PORT);
+    
+    if (inet_pton(AF_INET, SERVER_IP, &server_addr.sin_addr) <= 0) {
+        perror("invalid address");
+        close(sockfd);
+        exit(EXIT_FAILURE);
+    }
+    
+    // Connect to server
+    if (connect(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        perror("connection failed");
+        close(sockfd);
+        exit(EXIT_FAILURE);
+    }
+    printf("Connected to server %s:%d\n", SERVER_IP, PORT);
+    snprintf(peer, sizeof(peer), "%s:%d", SERVER_IP, PORT);
+    tcp_tuner_init(&tuner, sockfd, peer, autotune, telemetry_fd);
+
+    reader = frame_reader_new(0);
+    if (reader == NULL) {
+        perror("frame_reader_new failed");
+        close(sockfd);
+        exit(EXIT_FAILURE);
+    }
+    
+    if (load) {
+        // Each depth gets its own run over the same connection
+        struct pipeline_result result;
+        printf("Load: %zu requests per depth, %zu distinct messages\n", requests, messages.count);
+        fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) | O_NONBLOCK);
+        for (int i = 0; i < ndepths; i++) {
+            frame_reader_reset(reader);
+            int rc = run_pipeline(sockfd, reader, &messages, depths[i], requests, 0, &result);
+            print_pipeline_result(depths[i], &result);
+            free(result.latencies);
+            if (rc < 0) {
+                break;
+            }
+        }
+    } else if (pipelined) {
+        struct pipeline_result result;
+        fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) | O_NONBLOCK);
+        run_pipeline(sockfd, reader, &messages, depths[0], messages.count, 1, &result);
+        print_pipeline_result(depths[0], &result);
+        free(result.latencies);
+    } else {
+        run_interactive(sockfd, reader);
+    }
+    
+    if ((autotune || telemetry_fd >= 0) && tcp_tuner_sample(&tuner) == 0) {
+        tcp_tuner_print(&tuner, stdout);
+    }
+    frame_reader_free(reader);
     close(sockfd);
     printf("Connection closed\n");
     
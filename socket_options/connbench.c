@@ -0,0 +1,167 @@
+// Connection setup benchmark for socket_options/server.c
+//
+// Every thread repeatedly connects, sends one message, waits for the
+// "Server received: ..." reply and closes, for -d seconds. The result is
+// the connection setup rate and the connect-to-first-reply latency, which
+// is what fork-per-connection pays for on every client.
+//
+//   ./server -m fork    > /dev/null &   ./connbench
+//   ./server -m prefork > /dev/null &   ./connbench
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include "framing.h"
+
+#define SERVER_IP "127.0.0.1"
+#define PORT 8080
+
+struct worker {
+    pthread_t tid;
+    long long *samples;
+    size_t nsamples;
+    size_t cap;
+    long failed;
+};
+
+static const char *server_ip = SERVER_IP;
+static int duration = 5;
+static long long deadline_ns;
+
+long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// One short-lived connection. Returns the setup latency in ns or -1.
+long long one_connection(struct sockaddr_in *addr, struct frame_reader *reader) {
+    const char *message = "ping\n";
+    const char *reply;
+    size_t reply_len;
+    int opt = 1;
+    long long start = now_ns();
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    if (connect(fd, (struct sockaddr *)addr, sizeof(*addr)) < 0 ||
+        frame_write(fd, message, strlen(message)) < 0 ||
+        frame_read(reader, fd, &reply, &reply_len) <= 0) {
+        close(fd);
+        return -1;
+    }
+    long long elapsed = now_ns() - start;
+    close(fd);
+    return elapsed;
+}
+
+void *worker_main(void *arg) {
+    struct worker *w = arg;
+    struct sockaddr_in addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PORT);
+    inet_pton(AF_INET, server_ip, &addr.sin_addr);
+
+    struct frame_reader *reader = frame_reader_new(0);
+    if (reader == NULL) {
+        perror("frame_reader_new");
+        exit(EXIT_FAILURE);
+    }
+
+    while (now_ns() < deadline_ns) {
+        frame_reader_reset(reader);
+        long long ns = one_connection(&addr, reader);
+        if (ns < 0) {
+            w->failed++;
+            continue;
+        }
+        if (w->nsamples == w->cap) {
+            w->cap = w->cap ? w->cap * 2 : 16384;
+            w->samples = realloc(w->samples, w->cap * sizeof(*w->samples));
+            if (w->samples == NULL) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        w->samples[w->nsamples++] = ns;
+    }
+    frame_reader_free(reader);
+    return NULL;
+}
+
+int cmp_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+double percentile_us(long long *sorted, size_t n, double p) {
+    if (n == 0) {
+        return 0.0;
+    }
+    return sorted[(size_t)(p / 100.0 * (n - 1))] / 1000.0;
+}
+
+int main(int argc, char *argv[]) {
+    int threads = 4;
+    int c;
+
+    while ((c = getopt(argc, argv, "t:d:H:")) != -1) {
+        switch (c) {
+        case 't': threads = atoi(optarg); break;
+        case 'd': duration = atoi(optarg); break;
+        case 'H': server_ip = optarg; break;
+        default:
+            fprintf(stderr, "Usage: %s [-t threads] [-d seconds] [-H host]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (threads < 1 || duration < 1) {
+        fprintf(stderr, "threads and duration must be positive\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct worker *workers = calloc(threads, sizeof(*workers));
+    deadline_ns = now_ns() + duration * 1000000000LL;
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&workers[i].tid, NULL, worker_main, &workers[i]);
+    }
+
+    size_t total = 0;
+    long failed = 0;
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i].tid, NULL);
+        total += workers[i].nsamples;
+        failed += workers[i].failed;
+    }
+
+    long long *all = malloc((total ? total : 1) * sizeof(*all));
+    size_t off = 0;
+    for (int i = 0; i < threads; i++) {
+        memcpy(all + off, workers[i].samples, workers[i].nsamples * sizeof(*all));
+        off += workers[i].nsamples;
+        free(workers[i].samples);
+    }
+    qsort(all, total, sizeof(*all), cmp_ll);
+
+    printf("%zu connections in %d s from %d threads (%ld failed): %.0f connections/sec\n",
+           total, duration, threads, failed, total / (double)duration);
+    printf("Setup latency (us): p50 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+           percentile_us(all, total, 50), percentile_us(all, total, 99),
+           percentile_us(all, total, 99.9), percentile_us(all, total, 100));
+
+    free(all);
+    free(workers);
+    return 0;
+}
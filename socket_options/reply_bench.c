@@ -0,0 +1,228 @@
+// Benchmark for the reply path of server.c's handle_client
+//
+// For payloads from 64 B to 1 MB, a client thread sends a message, waits
+// for the "Server received: ..." reply and checks it, over loopback TCP,
+// for -d milliseconds. The serving side reads requests into a ring of the
+// server's size (sockopt_proto.h), answers the way handle_client does and
+// with the path it replaced, and counts the bytes each reply copies:
+//
+//   copy      prefix and payload formatted into one buffer, then sent
+//   writev    prefix and payload gathered from where they lie by sendmsg()
+//   zerocopy  as writev, with the payload sent MSG_ZEROCOPY
+//
+// Over loopback the kernel copies zero-copy pages when it delivers them
+// to the receiving socket and reports so, after which the sender falls
+// back to writev; the copied columns say what actually happened. Expect
+// zerocopy to pay off only on a real NIC.
+//
+//   ./reply_bench [-d ms]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include "framing.h"
+#include "sockopt_proto.h"
+#include "zerocopy.h"
+
+#define MIN_PAYLOAD 64
+#define MAX_PAYLOAD SOCKOPT_MAX_PAYLOAD
+// The client's ring, which has to hold a reply: the prefix and a payload
+#define RING_SIZE (2 * MAX_PAYLOAD)
+
+enum path { PATH_COPY, PATH_WRITEV, PATH_ZEROCOPY };
+
+static const char *const path_names[] = { "copy", "writev", "zerocopy" };
+
+static const char response_prefix[] = "Server received: ";
+#define RESPONSE_PREFIX_LEN (sizeof(response_prefix) - 1)
+
+// One serving side, for one connection
+struct replier {
+    pthread_t tid;
+    int listen_fd;
+    enum path path;
+    unsigned long long replies;
+    unsigned long long bytes_sent;
+    unsigned long long user_copied;   // by us, formatting
+    unsigned long long kernel_copied; // by the kernel, sending
+    int failed;
+};
+
+long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void set_nodelay(int fd) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+// Answer every message until the client closes
+void *replier_main(void *arg) {
+    struct replier *r = arg;
+    struct frame_reader *reader = frame_reader_new(SOCKOPT_READER_CAPACITY);
+    char *response = malloc(RESPONSE_PREFIX_LEN + MAX_PAYLOAD);
+    struct zc_sender zc;
+    const char *payload;
+    size_t payload_len;
+
+    int fd = accept(r->listen_fd, NULL, NULL);
+    if (fd < 0 || reader == NULL || response == NULL) {
+        r->failed = 1;
+        return NULL;
+    }
+    set_nodelay(fd);
+    zc_init(&zc, fd, r->path == PATH_ZEROCOPY ? 1 : 0);
+    if (r->path == PATH_ZEROCOPY && !zc.enabled) {
+        fprintf(stderr, "SO_ZEROCOPY not supported here\n");
+        r->failed = 1;
+    }
+
+    while (!r->failed) {
+        int rc = frame_reader_next(reader, &payload, &payload_len);
+        if (rc == 0) {
+            if (zc_wait(&zc, 0, -1) < 0) {
+                r->failed = 1;
+                break;
+            }
+            rc = frame_read(reader, fd, &payload, &payload_len);
+        }
+        if (rc <= 0) {
+            r->failed = rc < 0;
+            break;
+        }
+
+        if (r->path == PATH_COPY) {
+            memcpy(response, response_prefix, RESPONSE_PREFIX_LEN);
+            memcpy(response + RESPONSE_PREFIX_LEN, payload, payload_len);
+            r->user_copied += RESPONSE_PREFIX_LEN + payload_len;
+            if (frame_write(fd, response, RESPONSE_PREFIX_LEN + payload_len) < 0) {
+                r->failed = 1;
+            }
+            r->bytes_sent += FRAME_HEADER_SIZE + RESPONSE_PREFIX_LEN + payload_len;
+            r->kernel_copied += FRAME_HEADER_SIZE + RESPONSE_PREFIX_LEN + payload_len;
+        } else if (zc_send_frame(&zc, response_prefix, RESPONSE_PREFIX_LEN, payload, payload_len) < 0) {
+            r->failed = 1;
+        }
+        r->replies++;
+    }
+    if (zc_wait(&zc, 0, 1000) < 0) {
+        r->failed = 1;
+    }
+    if (r->path != PATH_COPY) {
+        r->bytes_sent = zc.bytes_sent;
+        r->kernel_copied = zc.bytes_copied;
+    }
+    close(fd);
+    free(response);
+    frame_reader_free(reader);
+    return NULL;
+}
+
+// Returns the replies per second, or -1 if anything failed
+double run(struct sockaddr_in *addr, struct replier *r, const char *message, size_t len, int duration_ms) {
+    struct frame_reader *reader = frame_reader_new(RING_SIZE);
+    const char *reply;
+    size_t reply_len;
+    long long start, end;
+    unsigned long long sent = 0;
+    int ok = 1;
+
+    pthread_create(&r->tid, NULL, replier_main, r);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (reader == NULL || fd < 0 || connect(fd, (struct sockaddr *)addr, sizeof(*addr)) < 0) {
+        perror("connect");
+        exit(EXIT_FAILURE);
+    }
+    set_nodelay(fd);
+
+    start = now_ns();
+    end = start + duration_ms * 1000000LL;
+    while (ok && now_ns() < end) {
+        if (frame_write(fd, message, len) < 0 || frame_read(reader, fd, &reply, &reply_len) <= 0) {
+            ok = 0;
+            break;
+        }
+        ok = reply_len == RESPONSE_PREFIX_LEN + len &&
+             memcmp(reply, response_prefix, RESPONSE_PREFIX_LEN) == 0 &&
+             memcmp(reply + RESPONSE_PREFIX_LEN, message, len) == 0;
+        sent++;
+    }
+    double rate = sent / ((now_ns() - start) / 1e9);
+    close(fd);
+    pthread_join(r->tid, NULL);
+    frame_reader_free(reader);
+    if (!ok || r->failed || r->replies != sent) {
+        fprintf(stderr, "%s, %zu bytes: bad reply\n", path_names[r->path], len);
+        return -1;
+    }
+    return rate;
+}
+
+int main(int argc, char *argv[]) {
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int duration_ms = 500;
+    int failed = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "d:")) != -1) {
+        switch (c) {
+        case 'd': duration_ms = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-d ms]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (duration_ms <= 0) {
+        fprintf(stderr, "duration must be positive\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(listen_fd, 1) < 0 || getsockname(listen_fd, (struct sockaddr *)&addr, &addr_len) < 0) {
+        perror("listen");
+        exit(EXIT_FAILURE);
+    }
+
+    char *message = malloc(MAX_PAYLOAD);
+    if (message == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < MAX_PAYLOAD; i++) {
+        message[i] = 'a' + i % 26;
+    }
+
+    printf("%8s  %-8s  %12s  %10s  %14s  %14s\n",
+           "payload", "path", "replies/s", "MB/s", "copied/reply", "kernel/reply");
+    for (size_t len = MIN_PAYLOAD; len <= MAX_PAYLOAD; len *= 4) {
+        for (enum path p = PATH_COPY; p <= PATH_ZEROCOPY; p++) {
+            struct replier r = { .listen_fd = listen_fd, .path = p };
+            double rate = run(&addr, &r, message, len, duration_ms);
+            if (rate < 0) {
+                failed = 1;
+                continue;
+            }
+            printf("%8zu  %-8s  %12.0f  %10.1f  %14.0f  %14.0f\n", len, path_names[p], rate,
+                   rate * len / 1e6, (double)(r.user_copied + r.kernel_copied) / r.replies,
+                   (double)r.kernel_copied / r.replies);
+        }
+    }
+    free(message);
+    close(listen_fd);
+    return failed ? EXIT_FAILURE : 0;
+}
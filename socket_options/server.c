@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,10 +10,78 @@
 #include <errno.h>
 #include <signal.h>
 #include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <time.h>
+#include "framing.h"
+#include "metrics.h"
+#include "sock_profile.h"
+#include "sockopt_proto.h"
+#include "tcp_tuner.h"
+#include "timer_wheel.h"
+#include "zerocopy.h"
 
 #define PORT 8080
 #define BACKLOG 10
 #define BUFFER_SIZE 1024
+#define DEFAULT_WORKERS 8
+#define MAX_WORKERS 1024
+#define MAX_LISTENERS 16
+#define MAX_EVENTS 256
+#define DEFAULT_DEADLINE_MS 5000
+#define ZEROCOPY_WAIT_MS 5000 // as long as SO_SNDTIMEO
+
+// How connections are dispatched, selected with -m on the command line
+enum server_mode { MODE_FORK, MODE_PREFORK, MODE_EPOLL };
+
+// A port served by -m epoll, with its own deadlines in milliseconds
+struct listener {
+    int fd;
+    int port;
+    int idle_ms;  // between messages
+    int read_ms;  // to finish a message once its first byte is in
+    int write_ms; // for a reply to drain once it is stuck
+};
+
+// Which deadline a connection's timer stands for
+enum deadline { DEADLINE_IDLE, DEADLINE_READ, DEADLINE_WRITE };
+
+static const char *const deadline_names[] = { "idle", "read", "write" };
+
+// A client of -m epoll. One timer per connection, armed for whichever
+// deadline applies: write while a reply is stuck, read while a message is
+// part way in, idle otherwise.
+struct conn {
+    struct timer timer; // first, so a fired timer is its connection
+    enum deadline deadline;
+    int fd;
+    struct listener *l;
+    struct frame_reader *reader;
+    char *out;
+    size_t out_len;
+    size_t out_sent;
+    size_t out_cap;
+    char ip[INET_ADDRSTRLEN];
+    int port;
+    struct tcp_tuner tuner;
+};
+
+// State of the -m epoll event loop
+struct event_loop {
+    int epfd;
+    struct listener *listeners;
+    int nlisteners;
+    struct timer_wheel wheel; // ticks are milliseconds
+    unsigned long long accepted;
+    unsigned long long messages;
+    unsigned long long timeouts[3]; // by enum deadline
+    size_t open;
+    size_t peak_open;
+};
+
+// Set by SIGINT/SIGTERM in the prefork master
+static volatile sig_atomic_t stop_requested = 0;
 
 void configure_socket_options(int server_fd) {
     int opt = 1;
@@ -62,62 +131,108 @@ void configure_socket_options(int server_fd) {
     }
 }
 
+// Every reply is this, then the client's message
+static const char response_prefix[] = "Server received: ";
+#define RESPONSE_PREFIX_LEN (sizeof(response_prefix) - 1)
+
+// Payloads from this size on are answered with MSG_ZEROCOPY; set with -z
+static size_t zerocopy_threshold = ZC_DEFAULT_THRESHOLD;
+
+// TCP_INFO sampling: -a tunes each connection, -T exports the samples
+static int autotune = 0;
+static int telemetry_fd = -1;
+
+// Socket tuning chosen with -p, NULL to leave the options above alone
+static const struct sock_profile *profile = NULL;
+
+// Scraped with -M, from every mode. Timeouts are by enum deadline; the
+// blocking modes' SO_RCVTIMEO counts as idle.
+static struct server_metrics metrics;
+static metric_t timeout_metrics[3];
+
+void start_telemetry(struct tcp_tuner *t, int fd, const char *ip, int port) {
+    char peer[INET_ADDRSTRLEN + 8];
+
+    snprintf(peer, sizeof(peer), "%s:%d", ip, port);
+    tcp_tuner_init(t, fd, peer, autotune, telemetry_fd);
+}
+
+// Last sample and a summary line, just before the connection closes
+void finish_telemetry(struct tcp_tuner *t) {
+    if ((t->tune || t->export_fd >= 0) && tcp_tuner_sample(t) == 0) {
+        tcp_tuner_print(t, stdout);
+    }
+}
+
 void handle_client(int client_fd, struct sockaddr_in *client_addr) {
-    char buffer[BUFFER_SIZE];
     char client_ip[INET_ADDRSTRLEN];
-    int bytes_received;
+    struct frame_reader *reader;
+    const char *payload;
+    size_t payload_len;
+    struct zc_sender zc;
+    struct tcp_tuner tuner;
+    int rc;
     
+    if (profile != NULL) {
+        sock_profile_apply_accepted(profile, client_fd);
+    }
+    metrics_inc(metrics.accepts);
+    metrics_inc(metrics.active);
     inet_ntop(AF_INET, &(client_addr->sin_addr), client_ip, INET_ADDRSTRLEN);
     printf("Client connected from %s:%d\n", client_ip, ntohs(client_addr->sin_port));
     
+    reader = frame_reader_new(SOCKOPT_READER_CAPACITY);
+    if (reader == NULL) {
+        perror("frame_reader_new failed");
+        close(client_fd);
+        metrics_dec(metrics.active);
+        return;
+    }
+    zc_init(&zc, client_fd, zerocopy_threshold);
+    start_telemetry(&tuner, client_fd, client_ip, ntohs(client_addr->sin_port));
+    
     while (1) {
-        // Clear buffer
-        memset(buffer, 0, BUFFER_SIZE);
-        
-        // Receive data from client
-        bytes_received = recv(client_fd, buffer, BUFFER_SIZE - 1, 0);
+        // Receive one complete message from the client. Replies sent
+        // zero-copy point into the reader's ring, so before receiving into
+        // it again wait until the kernel is done with them.
+        rc = frame_reader_next(reader, &payload, &payload_len);
+        if (rc == 0) {
+            if (zc_wait(&zc, 0, ZEROCOPY_WAIT_MS) < 0) {
+                perror("zero-copy completion failed");
+                break;
+            }
+            rc = frame_read(reader, client_fd, &payload, &payload_len);
+        }
         
-        if (bytes_received > 0) {
-            buffer[bytes_received] = '\0';
-            printf("Received from client: %s", buffer);
+        if (rc > 0) {
+            printf("Received from client: %.*s", (int)payload_len, payload);
             
             // Check for exit command
-            if (strncmp(buffer, "exit", 4) == 0) {
+            if (payload_len >= 4 && strncmp(payload, "exit", 4) == 0) {
                 printf("Client requested disconnect\n");
                 break;
             }
             
-            // Send response back to client (use a safe bounded format to avoid truncation warnings)
-            char response[BUFFER_SIZE];
-            const char *prefix = "Server received: ";
-            size_t prefix_len = strlen(prefix);
-            /* Reserve space for null terminator */
-            if (prefix_len >= sizeof(response)) {
-                /* Shouldn't happen for current prefix, but guard anyway */
-                response[0] = '\0';
-            } else {
-                /* Compute max number of chars we can copy from buffer */
-                int max_copy = (int)(sizeof(response) - prefix_len - 1);
-                if (max_copy < 0) max_copy = 0;
-                /* Use precision to limit how much of buffer is inserted */
-                int written = snprintf(response, sizeof(response), "%s%.*s", prefix, max_copy, buffer);
-                /* snprintf returns the number of bytes that would have been written (excluding NUL)
-                   We don't need to check for truncation here; response is always NUL-terminated by snprintf */
-                (void)written;
-            }
-            if (send(client_fd, response, strlen(response), 0) < 0) {
+            // Send response back to client: the prefix and the payload
+            // where it lies in the ring, gathered by the kernel
+            if (zc_send_frame(&zc, response_prefix, RESPONSE_PREFIX_LEN, payload, payload_len) < 0) {
                 perror("send failed");
                 break;
             }
-        } else if (bytes_received == 0) {
+            metrics_inc(metrics.requests);
+            metrics_add(metrics.bytes_in, FRAME_HEADER_SIZE + payload_len);
+            metrics_add(metrics.bytes_out, FRAME_HEADER_SIZE + RESPONSE_PREFIX_LEN + payload_len);
+            tcp_tuner_poll(&tuner);
+        } else if (rc == 0) {
             printf("Client disconnected\n");
             break;
         } else {
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
                 printf("Receive timeout occurred\n");
+                metrics_inc(timeout_metrics[DEADLINE_IDLE]);
                 // Send timeout message to client
                 char *timeout_msg = "Server timeout - no data received\n";
-                send(client_fd, timeout_msg, strlen(timeout_msg), 0);
+                frame_write(client_fd, timeout_msg, strlen(timeout_msg));
                 break;
             } else {
                 perror("recv failed");
@@ -126,17 +241,549 @@ void handle_client(int client_fd, struct sockaddr_in *client_addr) {
         }
     }
     
+    finish_telemetry(&tuner);
+
+    // A reader the kernel may still be sending from must not be recycled
+    // for the next client; leak it instead
+    if (zc_wait(&zc, 0, ZEROCOPY_WAIT_MS) == 0) {
+        frame_reader_free(reader);
+    }
     close(client_fd);
+    metrics_dec(metrics.active);
+    if (zc.next_id > 0) {
+        printf("Zero-copy: %llu of %llu reply bytes copied by the kernel\n",
+               (unsigned long long)zc.bytes_copied, (unsigned long long)zc.bytes_sent);
+    }
     printf("Connection with client %s:%d closed\n", client_ip, ntohs(client_addr->sin_port));
 }
 
-int main() {
-    int server_fd, client_fd;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t client_len = sizeof(client_addr);
+// Fork-per-connection: the parent accepts, a fresh child serves each client
+void run_fork_per_connection(int server_fd) {
+    int client_fd;
+    struct sockaddr_in client_addr;
+    socklen_t client_len;
+
+    // Handle SIGCHLD to avoid zombie processes
+    signal(SIGCHLD, SIG_IGN);
     
+    while (1) {
+        // Accept incoming connection
+        client_len = sizeof(client_addr);
+        client_fd = accept(server_fd, (struct sockaddr *)&client_addr, &client_len);
+        if (client_fd < 0) {
+            perror("accept failed");
+            continue;
+        }
+        
+        // Fork to handle client in separate process
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+            // Child process
+            close(server_fd);  // Close server socket in child
+            metrics_thread_init();
+            handle_client(client_fd, &client_addr);
+            exit(0);
+        } else if (pid > 0) {
+            // Parent process
+            close(client_fd);  // Close client socket in parent
+        } else {
+            perror("fork failed");
+            close(client_fd);
+        }
+    }
+}
+
+// Prefork worker: wait on the shared listening socket with EPOLLEXCLUSIVE so
+// that a new connection wakes only one idle worker instead of the whole pool,
+// then serve that client to completion.
+void prefork_worker(int server_fd, int id) {
+    struct epoll_event ev;
+    struct sockaddr_in client_addr;
+    socklen_t client_len;
+
+    int epfd = epoll_create1(0);
+    if (epfd < 0) {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.fd = server_fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, server_fd, &ev) < 0) {
+        perror("epoll_ctl EPOLLEXCLUSIVE");
+        exit(EXIT_FAILURE);
+    }
+
+    metrics_thread_init();
+    printf("Worker %d (pid %d) ready\n", id, getpid());
+    fflush(stdout);
+
+    while (1) {
+        if (epoll_wait(epfd, &ev, 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            exit(EXIT_FAILURE);
+        }
+
+        // The listening socket is non-blocking, so a worker that loses the
+        // race for this connection just goes back to waiting
+        client_len = sizeof(client_addr);
+        int client_fd = accept(server_fd, (struct sockaddr *)&client_addr, &client_len);
+        if (client_fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED) {
+                perror("accept failed");
+            }
+            continue;
+        }
+
+        handle_client(client_fd, &client_addr);
+        fflush(stdout);
+    }
+}
+
+pid_t spawn_worker(int server_fd, int id) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        prefork_worker(server_fd, id);
+        exit(0);
+    }
+    if (pid < 0) {
+        perror("fork failed");
+    }
+    return pid;
+}
+
+void handle_stop(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+// Prefork master: start a fixed pool of workers, then supervise them and
+// respawn any worker that exits or crashes
+void run_prefork(int server_fd, int nworkers) {
+    pid_t workers[MAX_WORKERS];
+    time_t started[MAX_WORKERS];
+    struct sigaction sa;
+    int status;
+
+    int flags = fcntl(server_fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(server_fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        perror("fcntl O_NONBLOCK");
+        exit(EXIT_FAILURE);
+    }
+
+    // No SA_RESTART, so waitpid() returns when we are asked to stop
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    for (int i = 0; i < nworkers; i++) {
+        workers[i] = spawn_worker(server_fd, i);
+        started[i] = time(NULL);
+    }
+    printf("Prefork master (pid %d) supervising %d workers\n", getpid(), nworkers);
+
+    while (!stop_requested) {
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("waitpid");
+            break;
+        }
+
+        for (int i = 0; i < nworkers; i++) {
+            if (workers[i] != pid) {
+                continue;
+            }
+            if (WIFSIGNALED(status)) {
+                printf("Worker %d (pid %d) killed by signal %d, respawning\n", i, pid, WTERMSIG(status));
+            } else {
+                printf("Worker %d (pid %d) exited with status %d, respawning\n", i, pid, WEXITSTATUS(status));
+            }
+            // Back off if the worker keeps dying right after start
+            if (time(NULL) - started[i] < 1) {
+                sleep(1);
+            }
+            workers[i] = spawn_worker(server_fd, i);
+            started[i] = time(NULL);
+            break;
+        }
+    }
+
+    printf("Shutting down workers\n");
+    for (int i = 0; i < nworkers; i++) {
+        if (workers[i] > 0) {
+            kill(workers[i], SIGTERM);
+        }
+    }
+    while (waitpid(-1, &status, 0) > 0) {
+    }
+}
+
+// ---------------------------------------------------------------------------
+// -m epoll: every client in one non-blocking event loop, with deadlines on a
+// timer wheel instead of SO_RCVTIMEO/SO_SNDTIMEO
+// ---------------------------------------------------------------------------
+
+long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+void conn_close(struct event_loop *loop, struct conn *c) {
+    timer_cancel(&loop->wheel, &c->timer);
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    finish_telemetry(&c->tuner);
+    close(c->fd);
+    printf("Connection with client %s:%d closed\n", c->ip, c->port);
+    frame_reader_free(c->reader);
+    free(c->out);
+    free(c);
+    loop->open--;
+    metrics_dec(metrics.active);
+}
+
+// Arm the timer for the deadline that applies now. Idle restarts with every
+// event; read and write run from when they started applying, so a client
+// trickling one byte at a time still runs out of time. 0 ms means none.
+void conn_set_deadline(struct event_loop *loop, struct conn *c) {
+    enum deadline d = DEADLINE_IDLE;
+    int ms = c->l->idle_ms;
+
+    if (c->out_sent < c->out_len) {
+        d = DEADLINE_WRITE;
+        ms = c->l->write_ms;
+    } else if (c->reader->used > 0) {
+        d = DEADLINE_READ;
+        ms = c->l->read_ms;
+    }
+    if (d == c->deadline && d != DEADLINE_IDLE && timer_armed(&c->timer)) {
+        return;
+    }
+    c->deadline = d;
+    if (ms > 0) {
+        timer_arm(&loop->wheel, &c->timer, (uint64_t)(now_ms() + ms));
+    } else {
+        timer_cancel(&loop->wheel, &c->timer);
+    }
+}
+
+// Append the framed reply to the connection's output. The payload is
+// copied: the reply may have to wait for EPOLLOUT past the next recv()
+// into the ring.
+int conn_queue_reply(struct conn *c, const char *payload, size_t payload_len) {
+    size_t len = RESPONSE_PREFIX_LEN + payload_len;
+
+    if (c->out_sent == c->out_len) {
+        c->out_sent = c->out_len = 0;
+    }
+    if (c->out_len + FRAME_HEADER_SIZE + len > c->out_cap) {
+        size_t cap = c->out_cap ? c->out_cap : BUFFER_SIZE;
+        while (cap < c->out_len + FRAME_HEADER_SIZE + len) {
+            cap *= 2;
+        }
+        char *out = realloc(c->out, cap);
+        if (out == NULL) {
+            return -1;
+        }
+        c->out = out;
+        c->out_cap = cap;
+    }
+    frame_encode_header(c->out + c->out_len, (uint32_t)len);
+    memcpy(c->out + c->out_len + FRAME_HEADER_SIZE, response_prefix, RESPONSE_PREFIX_LEN);
+    memcpy(c->out + c->out_len + FRAME_HEADER_SIZE + RESPONSE_PREFIX_LEN, payload, payload_len);
+    c->out_len += FRAME_HEADER_SIZE + len;
+    metrics_inc(metrics.requests);
+    metrics_add(metrics.bytes_out, FRAME_HEADER_SIZE + len);
+    return 0;
+}
+
+// Send queued output. If the socket is full, wait for EPOLLOUT and stop
+// reading until it drains, so a client that never reads cannot make the
+// output grow without bound. Returns -1 if the connection failed.
+int conn_flush(struct event_loop *loop, struct conn *c) {
+    struct epoll_event ev;
+    int stuck = 0;
+
+    while (c->out_sent < c->out_len) {
+        ssize_t n = send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            stuck = 1;
+            break;
+        }
+        if (n < 0) {
+            perror("send failed");
+            return -1;
+        }
+        c->out_sent += n;
+    }
+    ev.events = EPOLLRDHUP | (stuck ? EPOLLOUT : EPOLLIN);
+    ev.data.ptr = c;
+    if ((stuck || c->deadline == DEADLINE_WRITE) && epoll_ctl(loop->epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0) {
+        perror("epoll_ctl");
+        return -1;
+    }
+    return 0;
+}
+
+// Read what has arrived and answer every complete message. Returns -1 once
+// the connection is closed.
+int conn_on_readable(struct event_loop *loop, struct conn *c) {
+    const char *payload;
+    size_t payload_len;
+
+    while (1) {
+        ssize_t n = frame_reader_fill(c->reader, c->fd);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (n <= 0) {
+            if (n == 0) {
+                printf("Client disconnected\n");
+            } else {
+                perror("recv failed");
+            }
+            conn_close(loop, c);
+            return -1;
+        }
+        metrics_add(metrics.bytes_in, n);
+
+        int rc;
+        while ((rc = frame_reader_next(c->reader, &payload, &payload_len)) > 0) {
+            printf("Received from client: %.*s", (int)payload_len, payload);
+            loop->messages++;
+            if (payload_len >= 4 && strncmp(payload, "exit", 4) == 0) {
+                printf("Client requested disconnect\n");
+                conn_close(loop, c);
+                return -1;
+            }
+            if (conn_queue_reply(c, payload, payload_len) < 0) {
+                perror("Out of memory for a reply");
+                conn_close(loop, c);
+                return -1;
+            }
+        }
+        if (rc < 0) {
+            perror("recv failed");
+            conn_close(loop, c);
+            return -1;
+        }
+        if (conn_flush(loop, c) < 0) {
+            conn_close(loop, c);
+            return -1;
+        }
+        tcp_tuner_poll(&c->tuner);
+        if (c->out_sent < c->out_len) {
+            return 0;
+        }
+    }
+}
+
+// A deadline passed: tell the client, as the blocking modes do on
+// SO_RCVTIMEO, unless it is the reply that is stuck, and disconnect
+void conn_timed_out(struct timer *t, void *arg) {
+    struct event_loop *loop = arg;
+    struct conn *c = (struct conn *)t;
+    const char *timeout_msg = "Server timeout - no data received\n";
+
+    loop->timeouts[c->deadline]++;
+    metrics_inc(timeout_metrics[c->deadline]);
+    printf("%s timeout for client %s:%d\n", deadline_names[c->deadline], c->ip, c->port);
+    if (c->deadline != DEADLINE_WRITE) {
+        frame_write(c->fd, timeout_msg, strlen(timeout_msg));
+    }
+    conn_close(loop, c);
+}
+
+void accept_clients(struct event_loop *loop, struct listener *l) {
+    struct sockaddr_in client_addr;
+    socklen_t client_len;
+    struct epoll_event ev;
+
+    while (1) {
+        client_len = sizeof(client_addr);
+        int fd = accept4(l->fd, (struct sockaddr *)&client_addr, &client_len, SOCK_NONBLOCK);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept failed");
+            }
+            return;
+        }
+
+        struct conn *c = calloc(1, sizeof(*c));
+        if (c == NULL || (c->reader = frame_reader_new(SOCKOPT_READER_CAPACITY)) == NULL) {
+            perror("Out of memory for a new client");
+            free(c);
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        c->l = l;
+        if (profile != NULL) {
+            sock_profile_apply_accepted(profile, fd);
+        }
+        timer_init(&c->timer);
+        inet_ntop(AF_INET, &client_addr.sin_addr, c->ip, INET_ADDRSTRLEN);
+        c->port = ntohs(client_addr.sin_port);
+        start_telemetry(&c->tuner, fd, c->ip, c->port);
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = c;
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl client");
+            frame_reader_free(c->reader);
+            free(c);
+            close(fd);
+            continue;
+        }
+        printf("Client connected from %s:%d\n", c->ip, c->port);
+        loop->accepted++;
+        metrics_inc(metrics.accepts);
+        metrics_inc(metrics.active);
+        if (++loop->open > loop->peak_open) {
+            loop->peak_open = loop->open;
+        }
+        conn_set_deadline(loop, c);
+    }
+}
+
+void run_event_loop(struct listener *listeners, int nlisteners) {
+    struct event_loop *loop = calloc(1, sizeof(*loop));
+    struct epoll_event ev, events[MAX_EVENTS];
+    struct sigaction sa;
+
+    if (loop == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    loop->listeners = listeners;
+    loop->nlisteners = nlisteners;
+    loop->epfd = epoll_create1(0);
+    if (loop->epfd < 0) {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < nlisteners; i++) {
+        ev.events = EPOLLIN;
+        ev.data.ptr = &listeners[i];
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, listeners[i].fd, &ev) < 0) {
+            perror("epoll_ctl listener");
+            exit(EXIT_FAILURE);
+        }
+    }
+    timer_wheel_init(&loop->wheel, (uint64_t)now_ms());
+
+    // No SA_RESTART, so epoll_wait() returns when we are asked to stop
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    while (!stop_requested) {
+        uint64_t next = timer_wheel_next(&loop->wheel);
+        long long now = now_ms();
+        int timeout = next == UINT64_MAX ? -1 : (long long)next <= now ? 0 : (int)((long long)next - now);
+
+        fflush(stdout);
+        int nfds = epoll_wait(loop->epfd, events, MAX_EVENTS, timeout);
+        if (nfds < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < nfds; i++) {
+            void *ptr = events[i].data.ptr;
+            if (ptr >= (void *)listeners && ptr < (void *)(listeners + nlisteners)) {
+                accept_clients(loop, ptr);
+                continue;
+            }
+            struct conn *c = ptr;
+            if ((events[i].events & EPOLLOUT) && conn_flush(loop, c) < 0) {
+                conn_close(loop, c);
+                continue;
+            }
+            if ((events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) &&
+                conn_on_readable(loop, c) < 0) {
+                continue;
+            }
+            conn_set_deadline(loop, c);
+        }
+        timer_wheel_advance(&loop->wheel, (uint64_t)now_ms(), conn_timed_out, loop);
+    }
+
+    printf("Served %llu connections, %llu messages; %zu open, at most %zu at once\n",
+           loop->accepted, loop->messages, loop->open, loop->peak_open);
+    printf("Timeouts: %llu idle, %llu read, %llu write\n",
+           loop->timeouts[DEADLINE_IDLE], loop->timeouts[DEADLINE_READ], loop->timeouts[DEADLINE_WRITE]);
+}
+
+void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-m fork|prefork|epoll] [-w workers] [-z bytes] [-a] [-T file] [-p profile] [-P file] [-M port|path] [-l port[:idle[:read[:write]]]]...\n", prog);
+    fprintf(stderr, "  -m  fork: one new process per connection (default)\n");
+    fprintf(stderr, "      prefork: fixed pool of workers sharing the listening socket\n");
+    fprintf(stderr, "      epoll: one process, every client in an event loop\n");
+    fprintf(stderr, "  -w  number of prefork workers (default %d)\n", DEFAULT_WORKERS);
+    fprintf(stderr, "  -z  fork and prefork: reply with MSG_ZEROCOPY to messages of at least\n");
+    fprintf(stderr, "      this many bytes, 0 never (default %d)\n", ZC_DEFAULT_THRESHOLD);
+    fprintf(stderr, "  -a  autotune socket buffers, TCP_NOTSENT_LOWAT and TCP_QUICKACK per\n");
+    fprintf(stderr, "      connection from TCP_INFO samples\n");
+    fprintf(stderr, "  -T  append a CSV line per TCP_INFO sample to file\n");
+    fprintf(stderr, "  -p  socket tuning profile: low-latency, bulk, high-conn or one from -P\n");
+    fprintf(stderr, "  -P  load socket tuning profiles from file\n");
+    fprintf(stderr, "  -M  serve Prometheus metrics on this TCP port or Unix socket path\n");
+    fprintf(stderr, "  -l  with -m epoll, a port to listen on and its idle, read and write\n");
+    fprintf(stderr, "      deadlines in ms, 0 for none (default %d:%d each); may be repeated\n",
+            PORT, DEFAULT_DEADLINE_MS);
+    exit(EXIT_FAILURE);
+}
+
+// port[:idle_ms[:read_ms[:write_ms]]], the deadlines left out defaulting
+int parse_listener(const char *spec, struct listener *l) {
+    int *fields[] = { &l->port, &l->idle_ms, &l->read_ms, &l->write_ms };
+    const char *p = spec;
+
+    l->idle_ms = l->read_ms = l->write_ms = DEFAULT_DEADLINE_MS;
+    for (int i = 0; i < 4; i++) {
+        char *end;
+        long v = strtol(p, &end, 10);
+        if (end == p || v < 0 || v > (i == 0 ? 65535 : INT32_MAX)) {
+            return -1;
+        }
+        *fields[i] = (int)v;
+        if (*end == '\0') {
+            return l->port > 0 ? 0 : -1;
+        }
+        if (*end != ':') {
+            return -1;
+        }
+        p = end + 1;
+    }
+    return -1;
+}
+
+int open_listener(int port) {
+    int server_fd;
+    struct sockaddr_in server_addr;
+
     // Create socket
-    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
+    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
         perror("socket failed");
         exit(EXIT_FAILURE);
     }
@@ -144,11 +791,17 @@ int main() {
     
     // Configure socket options
     configure_socket_options(server_fd);
+    if (profile != NULL) {
+        char description[256];
+        sock_profile_apply_listener(profile, server_fd);
+        sock_profile_describe(profile, description, sizeof(description));
+        printf("Socket profile %s\n", description);
+    }
     
     // Set up server address
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(PORT);
+    server_addr.sin_port = htons(port);
     
     // Bind socket to address
     if (bind(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
@@ -156,43 +809,125 @@ int main() {
         close(server_fd);
         exit(EXIT_FAILURE);
     }
-    printf("Socket bound to port %d\n", PORT);
+    printf("Socket bound to port %d\n", port);
     
     // Listen for connections
-    if (listen(server_fd, BACKLOG) < 0) {
+    if (listen(server_fd, sock_profile_backlog(profile, BACKLOG)) < 0) {
         perror("listen failed");
         close(server_fd);
         exit(EXIT_FAILURE);
     }
-    printf("Server listening on port %d...\n", PORT);
-    
-    // Handle SIGCHLD to avoid zombie processes
-    signal(SIGCHLD, SIG_IGN);
-    
-    while (1) {
-        // Accept incoming connection
-        client_fd = accept(server_fd, (struct sockaddr *)&client_addr, &client_len);
-        if (client_fd < 0) {
-            perror("accept failed");
-            continue;
+    printf("Server listening on port %d...\n", port);
+    return server_fd;
+}
+
+int main(int argc, char *argv[]) {
+    int server_fd;
+    enum server_mode mode = MODE_FORK;
+    int nworkers = DEFAULT_WORKERS;
+    struct listener listeners[MAX_LISTENERS];
+    int nlisteners = 0;
+    const char *profile_name = NULL;
+    const char *profile_file = NULL;
+    const char *metrics_endpoint = NULL;
+    int c;
+
+    while ((c = getopt(argc, argv, "m:w:l:z:aT:p:P:M:")) != -1) {
+        switch (c) {
+        case 'm':
+            if (strcmp(optarg, "fork") == 0) {
+                mode = MODE_FORK;
+            } else if (strcmp(optarg, "prefork") == 0) {
+                mode = MODE_PREFORK;
+            } else if (strcmp(optarg, "epoll") == 0) {
+                mode = MODE_EPOLL;
+            } else {
+                usage(argv[0]);
+            }
+            break;
+        case 'w':
+            nworkers = atoi(optarg);
+            if (nworkers < 1 || nworkers > MAX_WORKERS) {
+                usage(argv[0]);
+            }
+            break;
+        case 'a':
+            autotune = 1;
+            break;
+        case 'T':
+            telemetry_fd = tcp_tuner_open_export(optarg);
+            if (telemetry_fd < 0) {
+                perror(optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'p':
+            profile_name = optarg;
+            break;
+        case 'P':
+            profile_file = optarg;
+            break;
+        case 'M':
+            metrics_endpoint = optarg;
+            break;
+        case 'z':
+            zerocopy_threshold = strtoul(optarg, NULL, 10);
+            break;
+        case 'l':
+            if (nlisteners == MAX_LISTENERS || parse_listener(optarg, &listeners[nlisteners]) < 0) {
+                usage(argv[0]);
+            }
+            nlisteners++;
+            break;
+        default:
+            usage(argv[0]);
         }
-        
-        // Fork to handle client in separate process
-        pid_t pid = fork();
-        if (pid == 0) {
-            // Child process
-            close(server_fd);  // Close server socket in child
-            handle_client(client_fd, &client_addr);
-            exit(0);
-        } else if (pid > 0) {
-            // Parent process
-            close(client_fd);  // Close client socket in parent
-        } else {
-            perror("fork failed");
-            close(client_fd);
+    }
+    if (nlisteners > 0 && mode != MODE_EPOLL) {
+        usage(argv[0]);
+    }
+    if (profile_file != NULL && sock_profiles_load(profile_file) < 0) {
+        exit(EXIT_FAILURE);
+    }
+    if (profile_name != NULL && (profile = sock_profile_find(profile_name)) == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    metrics_register_server(&metrics);
+    for (int d = DEADLINE_IDLE; d <= DEADLINE_WRITE; d++) {
+        char labels[32];
+        snprintf(labels, sizeof(labels), "kind=\"%s\"", deadline_names[d]);
+        timeout_metrics[d] = metrics_counter("server_timeouts_total", labels,
+                                             "Connections closed by a deadline");
+    }
+    if (metrics_endpoint != NULL && metrics_serve(metrics_endpoint) < 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    if (mode == MODE_EPOLL) {
+        if (nlisteners == 0) {
+            listeners[0].port = PORT;
+            listeners[0].idle_ms = listeners[0].read_ms = listeners[0].write_ms = DEFAULT_DEADLINE_MS;
+            nlisteners = 1;
+        }
+        for (int i = 0; i < nlisteners; i++) {
+            listeners[i].fd = open_listener(listeners[i].port);
+            fcntl(listeners[i].fd, F_SETFL, fcntl(listeners[i].fd, F_GETFL) | O_NONBLOCK);
         }
+        run_event_loop(listeners, nlisteners);
+        for (int i = 0; i < nlisteners; i++) {
+            close(listeners[i].fd);
+        }
+        return 0;
+    }
+
+    server_fd = open_listener(PORT);
+    
+    if (mode == MODE_PREFORK) {
+        run_prefork(server_fd, nworkers);
+    } else {
+        run_fork_per_connection(server_fd);
     }
     
     close(server_fd);
     return 0;
-}
\ No newline at end of file
+}
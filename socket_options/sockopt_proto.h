@@ -0,0 +1,17 @@
+// Limits of the socket options server (server.c), shared with reply_bench.c
+// so that the benchmark reads requests the way the server does
+//
+// Requests and replies are frames (common/framing.h). The server answers
+// "Server received: " followed by the request payload.
+#ifndef SOCKOPT_PROTO_H
+#define SOCKOPT_PROTO_H
+
+#include "framing.h"
+
+// Largest request payload the server accepts
+#define SOCKOPT_MAX_PAYLOAD (1024 * 1024)
+// Ring of each connection's frame_reader: one whole frame of the largest
+// payload. Pages are only touched as big requests arrive.
+#define SOCKOPT_READER_CAPACITY (FRAME_HEADER_SIZE + SOCKOPT_MAX_PAYLOAD)
+
+#endif
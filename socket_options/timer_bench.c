@@ -0,0 +1,205 @@
+// Benchmark for the timer wheel behind server.c -m epoll
+//
+// First checks the wheel against the deadlines themselves: timers armed,
+// moved and cancelled at random, some beyond the wheel's reach, advanced
+// in steps of random length, must each fire in the step that passes their
+// deadline and never twice. Then, with -n timers armed (a million by
+// default) with deadlines spread over ten minutes of millisecond ticks,
+// times arming, moving and cancelling one, and advancing the wheel by one
+// tick, and prints the memory a timer costs. -c runs the check alone, as
+// ctest does.
+//
+//   ./timer_bench [-c] [-n timers]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "timer_wheel.h"
+
+#define CHECK_TIMERS 100000
+#define CHECK_ROUNDS 2000
+#define SPREAD_TICKS (10 * 60 * 1000) // ten minutes of milliseconds
+#define ADVANCE_TICKS 100000
+
+struct check_timer {
+    struct timer timer;
+    uint64_t deadline; // 0 while cancelled
+    int fired;
+};
+
+static uint64_t last_now, this_now;
+static size_t fired_total;
+
+long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// xorshift64*, so runs are reproducible
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+uint64_t random64(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+void check(int ok, const char *what) {
+    if (!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void check_fire(struct timer *t, void *arg) {
+    struct check_timer *c = (struct check_timer *)t; // the first member
+    (void)arg;
+    check(c->deadline != 0, "a cancelled timer fired");
+    check(!c->fired, "a timer fired twice");
+    check(c->deadline <= this_now, "a timer fired early");
+    check(c->deadline > last_now, "a timer fired late");
+    c->fired = 1;
+    fired_total++;
+}
+
+void self_test(void) {
+    static struct check_timer timers[CHECK_TIMERS];
+    struct timer_wheel *w = malloc(sizeof(*w));
+    size_t armed = 0;
+
+    check(w != NULL, "malloc");
+    timer_wheel_init(w, 1);
+    last_now = 0;
+    for (int round = 0; round < CHECK_ROUNDS; round++) {
+        // Arm, move or cancel a few hundred timers, then advance by up to
+        // two level 1 slots, and now and then by a lot
+        for (int k = 0; k < 200; k++) {
+            struct check_timer *c = &timers[random64() % CHECK_TIMERS];
+            uint64_t r = random64();
+            if (r % 4 == 0 && timer_armed(&c->timer)) {
+                timer_cancel(w, &c->timer);
+                c->deadline = 0;
+                armed--;
+                continue;
+            }
+            uint64_t delay = r % 8 == 1 ? (r >> 8) % (4 * TW_MAX_DELAY) : (r >> 8) % 40000;
+            armed += !timer_armed(&c->timer);
+            c->deadline = last_now + 1 + delay;
+            c->fired = 0;
+            timer_arm(w, &c->timer, c->deadline);
+        }
+        uint64_t step = random64() % 64 == 0 ? random64() % (TW_MAX_DELAY / 8) : random64() % 512;
+        this_now = last_now + step;
+        size_t before = fired_total;
+        timer_wheel_advance(w, this_now, check_fire, NULL);
+        armed -= fired_total - before;
+        check(w->armed == armed, "armed count");
+        uint64_t next = timer_wheel_next(w);
+        check(armed == 0 || next > this_now, "next tick is in the future");
+        last_now = this_now;
+    }
+
+    // Run everything out: whatever is left fires, each at its deadline
+    while (w->armed > 0) {
+        this_now = timer_wheel_next(w);
+        timer_wheel_advance(w, this_now, check_fire, NULL);
+        last_now = this_now;
+    }
+    for (int i = 0; i < CHECK_TIMERS; i++) {
+        check(timers[i].deadline == 0 || timers[i].fired, "every armed timer fired");
+    }
+    free(w);
+    printf("self test passed (%zu timers fired)\n", fired_total);
+}
+
+void count_fire(struct timer *t, void *arg) {
+    (void)t;
+    (*(size_t *)arg)++;
+}
+
+int main(int argc, char *argv[]) {
+    size_t n = 1000000;
+    int check_only = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "cn:")) != -1) {
+        switch (c) {
+        case 'c': check_only = 1; break;
+        case 'n': n = strtoul(optarg, NULL, 10); break;
+        default:
+            fprintf(stderr, "Usage: %s [-c] [-n timers]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (n == 0) {
+        fprintf(stderr, "timers must be positive\n");
+        exit(EXIT_FAILURE);
+    }
+
+    self_test();
+    if (check_only) {
+        return 0;
+    }
+
+    struct timer_wheel *w = malloc(sizeof(*w));
+    struct timer *timers = calloc(n, sizeof(*timers));
+    uint64_t *deadlines = malloc(n * sizeof(*deadlines));
+    size_t fired = 0;
+    if (w == NULL || timers == NULL || deadlines == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    // Deadlines drawn up front so the timings below are the wheel's alone
+    for (size_t i = 0; i < n; i++) {
+        deadlines[i] = 1 + random64() % SPREAD_TICKS;
+    }
+    timer_wheel_init(w, 0);
+
+    long long start = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        timer_arm(w, &timers[i], deadlines[i]);
+    }
+    double arm_ns = (double)(now_ns() - start) / n;
+
+    // What an idle deadline does on every message: move a timer later
+    start = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        timer_arm(w, &timers[i], deadlines[n - 1 - i]);
+    }
+    double move_ns = (double)(now_ns() - start) / n;
+
+    // Half of them cancelled, and armed again untimed
+    start = now_ns();
+    for (size_t i = 0; i < n / 2; i++) {
+        timer_cancel(w, &timers[i]);
+    }
+    double cancel_ns = (double)(now_ns() - start) / (n / 2 > 0 ? n / 2 : 1);
+    for (size_t i = 0; i < n / 2; i++) {
+        timer_arm(w, &timers[i], deadlines[i]);
+    }
+
+    // Advancing tick by tick with every timer armed: the cost per tick
+    // includes firing about n / SPREAD_TICKS timers and the spreading out of
+    // coarser slots as they come round
+    start = now_ns();
+    for (uint64_t tick = 1; tick <= ADVANCE_TICKS; tick++) {
+        timer_wheel_advance(w, tick, count_fire, &fired);
+    }
+    double tick_ns = (double)(now_ns() - start) / ADVANCE_TICKS;
+
+    printf("%zu timers, deadlines over %d ticks\n", n, SPREAD_TICKS);
+    printf("  arm      %8.1f ns\n", arm_ns);
+    printf("  move     %8.1f ns\n", move_ns);
+    printf("  cancel   %8.1f ns\n", cancel_ns);
+    printf("  advance  %8.1f ns per tick, %zu fired over %d ticks\n", tick_ns, fired, ADVANCE_TICKS);
+    printf("  memory   %zu bytes per timer, plus %zu bytes per wheel\n",
+           sizeof(struct timer), sizeof(struct timer_wheel));
+
+    free(deadlines);
+    free(timers);
+    free(w);
+    return 0;
+}
@@ -4,14 +4,16 @@
 #include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include "framing.h"
 
 #define PORT 8080
-#define BUFFER_SIZE 1024
 
 int main(int argc, char const *argv[]) {
     int sock = 0;
     struct sockaddr_in serv_addr;
-    char buffer[BUFFER_SIZE] = {0};
+    struct frame_reader *reader;
+    const char *reply;
+    size_t reply_len;
 
     // 1. Create a socket
     if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
@@ -39,13 +41,16 @@ int main(int argc, char const *argv[]) {
 
     // 3. Communicate with the server (send and read)
     char *hello = "Hello from client";
-    send(sock, hello, strlen(hello), 0);
+    frame_write(sock, hello, strlen(hello));
     printf("Hello message sent\n");
 
-    int valread = read(sock, buffer, BUFFER_SIZE);
-    printf("Server says: %s\n", buffer);
+    reader = frame_reader_new(0);
+    if (reader != NULL && frame_read(reader, sock, &reply, &reply_len) > 0) {
+        printf("Server says: %.*s\n", (int)reply_len, reply);
+    }
 
     // 4. Close the socket
+    frame_reader_free(reader);
     close(sock);
     
     return 0;
@@ -3,30 +3,302 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
 #include <arpa/inet.h>
+#include "framing.h"
+#include "metrics.h"
+#include "sock_profile.h"
+#include "uring_server.h"
 
 #define PORT 8080
-#define BUFFER_SIZE 1024
+#define BACKLOG 128
 
-int main() {
-    int server_fd, new_socket;
+// I/O backends, selected with -b on the command line
+enum backend { BACKEND_BLOCKING, BACKEND_URING };
+
+static const char *hello = "Hello from server";
+// The greeting as a ready-made frame
+static char framed_hello[FRAME_HEADER_SIZE + sizeof("Hello from server") - 1];
+static int quiet = 0;
+static volatile int stop_requested = 0;
+static const struct sock_profile *profile = NULL; // -p, NULL for none
+
+// Counters for the blocking backend, bumped at every recv(), send(),
+// accept() and close() it makes, successful or not
+static unsigned long long blocking_syscalls = 0;
+static unsigned long long blocking_messages = 0;
+
+// Scraped with -M, from either backend
+static struct server_metrics metrics;
+
+void handle_stop(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+void count_syscall(void) {
+    __atomic_add_fetch(&blocking_syscalls, 1, __ATOMIC_RELAXED);
+}
+
+// frame_read(), counting every recv() it takes
+int counted_frame_read(struct frame_reader *reader, int fd, const char **payload, size_t *len) {
+    while (1) {
+        int rc = frame_reader_next(reader, payload, len);
+        if (rc != 0) {
+            return rc;
+        }
+        ssize_t n = frame_reader_fill(reader, fd);
+        count_syscall();
+        if (n == 0) {
+            return 0;
+        }
+        if (n < 0 && errno != EINTR) {
+            return -1;
+        }
+    }
+}
+
+// send() the whole buffer, counting every call it takes
+int counted_send_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        count_syscall();
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Blocking backend: one thread per connection, answering every frame
+// until the client goes away
+void *serve_connection(void *arg) {
+    int new_socket = (int)(long)arg;
+    struct frame_reader *reader = frame_reader_new(0);
+    const char *payload;
+    size_t len;
+
+    if (reader == NULL) {
+        perror("frame_reader_new");
+        close(new_socket);
+        count_syscall();
+        return NULL;
+    }
+
+    // 5. Communicate with the client (read and write)
+    while (counted_frame_read(reader, new_socket, &payload, &len) > 0) {
+        if (!quiet) {
+            printf("Client says: %.*s\n", (int)len, payload);
+        }
+        if (counted_send_all(new_socket, framed_hello, sizeof(framed_hello)) < 0) {
+            break;
+        }
+        __atomic_add_fetch(&blocking_messages, 1, __ATOMIC_RELAXED);
+        metrics_inc(metrics.requests);
+        metrics_add(metrics.bytes_in, FRAME_HEADER_SIZE + len);
+        metrics_add(metrics.bytes_out, sizeof(framed_hello));
+    }
+
+    frame_reader_free(reader);
+    close(new_socket); // Close the connection with the client
+    count_syscall();
+    metrics_dec(metrics.active);
+    return NULL;
+}
+
+void run_blocking(int server_fd) {
+    struct sockaddr_in address;
+    socklen_t addrlen;
+    pthread_t tid;
+    int new_socket;
+
+    while (!stop_requested) {
+        // 4. Accept an incoming connection 🤝
+        // This is a blocking call. It waits for a client to connect.
+        // It creates a new socket (`new_socket`) for this specific connection.
+        addrlen = sizeof(address);
+        new_socket = accept(server_fd, (struct sockaddr *)&address, &addrlen);
+        count_syscall();
+        if (new_socket < 0) {
+            if (errno != EINTR) {
+                perror("accept");
+            }
+            continue;
+        }
+        metrics_inc(metrics.accepts);
+        metrics_inc(metrics.active);
+        if (profile != NULL) {
+            sock_profile_apply_accepted(profile, new_socket);
+        }
+
+        if (!quiet) {
+            printf("Connection accepted.\n");
+        }
+        if (pthread_create(&tid, NULL, serve_connection, (void *)(long)new_socket) != 0) {
+            perror("pthread_create");
+            close(new_socket);
+            count_syscall();
+            metrics_dec(metrics.active);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+
+    printf("blocking backend: %llu requests, %llu syscalls, %.3f syscalls/request\n",
+           blocking_messages, blocking_syscalls,
+           blocking_messages ? (double)blocking_syscalls / blocking_messages : 0.0);
+}
+
+// io_uring backend: each connection reassembles frames in its own reader,
+// and every complete frame is answered with the same greeting
+void *uring_on_open(void *ctx, int fd) {
+    (void)ctx;
+    if (profile != NULL) {
+        sock_profile_apply_accepted(profile, fd);
+    }
+    metrics_inc(metrics.accepts);
+    metrics_inc(metrics.active);
+    return frame_reader_new(0);
+}
+
+void uring_on_close(void *ctx, void *conn) {
+    (void)ctx;
+    frame_reader_free(conn);
+    metrics_dec(metrics.active);
+}
+
+int uring_on_data(void *ctx, void *conn, const char *data, size_t len,
+                  struct uring_reply *reply) {
+    struct frame_reader *reader = conn;
+    const char *payload;
+    size_t payload_len;
+    int rc;
+
+    (void)ctx;
+    if (reader == NULL || frame_reader_feed(reader, data, len) < 0) {
+        return -1;
+    }
+    reply->data = framed_hello;
+    reply->len = sizeof(framed_hello);
+    while ((rc = frame_reader_next(reader, &payload, &payload_len)) > 0) {
+        if (!quiet) {
+            printf("Client says: %.*s\n", (int)payload_len, payload);
+        }
+        reply->count++;
+    }
+    metrics_add(metrics.bytes_in, len);
+    metrics_add(metrics.requests, reply->count);
+    metrics_add(metrics.bytes_out, reply->count * sizeof(framed_hello));
+    return rc;
+}
+
+int run_uring(int server_fd) {
+    struct uring_server_ops ops = {
+        .on_open = uring_on_open,
+        .on_data = uring_on_data,
+        .on_close = uring_on_close,
+    };
+    struct uring_server_stats stats = { 0 };
+
+    if (uring_server_run(server_fd, NULL, 0, &ops, &stats, &stop_requested) < 0) {
+        return -1;
+    }
+
+    printf("io_uring backend: %llu requests, %llu syscalls, %.3f syscalls/request\n",
+           stats.messages, stats.enters,
+           stats.messages ? (double)stats.enters / stats.messages : 0.0);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int server_fd;
     struct sockaddr_in address;
+    struct sigaction sa;
     int opt = 1;
-    int addrlen = sizeof(address);
-    char buffer[BUFFER_SIZE] = {0};
+    enum backend backend = BACKEND_BLOCKING;
+    const char *profile_name = NULL;
+    const char *metrics_endpoint = NULL;
+    int c;
+
+    while ((c = getopt(argc, argv, "b:qp:P:M:")) != -1) {
+        switch (c) {
+        case 'b':
+            if (strcmp(optarg, "blocking") == 0) {
+                backend = BACKEND_BLOCKING;
+            } else if (strcmp(optarg, "uring") == 0) {
+                backend = BACKEND_URING;
+            } else {
+                fprintf(stderr, "unknown backend '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'q':
+            quiet = 1;
+            break;
+        case 'p':
+            profile_name = optarg;
+            break;
+        case 'M':
+            metrics_endpoint = optarg;
+            break;
+        case 'P':
+            if (sock_profiles_load(optarg) < 0) {
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-b blocking|uring] [-q] [-p profile] [-P file] [-M port|path]\n", argv[0]);
+            fprintf(stderr, "  -b  blocking read()/send() with one thread per client (default)\n");
+            fprintf(stderr, "      or an io_uring event loop\n");
+            fprintf(stderr, "  -q  do not print every message\n");
+            fprintf(stderr, "  -p  socket tuning profile: low-latency, bulk, high-conn or one from -P\n");
+            fprintf(stderr, "  -P  load socket tuning profiles from file\n");
+            fprintf(stderr, "  -M  serve Prometheus metrics on this TCP port or Unix socket path\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (profile_name != NULL && (profile = sock_profile_find(profile_name)) == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    metrics_register_server(&metrics);
+    if (metrics_endpoint != NULL && metrics_serve(metrics_endpoint) < 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    frame_encode_header(framed_hello, strlen(hello));
+    memcpy(framed_hello + FRAME_HEADER_SIZE, hello, strlen(hello));
+
+    // Ctrl-C stops the server and prints its syscall counters. No
+    // SA_RESTART, so blocking calls return and notice the request.
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
 
     // 1. Create a socket file descriptor
     // AF_INET: IPv4, SOCK_STREAM: TCP, 0: IP protocol
-    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
+    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
         perror("socket failed");
         exit(EXIT_FAILURE);
     }
 
-    // Optional: Helps in reusing the address and port
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt))) {
+    // Optional: Helps in reusing the address and port. Each option is its
+    // own setsockopt(); their values are not flags to be ORed together.
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) ||
+        setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt))) {
         perror("setsockopt");
         exit(EXIT_FAILURE);
     }
+    if (profile != NULL) {
+        sock_profile_apply_listener(profile, server_fd);
+    }
 
     // 2. Bind the socket to the network address and port
     address.sin_family = AF_INET;
@@ -40,34 +312,29 @@ int main() {
 
     // 3. Listen for incoming connections
     // The second argument is the backlog, the max number of pending connections
-    if (listen(server_fd, 3) < 0) {
+    if (listen(server_fd, sock_profile_backlog(profile, BACKLOG)) < 0) {
         perror("listen");
         exit(EXIT_FAILURE);
     }
 
-    printf("Server listening on port %d\n", PORT);
-
-    // 4. Accept an incoming connection 🤝
-    // This is a blocking call. It waits for a client to connect.
-    // It creates a new socket (`new_socket`) for this specific connection.
-    if ((new_socket = accept(server_fd, (struct sockaddr *)&address, (socklen_t*)&addrlen)) < 0) {
-        perror("accept");
-        exit(EXIT_FAILURE);
+    printf("Server listening on port %d (%s backend)\n", PORT,
+           backend == BACKEND_URING ? "io_uring" : "blocking");
+    if (profile != NULL) {
+        char description[256];
+        sock_profile_describe(profile, description, sizeof(description));
+        printf("Socket profile %s\n", description);
     }
 
-    printf("Connection accepted.\n");
-
-    // 5. Communicate with the client (read and write)
-    int valread = read(new_socket, buffer, BUFFER_SIZE);
-    printf("Client says: %s\n", buffer);
-
-    char *hello = "Hello from server";
-    send(new_socket, hello, strlen(hello), 0);
-    printf("Hello message sent\n");
+    if (backend == BACKEND_URING && run_uring(server_fd) < 0) {
+        perror("io_uring unavailable, falling back to the blocking backend");
+        backend = BACKEND_BLOCKING;
+    }
+    if (backend == BACKEND_BLOCKING) {
+        run_blocking(server_fd);
+    }
 
-    // 6. Close the sockets
-    close(new_socket); // Close the connection with the client
-    close(server_fd);  // Close the listening socket
+    // 6. Close the listening socket
+    close(server_fd);
 
     return 0;
 }
@@ -0,0 +1,260 @@
+// Packet rate and bulk throughput benchmark for udp.server.c
+//
+// Each thread owns one UDP socket and keeps up to -w requests in flight.
+//
+// Default mode sends and receives with sendmmsg()/recvmmsg() so the client
+// is not the bottleneck; replies received per second is the server's
+// packet rate.
+//
+//   for b in 1 8 32 64; do
+//       ./udp.server -q -b $b & ./udp.bench -d 5; kill %1
+//   done
+//
+// Bulk mode (-B) streams -s byte datagrams (default BUFFER_SIZE) and reports
+// acknowledged payload in GB/s. Without -g that is one datagram per
+// send()/recv(); with -g the datagrams are sent as UDP_SEGMENT buffers and
+// replies are read as UDP_GRO buffers, matching `udp.server -g`.
+//
+//   ./udp.server -q      & ./udp.bench -B;    kill %1
+//   ./udp.server -q -g   & ./udp.bench -B -g; kill %1
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <pthread.h>
+#include "udp_offload.h"
+
+#define BUFFER_SIZE 1024
+#define SERVER_PORT 65432
+#define SERVER_IP "127.0.0.1"
+#define MAX_WINDOW 1024
+
+struct worker {
+    pthread_t tid;
+    long sent;
+    long received;
+    long lost;
+};
+
+static const char *server_ip = SERVER_IP;
+static int duration = 5;
+static int window = 256;
+static int payload = 0;
+static int offload = 0;
+static long long deadline_ns;
+
+long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void error_exit(const char *message) {
+    perror(message);
+    exit(EXIT_FAILURE);
+}
+
+void *worker_main(void *arg) {
+    struct worker *w = arg;
+    struct sockaddr_in server_addr;
+    struct timeval timeout = { .tv_sec = 0, .tv_usec = 20000 };
+    char (*rx_buffers)[BUFFER_SIZE];
+    char tx_buffer[BUFFER_SIZE];
+    struct iovec tx_iov, *rx_iov;
+    struct mmsghdr *tx, *rx;
+    int inflight = 0;
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        error_exit("socket creation failed");
+    }
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(SERVER_PORT);
+    if (inet_pton(AF_INET, server_ip, &server_addr.sin_addr) <= 0) {
+        error_exit("Invalid address/ Address not supported");
+    }
+    if (connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        error_exit("connect failed");
+    }
+    // A reply that never comes (dropped on a full queue) must not stall us
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    memset(tx_buffer, 'x', sizeof(tx_buffer));
+    tx_iov.iov_base = tx_buffer;
+    tx_iov.iov_len = payload;
+    tx = calloc(window, sizeof(*tx));
+    rx = calloc(window, sizeof(*rx));
+    rx_iov = calloc(window, sizeof(*rx_iov));
+    rx_buffers = calloc(window, BUFFER_SIZE);
+    if (!tx || !rx || !rx_iov || !rx_buffers) {
+        error_exit("calloc failed");
+    }
+    for (int i = 0; i < window; i++) {
+        tx[i].msg_hdr.msg_iov = &tx_iov;
+        tx[i].msg_hdr.msg_iovlen = 1;
+        rx_iov[i].iov_base = rx_buffers[i];
+        rx_iov[i].iov_len = BUFFER_SIZE;
+        rx[i].msg_hdr.msg_iov = &rx_iov[i];
+        rx[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    while (now_ns() < deadline_ns) {
+        if (inflight < window) {
+            int n = sendmmsg(sock, tx, window - inflight, 0);
+            if (n > 0) {
+                inflight += n;
+                w->sent += n;
+            }
+        }
+
+        int n = recvmmsg(sock, rx, window, MSG_WAITFORONE, NULL);
+        if (n > 0) {
+            inflight -= n;
+            w->received += n;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            // Whatever is still outstanding was dropped
+            w->lost += inflight;
+            inflight = 0;
+        }
+    }
+
+    free(tx);
+    free(rx);
+    free(rx_iov);
+    free(rx_buffers);
+    close(sock);
+    return NULL;
+}
+
+// Bulk mode. The window is counted in datagrams; with offload each send
+// carries as many payload-sized segments as fit in one GSO buffer.
+void *bulk_worker_main(void *arg) {
+    struct worker *w = arg;
+    struct sockaddr_in server_addr;
+    struct timeval timeout = { .tv_sec = 0, .tv_usec = 20000 };
+    char control[UDP_OFFLOAD_CMSG_SPACE];
+    char *tx_buffer = malloc(UDP_OFFLOAD_MAX_BYTES);
+    char *rx_buffer = malloc(UDP_OFFLOAD_MAX_BYTES);
+    int per_send = offload ? UDP_OFFLOAD_MAX_BYTES / payload : 1;
+    int inflight = 0;
+
+    if (tx_buffer == NULL || rx_buffer == NULL) {
+        error_exit("malloc failed");
+    }
+    if (per_send > UDP_OFFLOAD_MAX_SEGMENTS) {
+        per_send = UDP_OFFLOAD_MAX_SEGMENTS;
+    }
+    memset(tx_buffer, 'x', UDP_OFFLOAD_MAX_BYTES);
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        error_exit("socket creation failed");
+    }
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(SERVER_PORT);
+    if (inet_pton(AF_INET, server_ip, &server_addr.sin_addr) <= 0) {
+        error_exit("Invalid address/ Address not supported");
+    }
+    if (connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        error_exit("connect failed");
+    }
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    while (now_ns() < deadline_ns) {
+        while (inflight + per_send <= window) {
+            struct iovec iov = { .iov_base = tx_buffer, .iov_len = (size_t)per_send * payload };
+            struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+            if (per_send > 1) {
+                udp_set_segment_size(&msg, control, payload);
+            }
+            if (sendmsg(sock, &msg, 0) < 0) {
+                break;
+            }
+            inflight += per_send;
+            w->sent += per_send;
+        }
+
+        struct iovec iov = { .iov_base = rx_buffer, .iov_len = UDP_OFFLOAD_MAX_BYTES };
+        struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+        if (offload) {
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+        }
+        ssize_t len = recvmsg(sock, &msg, 0);
+        if (len >= 0) {
+            int n = offload ? udp_segment_count(len, udp_gro_segment_size(&msg)) : 1;
+            inflight -= n;
+            w->received += n;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            w->lost += inflight;
+            inflight = 0;
+        }
+    }
+
+    free(tx_buffer);
+    free(rx_buffer);
+    close(sock);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    int threads = 1;
+    int bulk = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "t:d:w:s:H:Bg")) != -1) {
+        switch (c) {
+        case 't': threads = atoi(optarg); break;
+        case 'd': duration = atoi(optarg); break;
+        case 'w': window = atoi(optarg); break;
+        case 's': payload = atoi(optarg); break;
+        case 'H': server_ip = optarg; break;
+        case 'B': bulk = 1; break;
+        case 'g': offload = 1; break;
+        default:
+            fprintf(stderr, "Usage: %s [-t threads] [-d seconds] [-w window] [-s payload] [-H host] [-B [-g]]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (payload == 0) {
+        payload = bulk ? BUFFER_SIZE : 64;
+    }
+    if (threads < 1 || duration < 1 || window < 1 || window > MAX_WINDOW ||
+        payload < 1 || payload > BUFFER_SIZE) {
+        fprintf(stderr, "invalid arguments\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct worker *workers = calloc(threads, sizeof(*workers));
+    deadline_ns = now_ns() + duration * 1000000000LL;
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&workers[i].tid, NULL, bulk ? bulk_worker_main : worker_main, &workers[i]);
+    }
+
+    long sent = 0, received = 0, lost = 0;
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i].tid, NULL);
+        sent += workers[i].sent;
+        received += workers[i].received;
+        lost += workers[i].lost;
+    }
+
+    printf("%d-byte datagrams, %d threads, window %d: sent %ld, received %ld, lost %ld\n",
+           payload, threads, window, sent, received, lost);
+    printf("%.0f packets/sec\n", received / (double)duration);
+    if (bulk) {
+        printf("%.3f GB/s acknowledged payload (%s)\n",
+               (double)received * payload / duration / 1e9, offload ? "GSO/GRO" : "no offload");
+    }
+
+    free(workers);
+    return 0;
+}
@@ -4,6 +4,8 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/time.h>
+#include "udp_offload.h"
 
 #define BUFFER_SIZE 1024
 #define SERVER_PORT 65432
@@ -14,11 +16,94 @@ void error_exit(const char *message) {
     exit(EXIT_FAILURE);
 }
 
-int main() {
+// Bulk mode: send a file as BUFFER_SIZE-byte datagrams and count the
+// server's replies. With offload, up to UDP_OFFLOAD_MAX_SEGMENTS datagrams
+// go out per sendmsg() via UDP_SEGMENT and replies arrive coalesced via
+// UDP_GRO; otherwise it is one datagram per syscall.
+void send_file(int client_socket, struct sockaddr_in *server_addr, const char *path, int offload) {
+    // Largest multiple of BUFFER_SIZE that fits in one GSO send
+    static char data[UDP_OFFLOAD_MAX_BYTES / BUFFER_SIZE * BUFFER_SIZE];
+    static char replies[UDP_OFFLOAD_MAX_BYTES];
+    char control[UDP_OFFLOAD_CMSG_SPACE];
+    struct timeval timeout = { .tv_sec = 1, .tv_usec = 0 };
+    long datagrams = 0, reply_count = 0, bytes = 0;
+    size_t chunk = offload ? sizeof(data) : BUFFER_SIZE;
+    size_t n;
+
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        error_exit("Failed to open input file");
+    }
+
+    // Connecting lets us use plain send()/recv() and filters other peers
+    if (connect(client_socket, (struct sockaddr *)server_addr, sizeof(*server_addr)) == -1) {
+        error_exit("connect failed");
+    }
+    if (offload && (!udp_gso_supported(client_socket) || udp_enable_gro(client_socket) != 0)) {
+        fprintf(stderr, "UDP GSO/GRO not supported by this kernel, sending one datagram per call\n");
+        offload = 0;
+        chunk = BUFFER_SIZE;
+    }
+
+    while ((n = fread(data, 1, chunk, fp)) > 0) {
+        struct iovec iov = { .iov_base = data, .iov_len = n };
+        struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+        if (offload && n > BUFFER_SIZE) {
+            udp_set_segment_size(&msg, control, BUFFER_SIZE);
+        }
+        if (sendmsg(client_socket, &msg, 0) == -1) {
+            error_exit("sendmsg failed");
+        }
+        datagrams += (n + BUFFER_SIZE - 1) / BUFFER_SIZE;
+        bytes += n;
+    }
+    fclose(fp);
+    printf("Sent %ld bytes in %ld datagrams%s.\n", bytes, datagrams, offload ? " (GSO)" : "");
+
+    // Collect replies until the server has been quiet for a second
+    setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    while (reply_count < datagrams) {
+        struct iovec iov = { .iov_base = replies, .iov_len = sizeof(replies) };
+        struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+        if (offload) {
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+        }
+        ssize_t len = recvmsg(client_socket, &msg, 0);
+        if (len == -1) {
+            break;
+        }
+        reply_count += offload ? udp_segment_count(len, udp_gro_segment_size(&msg)) : 1;
+    }
+    printf("Received %ld of %ld replies from server.\n", reply_count, datagrams);
+}
+
+int main(int argc, char *argv[]) {
     int client_socket;
     char buffer[BUFFER_SIZE];
     struct sockaddr_in server_addr;
     socklen_t server_addr_len = sizeof(server_addr);
+    const char *input_file = NULL;
+    int offload = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "f:g")) != -1) {
+        switch (c) {
+        case 'f':
+            input_file = optarg;
+            break;
+        case 'g':
+            offload = 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-f file [-g]]\n", argv[0]);
+            fprintf(stderr, "  -f  send the contents of file in %d-byte datagrams\n", BUFFER_SIZE);
+            fprintf(stderr, "  -g  batch the datagrams with UDP_SEGMENT/UDP_GRO offload\n");
+            exit(EXIT_FAILURE);
+        }
+    }
 
     // 1. Create a UDP socket
     if ((client_socket = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
@@ -35,6 +120,12 @@ int main() {
         error_exit("Invalid address/ Address not supported");
     }
 
+    if (input_file != NULL) {
+        send_file(client_socket, &server_addr, input_file, offload);
+        close(client_socket);
+        return 0;
+    }
+
     printf("Enter message to send to server: ");
     if (fgets(buffer, BUFFER_SIZE, stdin) == NULL) {
         error_exit("Failed to read input");
@@ -1,23 +1,175 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include "metrics.h"
+#include "udp_offload.h"
 
 #define BUFFER_SIZE 1024
 #define SERVER_PORT 65432
+#define DEFAULT_BATCH 32
+#define MAX_BATCH 1024
+
+// Receive and reply state for one batch, allocated once at startup so the
+// hot loop never allocates. Slot i receives into its buffer from addrs[i],
+// and reply i is sent back to that same addrs[i].
+//
+// In offload mode each slot buffer is large enough for a whole GRO buffer,
+// and the reply to a GRO buffer of N datagrams is a single GSO send of N
+// copies of the response, taken from the preallocated replies[] buffer.
+struct udp_batch {
+    int size;
+    int offload;
+    size_t slot_size;
+    size_t response_len;
+    char *buffers;
+    char *replies;
+    struct sockaddr_in *addrs;
+    struct iovec *rx_iov;
+    struct mmsghdr *rx;
+    char (*rx_control)[UDP_OFFLOAD_CMSG_SPACE];
+    struct iovec *tx_iov;
+    struct mmsghdr *tx;
+    char (*tx_control)[UDP_OFFLOAD_CMSG_SPACE];
+};
+
+// Scraped with -M. No connections here, so of the TCP servers' series
+// only the request and byte counts, added up once per batch.
+static metric_t requests_metric, bytes_in_metric, bytes_out_metric;
 
 void error_exit(const char *message) {
     perror(message);
     exit(EXIT_FAILURE);
 }
 
-int main() {
+void batch_init(struct udp_batch *b, int size, int offload, const char *response) {
+    b->size = size;
+    b->offload = offload;
+    b->slot_size = offload ? UDP_OFFLOAD_MAX_BYTES + 1 : BUFFER_SIZE;
+    b->response_len = strlen(response);
+    b->buffers = calloc(size, b->slot_size);
+    b->replies = calloc(UDP_OFFLOAD_MAX_SEGMENTS, b->response_len);
+    b->addrs = calloc(size, sizeof(*b->addrs));
+    b->rx_iov = calloc(size, sizeof(*b->rx_iov));
+    b->rx = calloc(size, sizeof(*b->rx));
+    b->rx_control = calloc(size, sizeof(*b->rx_control));
+    b->tx_iov = calloc(size, sizeof(*b->tx_iov));
+    b->tx = calloc(size, sizeof(*b->tx));
+    b->tx_control = calloc(size, sizeof(*b->tx_control));
+    if (!b->buffers || !b->replies || !b->addrs || !b->rx_iov || !b->rx ||
+        !b->rx_control || !b->tx_iov || !b->tx || !b->tx_control) {
+        error_exit("batch allocation failed");
+    }
+
+    for (int i = 0; i < UDP_OFFLOAD_MAX_SEGMENTS; i++) {
+        memcpy(b->replies + i * b->response_len, response, b->response_len);
+    }
+
+    for (int i = 0; i < size; i++) {
+        // Leave one byte for the terminator added when logging
+        b->rx_iov[i].iov_base = b->buffers + i * b->slot_size;
+        b->rx_iov[i].iov_len = b->slot_size - 1;
+        b->rx[i].msg_hdr.msg_iov = &b->rx_iov[i];
+        b->rx[i].msg_hdr.msg_iovlen = 1;
+        b->rx[i].msg_hdr.msg_name = &b->addrs[i];
+
+        // Every reply carries the same response, only the peer differs
+        b->tx_iov[i].iov_base = b->replies;
+        b->tx_iov[i].iov_len = b->response_len;
+        b->tx[i].msg_hdr.msg_iov = &b->tx_iov[i];
+        b->tx[i].msg_hdr.msg_iovlen = 1;
+        b->tx[i].msg_hdr.msg_name = &b->addrs[i];
+    }
+}
+
+// Build the reply to received buffer i. Without offload, or for
+// a plain datagram, that is one response. For a GRO buffer it is one
+// response per coalesced datagram, sent as a single GSO buffer.
+// Returns the number of datagrams the reply stands for.
+int batch_prepare_reply(struct udp_batch *b, int i) {
+    struct msghdr *rx = &b->rx[i].msg_hdr;
+    struct msghdr *tx = &b->tx[i].msg_hdr;
+    int segments = 1;
+
+    tx->msg_namelen = rx->msg_namelen;
+    tx->msg_control = NULL;
+    tx->msg_controllen = 0;
+
+    if (b->offload) {
+        segments = udp_segment_count(b->rx[i].msg_len, udp_gro_segment_size(rx));
+        if (segments > UDP_OFFLOAD_MAX_SEGMENTS) {
+            segments = UDP_OFFLOAD_MAX_SEGMENTS;
+        }
+        if (segments > 1) {
+            udp_set_segment_size(tx, b->tx_control[i], b->response_len);
+        }
+    }
+    b->tx_iov[i].iov_len = segments * b->response_len;
+    return segments;
+}
+
+// GSO send failed for reply i: send its datagrams one at a time instead
+void send_reply_segments(int fd, struct udp_batch *b, int i) {
+    struct msghdr *tx = &b->tx[i].msg_hdr;
+    int segments = b->tx_iov[i].iov_len / b->response_len;
+
+    for (int s = 0; s < segments; s++) {
+        if (sendto(fd, b->replies, b->response_len, 0,
+                   (struct sockaddr *)tx->msg_name, tx->msg_namelen) == -1) {
+            perror("sendto failed");
+            return;
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
     int server_socket;
-    char buffer[BUFFER_SIZE];
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t client_addr_len = sizeof(client_addr);
+    struct sockaddr_in server_addr;
+    struct udp_batch batch;
+    int batch_size = DEFAULT_BATCH;
+    int quiet = 0;
+    int offload = 0;
+    const char *metrics_endpoint = NULL;
+    int c;
+
+    while ((c = getopt(argc, argv, "b:gqM:")) != -1) {
+        switch (c) {
+        case 'b':
+            batch_size = atoi(optarg);
+            break;
+        case 'g':
+            offload = 1;
+            break;
+        case 'q':
+            quiet = 1;
+            break;
+        case 'M':
+            metrics_endpoint = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-b batch_size] [-g] [-q] [-M port|path]\n", argv[0]);
+            fprintf(stderr, "  -b  datagrams per recvmmsg()/sendmmsg() call, 1-%d (default %d)\n",
+                    MAX_BATCH, DEFAULT_BATCH);
+            fprintf(stderr, "  -g  receive with UDP_GRO and reply with UDP_SEGMENT (GSO)\n");
+            fprintf(stderr, "  -q  do not print every received message\n");
+            fprintf(stderr, "  -M  serve Prometheus metrics on this TCP port or Unix socket path\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (batch_size < 1 || batch_size > MAX_BATCH) {
+        fprintf(stderr, "batch size must be between 1 and %d\n", MAX_BATCH);
+        exit(EXIT_FAILURE);
+    }
+    requests_metric = metrics_counter("server_requests_total", NULL, "Datagrams answered");
+    bytes_in_metric = metrics_counter("server_received_bytes_total", NULL, "Bytes read from clients");
+    bytes_out_metric = metrics_counter("server_sent_bytes_total", NULL, "Bytes written to clients");
+    if (metrics_endpoint != NULL && metrics_serve(metrics_endpoint) < 0) {
+        exit(EXIT_FAILURE);
+    }
 
     // 1. Create a UDP socket
     if ((server_socket = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
@@ -35,31 +187,80 @@ int main() {
         error_exit("bind failed");
     }
 
-    printf("UDP Server is listening on port %d...\n", SERVER_PORT);
+    // Segmentation offload needs both directions, otherwise run without it
+    if (offload && (!udp_gso_supported(server_socket) || udp_enable_gro(server_socket) != 0)) {
+        fprintf(stderr, "UDP GSO/GRO not supported by this kernel, continuing without offload\n");
+        offload = 0;
+    }
+
+    const char *response = "Hello, client! I received your message.";
+    batch_init(&batch, batch_size, offload, response);
+
+    printf("UDP Server is listening on port %d (batch size %d%s)...\n",
+           SERVER_PORT, batch_size, offload ? ", GSO/GRO" : "");
 
     while (1) {
-        // 3. Receive data from a client
-        ssize_t bytes_received = recvfrom(server_socket, buffer, BUFFER_SIZE, 0,
-                                         (struct sockaddr *)&client_addr, &client_addr_len);
-        if (bytes_received == -1) {
-            perror("recvfrom failed");
+        // 3. Receive up to batch_size datagrams. MSG_WAITFORONE blocks for
+        // the first one only and then takes whatever is already queued.
+        for (int i = 0; i < batch.size; i++) {
+            batch.rx[i].msg_hdr.msg_namelen = sizeof(batch.addrs[i]);
+            if (batch.offload) {
+                batch.rx[i].msg_hdr.msg_control = batch.rx_control[i];
+                batch.rx[i].msg_hdr.msg_controllen = sizeof(batch.rx_control[i]);
+            }
+        }
+        int received = recvmmsg(server_socket, batch.rx, batch.size, MSG_WAITFORONE, NULL);
+        if (received == -1) {
+            perror("recvmmsg failed");
             continue;
         }
 
-        buffer[bytes_received] = '\0'; // Null-terminate the received data
-        printf("Received message from %s:%d: %s\n",
-               inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port), buffer);
+        uint64_t datagrams = 0, bytes_in = 0, bytes_out = 0;
+        for (int i = 0; i < received; i++) {
+            int segments = batch_prepare_reply(&batch, i);
+            datagrams += segments;
+            bytes_in += batch.rx[i].msg_len;
+            bytes_out += batch.tx_iov[i].iov_len;
+            if (!quiet) {
+                char *buffer = batch.rx_iov[i].iov_base;
+                buffer[batch.rx[i].msg_len] = '\0'; // Null-terminate the received data
+                if (segments > 1) {
+                    printf("Received %d datagrams (%u bytes) from %s:%d\n", segments,
+                           batch.rx[i].msg_len, inet_ntoa(batch.addrs[i].sin_addr),
+                           ntohs(batch.addrs[i].sin_port));
+                } else {
+                    printf("Received message from %s:%d: %s\n",
+                           inet_ntoa(batch.addrs[i].sin_addr), ntohs(batch.addrs[i].sin_port),
+                           buffer);
+                }
+            }
+        }
 
-        // 4. Prepare and send a response back to the client
-        const char *response = "Hello, client! I received your message.";
-        if (sendto(server_socket, response, strlen(response), 0,
-                   (struct sockaddr *)&client_addr, client_addr_len) == -1) {
-            perror("sendto failed");
+        // 4. Send all the responses back with a single call, retrying the
+        // remainder if the kernel accepted only part of the batch
+        int sent = 0;
+        while (sent < received) {
+            int n = sendmmsg(server_socket, batch.tx + sent, received - sent, 0);
+            if (n == -1) {
+                if (batch.tx[sent].msg_hdr.msg_controllen != 0 &&
+                    (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT)) {
+                    // The route cannot segment this GSO buffer
+                    send_reply_segments(server_socket, &batch, sent);
+                } else {
+                    perror("sendmmsg failed");
+                }
+                // Skip the datagram that failed and carry on with the rest
+                sent++;
+                continue;
+            }
+            sent += n;
         }
+        metrics_add(requests_metric, datagrams);
+        metrics_add(bytes_in_metric, bytes_in);
+        metrics_add(bytes_out_metric, bytes_out);
     }
 
     // 5. Close the socket (This part is unreachable in the current loop)
     close(server_socket);
     return 0;
 }
-
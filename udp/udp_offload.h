@@ -0,0 +1,85 @@
+// UDP segmentation offload helpers shared by the UDP server, client and
+// benchmark.
+//
+// With UDP_SEGMENT (GSO, Linux 4.18+) one sendmsg() carries a buffer that the
+// stack or NIC splits into gso_size-byte datagrams. With UDP_GRO (Linux 5.0+)
+// the receive path coalesces consecutive datagrams of one flow into a single
+// buffer and reports the segment size in a control message. Both are probed
+// at runtime so callers can fall back to one datagram per syscall.
+#ifndef UDP_OFFLOAD_H
+#define UDP_OFFLOAD_H
+
+#include <string.h>
+#include <stdint.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+// Kernel limit on segments per GSO send (UDP_MAX_SEGMENTS)
+#define UDP_OFFLOAD_MAX_SEGMENTS 64
+// Largest buffer a single GSO send or GRO receive can carry
+#define UDP_OFFLOAD_MAX_BYTES 65507
+// Control buffer large enough for one UDP_SEGMENT (u16) or UDP_GRO (int) cmsg
+#define UDP_OFFLOAD_CMSG_SPACE CMSG_SPACE(sizeof(int))
+
+// Returns 1 if the kernel accepts UDP_SEGMENT on this socket.
+static inline int udp_gso_supported(int fd) {
+    int size = 0;
+    socklen_t len = sizeof(size);
+    return getsockopt(fd, SOL_UDP, UDP_SEGMENT, &size, &len) == 0;
+}
+
+// Ask the kernel to hand us coalesced GRO buffers. Returns 0 on success.
+static inline int udp_enable_gro(int fd) {
+    int on = 1;
+    return setsockopt(fd, SOL_UDP, UDP_GRO, &on, sizeof(on));
+}
+
+// Attach a UDP_SEGMENT control message to msg using the caller's control
+// buffer of at least UDP_OFFLOAD_CMSG_SPACE bytes.
+static inline void udp_set_segment_size(struct msghdr *msg, void *control, uint16_t gso_size) {
+    struct cmsghdr *cm;
+
+    msg->msg_control = control;
+    msg->msg_controllen = UDP_OFFLOAD_CMSG_SPACE;
+    cm = CMSG_FIRSTHDR(msg);
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type = UDP_SEGMENT;
+    cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    memcpy(CMSG_DATA(cm), &gso_size, sizeof(gso_size));
+}
+
+// Segment size of a received GRO buffer, or 0 if it was not coalesced
+// (in which case the whole buffer is a single datagram).
+static inline int udp_gro_segment_size(struct msghdr *msg) {
+    struct cmsghdr *cm;
+
+    for (cm = CMSG_FIRSTHDR(msg); cm != NULL; cm = CMSG_NXTHDR(msg, cm)) {
+        if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+            int size;
+            memcpy(&size, CMSG_DATA(cm), sizeof(size));
+            return size;
+        }
+    }
+    return 0;
+}
+
+// Number of datagrams in a received buffer of len bytes.
+static inline int udp_segment_count(int len, int gso_size) {
+    if (gso_size <= 0 || len <= gso_size) {
+        return 1;
+    }
+    return (len + gso_size - 1) / gso_size;
+}
+
+#endif